@@ -4,11 +4,28 @@
 #include "common.h"
 #include "db.h"
 
+struct Group;
+
 typedef struct {
   char username[MAX_USERNAME];
   int sockfd;
+  int index; /* posição em ClientManager.clients */
   bool authenticated;
+
+  /* Grupos assinados pela sessão (índice inverso de Group.members) e o grupo
+   * que recebe o chat enviado sem grupo explícito. Protegidos por 'lock'. */
+  char groups[MAX_SUBSCRIPTIONS][MAX_GROUPNAME];
+  bool presence[MAX_SUBSCRIPTIONS]; /* recebe os deltas de presença */
+  bool channel[MAX_SUBSCRIPTIONS];  /* o grupo é um canal de anúncios */
+  uint64_t ring_read[MAX_SUBSCRIPTIONS]; /* último frame do anel enviado */
+  /* O grupo de cada assinatura, achado pela thread da conexão na primeira
+   * leitura do anel, e a sua geração na época; NULL até lá. Evitam a busca
+   * pelo nome a cada leitura. */
+  struct Group *ring_group[MAX_SUBSCRIPTIONS];
+  uint64_t ring_generation[MAX_SUBSCRIPTIONS];
+  int group_count;
   char current_group[MAX_GROUPNAME];
+  pthread_mutex_t lock;
 } User;
 
 bool register_user(Database *db, const char *username, const char *password);
@@ -0,0 +1,89 @@
+#ifndef WHISP_CAPTURE_H
+#define WHISP_CAPTURE_H
+
+#include "common.h"
+#include <stdint.h>
+
+#define CAPTURE_MAGIC   0x50414357u /* "WCAP" */
+#define CAPTURE_VERSION 3
+
+/* Formato do arquivo: cabeçalho (magic, versão, horário de início) seguido de
+ * registros. Cada registro começa com o tipo (1 byte), o id da conexão e o
+ * delta em microssegundos desde o registro anterior, ambos como varint. Um
+ * CAPTURE_FRAME carrega ainda o tipo, o req_id e o seq do comando (varints)
+ * e os campos de texto da Message, cada um como varint de tamanho seguido
+ * dos bytes, sem o preenchimento de tamanho fixo da struct. */
+typedef enum { CAPTURE_OPEN, CAPTURE_FRAME, CAPTURE_CLOSE } CaptureKind;
+
+typedef struct {
+  CaptureKind kind;
+  uint32_t conn;
+  uint64_t time_us; /* tempo relativo ao início da captura */
+  Message msg;      /* válido apenas para CAPTURE_FRAME */
+} CaptureRecord;
+
+typedef struct {
+  FILE *file;
+  uint64_t time_us;
+  uint64_t start_wall_us;
+} CaptureReader;
+
+/**
+ * @brief Inicia a captura do tráfego de entrada no arquivo indicado.
+ *
+ * @param path Caminho do arquivo de captura.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool capture_start(const char *path);
+
+/**
+ * @brief Encerra a captura, gravando os dados pendentes.
+ */
+void capture_stop(void);
+
+bool capture_enabled(void);
+
+/**
+ * @brief Registra a abertura de uma conexão e retorna seu id na captura.
+ *
+ * @return O id da conexão, ou 0 se a captura estiver desativada.
+ */
+uint32_t capture_open_connection(void);
+
+/**
+ * @brief Registra um frame recebido em uma conexão.
+ *
+ * @param conn O id retornado por capture_open_connection().
+ * @param msg A mensagem recebida.
+ */
+void capture_frame(uint32_t conn, const Message *msg);
+
+/**
+ * @brief Registra o fechamento de uma conexão.
+ *
+ * @param conn O id retornado por capture_open_connection().
+ */
+void capture_close_connection(uint32_t conn);
+
+/**
+ * @brief Abre um arquivo de captura para leitura e valida o cabeçalho.
+ *
+ * @param reader O leitor a ser inicializado.
+ * @param path Caminho do arquivo de captura.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool capture_reader_open(CaptureReader *reader, const char *path);
+
+/**
+ * @brief Lê o próximo registro da captura.
+ *
+ * @param reader O leitor.
+ * @param record Saída com o registro lido.
+ * @return 1 se um registro foi lido, 0 no fim do arquivo, -1 se o arquivo
+ * estiver corrompido ou truncado.
+ */
+int capture_read(CaptureReader *reader, CaptureRecord *record);
+
+void capture_reader_close(CaptureReader *reader);
+
+#endif
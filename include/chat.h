@@ -3,20 +3,139 @@
 
 #include "auth.h"
 #include "common.h"
+#include "listing.h"
+#include "ratelimit.h"
 
+#define GROUP_HISTORY        1024 /* mensagens guardadas para retransmissão */
+#define CURSOR_GRACE_SECONDS 120  /* retenção do cursor após desconexão */
+#define PRESENCE_PENDING     (MAX_CLIENTS * 2)
+#define PRESENCE_DEFAULT_WINDOW_MS 1000
+#define CHANNEL_PUBLISHERS   16 /* publicadores de um canal, além do criador */
+#define RING_DEFAULT_FRAMES  256  /* frames do anel de cada grupo */
+#define RING_MIN_FRAMES      16
+#define RING_DRAIN_BATCH     64   /* frames por writev, por grupo */
+#define READER_WORDS         ((MAX_CLIENTS + 63) / 64)
+#define REMOTE_MEMBERS       MAX_CLIENTS /* membros em outros nós (relay.h) */
+
+/* Mensagem de chat guardada para retransmissão (CMD_RESUME). */
+typedef struct {
+  uint64_t seq;
+  time_t timestamp;
+  char username[MAX_USERNAME];
+  char *text;
+} GroupHistoryEntry;
+
+/* Até onde um usuário confirmou (CMD_ACK) ter recebido o chat do grupo. O
+ * cursor sobrevive a uma desconexão por CURSOR_GRACE_SECONDS, para que o
+ * cliente retome de onde parou ao reconectar; sair do grupo o descarta. */
+typedef struct {
+  char username[MAX_USERNAME];
+  uint64_t acked;
+  time_t detached_at; /* 0 = membro conectado */
+} GroupCursor;
+
+/* Um frame do anel do grupo. 'seq' é a sequência do frame guardado, 0
+ * enquanto ele é reescrito: o leitor a confere antes e depois de usar o
+ * frame para saber se o publicador deu a volta no anel por cima dele. */
+typedef struct {
+  _Atomic uint64_t seq;
+  Message frame;
+} RingSlot;
+
+/* Membro de um grupo conectado a outro nó da federação (relay.h). */
+typedef struct {
+  char username[MAX_USERNAME];
+  int node; /* índice do nó no relay */
+} RemoteMember;
+
+/* Entrada ou saída de um membro ainda não anunciada. Um usuário que sai e
+ * volta dentro da mesma janela se cancela. */
 typedef struct {
+  char username[MAX_USERNAME];
+  bool joined;
+} PresenceChange;
+
+typedef struct Group {
+  /* O Group nunca é movido: apagar o grupo só libera o slot, e quem guardou
+   * o ponteiro continua vendo o mesmo grupo. Quem o usa fora do mutex do
+   * GroupManager, como quem lê o anel sem locks, o fixa antes (pin_group());
+   * um slot fixado não é reaproveitado por um grupo novo, então o ponteiro
+   * nunca passa a ser o de outro grupo. Um grupo apagado enquanto fixado
+   * fica com in_use false. 'generation' muda a cada reaproveitamento e
+   * invalida os ponteiros guardados nas assinaturas (User.ring_group). */
+  _Atomic bool in_use;
+  _Atomic int pins;
+  _Atomic uint64_t generation;
+
   char name[MAX_GROUPNAME];
   char creator[MAX_USERNAME];
   char password[MAX_PASSWORD];
   User *members[MAX_CLIENTS];
   int member_count;
   pthread_mutex_t mutex;
+
+  /* Histórico circular com as sequências (history_first .. seq]; entradas
+   * confirmadas por todos os cursores são liberadas. */
+  uint64_t seq;
+  uint64_t history_first;
+  GroupHistoryEntry history[GROUP_HISTORY];
+  GroupCursor cursors[MAX_CLIENTS];
+  int cursor_count;
+
+  /* Incrementada a cada entrada ou saída de membro; invalida a listagem de
+   * membros guardada. */
+  _Atomic uint64_t members_version;
+  ListingCache members_listing;
+  TokenBucket chat_rate; /* rate_config.group */
+
+  PresenceChange presence[PRESENCE_PENDING];
+  int presence_count;
+
+  /* Anel com os últimos chats publicados, já serializados. Publicar é
+   * escrever o frame no slot (seq & máscara) e avançar ring_head; o chat não
+   * é copiado para a fila de cada membro. Cada assinante guarda a própria
+   * posição de leitura (User.ring_read) e a thread da sua conexão escreve do
+   * anel direto no socket (drain_rings()). Alocado na criação do grupo e
+   * reaproveitado pelo slot quando ele é apagado, nunca liberado. */
+  RingSlot *ring;
+  _Atomic uint64_t ring_head;
+
+  /* Canal de anúncios: só o criador e os publicadores postam. Os leitores
+   * não entram em members[] (assinar e sair custam O(1)) e ninguém é avisado
+   * de entradas e saídas; eles leem o anel como os membros de um grupo. Os
+   * conectados ficam num mapa de bits por User.index, com o socket ao lado,
+   * para que cada post acorde só as suas conexões. */
+  bool channel;
+  char publishers[CHANNEL_PUBLISHERS][MAX_USERNAME];
+  int publisher_count;
+  _Atomic int subscriber_count;
+  uint64_t readers[READER_WORDS];
+  int reader_fds[MAX_CLIENTS];
+
+  /* Nó dono do grupo pelo anel de placement.h (PLACEMENT_SELF = este). O
+   * dono guarda o estado autoritativo: atribui as sequências e sabe quem são
+   * os membros em todos os nós. Os outros nós só têm o grupo como réplica
+   * enquanto têm membros locais. */
+  int owner;
+
+  /* Membros em outros nós. Eles não recebem nada daqui: o chat do grupo
+   * atravessa uma vez o link de cada nó que tem membros, e o nó o publica no
+   * seu próprio anel. Vazio num canal, cujos leitores não são contados entre
+   * os nós. */
+  RemoteMember remote[REMOTE_MEMBERS];
+  int remote_count;
 } Group;
 
 typedef struct {
-  Group groups[MAX_GROUPS];
+  Group groups[MAX_GROUPS]; /* slots, livres ou em uso */
+  Group *list[MAX_GROUPS];  /* os grupos em uso, na ordem de criação */
   int group_count;
   pthread_mutex_t mutex;
+
+  /* Incrementada ao criar ou apagar um grupo e quando um grupo ganha ou perde
+   * membros; invalida a listagem de grupos guardada. */
+  _Atomic uint64_t version;
+  ListingCache groups_listing;
 } GroupManager;
 
 typedef struct {
@@ -28,12 +147,48 @@ typedef struct {
 void init_group_manager(GroupManager *gm);
 void init_client_manager(ClientManager *cm);
 bool create_group(GroupManager *gm, const char *name, const char *password,
-                  const char *creator);
+                  const char *creator, bool channel);
 bool delete_group(GroupManager *gm, const char *name, const char *username);
 Group *find_group(GroupManager *gm, const char *name);
+Group *claim_group_slot(GroupManager *gm);
+Group *pin_group(GroupManager *gm, const char *name);
+void unpin_group(Group *group);
 bool join_group(GroupManager *gm, Group *group, User *user);
 bool leave_group(GroupManager *gm, Group *group, User *user);
+bool disconnect_from_group(GroupManager *gm, Group *group, User *user);
+bool is_subscribed(User *user, const char *groupname);
+void remove_subscription(User *user, const char *groupname);
+int copy_subscriptions(User *user, char groups[][MAX_GROUPNAME]);
+void copy_current_group(User *user, char *groupname);
+bool set_presence_watch(User *user, const char *groupname, bool enabled);
+
+void set_presence_window(int window_ms);
+int get_presence_window(void);
+void record_presence(Group *group, const char *username, bool joined);
+void flush_presence(GroupManager *gm);
+uint64_t take_group_token(Group *group, uint64_t now_ns);
 void broadcast_to_group(Group *group, const Message *msg, int exclude_sockfd);
+uint64_t publish_to_group(Group *group, Message *msg);
+void advance_group_seq(Group *group, uint64_t seq);
+void ack_group(Group *group, const char *username, uint64_t seq);
+size_t copy_group_history(Group *group, uint64_t after,
+                          GroupHistoryEntry **entries, uint64_t *missed);
+void free_group_history(GroupHistoryEntry *entries, size_t count);
+
+bool is_channel_publisher(Group *group, const char *username);
+bool set_channel_publisher(Group *group, const char *username, bool enabled);
+uint64_t resume_channel(Group *group, User *user, uint64_t after);
+
+bool set_remote_member(GroupManager *gm, Group *group, const char *username,
+                       int node, bool joined);
+uint32_t remote_node_mask(Group *group);
+void drop_remote_node(GroupManager *gm, int node);
+bool evict_group(GroupManager *gm, Group *group, const char *creator);
+
+bool set_ring_frames(size_t frames);
+bool rebuild_group_ring(Group *group);
+bool rings_pending(User *user);
+bool drain_rings(GroupManager *gm, User *user);
 
 bool verify_group_password(Group *group, const char *password);
 User *add_client(ClientManager *cm, const char *username, int sockfd);
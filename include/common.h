@@ -9,6 +9,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,15 +18,16 @@
 #include <time.h>
 #include <unistd.h>
 
-#define DEFAULT_PORT     6969
-#define MAX_BUFFER       4096
-#define MAX_CONTENT_SIZE 4096
-#define MAX_MESSAGE      4096
-#define MAX_USERNAME     32
-#define MAX_PASSWORD     64
-#define MAX_GROUPNAME    32
-#define MAX_CLIENTS      100
-#define MAX_GROUPS       50
+#define DEFAULT_PORT      6969
+#define MAX_BUFFER        4096
+#define MAX_CONTENT_SIZE  4096
+#define MAX_MESSAGE       4096
+#define MAX_USERNAME      32
+#define MAX_PASSWORD      64
+#define MAX_GROUPNAME     32
+#define MAX_CLIENTS       100
+#define MAX_GROUPS        50
+#define MAX_SUBSCRIPTIONS 16 /* grupos assinados por sessão */
 
 typedef enum {
   CMD_REGISTER,
@@ -41,11 +43,50 @@ typedef enum {
   CMD_LIST_MEMBERS,
   CMD_SUCCESS,
   CMD_ERROR,
-  CMD_NOTIFICATION
+  CMD_NOTIFICATION,
+  CMD_ACK,
+  CMD_RESUME,
+  CMD_LIST_PAGE,
+  CMD_PRESENCE,
+  CMD_PUBLISHER
 } CommandType;
 
+#define CMD_TYPE_COUNT (CMD_PUBLISHER + 1)
+
+/* Listagens (CMD_LIST_GROUPS, CMD_LIST_MEMBERS) são paginadas por cursor: o
+ * pedido leva em 'message' o nome da última entrada já recebida (vazio = do
+ * início) e em 'seq' o máximo de entradas (0 = quantas couberem). A resposta
+ * é um CMD_LIST_PAGE com as entradas em ordem de nome, uma por linha, campos
+ * separados por LIST_FIELD_SEP, e em 'seq' quantas entradas ainda faltam:
+ *   grupos:  nome, criador, membros
+ *   membros: usuário, "creator", "publisher" ou "member" (groupname = o
+ *            grupo)
+ * Num canal de anúncios os membros listados são o criador e os publicadores,
+ * e a contagem da lista de grupos é a de leitores. */
+#define LIST_FIELD_SEP '\t'
+
+/* Presença: entradas e saídas de um grupo são acumuladas por uma janela curta
+ * e enviadas de uma vez. Membros comuns recebem um CMD_NOTIFICATION com o
+ * resumo ("+12 joined, -3 left"). Quem pede CMD_PRESENCE para o grupo (seq 1
+ * liga, 0 desliga; groupname vazio = grupo atual) recebe, no lugar do resumo,
+ * frames CMD_PRESENCE com uma linha por usuário: "+nome" ou "-nome". */
+
+/* Canais de anúncios: CMD_CREATE com seq != 0 cria um canal em vez de um
+ * grupo. Só o criador e os publicadores postam; o criador designa (seq 1) ou
+ * retira (seq 0) um publicador com CMD_PUBLISHER (username = o usuário,
+ * groupname vazio = grupo atual). Entradas e saídas de um canal não são
+ * anunciadas. */
+
 typedef struct {
   CommandType type;
+  uint32_t req_id; /* id do comando, ecoado na resposta (0 = sem id) */
+  uint64_t seq;    /* sequência do chat no grupo (CMD_MESSAGE, CMD_ACK,
+                      CMD_RESUME); 0 = sem sequência. Nas listagens, ver
+                      CMD_LIST_PAGE */
+  /* username: remetente do chat ou destinatário da DM. groupname: grupo do
+   * comando; em CMD_MESSAGE, CMD_LEAVE e CMD_LIST_MEMBERS vazio significa o
+   * grupo atual. Tudo o que o servidor envia a partir de um grupo (chat e
+   * avisos) vem com o groupname preenchido. */
   char username[MAX_USERNAME];
   char password[MAX_PASSWORD];
   char groupname[MAX_GROUPNAME];
@@ -55,6 +96,9 @@ typedef struct {
 
 void error_exit(const char *message);
 
+const char *command_name(CommandType type);
+bool command_from_name(const char *name, CommandType *type);
+
 int set_nonblocking(int sockfd);
 
 #endif
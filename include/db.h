@@ -59,4 +59,17 @@ bool add_user(Database *db, const char *username, const char *hashed_password);
  */
 bool verify_user(Database *db, const char *username, const char *password);
 
+typedef void (*UserVisitor)(const char *username, const char *hashed_password,
+                            void *arg);
+
+/**
+ * @brief Percorre os usuários cadastrados, com o mutex do banco travado.
+ *
+ * @param db Ponteiro para a estrutura Database.
+ * @param visit Chamada com o nome e a senha hash de cada usuário.
+ * @param arg Repassado a visit.
+ * @return false se a consulta falhou.
+ */
+bool for_each_user(Database *db, UserVisitor visit, void *arg);
+
 #endif
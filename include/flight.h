@@ -0,0 +1,84 @@
+#ifndef WHISP_FLIGHT_H
+#define WHISP_FLIGHT_H
+
+#include "common.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define FLIGHT_MAGIC          0x544c4657u /* "WFLT" */
+#define FLIGHT_VERSION        1
+#define FLIGHT_DEFAULT_EVENTS 4096
+#define FLIGHT_DEFAULT_PATH   "whisp.flight"
+
+typedef enum {
+  FLIGHT_CONNECT,
+  FLIGHT_COMMAND,
+  FLIGHT_DISCONNECT
+} FlightEventKind;
+
+/* Um evento no ring. 'seq' é escrito por último e funciona como marcador de
+ * commit: 0 (ou um valor que não corresponde ao slot) indica um evento
+ * incompleto, interrompido por um crash no meio da escrita. */
+typedef struct {
+  _Atomic uint64_t seq;
+  uint64_t wall_ns;
+  uint64_t duration_ns;
+  int32_t conn;
+  uint8_t kind;
+  uint8_t command;
+  uint8_t result;
+  uint8_t reserved;
+  char username[MAX_USERNAME];
+  char groupname[MAX_GROUPNAME];
+} FlightEvent;
+
+/* Cabeçalho do arquivo mapeado, seguido de 'capacity' eventos. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t event_size;
+  uint64_t created_ns;
+  _Atomic uint64_t head;
+} FlightHeader;
+
+/**
+ * @brief Cria (ou reutiliza) o arquivo do flight recorder e o mapeia em
+ * memória. Um arquivo com capacidade diferente é recriado.
+ *
+ * @param path Caminho do arquivo.
+ * @param capacity Quantidade de eventos mantidos no ring.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool flight_open(const char *path, uint32_t capacity);
+
+/**
+ * @brief Sincroniza e desfaz o mapeamento do arquivo.
+ */
+void flight_close(void);
+
+/**
+ * @brief Retorna o tempo monotônico atual em nanossegundos, para medir a
+ * duração de um evento.
+ */
+uint64_t flight_now_ns(void);
+
+/**
+ * @brief Registra um evento no ring. Não faz nada se o recorder não estiver
+ * aberto.
+ *
+ * @param kind Tipo do evento.
+ * @param conn Descritor de arquivo da conexão.
+ * @param command O comando processado (ou -1).
+ * @param result O tipo da resposta enviada (ou -1).
+ * @param username O usuário envolvido (pode ser NULL).
+ * @param groupname O grupo envolvido (pode ser NULL).
+ * @param start_ns Início do evento, obtido de flight_now_ns().
+ */
+void flight_record(FlightEventKind kind, int conn, int command, int result,
+                   const char *username, const char *groupname,
+                   uint64_t start_ns);
+
+bool flight_enabled(void);
+
+#endif
@@ -7,6 +7,8 @@ typedef void (*SimpleFunc)(void);
 typedef void (*MessageFunc)(const char *);
 typedef void (*GroupCommandWithPassword)(const char *, const char *);
 typedef void (*DirectMessageFunc)(const char *, const char *);
+typedef void (*PresenceFunc)(const char *, bool);
+typedef void (*PublisherFunc)(const char *, const char *, bool);
 
 /* A struct abaixo serve para agrupar as funções acima (comportamentos do
  * strategy pattern). O `parse_command` serve como dispatcher que não se
@@ -25,7 +27,8 @@ typedef void (*DirectMessageFunc)(const char *, const char *);
 typedef struct {
   RegisterLoginFunc register_cmd;
   RegisterLoginFunc login_cmd;
-  SimpleFunc leave_group_cmd;
+  GroupNameFunc leave_group_cmd; /* NULL = grupo atual */
+  GroupNameFunc switch_group_cmd;
   GroupNameFunc delete_group_cmd;
   SimpleFunc exit_cmd;
   MessageFunc chat_message_cmd;
@@ -33,7 +36,10 @@ typedef struct {
   GroupCommandWithPassword enter_group_cmd;
   DirectMessageFunc direct_message_cmd;
   SimpleFunc list_groups_cmd;
-  SimpleFunc list_members_cmd;
+  GroupNameFunc list_members_cmd; /* NULL = grupo atual */
+  PresenceFunc presence_cmd;      /* grupo NULL = grupo atual */
+  GroupCommandWithPassword create_channel_cmd;
+  PublisherFunc publisher_cmd; /* canal NULL = grupo atual */
 } CommandHandlers;
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef WHISP_HANDOFF_H
+#define WHISP_HANDOFF_H
+
+#include "common.h"
+
+#define HANDOFF_DEFAULT_PATH "whisp.handoff"
+#define HANDOFF_FREEZE_MS    3000  /* espera pelas conexões ocupadas */
+#define HANDOFF_TIMEOUT_MS   10000 /* cada leitura/escrita no socket Unix */
+
+/* Troca do processo do servidor sem derrubar conexões. O servidor em execução
+ * escuta num socket Unix; um novo binário iniciado com --takeover se conecta
+ * a ele e recebe:
+ *   - os sockets de escuta e os de cada conexão (SCM_RIGHTS);
+ *   - por conexão: o usuário logado, suas assinaturas (com a posição de
+ *     leitura no anel de cada grupo), os bytes recebidos que ainda não
+ *     formavam um frame e a fila de saída;
+ *   - por grupo: dados, membros, publicadores, cursores, presença pendente e
+ *     histórico, do qual o processo novo refaz o anel.
+ * O processo antigo para de aceitar, estaciona as conexões (session.h) e só
+ * sai depois que o novo confirma ter restaurado tudo; se algo falhar antes
+ * disso, ele volta a atender normalmente. Os dois processos precisam ter o
+ * mesmo HANDOFF_VERSION. Limites de taxa recomeçam do zero no processo novo. */
+
+/**
+ * @brief Cria o socket Unix em que o servidor espera um pedido de troca,
+ * substituindo um arquivo antigo no mesmo caminho.
+ *
+ * @return O descritor do socket, ou -1 em caso de falha.
+ */
+int handoff_listen(const char *path);
+
+/**
+ * @brief Entrega o estado ao processo novo conectado em conn_fd. As threads
+ * de aceitação devem estar paradas e as conexões estacionadas.
+ *
+ * @param listen_fds Os sockets de escuta a entregar.
+ * @param listeners Quantos são.
+ * @return true se o processo novo confirmou a troca. Nesse caso o estado
+ * continua travado e o processo deve sair sem tocar nas conexões; com false,
+ * nada mudou.
+ */
+bool handoff_serve(int conn_fd, const int *listen_fds, int listeners);
+
+/**
+ * @brief Assume as conexões e o estado do servidor que escuta em path. Deve
+ * ser chamada com os gerenciadores inicializados e vazios; ao retornar true,
+ * as threads das conexões já estão rodando.
+ *
+ * @param listen_fds Saída com os sockets de escuta recebidos.
+ * @param max_listeners Capacidade de listen_fds.
+ * @param listeners Saída com quantos sockets de escuta foram recebidos.
+ * @return false se a troca falhou (o processo antigo continua atendendo).
+ */
+bool handoff_receive(const char *path, int *listen_fds, int max_listeners,
+                     int *listeners);
+
+#endif
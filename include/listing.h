@@ -0,0 +1,83 @@
+#ifndef WHISP_LISTING_H
+#define WHISP_LISTING_H
+
+#include "common.h"
+#include <stdatomic.h>
+
+/* Entrada de uma listagem (grupos ou membros de um grupo). */
+typedef struct {
+  char name[MAX_USERNAME]; /* nome do grupo ou do usuário (o cursor) */
+  char creator[MAX_USERNAME];
+  int members;
+  bool is_creator;
+  bool is_publisher; /* canal de anúncios */
+} ListEntry;
+
+typedef int (*ListFormatter)(char *line, size_t size, const ListEntry *entry);
+
+/* Listagem já ordenada e serializada no formato de CMD_LIST_PAGE. É imutável
+ * depois de criada e compartilhada por contagem de referências: uma página é
+ * só uma busca binária pelo cursor e uma cópia de bytes contíguos. */
+typedef struct {
+  atomic_int refs;
+  uint64_t version; /* versão dos dados de origem quando foi copiada */
+  size_t count;
+  char (*names)[MAX_USERNAME];
+  size_t *offsets; /* início de cada linha em 'text'; offsets[count] = fim */
+  char *text;
+} ListingSnapshot;
+
+/* A última listagem gerada para uma fonte de dados. Ela vale enquanto a
+ * versão da fonte não mudar; a próxima listagem depois de uma mudança gera
+ * uma nova. */
+typedef struct {
+  pthread_mutex_t mutex;
+  ListingSnapshot *snapshot;
+} ListingCache;
+
+void listing_cache_init(ListingCache *cache);
+
+/**
+ * @brief Descarta a listagem guardada (quem ainda a usa mantém sua
+ * referência).
+ */
+void listing_cache_clear(ListingCache *cache);
+
+/**
+ * @brief Retorna uma referência à listagem guardada se ela corresponde a
+ * 'version', ou NULL se é preciso gerar outra.
+ */
+ListingSnapshot *listing_acquire(ListingCache *cache, uint64_t version);
+
+/**
+ * @brief Ordena as entradas por nome e as serializa em uma nova listagem, com
+ * uma referência para o chamador.
+ *
+ * @return A listagem, ou NULL se faltar memória.
+ */
+ListingSnapshot *listing_build(ListEntry *entries, size_t count,
+                               ListFormatter format, uint64_t version);
+
+/**
+ * @brief Guarda a listagem no cache, a menos que ele já tenha uma mais nova.
+ */
+void listing_publish(ListingCache *cache, ListingSnapshot *snapshot);
+
+void listing_release(ListingSnapshot *snapshot);
+
+/**
+ * @brief Copia uma página da listagem: as entradas depois de 'cursor' (vazio
+ * = do início), até 'limit' entradas (0 = sem limite) ou até encher 'size'
+ * bytes. Uma entrada nunca é cortada ao meio.
+ *
+ * @param snapshot A listagem.
+ * @param cursor O nome da última entrada já recebida.
+ * @param limit O máximo de entradas.
+ * @param out Saída com as linhas da página, terminada em '\0'.
+ * @param size O tamanho de 'out'.
+ * @return Quantas entradas ficaram depois da página.
+ */
+size_t listing_page(const ListingSnapshot *snapshot, const char *cursor,
+                    size_t limit, char *out, size_t size);
+
+#endif
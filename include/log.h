@@ -0,0 +1,92 @@
+#ifndef WHISP_LOG_H
+#define WHISP_LOG_H
+
+#include "common.h"
+#include <stdatomic.h>
+
+#define LOG_MSG_MAX          232
+#define LOG_RING_SLOTS       256
+#define LOG_DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+#define LOG_DEFAULT_FILES    4
+
+typedef enum {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_OFF
+} LogLevel;
+
+typedef struct {
+  const char *path; /* NULL ou "-" para stderr (sem rotação) */
+  LogLevel level;
+  size_t max_bytes;
+  int max_files;
+} LogConfig;
+
+/* Nível mínimo atual. Lido de forma relaxada pelas macros abaixo para que uma
+ * mensagem filtrada custe apenas um load e uma comparação. */
+extern atomic_int log_threshold;
+
+#define log_enabled(lvl)                                                       \
+  ((int)(lvl) >= atomic_load_explicit(&log_threshold, memory_order_relaxed))
+
+#define LOG_AT(lvl, ...)                                                       \
+  do {                                                                         \
+    if (log_enabled(lvl)) log_write((lvl), __VA_ARGS__);                       \
+  } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * @brief Inicializa o subsistema de log e inicia a thread de escrita em
+ * segundo plano.
+ *
+ * @param config Configuração do destino, nível e rotação.
+ * @return true em caso de sucesso, false se o arquivo não puder ser aberto.
+ */
+bool log_init(const LogConfig *config);
+
+/**
+ * @brief Drena os buffers pendentes, encerra a thread de escrita e fecha o
+ * arquivo de log.
+ */
+void log_shutdown(void);
+
+/**
+ * @brief Registra uma mensagem no buffer da thread atual, sem locks nem
+ * chamadas de sistema além do relógio. Use as macros LOG_* em vez de chamar
+ * diretamente, para que o filtro de nível seja avaliado antes dos argumentos.
+ *
+ * @param level Nível da mensagem.
+ * @param fmt String de formato no estilo printf.
+ */
+void log_write(LogLevel level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Altera o nível mínimo em tempo de execução. Seguro para uso em
+ * handlers de sinal.
+ *
+ * @param level O novo nível mínimo.
+ */
+void log_set_level(LogLevel level);
+
+LogLevel log_get_level(void);
+
+/**
+ * @brief Converte um nome ("debug", "info", "warn", "error", "off") para o
+ * nível correspondente.
+ *
+ * @param name O nome do nível.
+ * @param level Saída com o nível encontrado.
+ * @return true se o nome for válido, false caso contrário.
+ */
+bool log_level_from_string(const char *name, LogLevel *level);
+
+const char *log_level_name(LogLevel level);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef WHISP_MIRROR_H
+#define WHISP_MIRROR_H
+
+#include "common.h"
+#include "peer.h"
+
+#define MIRROR_MAX_ADDRESS  128       /* "host:porta" do primário */
+#define MIRROR_QUEUE_BYTES  (64 << 20) /* fila de saída de um standby */
+#define MIRROR_HEARTBEAT_MS 1000      /* feed ocioso: o primário dá sinal */
+#define MIRROR_TIMEOUT_MS   3000      /* feed mudo: o standby o dá por caído */
+#define MIRROR_RETRY_MS     500       /* espera antes de reconectar ao primário */
+#define MIRROR_CONNECT_MS   1000
+#define MIRROR_FAILOVER_MS  5000      /* padrão de --failover-after */
+
+/* Replicação para um servidor em espera (warm standby). O primário abre
+ * --mirror-port e, a cada standby que conecta, manda um snapshot (as contas
+ * do whisp.db e os grupos com criador, senha, publicadores e o histórico)
+ * seguido do feed: cada escrita no banco e cada mudança nos grupos vira um
+ * registro, enfileirado no mesmo lock que a ordenou, e uma thread por standby
+ * escreve a fila acumulada de uma vez, sem que quem publica espere pelo
+ * socket. Aplicar um registro é idempotente, então o feed pode repetir o que
+ * o snapshot já trouxe.
+ *
+ * O standby (--standby-of) aplica o feed ao seu banco e ao seu GroupManager
+ * sem abrir as portas dos clientes. Um snapshot só substitui o estado
+ * quando chega inteiro; até lá vale o anterior. Se o primário fica
+ * --failover-after ms fora do ar depois de ao menos um snapshot completo, o
+ * standby assume: abre as portas com o estado já quente. Os clientes
+ * reconectam, fazem login de novo e retomam os grupos (CMD_RESUME) do
+ * histórico replicado. Membros, cursores e sessões não são replicados, nem o
+ * estado da federação (relay.h), que o anel refaz. Quem garante que o primário não volta a atender junto com
+ * o standby (IP virtual, fencing) é o ambiente.
+ *
+ * O feed leva os hashes das senhas e as senhas dos grupos: a porta escuta no
+ * IP do servidor, só aceita os hosts de --standby e nada passa antes de os
+ * dois lados provarem o segredo compartilhado (peer.h). */
+
+typedef struct {
+  int port;                         /* aceita standbys; 0 = não */
+  char primary[MIRROR_MAX_ADDRESS]; /* "host:porta"; vazio = não é standby */
+  int failover_ms;
+  PeerAllowlist standbys;           /* quem pode seguir este primário */
+} MirrorConfig;
+
+extern MirrorConfig mirror_config;
+
+/**
+ * @brief Segue o primário (mirror_config.primary) até ele cair ou o servidor
+ * ser interrompido. Chamada antes de abrir as portas dos clientes.
+ *
+ * @param running Zerado pelo sinal de parada.
+ * @return true se o standby deve assumir, false se foi interrompido.
+ */
+bool mirror_follow(volatile sig_atomic_t *running);
+
+/**
+ * @brief Permite que um host siga este primário (--standby).
+ *
+ * @return false se o host não resolve ou a lista está cheia.
+ */
+bool mirror_allow_standby(const char *host);
+
+/**
+ * @brief Abre mirror_config.port para os standbys. Não faz nada sem porta.
+ *
+ * @param ip O endereço em que a porta escuta (o do servidor).
+ * @return false se a porta não pôde ser aberta ou não há segredo
+ * (peer_load_secret()).
+ */
+bool mirror_start(const char *ip);
+
+/**
+ * @brief Derruba os standbys e espera as suas threads; eles reconectam a
+ * quem abrir a porta de novo (mirror_start()).
+ */
+void mirror_stop(void);
+
+/* Registros do feed. Chamadas com o lock que ordena a mudança (o do banco, o
+ * do GroupManager ou o do grupo) travado; não fazem nada sem standbys. */
+void mirror_user(const char *username, const char *hashed_password);
+void mirror_group(const char *name, const char *creator, const char *password,
+                  bool channel);
+void mirror_group_deleted(const char *name, const char *creator);
+void mirror_publisher(const char *groupname, const char *username,
+                      bool enabled);
+void mirror_seq(const char *groupname, uint64_t seq);
+void mirror_chat(const char *groupname, const Message *msg);
+
+#endif
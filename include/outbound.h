@@ -0,0 +1,165 @@
+#ifndef WHISP_OUTBOUND_H
+#define WHISP_OUTBOUND_H
+
+#include "common.h"
+
+#define OUTBOUND_DEFAULT_BUDGET   (512 * 1024)
+#define OUTBOUND_DEFAULT_GRACE_MS 5000
+#define OUTBOUND_REPLY_TIMEOUT_MS 1000
+#define OUTBOUND_MAX_FDS          65536
+#define OUTBOUND_REPORT_SECONDS   10
+#define OUTBOUND_WRITEV_MAX       64 /* frames por outbound_writev() */
+
+/* Respostas, avisos e mensagens diretas passam pela fila de saída da
+ * conexão. O envio tenta escrever direto no socket (não-bloqueante) e só
+ * enfileira o que não coube; a thread da conexão esvazia a fila quando o
+ * socket permite. O chat dos grupos não entra na fila: a thread da conexão o
+ * escreve direto do anel do grupo (outbound_writev()), e o atraso no anel
+ * conta como fila. Quando um cliente para de ler e a fila atinge o orçamento
+ * de bytes, a política decide o que acontece, sem segurar quem está enviando:
+ *   drop:       descarta o chat mais antigo da fila;
+ *   coalesce:   descarta o chat mais antigo e deixa no lugar um único aviso
+ *               "You missed N messages" por grupo, com o grupo e a maior
+ *               sequência descartada;
+ *   disconnect: descarta o que chega e derruba a conexão se a fila continuar
+ *               cheia depois do período de tolerância.
+ * Só frames de chat são descartados pelas duas primeiras; se a fila não tem
+ * chat, é o frame novo que se perde. */
+typedef enum { SLOW_DROP, SLOW_COALESCE, SLOW_DISCONNECT } SlowPolicy;
+
+typedef struct {
+  size_t budget; /* bytes enfileirados por conexão */
+  SlowPolicy policy;
+  int grace_ms; /* SLOW_DISCONNECT */
+} OutboundConfig;
+
+extern OutboundConfig outbound_config;
+
+bool slow_policy_from_string(const char *name, SlowPolicy *policy);
+
+/**
+ * @brief Registra a fila de saída de uma conexão nova.
+ *
+ * @return false se o descritor passa de OUTBOUND_MAX_FDS ou falta memória.
+ */
+bool outbound_open(int sockfd);
+
+/**
+ * @brief Descarta a fila da conexão. Chamada pela thread da conexão antes de
+ * fechar o socket.
+ */
+void outbound_close(int sockfd);
+
+/**
+ * @brief Associa o usuário logado à conexão, para nomeá-la nas métricas.
+ */
+void outbound_set_name(int sockfd, const char *username);
+
+/**
+ * @brief Envia (ou enfileira) uma mensagem sem bloquear, aplicando a política
+ * de consumidor lento se a fila estiver cheia. Pode ser chamada de qualquer
+ * thread.
+ *
+ * @return 0 se a mensagem foi enviada ou enfileirada, -1 se foi descartada ou
+ * a conexão falhou.
+ */
+int outbound_send(int sockfd, const Message *msg);
+
+/**
+ * @brief Quantos frames ainda cabem na fila da conexão antes do orçamento.
+ */
+size_t outbound_space(int sockfd);
+
+/**
+ * @brief Escreve frames de fora da fila (o anel de um grupo) direto no
+ * socket, com um só writev() e sem copiá-los. Só escreve se a fila está
+ * vazia, para não passar à frente do que já foi enfileirado; o que faltou de
+ * um frame escrito pela metade é copiado para a fila. Só a thread da própria
+ * conexão pode chamá-la.
+ *
+ * @param count Quantos frames, até OUTBOUND_WRITEV_MAX.
+ * @return Quantos frames foram consumidos (escritos ou enfileirados), ou -1
+ * se a conexão falhou.
+ */
+int outbound_writev(int sockfd, const Message *const *frames, int count);
+
+/**
+ * @brief Aplica a política de consumidor lento a uma conexão atrasada no
+ * anel de um grupo: drop e coalesce pulam os frames mais antigos (coalesce
+ * deixa na fila o aviso "You missed N messages"); disconnect derruba a
+ * conexão se o atraso durar mais que o período de tolerância.
+ *
+ * @param lag Frames publicados no anel e ainda não enviados à conexão.
+ * @param limit O atraso a partir do qual a política age.
+ * @return Quantos frames pular.
+ */
+uint64_t outbound_lagging(int sockfd, uint64_t lag, uint64_t limit);
+
+/**
+ * @brief Derruba a conexão, registrando o motivo no log.
+ */
+void outbound_fail(int sockfd, const char *reason);
+
+/**
+ * @brief Acorda a thread da conexão se ela está em outbound_wait(). Barato
+ * quando não está: não faz chamada de sistema.
+ */
+void outbound_wake(int sockfd);
+
+/**
+ * @brief Espera o socket ter dados para ler, espaço para escrever (se há
+ * fila) ou um outbound_wake(), por até timeout_ms. Só a thread da conexão
+ * pode chamá-la.
+ *
+ * @param idle Chamada depois que a espera é anunciada; se retornar false há
+ * trabalho novo e a espera é cancelada. Pode ser NULL.
+ */
+void outbound_wait(int sockfd, int timeout_ms, bool (*idle)(void));
+
+/**
+ * @brief Como outbound_send(), mas antes espera (até
+ * OUTBOUND_REPLY_TIMEOUT_MS) a fila ter espaço, para que respostas e
+ * retransmissões não sejam descartadas. Só a thread da própria conexão pode
+ * chamá-la.
+ */
+int outbound_reply(int sockfd, const Message *msg);
+
+/**
+ * @brief Escreve o que couber da fila no socket. Chamada pela thread da
+ * conexão.
+ *
+ * @return 0 se a conexão continua, -1 se ela falhou ou foi derrubada pela
+ * política.
+ */
+int outbound_flush(int sockfd);
+
+bool outbound_pending(int sockfd);
+
+/**
+ * @brief Copia os frames ainda na fila, em ordem, para entregá-los a outro
+ * processo (handoff.h). O primeiro pode já ter sido escrito em parte.
+ *
+ * @param frames Saída com a cópia (liberar com free()), NULL se vazia.
+ * @param head_offset Saída com os bytes do primeiro frame já escritos.
+ * @return A quantidade de frames, ou 0 se a fila está vazia ou falta memória.
+ */
+size_t outbound_export(int sockfd, Message **frames, size_t *head_offset);
+
+/**
+ * @brief Como outbound_open(), para uma conexão recebida de outro processo:
+ * a fila é registrada já com os frames exportados por outbound_export(), e
+ * nenhum envio chega antes deles (nem direto no socket, no meio do frame
+ * escrito em parte). A fila cresce se o orçamento for menor que o exportado.
+ *
+ * @return false se o descritor passa de OUTBOUND_MAX_FDS ou falta memória.
+ */
+bool outbound_adopt(int sockfd, const Message *frames, size_t count,
+                    size_t head_offset);
+
+/**
+ * @brief Registra no log as conexões com fila acumulada ou frames descartados
+ * desde o último relatório.
+ */
+void outbound_report(void);
+
+#endif
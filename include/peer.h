@@ -0,0 +1,80 @@
+#ifndef WHISP_PEER_H
+#define WHISP_PEER_H
+
+#include "common.h"
+
+#define PEER_MAX_ALLOWED 32  /* endereços numa lista de permitidos */
+#define PEER_SECRET_MIN  16  /* bytes do segredo compartilhado */
+#define PEER_SECRET_MAX  256
+#define PEER_HEX         65  /* nonce ou prova em hexadecimal, com o '\0' */
+
+/* Autenticação dos links entre servidores (relay.h, mirror.h). Só abrem
+ * link os endereços de uma lista de permitidos, e os dois lados provam que
+ * conhecem o segredo compartilhado (--secret-file): cada um manda um nonce
+ * novo e responde com o HMAC-SHA256 do segredo sobre o protocolo, o nonce
+ * do outro, o seu e o nome de quem prova. Com o nome na prova, o que um lado
+ * diz não serve ao outro, nem a prova de um protocolo serve ao outro. O
+ * segredo nunca passa pelo link, mas o resto do tráfego continua em
+ * claro. */
+
+typedef struct {
+  struct in_addr addresses[PEER_MAX_ALLOWED];
+  int count;
+} PeerAllowlist;
+
+/**
+ * @brief Lê o segredo compartilhado de um arquivo, sem o fim de linha.
+ *
+ * @return false se o arquivo não pôde ser lido ou o segredo tem menos de
+ * PEER_SECRET_MIN bytes.
+ */
+bool peer_load_secret(const char *path);
+
+/**
+ * @brief Diz se há um segredo carregado.
+ */
+bool peer_has_secret(void);
+
+/**
+ * @brief Acrescenta à lista os endereços IPv4 de um host.
+ *
+ * @param list A lista.
+ * @param host "host" ou "host:porta" (a porta é ignorada).
+ * @return false se o host não resolve ou a lista está cheia.
+ */
+bool peer_allow(PeerAllowlist *list, const char *host);
+
+/**
+ * @brief Diz se um endereço está na lista.
+ */
+bool peer_allowed(const PeerAllowlist *list, struct in_addr address);
+
+/**
+ * @brief Gera um nonce aleatório, em hexadecimal.
+ */
+void peer_nonce(char nonce[PEER_HEX]);
+
+/**
+ * @brief Calcula a prova de quem se apresenta a um par.
+ *
+ * @param context O protocolo ("relay", "mirror").
+ * @param verifier_nonce O nonce de quem confere.
+ * @param prover_nonce O nonce de quem prova.
+ * @param prover O nome de quem prova.
+ * @param proof Recebe a prova, em hexadecimal.
+ */
+void peer_proof(const char *context, const char *verifier_nonce,
+                const char *prover_nonce, const char *prover,
+                char proof[PEER_HEX]);
+
+/**
+ * @brief Confere a prova recebida de um par, em tempo constante.
+ *
+ * @return false se a prova não confere ou os dois nonces são iguais (o par
+ * devolveu o nosso).
+ */
+bool peer_verify(const char *context, const char *verifier_nonce,
+                 const char *prover_nonce, const char *prover,
+                 const char *proof);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WHISP_PLACEMENT_H
+#define WHISP_PLACEMENT_H
+
+#include "common.h"
+
+#define PLACEMENT_VNODES    64 /* pontos de cada nó no anel */
+#define PLACEMENT_MAX_NODES 32
+#define PLACEMENT_SELF      -1 /* o nó local */
+
+/* Anel de hash consistente que dá a cada grupo um nó dono. Cada nó no ar
+ * (este e os pares com link, relay.h) ocupa PLACEMENT_VNODES pontos do anel,
+ * pelo hash de "nome#i"; o dono de um grupo é o nó do primeiro ponto a
+ * partir do hash do nome. Quando um nó entra ou sai, só os grupos cujo ponto
+ * mais próximo era ou passa a ser dele mudam de dono. Todos os nós calculam o
+ * mesmo anel a partir dos mesmos nomes. */
+
+/**
+ * @brief Refaz o anel com os nós no ar.
+ *
+ * @param names Os nomes dos nós.
+ * @param ids O identificador de cada nó, devolvido por placement_owner()
+ * (PLACEMENT_SELF para o nó local).
+ * @param count Quantos são (até PLACEMENT_MAX_NODES).
+ */
+void placement_set(const char (*names)[MAX_USERNAME], const int *ids,
+                   int count);
+
+/**
+ * @brief Retorna o dono de um grupo.
+ *
+ * @return O identificador do nó dono, ou PLACEMENT_SELF se o anel está vazio.
+ */
+int placement_owner(const char *groupname);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef WHISP_RATELIMIT_H
+#define WHISP_RATELIMIT_H
+
+#include "common.h"
+#include <stdint.h>
+
+#define RATE_DEFAULT_MAX_DELAY_MS 1000
+#define RATE_TABLE_SLOTS          1024 /* chaves acompanhadas ao mesmo tempo */
+#define RATE_TABLE_PROBE          8    /* slots examinados por chave */
+#define RATE_MAX_KEY              64
+
+/* Limite de um token bucket: 'rate' comandos por segundo, acumulando até
+ * 'burst'. rate 0 = sem limite. */
+typedef struct {
+  double rate;
+  double burst;
+} RateLimit;
+
+typedef struct {
+  double tokens;
+  uint64_t updated_ns; /* 0 = bucket cheio, nunca usado */
+} TokenBucket;
+
+/* O que fazer com um comando acima do limite: responder com erro na hora, ou
+ * segurar a sessão até haver token (no máximo max_delay_ms; acima disso o
+ * comando é rejeitado). Segurar a sessão para de ler o socket, o que empurra
+ * o controle de fluxo do TCP de volta para o cliente. */
+typedef enum { RATE_REJECT, RATE_DELAY } RatePolicy;
+
+typedef struct {
+  RateLimit connection;              /* todos os comandos de uma sessão */
+  RateLimit command[CMD_TYPE_COUNT]; /* cada tipo de comando, por sessão */
+  RateLimit group;                   /* chat publicado em cada grupo */
+  RatePolicy policy;
+  uint32_t max_delay_ms;
+} RateConfig;
+
+/* Buckets de uma chave da tabela compartilhada por todas as conexões: o
+ * usuário, para os comandos e o chat depois do login, ou o endereço do
+ * cliente, para LOGIN, REGISTER e tudo antes do login. Reconectar não devolve
+ * os tokens. A tabela tem tamanho fixo; uma chave nova ocupa o slot menos
+ * usado entre os RATE_TABLE_PROBE da sua posição, que volta cheio. */
+typedef struct {
+  TokenBucket connection;
+  TokenBucket command[CMD_TYPE_COUNT];
+} RateBuckets;
+
+extern RateConfig rate_config;
+
+/**
+ * @brief Atualiza o bucket até 'now_ns' e diz quanto falta para que ele tenha
+ * um token, sem consumi-lo.
+ *
+ * @return 0 se há token (ou o limite está desligado), ou a espera em ns.
+ */
+uint64_t bucket_wait(TokenBucket *bucket, const RateLimit *limit,
+                     uint64_t now_ns);
+
+/**
+ * @brief Consome um token do bucket (depois de bucket_wait() retornar 0).
+ */
+void bucket_take(TokenBucket *bucket, const RateLimit *limit);
+
+/**
+ * @brief Atualiza os buckets da chave (o da sessão e o do tipo do comando) e
+ * diz quanto falta para que ambos tenham token, sem consumi-los.
+ *
+ * @param key "user:nome" ou "addr:ip".
+ * @return 0 se o comando pode passar, ou a espera em ns.
+ */
+uint64_t rate_wait(const char *key, CommandType type, uint64_t now_ns);
+
+/**
+ * @brief Consome os tokens da chave (depois de rate_wait() retornar 0).
+ */
+void rate_take(const char *key, CommandType type);
+
+/**
+ * @brief Lê um limite no formato "rate[:burst]" (burst padrão: 2 * rate).
+ */
+bool rate_parse_limit(const char *spec, RateLimit *limit);
+
+/**
+ * @brief Lê um limite por comando no formato "NOME=rate[:burst]" (NOME como
+ * em command_name()) e o aplica a rate_config.
+ */
+bool rate_parse_command(const char *spec);
+
+bool rate_parse_policy(const char *name, RatePolicy *policy);
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef WHISP_RELAY_H
+#define WHISP_RELAY_H
+
+#include "chat.h"
+#include "common.h"
+#include "peer.h"
+
+#define RELAY_VERSION      2
+#define RELAY_MAX_NODES    16      /* nós da federação, contando este */
+#define RELAY_MAX_ADDRESS  128     /* "host:porta" de um par */
+#define RELAY_RETRY_MS     1000    /* espera antes de reconectar a um par */
+#define RELAY_QUEUE_BYTES  (8 << 20) /* fila de saída de um link */
+#define RELAY_CONNECT_MS   1000
+#define RELAY_CALL_MS      2000    /* espera pela resposta do dono */
+#define RELAY_MAX_CALLS    MAX_CLIENTS /* pedidos ao dono em andamento */
+
+/* Federação de servidores. Cada nó mantém links TCP persistentes com os
+ * demais (--peer, de um lado ou dos dois, e --relay-port para aceitar),
+ * num protocolo de frames compactos (relay.c). Os usuários logados são
+ * anunciados a todos, para que o login e as mensagens diretas valham para o
+ * cluster todo.
+ *
+ * Cada grupo tem um nó dono, dado pelo anel de hash consistente de
+ * placement.h sobre os nós no ar. O dono guarda o estado autoritativo:
+ * cria e apaga o grupo, confere a senha, designa os publicadores, sabe
+ * quem são os membros em cada nó e numera o chat. Um nó que não é o dono
+ * pede a operação a ele por uma chamada com resposta, e só guarda o grupo
+ * como réplica enquanto tem membros locais (Group.owner diz de quem é).
+ * O chat postado numa réplica vai ao dono, que o publica e o reenvia, já
+ * com a sequência, uma vez só pelo link de cada nó com membros (todos, num
+ * canal); as réplicas o publicam com a mesma sequência, então CMD_ACK e
+ * CMD_RESUME valem em qualquer nó. A listagem de grupos junta a de cada
+ * dono.
+ *
+ * Quando um nó entra ou sai, o anel muda e cada grupo cujo dono mudou tem
+ * o estado enviado ao novo dono; quando o último link com um nó cai, seus
+ * usuários e membros somem, com o aviso de saída nos grupos. Nada é
+ * reencaminhado além de um salto até o dono: a malha precisa ser completa.
+ *
+ * A porta dos links escuta no IP do servidor e só aceita os hosts dos
+ * --peer e dos --relay-allow; um nó só entra na tabela depois de provar o
+ * segredo compartilhado (peer.h), então ninguém de fora anuncia usuários,
+ * posta chat ou ocupa os RELAY_MAX_NODES lugares. O tráfego, senhas dos
+ * grupos inclusive, segue em claro e deve ficar numa rede privada; as contas
+ * continuam no whisp.db de cada nó. */
+
+/* Resultado de uma operação pedida ao dono de um grupo. */
+typedef enum {
+  RELAY_OK = 0,
+  RELAY_NO_GROUP,    /* o grupo não existe */
+  RELAY_DENIED,      /* senha errada, ou quem pediu não é o criador */
+  RELAY_FAILED,      /* nome em uso ou limite atingido */
+  RELAY_NOT_CHANNEL, /* o grupo não é um canal */
+  RELAY_UNAVAILABLE, /* o dono não respondeu a tempo */
+} RelayStatus;
+
+typedef struct {
+  char node[MAX_USERNAME]; /* nome único do nó; vazio = "ip:porta" */
+  int port;                /* porta dos links de entrada; 0 = só sai */
+  char peers[RELAY_MAX_NODES][RELAY_MAX_ADDRESS];
+  int peer_count;
+  PeerAllowlist allowed;   /* de quem a porta aceita links */
+} RelayConfig;
+
+extern RelayConfig relay_config;
+
+/**
+ * @brief Acrescenta um par (--peer) a relay_config, e o seu host aos que
+ * podem abrir links com este nó.
+ *
+ * @param address "host:porta".
+ * @return false se o endereço é inválido ou não resolve, ou se já há pares
+ * demais.
+ */
+bool relay_add_peer(const char *address);
+
+/**
+ * @brief Aceita links de um host que não está entre os pares (--relay-allow),
+ * como um nó sem porta própria.
+ *
+ * @return false se o host não resolve ou a lista está cheia.
+ */
+bool relay_allow(const char *host);
+
+/**
+ * @brief Abre a porta dos links e começa a conectar aos pares. Não faz nada
+ * se relay_config não tem porta nem pares.
+ *
+ * @param ip O endereço em que a porta escuta (o do servidor).
+ * @param default_node O nome do nó se relay_config.node estiver vazio.
+ * @return false se a porta não pôde ser aberta ou não há segredo
+ * (peer_load_secret()).
+ */
+bool relay_start(const char *ip, const char *default_node);
+
+/**
+ * @brief Derruba os links e espera as suas threads. Os pares veem o nó sair;
+ * relay_start() o traz de volta.
+ */
+void relay_stop(void);
+
+/**
+ * @brief Anuncia aos pares que um usuário entrou ou saiu.
+ */
+void relay_user(const char *username, bool online);
+
+/**
+ * @brief Diz se o usuário está logado em outro nó.
+ */
+bool relay_user_online(const char *username);
+
+/**
+ * @brief Cria um grupo ou canal cujo dono é outro nó, pedindo ao dono. O
+ * grupo não é copiado para cá: a réplica surge quando alguém daqui entra.
+ *
+ * @return RELAY_NO_GROUP se o dono do nome é este nó (quem chama cria o
+ * grupo com create_group()), RELAY_FAILED se o nome está em uso ou o dono
+ * está cheio, ou o resultado da chamada.
+ */
+RelayStatus relay_create_group(const char *name, const char *password,
+                               const char *creator, bool channel);
+
+/**
+ * @brief Busca no dono um grupo que não tem réplica aqui, ou cuja réplica
+ * não tem membros locais e pode estar velha, conferindo a senha. A réplica
+ * é criada ou atualizada com o estado do dono.
+ *
+ * @param name O grupo.
+ * @param password A senha informada.
+ * @param group Recebe a réplica, fixada (pin_group()); quem chama a solta.
+ * @return RELAY_OK, RELAY_NO_GROUP (também quando o dono é este nó),
+ * RELAY_DENIED ou RELAY_UNAVAILABLE.
+ */
+RelayStatus relay_fetch_group(const char *name, const char *password,
+                              Group **group);
+
+/**
+ * @brief Pede ao dono que apague um grupo que não é deste nó.
+ *
+ * @param name O grupo.
+ * @param username Quem pediu (precisa ser o criador).
+ * @return RELAY_OK, RELAY_NO_GROUP, RELAY_DENIED ou RELAY_UNAVAILABLE.
+ */
+RelayStatus relay_delete_group(const char *name, const char *username);
+
+/**
+ * @brief Avisa os nós de que o dono está apagando o grupo, para que
+ * descartem as réplicas. Chamada pelo dono antes de delete_group().
+ */
+void relay_group_deleted(Group *group);
+
+/**
+ * @brief Pede ao dono que designe ou retire um publicador de um canal que
+ * não é deste nó.
+ *
+ * @param name O canal.
+ * @param requester Quem pediu (precisa ser o criador).
+ * @param username O publicador.
+ * @param enabled true para designar.
+ * @return RELAY_OK, RELAY_NO_GROUP, RELAY_NOT_CHANNEL, RELAY_DENIED,
+ * RELAY_FAILED (publicadores demais) ou RELAY_UNAVAILABLE.
+ */
+RelayStatus relay_set_publisher(const char *name, const char *requester,
+                                const char *username, bool enabled);
+
+/**
+ * @brief Leva às réplicas um publicador designado ou retirado no dono.
+ */
+void relay_publisher(Group *group, const char *username, bool enabled);
+
+/**
+ * @brief Anuncia que um usuário daqui entrou ou saiu de um grupo (não de um
+ * canal, cujos leitores não são contados entre os nós): ao dono, se o grupo
+ * é uma réplica, ou aos nós com membros, se é deste nó.
+ */
+void relay_membership(Group *group, const char *username, bool joined);
+
+/**
+ * @brief Descarta a réplica de um grupo que ficou sem membros locais. Não
+ * faz nada com os grupos deste nó.
+ */
+void relay_release_group(Group *group);
+
+/**
+ * @brief Manda ao dono um chat postado numa réplica, para que ele o numere e
+ * publique.
+ *
+ * @return false se o grupo é deste nó ou o dono está fora do ar; quem chama
+ * publica aqui.
+ */
+bool relay_post(Group *group, const Message *msg);
+
+/**
+ * @brief Leva um chat que o dono acabou de publicar aos nós com membros do
+ * grupo. Não faz nada numa réplica.
+ *
+ * @param group O grupo.
+ * @param msg O chat (remetente, texto e a sequência atribuída).
+ */
+void relay_chat(Group *group, const Message *msg);
+
+/**
+ * @brief Diz se há outros nós no ar; quando há, a listagem de grupos junta
+ * a dos donos (relay_list_groups()).
+ */
+bool relay_clustered(void);
+
+/**
+ * @brief Busca em cada nó no ar os grupos de que ele é dono.
+ *
+ * @param entries Recebe os grupos (nome, criador e membros).
+ * @param max Quantos cabem.
+ * @return Quantos foram copiados.
+ */
+size_t relay_list_groups(ListEntry *entries, size_t max);
+
+/**
+ * @brief Entrega uma mensagem direta a um usuário logado em outro nó.
+ *
+ * @return false se ele não está em nenhum nó.
+ */
+bool relay_direct(const char *recipient, const char *sender,
+                  const char *text);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef WHISP_SESSION_H
+#define WHISP_SESSION_H
+
+#include "common.h"
+
+/* Estado com que a thread de uma conexão começa. Conexões recebidas de outro
+ * processo (handoff.h) trazem os bytes já lidos que ainda não formavam um
+ * frame, que passam a pertencer à thread, e chegam com a fila de saída já
+ * restaurada (outbound_adopt()). */
+typedef struct {
+  int sockfd;
+  char *inbound;
+  size_t inbound_len;
+  bool outbound_open; /* a fila de saída já está registrada */
+} ClientArgs;
+
+/**
+ * @brief Cria a thread (destacada) que atende a conexão.
+ *
+ * @param args Alocado com malloc(); a thread o libera.
+ * @return false se a thread não pôde ser criada; o chamador continua dono de
+ * args e do socket.
+ */
+bool spawn_session(ClientArgs *args);
+
+/* Para uma troca de processo, as threads das conexões param entre dois
+ * comandos ("estacionam") e esperam até thaw_sessions(). Estacionadas, elas
+ * não leem nem escrevem no socket e não seguram nenhum lock. */
+
+/**
+ * @brief Pede que todas as conexões estacionem e espera até que estejam.
+ *
+ * @param timeout_ms Quanto esperar pelas threads ocupadas.
+ * @return false se alguma thread não estacionou a tempo; chame
+ * thaw_sessions() de qualquer forma.
+ */
+bool freeze_sessions(int timeout_ms);
+
+void thaw_sessions(void);
+
+typedef bool (*ParkedVisitor)(int sockfd, const char *inbound,
+                              size_t inbound_len, void *arg);
+
+/**
+ * @brief Percorre as conexões estacionadas, com os bytes recebidos que ainda
+ * não formam um frame. Só pode ser chamada entre freeze_sessions() e
+ * thaw_sessions().
+ *
+ * @return false se visit() retornou false (a iteração para ali).
+ */
+bool for_each_parked_session(ParkedVisitor visit, void *arg);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef WHISP_SHARD_H
+#define WHISP_SHARD_H
+
+#include "chat.h"
+#include "common.h"
+
+#define SHARD_MAX           64
+#define SHARD_IDLE_WAIT_MS  100 /* cochilo máximo de um dono sem trabalho */
+#define FANOUT_DEFAULT_THRESHOLD 64 /* assinantes a partir dos quais o fanout
+                                       é dividido entre os shards */
+
+/* Cada grupo pertence, pelo hash do nome, a uma thread dona (shard). O chat
+ * publicado, as confirmações (CMD_ACK), as entradas e as saídas de um grupo
+ * não são aplicados pela thread da conexão: vão para a fila do dono, uma
+ * fila MPSC sem lock, e o dono atribui a sequência, guarda o histórico,
+ * publica no anel e mexe nos membros e cursores. Cada tarefa leva o Group
+ * fixado (pin_group()), então o dono não passa pelo mutex do GroupManager,
+ * e o mutex do grupo só o separa de quem lê o grupo (listagens, CMD_RESUME,
+ * avisos de presença), não de outros escritores. A vazão cresce com o
+ * número de grupos e de shards. A ordem é preservada por remetente e por
+ * grupo. Entradas, saídas e a remoção do grupo respondem com o resultado: a
+ * thread da conexão espera o dono aplicá-las. */
+
+/**
+ * @brief Cria as threads donas.
+ *
+ * @param count Quantas (até SHARD_MAX); 0 mantém tudo na thread da conexão.
+ * @return false se nenhuma thread pôde ser criada.
+ */
+bool shard_start(int count);
+
+/**
+ * @brief Aplica o que ainda está nas filas e encerra as threads donas.
+ */
+void shard_stop(void);
+
+/**
+ * @brief Espera as filas esvaziarem. Com as conexões estacionadas
+ * (session.h), nada mais entra nelas.
+ */
+void shard_drain(void);
+
+/**
+ * @brief Entrega um chat ao dono do grupo, que o publica com
+ * publish_to_group(). A tarefa fixa o grupo até ser aplicada; quem chama
+ * já o fixou (pin_group()), para que o slot não mude de grupo antes disso.
+ *
+ * @return false se não há shards ou falta memória; publique na hora.
+ */
+bool shard_publish(Group *group, const Message *msg);
+
+/**
+ * @brief Entrega uma confirmação cumulativa ao dono do grupo (ack_group()),
+ * com o grupo fixado como em shard_publish().
+ *
+ * @return false se não há shards ou falta memória; aplique na hora.
+ */
+bool shard_ack(Group *group, const char *username, uint64_t seq);
+
+/**
+ * @brief Faz o dono aplicar join_group() e espera o resultado.
+ *
+ * @param joined Saída com o retorno de join_group().
+ * @return false se não há shards; entre na hora.
+ */
+bool shard_join(Group *group, User *user, bool *joined);
+
+/**
+ * @brief Faz o dono aplicar leave_group() ou, com 'keep_cursor',
+ * disconnect_from_group(), e espera o resultado.
+ *
+ * @param left Saída com o retorno da função aplicada.
+ * @return false se não há shards; saia na hora.
+ */
+bool shard_leave(Group *group, User *user, bool keep_cursor, bool *left);
+
+/**
+ * @brief Faz o dono avisar os membros com 'notification' e aplicar
+ * delete_group() em nome de 'creator', e espera o resultado. Os chats que já
+ * estavam na fila do dono são publicados antes.
+ *
+ * @param deleted Saída com o retorno de delete_group().
+ * @return false se não há shards; apague na hora.
+ */
+bool shard_delete(Group *group, const char *creator,
+                  const Message *notification, bool *deleted);
+
+/* Fanout paralelo: o chat de um grupo é escrito uma vez no anel, mas cada
+ * assinante ocioso precisa ser acordado (outbound_wake(), uma escrita no
+ * eventfd da conexão). Num grupo grande, o dono não acorda todos sozinho: os
+ * sockets são divididos em partições, uma por shard, e cada shard acorda a
+ * sua em paralelo; o dono fica com a própria. A ordem não importa, porque o
+ * chat sai do anel. */
+
+/**
+ * @brief Define a partir de quantos assinantes o fanout é dividido (0 =
+ * nunca).
+ */
+void set_fanout_threshold(int subscribers);
+
+/**
+ * @brief Divide entre os shards o acordar das conexões em 'fds'.
+ *
+ * @return false se são menos que o limite, há menos de dois shards ou falta
+ * memória; acorde-as na hora.
+ */
+bool shard_wake(const int *fds, int count);
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef WHISP_CLIENT_LIB_H
+#define WHISP_CLIENT_LIB_H
+
+#include "common.h"
+
+#define WHISP_DEFAULT_MAX_QUEUE (1024 * 1024)
+
+/* Uma sessão com o servidor. Todos os envios são não-bloqueantes: a mensagem
+ * é colocada na fila de saída da sessão e escrita quando o socket permitir.
+ * Uma única thread pode conduzir centenas de sessões com whisp_run_once() ou
+ * integrando whisp_fd()/whisp_poll_events()/whisp_process() ao seu próprio
+ * loop de eventos. */
+typedef struct WhispConn WhispConn;
+
+typedef void (*WhispMessageCallback)(WhispConn *conn, const Message *msg,
+                                     void *user_data);
+typedef void (*WhispStateCallback)(WhispConn *conn, int error,
+                                   void *user_data);
+
+/* Callbacks por tipo de mensagem. Qualquer um pode ser NULL. */
+typedef struct {
+  WhispStateCallback on_connect;    /* error = 0 */
+  WhispStateCallback on_disconnect; /* error = errno, ou 0 se o servidor
+                                       fechou a conexão */
+  WhispMessageCallback on_success;
+  WhispMessageCallback on_error;
+  WhispMessageCallback on_notification;
+  WhispMessageCallback on_chat;
+  WhispMessageCallback on_direct;
+  WhispMessageCallback on_list;     /* CMD_LIST_PAGE */
+  WhispMessageCallback on_presence; /* CMD_PRESENCE */
+} WhispCallbacks;
+
+/**
+ * @brief Inicia uma conexão não-bloqueante com o servidor. O callback
+ * on_connect é chamado quando a conexão é estabelecida; envios feitos antes
+ * disso ficam na fila.
+ *
+ * @param address O endereço IPv4 do servidor.
+ * @param port A porta do servidor.
+ * @param callbacks Os callbacks da sessão (copiados).
+ * @param user_data Ponteiro repassado a todos os callbacks.
+ * @return A sessão, ou NULL em caso de erro (errno indica a causa).
+ */
+WhispConn *whisp_connect(const char *address, int port,
+                         const WhispCallbacks *callbacks, void *user_data);
+
+/**
+ * @brief Tenta escrever o que estiver na fila e fecha a sessão, liberando a
+ * memória. Não chama on_disconnect.
+ *
+ * @param conn A sessão.
+ */
+void whisp_close(WhispConn *conn);
+
+int whisp_fd(const WhispConn *conn);
+
+void *whisp_user_data(const WhispConn *conn);
+
+bool whisp_is_connected(const WhispConn *conn);
+
+/**
+ * @brief Retorna os eventos de poll() que a sessão precisa: POLLIN sempre, e
+ * POLLOUT enquanto conecta ou enquanto houver dados na fila de saída.
+ */
+short whisp_poll_events(const WhispConn *conn);
+
+/**
+ * @brief Processa os eventos retornados pelo poll() para a sessão: completa a
+ * conexão, escreve a fila de saída e lê as mensagens disponíveis, chamando os
+ * callbacks. Também envia as confirmações de chat vencidas, então deve ser
+ * chamada com revents 0 quando o poll() expira (ver whisp_timeout_ms()).
+ *
+ * @param conn A sessão.
+ * @param revents Os eventos retornados pelo poll().
+ * @return 0 se a sessão continua ativa, -1 se ela foi encerrada (após
+ * on_disconnect). A sessão ainda deve ser liberada com whisp_close().
+ */
+int whisp_process(WhispConn *conn, short revents);
+
+/**
+ * @brief Retorna em quantos milissegundos whisp_process() precisa ser
+ * chamada para confirmar o chat já recebido, ou -1 se não há nada pendente.
+ * Use como limite do timeout do poll().
+ */
+int whisp_timeout_ms(const WhispConn *conn);
+
+/**
+ * @brief Executa uma iteração de poll() sobre várias sessões e processa os
+ * eventos de cada uma (e as confirmações vencidas, ver whisp_timeout_ms()).
+ * Sessões encerradas são mantidas no array; o chamador decide quando
+ * liberá-las.
+ *
+ * @param conns Array de sessões (entradas NULL são ignoradas).
+ * @param count Tamanho do array.
+ * @param timeout_ms Timeout do poll(), -1 para esperar indefinidamente.
+ * @return A quantidade de sessões com eventos, ou -1 em erro do poll().
+ */
+int whisp_run_once(WhispConn **conns, size_t count, int timeout_ms);
+
+/**
+ * @brief Tenta escrever a fila de saída sem bloquear.
+ *
+ * @return 0 em caso de sucesso (mesmo que parte da fila continue pendente),
+ * -1 se a conexão falhou.
+ */
+int whisp_flush(WhispConn *conn);
+
+size_t whisp_pending_bytes(const WhispConn *conn);
+
+/**
+ * @brief Limita o tamanho da fila de saída. Envios que ultrapassariam o limite
+ * falham com ENOBUFS.
+ */
+void whisp_set_max_queue(WhispConn *conn, size_t max_bytes);
+
+/**
+ * @brief Ativa ids de comando. Cada comando enviado recebe um req_id
+ * sequencial e o servidor responde a todos eles (inclusive chat e logout) com
+ * exatamente uma mensagem carregando o mesmo req_id, o que permite enviar
+ * comandos em pipeline e casar as respostas depois.
+ *
+ * @return O estado anterior, para restaurá-lo depois.
+ */
+bool whisp_set_request_ids(WhispConn *conn, bool enabled);
+
+/**
+ * @brief Retorna o req_id do último comando enfileirado (0 se os ids
+ * estiverem desativados) e, opcionalmente, o seu tipo.
+ */
+uint32_t whisp_last_request(const WhispConn *conn, CommandType *type);
+
+/**
+ * @brief Enfileira uma mensagem arbitrária.
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro (errno = ENOBUFS se a fila
+ * estiver cheia, ENOTCONN se a sessão estiver encerrada).
+ */
+int whisp_send(WhispConn *conn, const Message *msg);
+
+int whisp_register(WhispConn *conn, const char *username, const char *password);
+int whisp_login(WhispConn *conn, const char *username, const char *password);
+int whisp_logout(WhispConn *conn);
+int whisp_create_group(WhispConn *conn, const char *groupname,
+                       const char *password);
+
+/* Canais de anúncios: só o criador e os publicadores que ele designa postam,
+ * e entradas e saídas não são anunciadas. Leitores entram e saem com
+ * whisp_enter_group() e whisp_leave_group(). */
+int whisp_create_channel(WhispConn *conn, const char *groupname,
+                         const char *password);
+
+/**
+ * @brief Designa ou retira um publicador do canal (NULL = grupo atual). Só o
+ * criador do canal pode.
+ */
+int whisp_set_publisher(WhispConn *conn, const char *groupname,
+                        const char *username, bool enabled);
+
+/* Uma sessão pode assinar vários grupos (até MAX_SUBSCRIPTIONS): entrar em um
+ * grupo não sai dos outros, e o último grupo em que se entrou é o grupo atual.
+ * Nas funções abaixo, groupname NULL significa o grupo atual. Chat e avisos de
+ * grupo chegam com msg->groupname preenchido. */
+int whisp_enter_group(WhispConn *conn, const char *groupname,
+                      const char *password);
+int whisp_leave_group(WhispConn *conn, const char *groupname);
+int whisp_delete_group(WhispConn *conn, const char *groupname);
+int whisp_send_chat(WhispConn *conn, const char *message);
+int whisp_send_group_chat(WhispConn *conn, const char *groupname,
+                          const char *message);
+int whisp_send_direct(WhispConn *conn, const char *recipient,
+                      const char *message);
+
+/* Listagens paginadas (formato em common.h, ver CMD_LIST_PAGE). As funções
+ * sem cursor pedem a primeira página; cada página chega ao on_list e, se
+ * page->seq > 0, a próxima é pedida com o cursor de whisp_page_cursor(). */
+int whisp_list_groups(WhispConn *conn);
+int whisp_list_groups_after(WhispConn *conn, const char *cursor);
+int whisp_list_members(WhispConn *conn, const char *groupname);
+int whisp_list_members_after(WhispConn *conn, const char *groupname,
+                             const char *cursor);
+
+/**
+ * @brief Extrai de uma página o cursor para pedir a seguinte: o nome da
+ * última entrada.
+ *
+ * @param page A página recebida (CMD_LIST_PAGE).
+ * @param cursor Saída com o cursor (MAX_USERNAME bytes).
+ * @return true se há mais páginas, false se esta foi a última.
+ */
+bool whisp_page_cursor(const Message *page, char *cursor);
+
+/**
+ * @brief Liga ou desliga os deltas completos de presença do grupo (NULL = grupo
+ * atual). Ligados, as entradas e saídas chegam ao on_presence, uma linha
+ * "+nome" ou "-nome" por usuário, no lugar do aviso com o resumo.
+ */
+int whisp_watch_presence(WhispConn *conn, const char *groupname, bool enabled);
+
+/* Entrega do chat dos grupos. Cada CMD_MESSAGE de grupo traz uma sequência
+ * crescente por grupo. A biblioteca confirma o recebimento ao servidor
+ * (CMD_ACK) periodicamente, só até a primeira lacuna, e, ao detectar uma
+ * lacuna, pede a retransmissão (CMD_RESUME) sozinha; mensagens retransmitidas
+ * chegam ao on_chat com sequência menor que a última recebida. O chat que o
+ * servidor descartou por a conexão estar lenta, anunciado num aviso "You
+ * missed N messages" do grupo, não é pedido de novo. */
+
+/**
+ * @brief Retorna a maior sequência de chat do grupo recebida sem lacunas
+ * nesta sessão (0 se nenhuma). Guarde o valor antes de fechar uma sessão que caiu para
+ * passá-lo a whisp_resume() na próxima.
+ */
+uint64_t whisp_group_seq(const WhispConn *conn, const char *groupname);
+
+/**
+ * @brief Pede as mensagens do grupo com sequência maior que 'after_seq' (o
+ * usuário precisa ter entrado no grupo). Se parte delas já saiu do
+ * histórico do servidor, on_notification recebe um aviso.
+ */
+int whisp_resume(WhispConn *conn, const char *groupname, uint64_t after_seq);
+
+/**
+ * @brief Confirma o recebimento de todo o chat do grupo até 'seq'.
+ */
+int whisp_ack(WhispConn *conn, const char *groupname, uint64_t seq);
+
+#endif
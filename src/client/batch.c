@@ -0,0 +1,303 @@
+#include "../../include/common.h"
+#include "../../include/handlers.h"
+#include "../../include/whisp.h"
+#include <poll.h>
+
+/* Tempo máximo sem nenhuma resposta antes de desistir dos comandos
+ * pendentes. */
+#define BATCH_REPLY_TIMEOUT_MS 5000
+#define BATCH_MAX_FAILURES_SHOWN 20
+
+extern volatile bool running;
+
+extern WhispConn *session;
+
+extern void parse_command(char *input, CommandHandlers *handlers);
+
+typedef struct {
+  uint32_t req_id;
+  CommandType type;
+  int line;
+  uint64_t sent_ns;
+  uint64_t latency_ns;
+  CommandType result; /* CMD_SUCCESS, CMD_ERROR ou CMD_NOTIFICATION */
+  bool answered;
+  char *error; /* texto da resposta de erro */
+} BatchCommand;
+
+typedef struct {
+  BatchCommand *commands;
+  size_t count;
+  size_t capacity;
+  size_t answered;
+  bool script_done;
+  bool disconnected;
+  uint64_t last_reply_ns;
+} Batch;
+
+static Batch batch;
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * @brief Encontra o comando pendente com o req_id informado. Os ids são
+ * crescentes na sessão (a biblioteca pode consumir alguns para uso próprio),
+ * então a busca é binária.
+ */
+static BatchCommand *find_command(uint32_t req_id)
+{
+  size_t low = 0, high = batch.count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (batch.commands[mid].req_id < req_id)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low == batch.count || batch.commands[low].req_id != req_id) return NULL;
+  return &batch.commands[low];
+}
+
+/**
+ * @brief Callback das respostas do servidor: casa a resposta com o comando
+ * pelo req_id e registra a latência. Mensagens sem req_id (chat de outros
+ * usuários, notificações do grupo) são ignoradas.
+ */
+static void on_reply(WhispConn *conn, const Message *msg, void *user_data)
+{
+  (void)conn;
+  (void)user_data;
+
+  BatchCommand *command = find_command(msg->req_id);
+  if (!command || command->answered) return;
+
+  uint64_t now = monotonic_ns();
+  command->answered = true;
+  command->latency_ns = now - command->sent_ns;
+  command->result = msg->type;
+  if (msg->type == CMD_ERROR) command->error = strdup(msg->message);
+
+  batch.answered++;
+  batch.last_reply_ns = now;
+}
+
+static void on_disconnect(WhispConn *conn, int error, void *user_data)
+{
+  (void)conn;
+  (void)user_data;
+  if (error == 0)
+    fprintf(stderr, "Server disconnected.\n");
+  else
+    fprintf(stderr, "Server connection lost: %s\n", strerror(error));
+  batch.disconnected = true;
+}
+
+/**
+ * @brief Handler de /exit dentro de um script: encerra a leitura, mas ainda
+ * espera as respostas dos comandos já enviados.
+ */
+static void end_script(void)
+{
+  batch.script_done = true;
+}
+
+/**
+ * @brief Executa uma linha do script e, se ela gerou um comando, o registra
+ * como pendente.
+ */
+static void run_line(char *line, int line_number, CommandHandlers *handlers)
+{
+  line[strcspn(line, "\r\n")] = '\0';
+  if (line[0] == '\0' || line[0] == '#') return;
+
+  uint32_t before = whisp_last_request(session, NULL);
+  parse_command(line, handlers);
+
+  CommandType type;
+  uint32_t req_id = whisp_last_request(session, &type);
+  if (req_id == before) return;
+
+  if (batch.count == batch.capacity) {
+    size_t capacity = batch.capacity ? batch.capacity * 2 : 1024;
+    BatchCommand *commands =
+        realloc(batch.commands, capacity * sizeof(BatchCommand));
+    if (!commands) error_exit("realloc");
+    batch.commands = commands;
+    batch.capacity = capacity;
+  }
+
+  BatchCommand *command = &batch.commands[batch.count++];
+  memset(command, 0, sizeof(BatchCommand));
+  command->req_id = req_id;
+  command->type = type;
+  command->line = line_number;
+  command->sent_ns = monotonic_ns();
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Imprime o resumo da execução: totais, latência por tipo de comando
+ * (média, p50, p99 e máxima) e as linhas que falharam.
+ */
+static void print_report(uint64_t elapsed_ns)
+{
+  size_t failed = 0;
+  for (size_t i = 0; i < batch.count; i++)
+    if (batch.commands[i].answered && batch.commands[i].result == CMD_ERROR)
+      failed++;
+
+  double seconds = elapsed_ns / 1e9;
+  printf("Batch: %zu commands in %.3f s (%.0f/s), %zu ok, %zu failed, "
+         "%zu unanswered\n",
+         batch.count, seconds, seconds > 0 ? batch.answered / seconds : 0.0,
+         batch.answered - failed, failed, batch.count - batch.answered);
+
+  uint64_t *latencies = malloc((batch.count ? batch.count : 1) *
+                               sizeof(uint64_t));
+  if (!latencies) error_exit("malloc");
+
+  printf("%-16s %8s %8s %10s %10s %10s %10s\n", "command", "count", "failed",
+         "avg ms", "p50 ms", "p99 ms", "max ms");
+  for (int type = CMD_REGISTER; type <= CMD_LIST_MEMBERS; type++) {
+    size_t n = 0, count = 0, type_failed = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < batch.count; i++) {
+      BatchCommand *command = &batch.commands[i];
+      if ((int)command->type != type) continue;
+      count++;
+      if (!command->answered) continue;
+      if (command->result == CMD_ERROR) type_failed++;
+      latencies[n++] = command->latency_ns;
+      total += command->latency_ns;
+    }
+    if (count == 0) continue;
+
+    if (n == 0) {
+      printf("%-16s %8zu %8zu %10s %10s %10s %10s\n", command_name(type), count,
+             type_failed, "-", "-", "-", "-");
+      continue;
+    }
+
+    qsort(latencies, n, sizeof(uint64_t), compare_u64);
+    printf("%-16s %8zu %8zu %10.3f %10.3f %10.3f %10.3f\n", command_name(type),
+           count, type_failed, total / 1e6 / n, latencies[n / 2] / 1e6,
+           latencies[(n * 99) / 100] / 1e6, latencies[n - 1] / 1e6);
+  }
+  free(latencies);
+
+  size_t shown = 0;
+  for (size_t i = 0; i < batch.count; i++) {
+    BatchCommand *command = &batch.commands[i];
+    bool unanswered = !command->answered;
+    if (!unanswered && command->result != CMD_ERROR) continue;
+
+    if (shown++ == BATCH_MAX_FAILURES_SHOWN) {
+      printf("  ...\n");
+      break;
+    }
+    printf("  line %d: %s: %s\n", command->line, command_name(command->type),
+           unanswered ? "no reply" : command->error);
+  }
+}
+
+/**
+ * @brief Executa um script de comandos em pipeline: cada linha é enviada sem
+ * esperar a resposta da anterior e as respostas são casadas pelo req_id. A
+ * leitura do script pausa enquanto a fila de saída da sessão estiver com mais
+ * da metade do limite ocupado.
+ *
+ * @param server_ip O endereço IP do servidor.
+ * @param port A porta do servidor.
+ * @param path O arquivo de script, ou "-" para a entrada padrão.
+ * @param handlers Os handlers de comando do cliente.
+ * @return 0 se todos os comandos tiveram sucesso, 1 caso contrário.
+ */
+int run_batch(const char *server_ip, int port, const char *path,
+              CommandHandlers *handlers)
+{
+  FILE *script = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!script) {
+    perror(path);
+    return 1;
+  }
+
+  static const WhispCallbacks callbacks = {.on_disconnect = on_disconnect,
+                                           .on_success = on_reply,
+                                           .on_error = on_reply,
+                                           .on_notification = on_reply,
+                                           .on_list = on_reply};
+
+  session = whisp_connect(server_ip, port, &callbacks, NULL);
+  if (!session) {
+    fprintf(stderr, "Connection failed: %s\n", strerror(errno));
+    if (script != stdin) fclose(script);
+    return 1;
+  }
+  whisp_set_request_ids(session, true);
+
+  CommandHandlers batch_handlers = *handlers;
+  batch_handlers.exit_cmd = end_script;
+
+  char line[MAX_BUFFER];
+  int line_number = 0;
+  uint64_t start = monotonic_ns();
+  batch.last_reply_ns = start;
+
+  while (running && !batch.disconnected) {
+    while (!batch.script_done &&
+           whisp_pending_bytes(session) < WHISP_DEFAULT_MAX_QUEUE / 2) {
+      if (!fgets(line, sizeof(line), script)) {
+        batch.script_done = true;
+        break;
+      }
+      run_line(line, ++line_number, &batch_handlers);
+    }
+
+    if (batch.script_done) {
+      if (batch.answered == batch.count) break;
+      if (monotonic_ns() - batch.last_reply_ns >
+          BATCH_REPLY_TIMEOUT_MS * 1000000ull)
+        break;
+    }
+
+    struct pollfd pfd = {.fd = whisp_fd(session),
+                         .events = whisp_poll_events(session)};
+    int ready = poll(&pfd, 1, 100);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll error");
+      break;
+    }
+    if (ready > 0) whisp_process(session, pfd.revents);
+  }
+
+  uint64_t elapsed = monotonic_ns() - start;
+
+  if (whisp_is_connected(session)) {
+    whisp_set_request_ids(session, false);
+    whisp_logout(session);
+  }
+  whisp_close(session);
+  session = NULL;
+  if (script != stdin) fclose(script);
+
+  print_report(elapsed);
+
+  bool ok = batch.answered == batch.count;
+  for (size_t i = 0; i < batch.count; i++) {
+    if (batch.commands[i].result == CMD_ERROR) ok = false;
+    free(batch.commands[i].error);
+  }
+  free(batch.commands);
+
+  return ok ? 0 : 1;
+}
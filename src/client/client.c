@@ -1,11 +1,19 @@
 #include "../../include/common.h"
 #include "../../include/handlers.h"
-#include "../../include/network.h"
+#include "../../include/whisp.h"
+#include <getopt.h>
+#include <poll.h>
+
+#define OUTPUT_BUFFER (1 << 16)
 
 volatile bool running = true;
-int client_fd = -1;
-pthread_t receive_thread;
-void *receive_handler(void *arg);
+WhispConn *session = NULL;
+WhispConn *open_session(const char *server_ip, int port);
+void set_reconnect(bool enabled);
+int reconnect_timeout_ms(void);
+void reconnect_tick(void);
+int run_batch(const char *server_ip, int port, const char *path,
+              CommandHandlers *handlers);
 
 // Declaração das funções para enviar comandos ao servidor
 void send_register_command(const char *username, const char *password);
@@ -13,27 +21,30 @@ void send_login_command(const char *username, const char *password);
 void send_logout_command();
 void send_create_group_command(const char *groupname, const char *password);
 void send_enter_group_command(const char *groupname, const char *password);
-void send_leave_group_command();
+void send_leave_group_command(const char *groupname);
+void switch_group(const char *groupname);
 void send_delete_group_command(const char *groupname);
 void send_chat_message(const char *message);
 void send_direct_message(const char *recipient, const char *message);
 void send_list_groups_command();
-void send_list_members_command();
+void send_list_members_command(const char *groupname);
+void send_presence_command(const char *groupname, bool enabled);
+void send_create_channel_command(const char *groupname, const char *password);
+void send_publisher_command(const char *groupname, const char *username,
+                            bool enabled);
 void print_help();
 void parse_command(char *input, CommandHandlers *handlers);
+void set_render_rate_cap(int messages_per_second);
+void render_tick(void);
+int render_timeout_ms(void);
 
 /**
- * @brief Handler de encerramento do cliente. Envia logout, fecha o socket e
- * encerra o loop principal.
+ * @brief Handler de encerramento do cliente. Apenas encerra o loop principal;
+ * o logout e o fechamento da sessão são feitos ao final de main().
  */
 void handle_exit()
 {
-  if (!running) return;
   running = false;
-  send_logout_command();
-  shutdown(client_fd, SHUT_RDWR);
-  close(client_fd);
-  printf("\nDisconnected.\n");
 }
 
 /**
@@ -49,9 +60,74 @@ void sigint_handler(int sig)
   handle_exit();
 }
 
+/* Linha parcial lida do stdin, ainda sem o '\n'. */
+static char input[MAX_BUFFER];
+static size_t input_len = 0;
+
+/**
+ * @brief Lê o que estiver disponível no stdin e executa cada linha completa.
+ * Usa read() em vez de fgets() para que nenhuma linha fique presa no buffer
+ * do stdio sem que o poll() a veja.
+ *
+ * @param handlers Os handlers de comando.
+ * @return 1 se a entrada continua aberta, 0 em fim de arquivo, -1 em erro.
+ */
+static int read_stdin_commands(CommandHandlers *handlers)
+{
+  ssize_t n =
+      read(STDIN_FILENO, input + input_len, sizeof(input) - 1 - input_len);
+  if (n < 0) return (errno == EINTR || errno == EAGAIN) ? 1 : -1;
+  if (n == 0) return 0;
+
+  input_len += n;
+
+  char *line = input;
+  char *newline;
+  while (running && (newline = memchr(line, '\n', input + input_len - line))) {
+    *newline = '\0';
+    if (strlen(line) > 0) parse_command(line, handlers);
+    line = newline + 1;
+    if (running) printf("> ");
+  }
+
+  input_len -= line - input;
+  memmove(input, line, input_len);
+
+  /* Linha maior que o buffer: executa o que foi lido até aqui. */
+  if (input_len == sizeof(input) - 1) {
+    input[input_len] = '\0';
+    parse_command(input, handlers);
+    input_len = 0;
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Imprime as opções de linha de comando do cliente.
+ *
+ * @param prog O nome do executável.
+ */
+static void print_usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <server_ip> [port]\n"
+          "  -r, --rate-cap <n>    Show at most n chat messages per second "
+          "and summarize the rest\n"
+          "  -n, --no-reconnect    Exit when the connection drops instead of "
+          "reconnecting\n"
+          "  -b, --batch <file>    Pipeline every command in file ('-' for "
+          "stdin) and\n"
+          "                        report per-command latency\n",
+          prog);
+}
+
 /**
- * @brief Estabelece conexão com o servidor, configura sinais, inicia a thread
- * de recepção de mensagens e processa comandos da entrada padrão (stdin).
+ * @brief Estabelece conexão com o servidor, configura sinais e executa o loop
+ * de eventos que espera, com um único poll(), por comandos da entrada padrão
+ * (stdin) e por mensagens do servidor. O stdout usa um buffer completo que é
+ * descarregado uma vez por iteração do loop, para que uma rajada de mensagens
+ * vire uma única escrita no terminal.
  *
  * @param argc Número de argumentos da linha de comando.
  * @param argv Array de strings dos argumentos da linha de comando.
@@ -59,68 +135,116 @@ void sigint_handler(int sig)
  */
 int main(int argc, char *argv[])
 {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <server_ip> [port]\n", argv[0]);
+  static const struct option long_options[] = {
+      {"rate-cap", required_argument, NULL, 'r'},
+      {"batch", required_argument, NULL, 'b'},
+      {"no-reconnect", no_argument, NULL, 'n'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  const char *batch_path = NULL;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "r:b:nh", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'r':
+      set_render_rate_cap(atoi(optarg));
+      break;
+    case 'b':
+      batch_path = optarg;
+      break;
+    case 'n':
+      set_reconnect(false);
+      break;
+    default:
+      print_usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (argc - optind < 1) {
+    print_usage(argv[0]);
     return 1;
   }
 
-  const char *server_ip = argv[1];
+  const char *server_ip = argv[optind];
   int port = DEFAULT_PORT;
-  if (argc > 2) port = atoi(argv[2]);
+  if (argc - optind > 1) port = atoi(argv[optind + 1]);
 
   signal(SIGPIPE, SIG_IGN);
 
   signal(SIGINT, sigint_handler);
 
-  printf("Connecting to %s:%d...\n", server_ip, port);
-
-  client_fd = connect_to_server(server_ip, port);
-  printf("Connected! Enter '/help' for available commands.\n");
-
   CommandHandlers handlers = {.register_cmd = send_register_command,
                               .login_cmd = send_login_command,
                               .create_group_cmd = send_create_group_command,
                               .enter_group_cmd = send_enter_group_command,
                               .leave_group_cmd = send_leave_group_command,
+                              .switch_group_cmd = switch_group,
                               .delete_group_cmd = send_delete_group_command,
                               .exit_cmd = handle_exit,
                               .chat_message_cmd = send_chat_message,
                               .direct_message_cmd = send_direct_message,
                               .list_groups_cmd = send_list_groups_command,
-                              .list_members_cmd = send_list_members_command};
+                              .list_members_cmd = send_list_members_command,
+                              .presence_cmd = send_presence_command,
+                              .create_channel_cmd = send_create_channel_command,
+                              .publisher_cmd = send_publisher_command};
 
-  pthread_create(&receive_thread, NULL, receive_handler, &client_fd);
+  if (batch_path) return run_batch(server_ip, port, batch_path, &handlers);
 
-  char input[MAX_BUFFER];
-  printf("> ");
-  fflush(stdout);
+  printf("Connecting to %s:%d...\n", server_ip, port);
 
-  while (running) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(STDIN_FILENO, &read_fds);
+  session = open_session(server_ip, port);
+  if (!session) {
+    fprintf(stderr, "Connection failed: %s\n", strerror(errno));
+    return 1;
+  }
 
-    struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+  setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
 
-    int activity = select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &timeout);
-    if (activity < 0 && errno != EINTR) {
-      perror("select error");
+  struct pollfd fds[2] = {{.fd = STDIN_FILENO, .events = POLLIN},
+                          {.fd = whisp_fd(session)}};
+
+  while (running) {
+    /* A sessão é trocada a cada reconexão; enquanto ela está encerrada,
+     * whisp_fd() é -1 e o poll() ignora a entrada. Comandos digitados antes
+     * da conexão ficam na fila da sessão. */
+    fds[1].fd = whisp_fd(session);
+    fds[1].events = whisp_poll_events(session);
+
+    int timeout = render_timeout_ms();
+    int reconnect = reconnect_timeout_ms();
+    if (reconnect >= 0 && (timeout < 0 || reconnect < timeout))
+      timeout = reconnect;
+    int ack = whisp_timeout_ms(session);
+    if (ack >= 0 && (timeout < 0 || ack < timeout)) timeout = ack;
+
+    int ready = poll(fds, 2, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) continue;
+      perror("poll error");
       break;
     }
 
-    if (!running) break;
+    /* Sem eventos, whisp_process() ainda envia as confirmações vencidas. */
+    whisp_process(session, fds[1].revents);
 
-    if (FD_ISSET(STDIN_FILENO, &read_fds)) {
-      if (fgets(input, MAX_BUFFER, stdin) == NULL) break;
-      input[strcspn(input, "\n")] = '\0';
-      if (strlen(input) > 0) {
-        parse_command(input, &handlers);
-      }
-      printf("> ");
-      fflush(stdout);
+    if (running && fds[0].revents) {
+      if (read_stdin_commands(&handlers) <= 0) break;
     }
+
+    reconnect_tick();
+    render_tick();
+    fflush(stdout);
+  }
+
+  if (whisp_is_connected(session)) {
+    send_logout_command();
+    printf("\nDisconnected.\n");
   }
+  whisp_close(session);
 
-  pthread_join(receive_thread, NULL);
+  fflush(stdout);
   return 0;
 }
@@ -1,69 +1,435 @@
 #include "../../include/common.h"
-#include "../../include/network.h"
+#include "../../include/whisp.h"
+
+/* Backoff da reconexão: a espera máxima dobra a cada tentativa, de
+ * RECONNECT_BASE_MS até RECONNECT_MAX_MS, e a espera real é sorteada entre 0
+ * e esse máximo ("full jitter"), para que milhares de clientes derrubados
+ * pelo mesmo restart do servidor não reconectem no mesmo instante. */
+#define RECONNECT_BASE_MS 500
+#define RECONNECT_MAX_MS  30000
+#define MAX_PENDING       16
 
 extern volatile bool running;
 
-extern int client_fd;
+extern WhispConn *session;
+
+extern void render_server_message(const Message *msg);
+extern void render_list_page(const Message *msg, bool first);
+
+/* Grupo assinado que o servidor confirmou. */
+typedef struct {
+  char name[MAX_GROUPNAME];
+  char password[MAX_PASSWORD];
+  uint64_t seq;  /* última sequência de chat recebida no grupo */
+  bool presence; /* deltas de presença ligados (/presence on) */
+} Subscription;
+
+/* Estado restaurado após uma reconexão: credenciais do último login e os
+ * grupos assinados. 'current' é o grupo que recebe o texto digitado. */
+typedef struct {
+  char username[MAX_USERNAME];
+  char password[MAX_PASSWORD];
+  Subscription groups[MAX_SUBSCRIPTIONS];
+  int group_count;
+  char current[MAX_GROUPNAME];
+  bool logged_in;
+} SessionState;
+
+/* Comando que altera o estado da sessão e ainda espera resposta. Ele é
+ * enviado com req_id para que a resposta seja casada com o comando. */
+typedef struct {
+  uint32_t req_id; /* 0 = slot livre */
+  CommandType type;
+  char name[MAX_USERNAME]; /* usuário (login) ou grupo (enter, delete) */
+  char password[MAX_PASSWORD];
+  bool enabled; /* estado pedido (presence) */
+  bool restore; /* enviado automaticamente após reconectar */
+} PendingChange;
+
+static SessionState state;
+static PendingChange pending[MAX_PENDING];
+
+/* Listagens em andamento (grupos, membros): as páginas seguintes são pedidas
+ * automaticamente assim que cada página chega. */
+static bool listing_groups = false;
+static bool listing_members = false;
+
+static char server_address[64];
+static int server_port;
+static bool reconnect_enabled = true;
+static int reconnect_attempt = 0;
+static uint64_t reconnect_at_ms = 0; /* 0 = nenhuma reconexão agendada */
+static unsigned int jitter_seed;
+
+static uint64_t monotonic_ms(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Registra um comando enviado com req_id como pendente.
+ *
+ * @param status O retorno da função da libwhisp que enviou o comando.
+ * @param name O usuário ou grupo do comando (pode ser NULL).
+ * @param password A senha do comando (pode ser NULL).
+ * @param restore Se o comando faz parte da restauração após reconectar.
+ * @return O comando pendente, ou NULL se ele não foi enviado.
+ */
+static PendingChange *track_change(int status, const char *name,
+                                   const char *password, bool restore)
+{
+  if (status < 0) {
+    printf("[ERROR] Command not sent: %s\n", strerror(errno));
+    return NULL;
+  }
 
-extern void handle_exit();
+  CommandType type;
+  uint32_t req_id = whisp_last_request(session, &type);
+
+  PendingChange *change = &pending[req_id % MAX_PENDING];
+  memset(change, 0, sizeof(PendingChange));
+  change->req_id = req_id;
+  change->type = type;
+  change->restore = restore;
+  if (name) strncpy(change->name, name, sizeof(change->name) - 1);
+  if (password) strncpy(change->password, password, MAX_PASSWORD - 1);
+  return change;
+}
 
 /**
- * @brief Thread responsável por receber mensagens do servidor e exibi-las na
- * tela. Filtra mensagens por tipo (sucesso, erro, notificação, chat) e imprime
- * com cores. Detecta o fechamento da conexão pelo servidor e aciona a
- * desconexão do cliente.
+ * @brief Retira da lista de pendentes o comando respondido por 'msg'.
  *
- * @param arg Um ponteiro para o descritor de arquivo do socket do cliente.
+ * @return Uma cópia do comando pendente, ou req_id = 0 se a mensagem não
+ * responde a nenhum comando rastreado.
  */
-void *receive_handler(void *arg)
+static PendingChange take_change(const Message *msg)
 {
-  int sockfd = *(int *)arg;
+  PendingChange change = {.req_id = 0};
+  if (msg->req_id == 0) return change;
 
-  while (running) {
-    Message msg;
-    memset(&msg, 0, sizeof(Message));
-    int received = receive_message(sockfd, &msg);
+  PendingChange *slot = &pending[msg->req_id % MAX_PENDING];
+  if (slot->req_id != msg->req_id) return change;
 
-    if (received < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        usleep(10000);
-        continue;
-      }
+  change = *slot;
+  slot->req_id = 0;
+  return change;
+}
 
-      printf("\n[ERROR] Server connection lost.\n");
+static Subscription *find_subscription(const char *groupname)
+{
+  for (int i = 0; i < state.group_count; i++) {
+    if (strncmp(state.groups[i].name, groupname, MAX_GROUPNAME) == 0)
+      return &state.groups[i];
+  }
+  return NULL;
+}
 
-      handle_exit();
-      break;
-    } else if (received == 0) {
-      printf("\n[NOTIFICATION] Server disconnected.\n");
-      handle_exit();
-      break;
+/**
+ * @brief Retira um grupo das assinaturas. Se era o grupo atual, o último
+ * grupo assinado passa a ser o atual, como no servidor.
+ */
+static void remove_subscription(const char *groupname)
+{
+  Subscription *subscription = find_subscription(groupname);
+  if (subscription) {
+    *subscription = state.groups[--state.group_count];
+  }
+
+  if (strncmp(state.current, groupname, MAX_GROUPNAME) == 0) {
+    if (state.group_count > 0)
+      memcpy(state.current, state.groups[state.group_count - 1].name,
+             MAX_GROUPNAME);
+    else
+      state.current[0] = '\0';
+  }
+}
+
+/**
+ * @brief Aplica ao estado da sessão a confirmação de um comando.
+ */
+static void apply_success(const PendingChange *change)
+{
+  Subscription *subscription;
+
+  switch (change->type) {
+  case CMD_LOGIN:
+    strncpy(state.username, change->name, MAX_USERNAME - 1);
+    memcpy(state.password, change->password, MAX_PASSWORD);
+    state.logged_in = true;
+    if (!change->restore) {
+      state.group_count = 0;
+      state.current[0] = '\0';
+    }
+    break;
+  case CMD_ENTER:
+    subscription = find_subscription(change->name);
+    if (!subscription) {
+      if (state.group_count == MAX_SUBSCRIPTIONS) break;
+      subscription = &state.groups[state.group_count++];
+      memset(subscription, 0, sizeof(Subscription));
+      strncpy(subscription->name, change->name, MAX_GROUPNAME - 1);
     }
+    memcpy(subscription->password, change->password, MAX_PASSWORD);
+    if (!change->restore)
+      memcpy(state.current, subscription->name, MAX_GROUPNAME);
+    break;
+  case CMD_LEAVE:
+  case CMD_DELETE:
+    remove_subscription(change->name);
+    break;
+  case CMD_PRESENCE:
+    subscription = find_subscription(change->name);
+    if (subscription) subscription->presence = change->enabled;
+    break;
+  default:
+    break;
+  }
+}
 
-    switch (msg.type) {
-    case CMD_SUCCESS:
-      printf("\033[32m[SUCCESS] %s\033[0m\n", msg.message);
-      break;
-    case CMD_ERROR:
-      printf("\033[31m[ERROR] %s\033[0m\n", msg.message);
-      break;
-    case CMD_NOTIFICATION:
-      printf("\033[33m[NOTIFICATION] %s\033[0m\n", msg.message);
-      break;
-    case CMD_MESSAGE:
-    case CMD_DIRECT_MESSAGE:
-      if (msg.type == CMD_MESSAGE) {
-        printf("\033[34m[%s] %s\033[0m\n", msg.username, msg.message);
-      } else {
-        printf("\033[35m[DM de %s] %s\033[0m\n", msg.username, msg.message);
+/**
+ * @brief Exibe uma página de listagem e pede a próxima, se houver.
+ */
+static void on_list_page(const Message *msg)
+{
+  bool members = msg->groupname[0] != '\0';
+  bool *listing = members ? &listing_members : &listing_groups;
+
+  render_list_page(msg, !*listing);
+
+  char cursor[MAX_USERNAME];
+  *listing = whisp_page_cursor(msg, cursor);
+  if (!*listing) return;
+
+  int status = members
+                   ? whisp_list_members_after(session, msg->groupname, cursor)
+                   : whisp_list_groups_after(session, cursor);
+  if (status < 0) *listing = false;
+}
+
+/**
+ * @brief Callback da libwhisp para todas as mensagens recebidas: atualiza o
+ * estado da sessão se a mensagem responde a um comando rastreado e a repassa
+ * para a renderização do terminal.
+ */
+static void on_server_message(WhispConn *conn, const Message *msg,
+                              void *user_data)
+{
+  (void)conn;
+  (void)user_data;
+
+  PendingChange change = take_change(msg);
+  if (change.req_id != 0) {
+    if (msg->type == CMD_SUCCESS) {
+      apply_success(&change);
+    } else if (msg->type == CMD_ERROR && change.restore) {
+      /* O estado não pôde ser restaurado (ex.: o grupo foi apagado). */
+      if (change.type == CMD_LOGIN) {
+        state.logged_in = false;
+        state.group_count = 0;
+        state.current[0] = '\0';
+      } else if (change.type == CMD_ENTER) {
+        remove_subscription(change.name);
       }
-      break;
-    default:
-      break;
     }
   }
 
-  return NULL;
+  if (msg->type == CMD_LIST_PAGE) {
+    on_list_page(msg);
+    return;
+  }
+
+  /* O servidor também envia ao remetente o seu chat, para que a sequência
+   * do grupo chegue completa; não é preciso exibi-lo de novo. */
+  if (msg->type == CMD_MESSAGE && state.logged_in &&
+      strcmp(msg->username, state.username) == 0)
+    return;
+
+  render_server_message(msg);
+}
+
+/**
+ * @brief Reenvia login, entrada nos grupos e os deltas de presença ligados
+ * após uma reconexão e pede as mensagens de cada grupo enviadas enquanto o
+ * cliente estava desconectado.
+ */
+static void restore_session(void)
+{
+  if (!state.logged_in) return;
+
+  printf("[NOTIFICATION] Restoring session as %s...\n", state.username);
+
+  bool request_ids = whisp_set_request_ids(session, true);
+  track_change(whisp_login(session, state.username, state.password),
+               state.username, state.password, true);
+  for (int i = 0; i < state.group_count; i++) {
+    Subscription *subscription = &state.groups[i];
+    track_change(whisp_enter_group(session, subscription->name,
+                                   subscription->password),
+                 subscription->name, subscription->password, true);
+    if (subscription->presence) {
+      PendingChange *change = track_change(
+          whisp_watch_presence(session, subscription->name, true),
+          subscription->name, NULL, true);
+      if (change) change->enabled = true;
+    }
+  }
+  whisp_set_request_ids(session, request_ids);
+
+  for (int i = 0; i < state.group_count; i++) {
+    if (state.groups[i].seq > 0)
+      whisp_resume(session, state.groups[i].name, state.groups[i].seq);
+  }
+}
+
+static void on_connect(WhispConn *conn, int error, void *user_data)
+{
+  (void)conn;
+  (void)error;
+  (void)user_data;
+
+  if (reconnect_attempt == 0) {
+    printf("Connected! Enter '/help' for available commands.\n> ");
+    return;
+  }
+
+  printf("\n[NOTIFICATION] Reconnected to %s:%d.\n", server_address,
+         server_port);
+  reconnect_attempt = 0;
+  restore_session();
+  printf("> ");
+}
+
+/**
+ * @brief Agenda a próxima tentativa de reconexão com backoff exponencial e
+ * jitter.
+ */
+static void schedule_reconnect(void)
+{
+  int shift = reconnect_attempt < 6 ? reconnect_attempt : 6;
+  int ceiling = RECONNECT_BASE_MS << shift;
+  if (ceiling > RECONNECT_MAX_MS) ceiling = RECONNECT_MAX_MS;
+
+  int delay = rand_r(&jitter_seed) % (ceiling + 1);
+  reconnect_attempt++;
+  reconnect_at_ms = monotonic_ms() + delay;
+
+  printf("[NOTIFICATION] Reconnecting in %.1f s (attempt %d)...\n",
+         delay / 1000.0, reconnect_attempt);
+}
+
+/**
+ * @brief Callback da libwhisp para o fim da conexão: informa o motivo e
+ * agenda a reconexão, ou encerra o loop principal se ela estiver desativada.
+ */
+static void on_disconnect(WhispConn *conn, int error, void *user_data)
+{
+  (void)user_data;
+
+  memset(pending, 0, sizeof(pending));
+  listing_groups = false;
+  listing_members = false;
+  for (int i = 0; i < state.group_count; i++) {
+    uint64_t seq = whisp_group_seq(conn, state.groups[i].name);
+    if (seq > state.groups[i].seq) state.groups[i].seq = seq;
+  }
+
+  /* Se foi uma tentativa de reconexão que falhou, a queda já foi exibida. */
+  if (reconnect_attempt == 0) {
+    if (error == 0)
+      printf("\n[NOTIFICATION] Server disconnected.\n");
+    else
+      printf("\n[ERROR] Server connection lost: %s\n", strerror(error));
+  }
+
+  if (!reconnect_enabled) {
+    running = false;
+    return;
+  }
+  schedule_reconnect();
+}
+
+static const WhispCallbacks session_callbacks = {
+    .on_connect = on_connect,
+    .on_disconnect = on_disconnect,
+    .on_success = on_server_message,
+    .on_error = on_server_message,
+    .on_notification = on_server_message,
+    .on_chat = on_server_message,
+    .on_direct = on_server_message,
+    .on_list = on_server_message,
+    .on_presence = on_server_message};
+
+/**
+ * @brief Abre a sessão com o servidor usando os callbacks do cliente. O
+ * endereço é guardado para as reconexões.
+ *
+ * @param server_ip O endereço IP do servidor.
+ * @param port A porta do servidor.
+ * @return A sessão, ou NULL em caso de erro.
+ */
+WhispConn *open_session(const char *server_ip, int port)
+{
+  strncpy(server_address, server_ip, sizeof(server_address) - 1);
+  server_port = port;
+  jitter_seed = (unsigned int)(time(NULL) ^ getpid());
+
+  return whisp_connect(server_ip, port, &session_callbacks, NULL);
+}
+
+/**
+ * @brief Ativa ou desativa a reconexão automática.
+ */
+void set_reconnect(bool enabled)
+{
+  reconnect_enabled = enabled;
+}
+
+/**
+ * @brief Retorna quanto o loop de eventos pode esperar, em milissegundos,
+ * antes da próxima tentativa de reconexão.
+ *
+ * @return O timeout para o poll(), ou -1 se nenhuma reconexão está agendada.
+ */
+int reconnect_timeout_ms(void)
+{
+  if (reconnect_at_ms == 0) return -1;
+
+  uint64_t now = monotonic_ms();
+  return now >= reconnect_at_ms ? 0 : (int)(reconnect_at_ms - now);
+}
+
+/**
+ * @brief Faz a tentativa de reconexão agendada, se já for a hora. A sessão
+ * antiga, já encerrada, só é liberada quando a nova é criada; assim o loop
+ * de eventos nunca vê uma sessão NULL.
+ */
+void reconnect_tick(void)
+{
+  if (reconnect_at_ms == 0 || monotonic_ms() < reconnect_at_ms) return;
+  reconnect_at_ms = 0;
+
+  WhispConn *next = whisp_connect(server_address, server_port,
+                                  &session_callbacks, NULL);
+  if (!next) {
+    printf("[ERROR] Reconnect failed: %s\n", strerror(errno));
+    schedule_reconnect();
+    return;
+  }
+
+  whisp_close(session);
+  session = next;
+}
+
+/**
+ * @brief Informa ao usuário quando um comando não pôde ser enfileirado.
+ *
+ * @param status O retorno da função da libwhisp.
+ */
+static void check_queued(int status)
+{
+  if (status < 0) printf("[ERROR] Command not sent: %s\n", strerror(errno));
 }
 
 /**
@@ -74,16 +440,7 @@ void *receive_handler(void *arg)
  */
 void send_register_command(const char *username, const char *password)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-
-  msg.type = CMD_REGISTER;
-  strncpy(msg.username, username, MAX_USERNAME - 1);
-  msg.username[MAX_USERNAME - 1] = '\0';
-  strncpy(msg.password, password, MAX_PASSWORD - 1);
-  msg.password[MAX_PASSWORD - 1] = '\0';
-
-  send_message(client_fd, &msg);
+  check_queued(whisp_register(session, username, password));
 }
 
 /**
@@ -94,16 +451,10 @@ void send_register_command(const char *username, const char *password)
  */
 void send_login_command(const char *username, const char *password)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-
-  msg.type = CMD_LOGIN;
-  strncpy(msg.username, username, MAX_USERNAME - 1);
-  msg.username[MAX_USERNAME - 1] = '\0';
-  strncpy(msg.password, password, MAX_PASSWORD - 1);
-  msg.password[MAX_PASSWORD - 1] = '\0';
-
-  send_message(client_fd, &msg);
+  bool request_ids = whisp_set_request_ids(session, true);
+  track_change(whisp_login(session, username, password), username, password,
+               false);
+  whisp_set_request_ids(session, request_ids);
 }
 
 /**
@@ -111,11 +462,10 @@ void send_login_command(const char *username, const char *password)
  */
 void send_logout_command()
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-  msg.type = CMD_LOGOUT;
-
-  send_message(client_fd, &msg);
+  state.logged_in = false;
+  state.group_count = 0;
+  state.current[0] = '\0';
+  check_queued(whisp_logout(session));
 }
 
 /**
@@ -126,48 +476,97 @@ void send_logout_command()
  */
 void send_create_group_command(const char *groupname, const char *password)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
+  check_queued(whisp_create_group(session, groupname, password));
+}
 
-  msg.type = CMD_CREATE;
-  strncpy(msg.groupname, groupname, MAX_GROUPNAME - 1);
-  msg.groupname[MAX_GROUPNAME - 1] = '\0';
-  strncpy(msg.password, password, MAX_PASSWORD - 1);
-  msg.password[MAX_PASSWORD - 1] = '\0';
+/**
+ * @brief Envia um comando para criar um canal de anúncios ao servidor.
+ *
+ * @param groupname O nome do canal a ser criado.
+ * @param password A senha do canal.
+ */
+void send_create_channel_command(const char *groupname, const char *password)
+{
+  check_queued(whisp_create_channel(session, groupname, password));
+}
 
-  send_message(client_fd, &msg);
+/**
+ * @brief Designa ou retira um publicador de um canal.
+ *
+ * @param groupname O canal, ou NULL para o grupo atual.
+ * @param username O usuário.
+ * @param enabled true para designar, false para retirar.
+ */
+void send_publisher_command(const char *groupname, const char *username,
+                            bool enabled)
+{
+  if (!groupname && state.current[0] != '\0') groupname = state.current;
+  check_queued(whisp_set_publisher(session, groupname, username, enabled));
 }
 
 /**
- * @brief Envia um comando para entrar em um grupo ao servidor.
+ * @brief Envia um comando para entrar em um grupo ao servidor. O cliente
+ * continua nos grupos em que já estava.
  *
  * @param groupname O nome do grupo a ser entrado.
  * @param password A senha do grupo.
  */
 void send_enter_group_command(const char *groupname, const char *password)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
+  bool request_ids = whisp_set_request_ids(session, true);
+  track_change(whisp_enter_group(session, groupname, password), groupname,
+               password, false);
+  whisp_set_request_ids(session, request_ids);
+}
 
-  msg.type = CMD_ENTER;
-  strncpy(msg.groupname, groupname, MAX_GROUPNAME - 1);
-  msg.groupname[MAX_GROUPNAME - 1] = '\0';
-  strncpy(msg.password, password, MAX_PASSWORD - 1);
-  msg.password[MAX_PASSWORD - 1] = '\0';
+/**
+ * @brief Envia um comando para sair de um grupo ao servidor.
+ *
+ * @param groupname O grupo, ou NULL para o grupo atual.
+ */
+void send_leave_group_command(const char *groupname)
+{
+  if (!groupname && state.current[0] != '\0') groupname = state.current;
 
-  send_message(client_fd, &msg);
+  bool request_ids = whisp_set_request_ids(session, true);
+  track_change(whisp_leave_group(session, groupname), groupname, NULL, false);
+  whisp_set_request_ids(session, request_ids);
 }
 
 /**
- * @brief Envia um comando para sair do grupo atual ao servidor.
+ * @brief Troca o grupo que recebe o texto digitado. Não envia nada ao
+ * servidor: cada mensagem de chat leva o nome do grupo.
+ *
+ * @param groupname O grupo (precisa ter sido assinado com /enter).
  */
-void send_leave_group_command()
+void switch_group(const char *groupname)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-  msg.type = CMD_LEAVE;
+  if (state.logged_in && !find_subscription(groupname)) {
+    printf("[ERROR] Not in group '%s'. Use /enter first.\n", groupname);
+    return;
+  }
+
+  strncpy(state.current, groupname, MAX_GROUPNAME - 1);
+  state.current[MAX_GROUPNAME - 1] = '\0';
+  printf("[NOTIFICATION] Now chatting in '%s'\n", state.current);
+}
 
-  send_message(client_fd, &msg);
+/**
+ * @brief Liga ou desliga os deltas completos de presença de um grupo.
+ *
+ * @param groupname O grupo, ou NULL para o grupo atual.
+ * @param enabled O estado desejado.
+ */
+void send_presence_command(const char *groupname, bool enabled)
+{
+  if (!groupname && state.current[0] != '\0') groupname = state.current;
+
+  bool request_ids = whisp_set_request_ids(session, true);
+  PendingChange *change =
+      track_change(whisp_watch_presence(session, groupname, enabled),
+                   groupname, NULL, false);
+  if (change) change->enabled = enabled;
+  whisp_set_request_ids(session, request_ids);
 }
 
 /**
@@ -177,14 +576,9 @@ void send_leave_group_command()
  */
 void send_delete_group_command(const char *groupname)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-
-  msg.type = CMD_DELETE;
-  strncpy(msg.groupname, groupname, MAX_GROUPNAME - 1);
-  msg.groupname[MAX_GROUPNAME - 1] = '\0';
-
-  send_message(client_fd, &msg);
+  bool request_ids = whisp_set_request_ids(session, true);
+  track_change(whisp_delete_group(session, groupname), groupname, NULL, false);
+  whisp_set_request_ids(session, request_ids);
 }
 
 /**
@@ -194,14 +588,10 @@ void send_delete_group_command(const char *groupname)
  */
 void send_chat_message(const char *message)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-
-  msg.type = CMD_MESSAGE;
-  strncpy(msg.message, message, MAX_BUFFER - 1);
-  msg.message[MAX_BUFFER - 1] = '\0';
-
-  send_message(client_fd, &msg);
+  if (state.current[0] != '\0')
+    check_queued(whisp_send_group_chat(session, state.current, message));
+  else
+    check_queued(whisp_send_chat(session, message));
 }
 
 /**
@@ -212,16 +602,7 @@ void send_chat_message(const char *message)
  */
 void send_direct_message(const char *recipient, const char *message)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-
-  msg.type = CMD_DIRECT_MESSAGE;
-  strncpy(msg.username, recipient, MAX_USERNAME - 1);
-  msg.username[MAX_USERNAME - 1] = '\0';
-  strncpy(msg.message, message, MAX_BUFFER - 1);
-  msg.message[MAX_BUFFER - 1] = '\0';
-
-  send_message(client_fd, &msg);
+  check_queued(whisp_send_direct(session, recipient, message));
 }
 
 /**
@@ -229,22 +610,19 @@ void send_direct_message(const char *recipient, const char *message)
  */
 void send_list_groups_command()
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-  msg.type = CMD_LIST_GROUPS;
-
-  send_message(client_fd, &msg);
+  listing_groups = false;
+  check_queued(whisp_list_groups(session));
 }
 
 /**
- * @brief Envia um comando para listar os membros do grupo atual em que o
+ * @brief Envia um comando para listar os membros de um grupo em que o
  * usuário está.
+ *
+ * @param groupname O grupo, ou NULL para o grupo atual.
  */
-void send_list_members_command()
+void send_list_members_command(const char *groupname)
 {
-  Message msg;
-  memset(&msg, 0, sizeof(Message));
-  msg.type = CMD_LIST_MEMBERS;
-
-  send_message(client_fd, &msg);
+  if (!groupname && state.current[0] != '\0') groupname = state.current;
+  listing_members = false;
+  check_queued(whisp_list_members(session, groupname));
 }
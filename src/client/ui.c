@@ -2,6 +2,162 @@
 #include "../../include/handlers.h"
 #include "ctype.h"
 
+/* Limite de mensagens de chat exibidas por segundo (0 = sem limite) e o
+ * estado da janela atual. As mensagens excedentes são resumidas em uma linha
+ * "N more messages" quando a janela termina. */
+static int rate_cap = 0;
+static time_t window_start = 0;
+static int window_shown = 0;
+static int window_suppressed = 0;
+
+/**
+ * @brief Define o limite de mensagens de chat exibidas por segundo.
+ *
+ * @param messages_per_second O limite, ou 0 para exibir todas.
+ */
+void set_render_rate_cap(int messages_per_second)
+{
+  rate_cap = messages_per_second > 0 ? messages_per_second : 0;
+}
+
+/**
+ * @brief Fecha a janela de limite de taxa se ela já terminou, imprimindo o
+ * resumo das mensagens omitidas.
+ */
+void render_tick(void)
+{
+  time_t now = time(NULL);
+  if (now == window_start) return;
+
+  if (window_suppressed > 0) {
+    printf("\033[90m[... %d more messages]\033[0m\n", window_suppressed);
+  }
+  window_start = now;
+  window_shown = 0;
+  window_suppressed = 0;
+}
+
+/**
+ * @brief Retorna quanto o loop de eventos pode esperar, em milissegundos,
+ * antes de precisar chamar render_tick() para imprimir um resumo pendente.
+ *
+ * @return O timeout para o poll(), ou -1 se não houver resumo pendente.
+ */
+int render_timeout_ms(void)
+{
+  if (window_suppressed == 0) return -1;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (now.tv_sec != window_start) return 0;
+  return (int)((1000000000L - now.tv_nsec) / 1000000L) + 1;
+}
+
+/**
+ * @brief Renderiza uma mensagem recebida do servidor no buffer do stdout, com
+ * cores de acordo com o tipo (sucesso, erro, notificação, chat). O loop de
+ * eventos descarrega o buffer uma vez por iteração. Mensagens de chat acima
+ * do limite de taxa são contadas em vez de impressas.
+ *
+ * @param msg A mensagem recebida.
+ */
+void render_server_message(const Message *msg)
+{
+  switch (msg->type) {
+  case CMD_SUCCESS:
+    printf("\033[32m[SUCCESS] %s\033[0m\n", msg->message);
+    break;
+  case CMD_ERROR:
+    printf("\033[31m[ERROR] %s\033[0m\n", msg->message);
+    break;
+  case CMD_NOTIFICATION:
+    if (msg->groupname[0] != '\0')
+      printf("\033[33m[NOTIFICATION@%s] %s\033[0m\n", msg->groupname,
+             msg->message);
+    else
+      printf("\033[33m[NOTIFICATION] %s\033[0m\n", msg->message);
+    break;
+  case CMD_MESSAGE:
+    if (rate_cap > 0) {
+      render_tick();
+      if (window_shown >= rate_cap) {
+        window_suppressed++;
+        break;
+      }
+      window_shown++;
+    }
+    if (msg->groupname[0] != '\0')
+      printf("\033[34m[%s@%s] %s\033[0m\n", msg->username, msg->groupname,
+             msg->message);
+    else
+      printf("\033[34m[%s] %s\033[0m\n", msg->username, msg->message);
+    break;
+  case CMD_DIRECT_MESSAGE:
+    printf("\033[35m[DM de %s] %s\033[0m\n", msg->username, msg->message);
+    break;
+  case CMD_PRESENCE:
+    /* Uma linha "+nome" ou "-nome" por usuário; exibidas lado a lado. */
+    printf("\033[33m[PRESENCE@%s] ", msg->groupname);
+    for (const char *p = msg->message; *p; p++) {
+      putchar(*p == '\n' ? ' ' : *p);
+    }
+    printf("\033[0m\n");
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief Renderiza uma página de listagem (CMD_LIST_PAGE). A primeira página
+ * traz o cabeçalho com o total; as seguintes apenas continuam a lista.
+ *
+ * @param msg A página recebida.
+ * @param first Se é a primeira página da listagem.
+ */
+void render_list_page(const Message *msg, bool first)
+{
+  bool members = msg->groupname[0] != '\0';
+
+  int entries = 0;
+  for (const char *p = msg->message; *p; p++) {
+    if (*p == '\n') entries++;
+  }
+
+  if (first) {
+    unsigned long long total = entries + msg->seq;
+    if (members)
+      printf("\033[33m[NOTIFICATION] Members in '%s' (%llu/%d):\033[0m\n",
+             msg->groupname, total, MAX_CLIENTS);
+    else if (total == 0)
+      printf("\033[33m[NOTIFICATION] No groups available.\033[0m\n");
+    else
+      printf("\033[33m[NOTIFICATION] Available groups (%llu):\033[0m\n",
+             total);
+  }
+
+  char page[MAX_BUFFER];
+  memcpy(page, msg->message, MAX_BUFFER);
+  char *save = NULL;
+  for (char *line = strtok_r(page, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+    char *fields[3] = {line, "", ""};
+    for (int i = 1; i < 3; i++) {
+      char *sep = strchr(fields[i - 1], LIST_FIELD_SEP);
+      if (!sep) break;
+      *sep = '\0';
+      fields[i] = sep + 1;
+    }
+
+    if (members)
+      printf("\033[33m- %s %s\033[0m\n", fields[0],
+             strcmp(fields[1], "creator") == 0 ? "(Creator)" : "");
+    else
+      printf("\033[33m- %s (Creator: %s, Members: %s/%d)\033[0m\n",
+             fields[0], fields[1], fields[2], MAX_CLIENTS);
+  }
+}
+
 /**
  * @brief Imprime uma mensagem de ajuda com todos os comandos disponíveis para
  * o usuário.
@@ -13,19 +169,30 @@ void print_help()
   printf("  /register <username> <password> - Create a new account\n");
   printf("  /login <username> <password> - Log in to your account\n");
   printf("  /create <groupname> <password> - Create a new chat group\n");
-  printf("  /enter <groupname> <password> - Join a chat group\n");
-  printf("  /leave - Leave current chat group\n");
+  printf("  /channel <groupname> <password> - Create an announcement channel "
+         "(only publishers post)\n");
+  printf("  /enter <groupname> <password> - Join a chat group (you stay in "
+         "the others)\n");
+  printf("  /switch <groupname> - Send your messages to another joined "
+         "group\n");
+  printf("  /leave [groupname] - Leave a chat group (default: current)\n");
   printf("  /delete <groupname> - Delete a chat group (must be owner)\n");
   printf("  /dm <recipient_username> <message> - Send a direct message to a "
          "user\n");
   printf("  /listgroups - List all available chat groups\n");
 
-  printf("  /who - List members in your current chat group\n");
+  printf("  /who [groupname] - List members in a chat group (default: "
+         "current)\n");
+  printf("  /presence on|off [groupname] - Show every join and leave "
+         "instead of a summary\n");
+  printf("  /publisher add|remove <username> [groupname] - Choose who posts "
+         "in your channel\n");
 
   printf("  /help - Show this help\n");
   printf("  /exit - Quit the application\n");
   printf("\n");
-  printf("When in a group, any other text will be sent as a message.\n");
+  printf("When in a group, any other text will be sent as a message to the "
+         "current group.\n");
   printf("\n");
 }
 
@@ -111,6 +278,22 @@ void parse_command(char *input, CommandHandlers *handlers)
       printf("Usage: /create <groupname> <password>\n");
     }
   }
+  // /channel <groupname> <password>
+  else if (strncmp(input, "/channel ", 9) == 0) {
+    char groupname[MAX_GROUPNAME], password[MAX_PASSWORD];
+    if (sscanf(input + 9, "%31s %63s", groupname, password) == 2) {
+      if (strlen(groupname) >= 3 && strlen(password) >= 4 &&
+          is_alphanumeric(groupname) && is_alphanumeric(password)) {
+        handlers->create_channel_cmd(groupname, password);
+      } else {
+        printf("Error: Groupname must be 3-%d alphanumeric characters, "
+               "password 4-%d alphanumeric characters.\n",
+               MAX_GROUPNAME - 1, MAX_PASSWORD - 1);
+      }
+    } else {
+      printf("Usage: /channel <groupname> <password>\n");
+    }
+  }
   // /enter <groupname> <password> ou /join <groupname> <password>
   else if (strncmp(input, "/enter ", 7) == 0 ||
            strncmp(input, "/join ", 6) == 0) {
@@ -130,9 +313,29 @@ void parse_command(char *input, CommandHandlers *handlers)
       printf("Usage: /enter <groupname> <password>\n");
     }
   }
-  // /leave
+  // /leave [groupname]
   else if (strcmp(input, "/leave") == 0) {
-    handlers->leave_group_cmd();
+    handlers->leave_group_cmd(NULL);
+  } else if (strncmp(input, "/leave ", 7) == 0) {
+    char groupname[MAX_GROUPNAME];
+
+    if (sscanf(input + 7, "%31s", groupname) == 1 &&
+        is_alphanumeric(groupname)) {
+      handlers->leave_group_cmd(groupname);
+    } else {
+      printf("Usage: /leave [groupname]\n");
+    }
+  }
+  // /switch <groupname>
+  else if (strncmp(input, "/switch ", 8) == 0) {
+    char groupname[MAX_GROUPNAME];
+
+    if (sscanf(input + 8, "%31s", groupname) == 1 &&
+        is_alphanumeric(groupname)) {
+      handlers->switch_group_cmd(groupname);
+    } else {
+      printf("Usage: /switch <groupname>\n");
+    }
   }
   // /delete <groupname>
   else if (strncmp(input, "/delete ", 8) == 0) {
@@ -182,9 +385,50 @@ void parse_command(char *input, CommandHandlers *handlers)
   else if (strcmp(input, "/listgroups") == 0) {
     handlers->list_groups_cmd();
   }
-  // /who
+  // /who [groupname]
   else if (strcmp(input, "/who") == 0) {
-    handlers->list_members_cmd();
+    handlers->list_members_cmd(NULL);
+  } else if (strncmp(input, "/who ", 5) == 0) {
+    char groupname[MAX_GROUPNAME];
+
+    if (sscanf(input + 5, "%31s", groupname) == 1 &&
+        is_alphanumeric(groupname)) {
+      handlers->list_members_cmd(groupname);
+    } else {
+      printf("Usage: /who [groupname]\n");
+    }
+  }
+  // /presence on|off [groupname]
+  else if (strncmp(input, "/presence ", 10) == 0) {
+    char state[4];
+    char groupname[MAX_GROUPNAME];
+    int fields = sscanf(input + 10, "%3s %31s", state, groupname);
+    bool enabled = fields >= 1 && strcmp(state, "on") == 0;
+
+    if (fields >= 1 && (enabled || strcmp(state, "off") == 0) &&
+        (fields == 1 || is_alphanumeric(groupname))) {
+      handlers->presence_cmd(fields == 2 ? groupname : NULL, enabled);
+    } else {
+      printf("Usage: /presence on|off [groupname]\n");
+    }
+  }
+  // /publisher add|remove <username> [groupname]
+  else if (strncmp(input, "/publisher ", 11) == 0) {
+    char action[8];
+    char username[MAX_USERNAME];
+    char groupname[MAX_GROUPNAME];
+    int fields =
+        sscanf(input + 11, "%7s %31s %31s", action, username, groupname);
+    bool enabled = fields >= 1 && strcmp(action, "add") == 0;
+
+    if (fields >= 2 && (enabled || strcmp(action, "remove") == 0) &&
+        is_alphanumeric(username) &&
+        (fields == 2 || is_alphanumeric(groupname))) {
+      handlers->publisher_cmd(fields == 3 ? groupname : NULL, username,
+                              enabled);
+    } else {
+      printf("Usage: /publisher add|remove <username> [groupname]\n");
+    }
   }
   // /help
   else if (strcmp(input, "/help") == 0) {
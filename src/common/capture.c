@@ -0,0 +1,297 @@
+#include "../../include/capture.h"
+#include <stdatomic.h>
+
+#define CAPTURE_FILE_BUFFER (1 << 20)
+#define CAPTURE_MAX_RECORD  (MAX_USERNAME + MAX_PASSWORD + MAX_GROUPNAME + \
+                             MAX_BUFFER + 64)
+
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *capture_file = NULL;
+static atomic_bool capture_active = false;
+static atomic_uint next_capture_conn = 1;
+static uint64_t capture_start_us = 0;
+static uint64_t capture_last_us = 0;
+
+/**
+ * @brief Retorna o tempo monotônico atual em microssegundos.
+ */
+static uint64_t monotonic_us(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Codifica um inteiro sem sinal como varint (7 bits por byte).
+ *
+ * @param out O buffer de saída.
+ * @param value O valor a ser codificado.
+ * @return A quantidade de bytes escritos.
+ */
+static size_t put_varint(uint8_t *out, uint64_t value)
+{
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+/**
+ * @brief Lê um varint do arquivo.
+ *
+ * @return true em caso de sucesso, false em fim de arquivo ou valor inválido.
+ */
+static bool get_varint(FILE *file, uint64_t *value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+    if (c == EOF) return false;
+    *value |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Codifica um campo de texto de tamanho máximo 'max' como varint de
+ * tamanho seguido dos bytes.
+ */
+static size_t put_string(uint8_t *out, const char *s, size_t max)
+{
+  size_t len = strnlen(s, max - 1);
+  size_t n = put_varint(out, len);
+  memcpy(out + n, s, len);
+  return n + len;
+}
+
+static bool get_string(FILE *file, char *s, size_t max)
+{
+  uint64_t len;
+  if (!get_varint(file, &len) || len >= max) return false;
+  if (fread(s, 1, len, file) != len) return false;
+  s[len] = '\0';
+  return true;
+}
+
+/**
+ * @brief Escreve um registro já codificado, prefixado pelo tipo, id da
+ * conexão e delta de tempo. O delta é calculado sob o mutex para que os
+ * registros fiquem em ordem temporal no arquivo.
+ */
+static void write_record(CaptureKind kind, uint32_t conn, const uint8_t *body,
+                         size_t body_len)
+{
+  uint8_t prefix[1 + 10 + 10];
+
+  pthread_mutex_lock(&capture_mutex);
+  if (!capture_file) {
+    pthread_mutex_unlock(&capture_mutex);
+    return;
+  }
+
+  uint64_t now = monotonic_us() - capture_start_us;
+  if (now < capture_last_us) now = capture_last_us;
+
+  size_t n = 0;
+  prefix[n++] = (uint8_t)kind;
+  n += put_varint(prefix + n, conn);
+  n += put_varint(prefix + n, now - capture_last_us);
+  capture_last_us = now;
+
+  fwrite(prefix, 1, n, capture_file);
+  if (body_len > 0) fwrite(body, 1, body_len, capture_file);
+
+  pthread_mutex_unlock(&capture_mutex);
+}
+
+/**
+ * @brief Inicia a captura do tráfego de entrada. O arquivo é criado com
+ * permissão 0600, pois contém as credenciais enviadas pelos clientes.
+ *
+ * @param path Caminho do arquivo de captura.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool capture_start(const char *path)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    perror("Failed to open capture file");
+    return false;
+  }
+
+  FILE *file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    return false;
+  }
+  setvbuf(file, NULL, _IOFBF, CAPTURE_FILE_BUFFER);
+
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  uint32_t header[2] = {CAPTURE_MAGIC, CAPTURE_VERSION};
+  uint64_t start_wall_us =
+      (uint64_t)wall.tv_sec * 1000000ull + wall.tv_nsec / 1000;
+  fwrite(header, sizeof(header), 1, file);
+  fwrite(&start_wall_us, sizeof(start_wall_us), 1, file);
+
+  pthread_mutex_lock(&capture_mutex);
+  capture_start_us = monotonic_us();
+  capture_last_us = 0;
+  capture_file = file;
+  atomic_store(&capture_active, true);
+  pthread_mutex_unlock(&capture_mutex);
+  return true;
+}
+
+/**
+ * @brief Encerra a captura e fecha o arquivo.
+ */
+void capture_stop(void)
+{
+  pthread_mutex_lock(&capture_mutex);
+  atomic_store(&capture_active, false);
+  if (capture_file) {
+    fclose(capture_file);
+    capture_file = NULL;
+  }
+  pthread_mutex_unlock(&capture_mutex);
+}
+
+/**
+ * @brief Indica se a captura está ativa.
+ */
+bool capture_enabled(void)
+{
+  return atomic_load_explicit(&capture_active, memory_order_relaxed);
+}
+
+/**
+ * @brief Registra a abertura de uma conexão e retorna seu id na captura.
+ *
+ * @return O id da conexão, ou 0 se a captura estiver desativada.
+ */
+uint32_t capture_open_connection(void)
+{
+  if (!capture_enabled()) return 0;
+
+  uint32_t conn = atomic_fetch_add(&next_capture_conn, 1);
+  write_record(CAPTURE_OPEN, conn, NULL, 0);
+  return conn;
+}
+
+/**
+ * @brief Registra um frame recebido, codificando apenas o conteúdo útil de
+ * cada campo.
+ *
+ * @param conn O id retornado por capture_open_connection().
+ * @param msg A mensagem recebida.
+ */
+void capture_frame(uint32_t conn, const Message *msg)
+{
+  if (conn == 0 || !capture_enabled()) return;
+
+  uint8_t body[CAPTURE_MAX_RECORD];
+  size_t n = put_varint(body, (uint64_t)msg->type);
+  n += put_varint(body + n, msg->req_id);
+  n += put_varint(body + n, msg->seq);
+  n += put_string(body + n, msg->username, MAX_USERNAME);
+  n += put_string(body + n, msg->password, MAX_PASSWORD);
+  n += put_string(body + n, msg->groupname, MAX_GROUPNAME);
+  n += put_string(body + n, msg->message, MAX_BUFFER);
+
+  write_record(CAPTURE_FRAME, conn, body, n);
+}
+
+/**
+ * @brief Registra o fechamento de uma conexão.
+ *
+ * @param conn O id retornado por capture_open_connection().
+ */
+void capture_close_connection(uint32_t conn)
+{
+  if (conn == 0 || !capture_enabled()) return;
+
+  write_record(CAPTURE_CLOSE, conn, NULL, 0);
+}
+
+/**
+ * @brief Abre um arquivo de captura para leitura e valida o cabeçalho.
+ *
+ * @param reader O leitor a ser inicializado.
+ * @param path Caminho do arquivo de captura.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool capture_reader_open(CaptureReader *reader, const char *path)
+{
+  memset(reader, 0, sizeof(CaptureReader));
+
+  reader->file = fopen(path, "rb");
+  if (!reader->file) return false;
+  setvbuf(reader->file, NULL, _IOFBF, CAPTURE_FILE_BUFFER);
+
+  uint32_t header[2];
+  if (fread(header, sizeof(header), 1, reader->file) != 1 ||
+      fread(&reader->start_wall_us, sizeof(uint64_t), 1, reader->file) != 1 ||
+      header[0] != CAPTURE_MAGIC || header[1] != CAPTURE_VERSION) {
+    fclose(reader->file);
+    reader->file = NULL;
+    errno = EINVAL;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Lê o próximo registro da captura.
+ *
+ * @param reader O leitor.
+ * @param record Saída com o registro lido.
+ * @return 1 se um registro foi lido, 0 no fim do arquivo, -1 se o arquivo
+ * estiver corrompido ou truncado.
+ */
+int capture_read(CaptureReader *reader, CaptureRecord *record)
+{
+  int kind = fgetc(reader->file);
+  if (kind == EOF) return 0;
+
+  uint64_t conn, delta;
+  if (kind > CAPTURE_CLOSE || !get_varint(reader->file, &conn) ||
+      !get_varint(reader->file, &delta))
+    return -1;
+
+  reader->time_us += delta;
+  record->kind = (CaptureKind)kind;
+  record->conn = (uint32_t)conn;
+  record->time_us = reader->time_us;
+
+  if (record->kind != CAPTURE_FRAME) return 1;
+
+  uint64_t type, req_id;
+  memset(&record->msg, 0, sizeof(Message));
+  if (!get_varint(reader->file, &type) || !get_varint(reader->file, &req_id) ||
+      !get_varint(reader->file, &record->msg.seq) ||
+      !get_string(reader->file, record->msg.username, MAX_USERNAME) ||
+      !get_string(reader->file, record->msg.password, MAX_PASSWORD) ||
+      !get_string(reader->file, record->msg.groupname, MAX_GROUPNAME) ||
+      !get_string(reader->file, record->msg.message, MAX_BUFFER))
+    return -1;
+  record->msg.type = (CommandType)type;
+  record->msg.req_id = (uint32_t)req_id;
+
+  return 1;
+}
+
+/**
+ * @brief Fecha o arquivo de captura aberto para leitura.
+ */
+void capture_reader_close(CaptureReader *reader)
+{
+  if (reader->file) fclose(reader->file);
+  reader->file = NULL;
+}
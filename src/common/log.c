@@ -0,0 +1,424 @@
+#include "../../include/log.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define LOG_DRAIN_INTERVAL_NS 20000000L
+#define LOG_OUT_BUFFER        65536
+
+typedef struct {
+  uint64_t ts_ns;
+  uint8_t level;
+  uint16_t len;
+  char text[LOG_MSG_MAX];
+} LogRecord;
+
+/* Ring SPSC de uma thread produtora: só ela avança head, só a thread de
+ * escrita avança tail. */
+typedef struct LogBuffer {
+  LogRecord slots[LOG_RING_SLOTS];
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_uint dropped;
+  unsigned reported_dropped;
+  atomic_bool closed;
+  bool retired; /* fechado e já drenado; só a thread de escrita usa */
+  unsigned thread;
+  struct LogBuffer *next;
+} LogBuffer;
+
+atomic_int log_threshold = LOG_LEVEL_INFO;
+
+static atomic_bool log_active = false;
+static atomic_uint next_thread_id = 1;
+static _Thread_local LogBuffer *tls_buffer = NULL;
+
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogBuffer *registry = NULL;
+
+static pthread_t drain_thread;
+static atomic_bool drain_running = false;
+
+static int log_fd = -1;
+static bool log_rotates = false;
+static char log_path[512];
+static size_t log_size = 0;
+static size_t log_max_bytes = LOG_DEFAULT_MAX_SIZE;
+static int log_max_files = LOG_DEFAULT_FILES;
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+
+/**
+ * @brief Destrutor da chave TLS: marca o buffer da thread que terminou como
+ * fechado para que a thread de escrita o libere depois de drená-lo.
+ *
+ * @param ptr O LogBuffer da thread.
+ */
+static void release_buffer(void *ptr)
+{
+  LogBuffer *buffer = ptr;
+  atomic_store_explicit(&buffer->closed, true, memory_order_release);
+}
+
+static void make_buffer_key(void)
+{
+  pthread_key_create(&buffer_key, release_buffer);
+}
+
+/**
+ * @brief Retorna o buffer da thread atual, criando e registrando-o no
+ * primeiro uso. O registro é o único ponto com lock e ocorre uma vez por
+ * thread.
+ *
+ * @return O buffer da thread, ou NULL se a alocação falhar.
+ */
+static LogBuffer *thread_buffer(void)
+{
+  if (tls_buffer) return tls_buffer;
+
+  pthread_once(&buffer_key_once, make_buffer_key);
+
+  LogBuffer *buffer = calloc(1, sizeof(LogBuffer));
+  if (!buffer) return NULL;
+
+  buffer->thread = atomic_fetch_add(&next_thread_id, 1);
+
+  pthread_mutex_lock(&registry_mutex);
+  buffer->next = registry;
+  registry = buffer;
+  pthread_mutex_unlock(&registry_mutex);
+
+  pthread_setspecific(buffer_key, buffer);
+  tls_buffer = buffer;
+  return buffer;
+}
+
+/**
+ * @brief Registra uma mensagem no ring da thread atual. Se o ring estiver
+ * cheio a mensagem é descartada e contabilizada, em vez de bloquear.
+ *
+ * @param level Nível da mensagem.
+ * @param fmt String de formato no estilo printf.
+ */
+void log_write(LogLevel level, const char *fmt, ...)
+{
+  va_list args;
+
+  if (!atomic_load_explicit(&log_active, memory_order_acquire)) {
+    va_start(args, fmt);
+    fprintf(stderr, "%s ", level_names[level]);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return;
+  }
+
+  LogBuffer *buffer = thread_buffer();
+  if (!buffer) return;
+
+  unsigned head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+  if (head - tail >= LOG_RING_SLOTS) {
+    atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  LogRecord *record = &buffer->slots[head % LOG_RING_SLOTS];
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  record->ts_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  record->level = (uint8_t)level;
+
+  va_start(args, fmt);
+  int len = vsnprintf(record->text, LOG_MSG_MAX, fmt, args);
+  va_end(args);
+  if (len < 0) len = 0;
+  if (len >= LOG_MSG_MAX) len = LOG_MSG_MAX - 1;
+  record->len = (uint16_t)len;
+
+  atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief Abre (ou reabre) o arquivo de log em modo append.
+ *
+ * @return true em caso de sucesso, false caso contrário.
+ */
+static bool open_log_file(void)
+{
+  log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (log_fd < 0) return false;
+
+  struct stat st;
+  log_size = (fstat(log_fd, &st) == 0) ? (size_t)st.st_size : 0;
+  return true;
+}
+
+/**
+ * @brief Rotaciona os arquivos: whisp.log.(N-1) -> whisp.log.N, ...,
+ * whisp.log -> whisp.log.1, e abre um whisp.log vazio.
+ */
+static void rotate_log_file(void)
+{
+  char from[sizeof(log_path) + 16];
+  char to[sizeof(log_path) + 16];
+
+  close(log_fd);
+
+  for (int i = log_max_files - 1; i >= 1; i--) {
+    snprintf(from, sizeof(from), "%s.%d", log_path, i);
+    snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+    rename(from, to);
+  }
+  snprintf(to, sizeof(to), "%s.1", log_path);
+  rename(log_path, to);
+
+  if (!open_log_file()) log_fd = STDERR_FILENO;
+}
+
+/**
+ * @brief Escreve um bloco já formatado no destino, rotacionando o arquivo
+ * quando o limite de tamanho é atingido.
+ *
+ * @param data Os bytes a serem escritos.
+ * @param len A quantidade de bytes.
+ */
+static void write_out(const char *data, size_t len)
+{
+  if (len == 0) return;
+
+  if (log_rotates && log_size + len > log_max_bytes && log_size > 0)
+    rotate_log_file();
+
+  while (len > 0) {
+    ssize_t n = write(log_fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    data += n;
+    len -= n;
+    log_size += n;
+  }
+}
+
+/**
+ * @brief Formata um registro binário como uma linha de texto. O timestamp é
+ * convertido aqui, fora das threads produtoras.
+ */
+static size_t format_record(char *out, size_t size, unsigned thread,
+                            const LogRecord *record)
+{
+  static time_t cached_sec = -1;
+  static char cached_time[24];
+
+  time_t sec = (time_t)(record->ts_ns / 1000000000ull);
+  if (sec != cached_sec) {
+    struct tm tm_info;
+    localtime_r(&sec, &tm_info);
+    strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &tm_info);
+    cached_sec = sec;
+  }
+
+  int n = snprintf(out, size, "%s.%03u %-5s [t%u] %.*s\n", cached_time,
+                   (unsigned)(record->ts_ns / 1000000 % 1000),
+                   level_names[record->level], thread, record->len,
+                   record->text);
+  if (n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+/**
+ * @brief Drena todos os buffers registrados para o destino e libera os
+ * buffers de threads que já terminaram. O registry_mutex só é travado para
+ * ler o início da lista e para desligar os buffers liberados: a escrita no
+ * destino fica fora dele, e uma thread nova nunca espera pelo disco. Os
+ * buffers novos entram no início da lista e só esta thread tira buffers dela,
+ * então a lista a partir do início lido não muda durante a drenagem.
+ */
+static void drain_buffers(void)
+{
+  static char out[LOG_OUT_BUFFER];
+  size_t used = 0;
+  bool retired = false;
+
+  pthread_mutex_lock(&registry_mutex);
+  LogBuffer *first = registry;
+  pthread_mutex_unlock(&registry_mutex);
+
+  for (LogBuffer *buffer = first; buffer; buffer = buffer->next) {
+    bool closed = atomic_load_explicit(&buffer->closed, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+
+    for (; tail != head; tail++) {
+      if (LOG_OUT_BUFFER - used < LOG_MSG_MAX + 64) {
+        write_out(out, used);
+        used = 0;
+      }
+      used += format_record(out + used, LOG_OUT_BUFFER - used, buffer->thread,
+                            &buffer->slots[tail % LOG_RING_SLOTS]);
+    }
+    atomic_store_explicit(&buffer->tail, tail, memory_order_release);
+
+    unsigned dropped =
+        atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+    if (dropped != buffer->reported_dropped) {
+      if (LOG_OUT_BUFFER - used < 128) {
+        write_out(out, used);
+        used = 0;
+      }
+      used += snprintf(out + used, LOG_OUT_BUFFER - used,
+                       "WARN  [t%u] %u log messages dropped\n", buffer->thread,
+                       dropped - buffer->reported_dropped);
+      buffer->reported_dropped = dropped;
+    }
+
+    if (closed) buffer->retired = retired = true;
+  }
+
+  write_out(out, used);
+  if (!retired) return;
+
+  LogBuffer *released = NULL;
+  pthread_mutex_lock(&registry_mutex);
+  for (LogBuffer **link = &registry; *link;) {
+    LogBuffer *buffer = *link;
+    if (buffer->retired) {
+      *link = buffer->next;
+      buffer->next = released;
+      released = buffer;
+    } else {
+      link = &buffer->next;
+    }
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  while (released) {
+    LogBuffer *next = released->next;
+    free(released);
+    released = next;
+  }
+}
+
+/**
+ * @brief Loop da thread de escrita: drena os buffers periodicamente até o
+ * encerramento, e faz uma última drenagem antes de sair.
+ */
+static void *drain_loop(void *arg)
+{
+  (void)arg;
+  struct timespec interval = {.tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_NS};
+
+  while (atomic_load(&drain_running)) {
+    drain_buffers();
+    nanosleep(&interval, NULL);
+  }
+  drain_buffers();
+  return NULL;
+}
+
+/**
+ * @brief Inicializa o subsistema de log e inicia a thread de escrita.
+ *
+ * @param config Configuração do destino, nível e rotação.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool log_init(const LogConfig *config)
+{
+  log_set_level(config->level);
+  log_max_bytes = config->max_bytes ? config->max_bytes : LOG_DEFAULT_MAX_SIZE;
+  log_max_files = config->max_files > 0 ? config->max_files : LOG_DEFAULT_FILES;
+
+  if (!config->path || strcmp(config->path, "-") == 0) {
+    log_fd = STDERR_FILENO;
+    log_rotates = false;
+  } else {
+    strncpy(log_path, config->path, sizeof(log_path) - 1);
+    log_path[sizeof(log_path) - 1] = '\0';
+    if (!open_log_file()) {
+      perror("Failed to open log file");
+      return false;
+    }
+    log_rotates = true;
+  }
+
+  atomic_store(&drain_running, true);
+  if (pthread_create(&drain_thread, NULL, drain_loop, NULL) != 0) {
+    perror("Failed to create log thread");
+    atomic_store(&drain_running, false);
+    if (log_rotates) close(log_fd);
+    return false;
+  }
+
+  atomic_store_explicit(&log_active, true, memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Encerra a thread de escrita após uma última drenagem. Mensagens
+ * posteriores vão direto para o stderr.
+ */
+void log_shutdown(void)
+{
+  if (!atomic_load(&log_active)) return;
+
+  atomic_store_explicit(&log_active, false, memory_order_release);
+  atomic_store(&drain_running, false);
+  pthread_join(drain_thread, NULL);
+
+  if (log_rotates) close(log_fd);
+  log_fd = -1;
+}
+
+/**
+ * @brief Altera o nível mínimo. Apenas um store atômico, portanto seguro em
+ * handlers de sinal.
+ *
+ * @param level O novo nível mínimo.
+ */
+void log_set_level(LogLevel level)
+{
+  if (level < LOG_LEVEL_DEBUG) level = LOG_LEVEL_DEBUG;
+  if (level > LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+  atomic_store_explicit(&log_threshold, (int)level, memory_order_relaxed);
+}
+
+/**
+ * @brief Retorna o nível mínimo atual.
+ */
+LogLevel log_get_level(void)
+{
+  return (LogLevel)atomic_load_explicit(&log_threshold, memory_order_relaxed);
+}
+
+/**
+ * @brief Converte o nome de um nível para o valor correspondente.
+ *
+ * @param name O nome do nível, em minúsculas.
+ * @param level Saída com o nível encontrado.
+ * @return true se o nome for válido, false caso contrário.
+ */
+bool log_level_from_string(const char *name, LogLevel *level)
+{
+  static const char *lower_names[] = {"debug", "info", "warn", "error", "off"};
+
+  for (int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_OFF; i++) {
+    if (strcmp(name, lower_names[i]) == 0) {
+      *level = (LogLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Retorna o nome em maiúsculas de um nível.
+ */
+const char *log_level_name(LogLevel level)
+{
+  if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_OFF) return "?";
+  return level_names[level];
+}
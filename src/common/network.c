@@ -1,5 +1,9 @@
 #include "../../include/network.h"
 #include "../../include/common.h"
+#include <poll.h>
+
+/* Tempo máximo esperando um socket cheio ficar gravável. */
+#define SEND_TIMEOUT_MS 1000
 
 /**
  * @brief Cria um socket TCP reutilizável para comunicação.
@@ -71,31 +75,31 @@ int setup_server(int port)
 
 /**
  * @brief Envia uma struct Message pelo socket usando envio binário direto.
+ * Em sockets não-bloqueantes, escritas parciais são completadas esperando o
+ * socket ficar gravável, para que o frame nunca seja truncado.
  *
  * @param sockfd O descritor de arquivo do socket para enviar.
  * @param msg Um ponteiro para a estrutura Message a ser enviada.
+ * @return 0 em caso de sucesso, -1 se o envio falhou.
  */
-void send_message(int sockfd, const Message *msg)
+int send_message(int sockfd, const Message *msg)
 {
-  if (send(sockfd, msg, sizeof(Message), 0) < 0) error_exit("send failed");
-}
+  const char *data = (const char *)msg;
+  size_t left = sizeof(Message);
 
-/**
- * @brief Recebe dados do socket e preenche uma struct Message; trata modo
- * não-bloqueio e erros.
- *
- * @param sockfd O descritor de arquivo do socket para receber.
- * @param msg Um ponteiro para a estrutura Message a ser preenchida.
- * @return O número de bytes recebidos, 0 se não há dados (modo
- * não-bloqueante), ou -1 em caso de erro.
- */
-int receive_message(int sockfd, Message *msg)
-{
-  int n = recv(sockfd, msg, sizeof(Message), 0);
-  if (n < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
-    perror("recv failed");
+  while (left > 0) {
+    ssize_t n = send(sockfd, data, left, MSG_NOSIGNAL);
+    if (n > 0) {
+      data += n;
+      left -= n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {.fd = sockfd, .events = POLLOUT};
+      if (poll(&pfd, 1, SEND_TIMEOUT_MS) > 0) continue;
+    }
     return -1;
   }
-  return n;
+  return 0;
 }
@@ -1,4 +1,5 @@
 #include "../../include/common.h"
+#include <strings.h>
 
 /**
  * @brief Imprime uma mensagem de erro no stderr e encerra o programa.
@@ -23,3 +24,59 @@ int set_nonblocking(int sockfd)
   if (flags == -1) return -1;
   return fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
 }
+
+/**
+ * @brief Retorna o nome legível de um tipo de comando, para logs e
+ * ferramentas de diagnóstico.
+ *
+ * @param type O tipo do comando.
+ * @return Uma string estática com o nome do comando.
+ */
+const char *command_name(CommandType type)
+{
+  static const char *names[] = {
+      [CMD_REGISTER] = "REGISTER",
+      [CMD_LOGIN] = "LOGIN",
+      [CMD_LOGOUT] = "LOGOUT",
+      [CMD_CREATE] = "CREATE",
+      [CMD_ENTER] = "ENTER",
+      [CMD_LEAVE] = "LEAVE",
+      [CMD_DELETE] = "DELETE",
+      [CMD_MESSAGE] = "MESSAGE",
+      [CMD_DIRECT_MESSAGE] = "DIRECT_MESSAGE",
+      [CMD_LIST_GROUPS] = "LIST_GROUPS",
+      [CMD_LIST_MEMBERS] = "LIST_MEMBERS",
+      [CMD_SUCCESS] = "SUCCESS",
+      [CMD_ERROR] = "ERROR",
+      [CMD_NOTIFICATION] = "NOTIFICATION",
+      [CMD_ACK] = "ACK",
+      [CMD_RESUME] = "RESUME",
+      [CMD_LIST_PAGE] = "LIST_PAGE",
+      [CMD_PRESENCE] = "PRESENCE",
+      [CMD_PUBLISHER] = "PUBLISHER",
+  };
+
+  if ((int)type < 0 || (size_t)type >= sizeof(names) / sizeof(names[0]) ||
+      !names[type])
+    return "UNKNOWN";
+  return names[type];
+}
+
+/**
+ * @brief Converte o nome de um comando (como em command_name(), sem
+ * diferenciar maiúsculas) no seu tipo.
+ *
+ * @param name O nome do comando.
+ * @param type Saída com o tipo.
+ * @return false se o nome não corresponde a nenhum comando.
+ */
+bool command_from_name(const char *name, CommandType *type)
+{
+  for (int i = 0; i < CMD_TYPE_COUNT; i++) {
+    if (strcasecmp(name, command_name((CommandType)i)) == 0) {
+      *type = (CommandType)i;
+      return true;
+    }
+  }
+  return false;
+}
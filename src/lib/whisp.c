@@ -0,0 +1,844 @@
+#include "../../include/whisp.h"
+#include <poll.h>
+#include <stddef.h>
+
+/* Confirmações (CMD_ACK) do chat de um grupo cobrem só o que chegou sem
+ * lacunas e são enviadas a cada WHISP_ACK_EVERY mensagens ou
+ * WHISP_ACK_INTERVAL_MS após a última confirmação, mesmo sem chat novo
+ * (whisp_process()). */
+#define WHISP_ACK_EVERY       32
+#define WHISP_ACK_INTERVAL_MS 1000
+
+typedef enum { WHISP_CONNECTING, WHISP_CONNECTED, WHISP_CLOSED } WhispState;
+
+/* Progresso da sequência de chat de um grupo nesta sessão. */
+typedef struct {
+  char name[MAX_GROUPNAME];
+  uint64_t last_seq;      /* maior sequência recebida */
+  uint64_t delivered_seq; /* maior sequência recebida sem lacunas */
+  uint64_t acked_seq;     /* última sequência confirmada ao servidor */
+  uint64_t last_ack_ms;
+  uint32_t resume_req_id; /* CMD_RESUME aguardando resposta (0 = nenhum) */
+  uint64_t resume_after;  /* sequência pedida nesse CMD_RESUME */
+} WhispGroupSeq;
+
+struct WhispConn {
+  int fd;
+  WhispState state;
+  WhispCallbacks callbacks;
+  void *user_data;
+
+  /* Fila de saída: bytes em out[out_head .. out_head + out_len). */
+  char *out;
+  size_t out_head;
+  size_t out_len;
+  size_t out_capacity;
+  size_t max_queue;
+
+  /* Ids de comando para pipelining (ver whisp_set_request_ids()). */
+  bool request_ids;
+  uint32_t next_req_id;
+  uint32_t last_req_id;
+  CommandType last_type;
+
+  WhispGroupSeq *groups;
+  size_t group_count;
+
+  /* Bytes recebidos que ainda não formam uma Message completa. */
+  char in[sizeof(Message) * 4];
+  size_t in_len;
+};
+
+/**
+ * @brief Marca a sessão como encerrada, fecha o socket e chama
+ * on_disconnect.
+ *
+ * @param conn A sessão.
+ * @param error O errno da falha, ou 0 se o servidor fechou a conexão.
+ */
+static void fail_connection(WhispConn *conn, int error)
+{
+  if (conn->state == WHISP_CLOSED) return;
+
+  conn->state = WHISP_CLOSED;
+  conn->out_head = 0;
+  conn->out_len = 0;
+  close(conn->fd);
+  conn->fd = -1;
+
+  if (conn->callbacks.on_disconnect)
+    conn->callbacks.on_disconnect(conn, error, conn->user_data);
+}
+
+/**
+ * @brief Inicia uma conexão não-bloqueante com o servidor.
+ *
+ * @param address O endereço IPv4 do servidor.
+ * @param port A porta do servidor.
+ * @param callbacks Os callbacks da sessão (copiados).
+ * @param user_data Ponteiro repassado a todos os callbacks.
+ * @return A sessão, ou NULL em caso de erro (errno indica a causa).
+ */
+WhispConn *whisp_connect(const char *address, int port,
+                         const WhispCallbacks *callbacks, void *user_data)
+{
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &server_addr.sin_addr) <= 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  WhispConn *conn = calloc(1, sizeof(WhispConn));
+  if (!conn) return NULL;
+
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn->fd < 0) {
+    free(conn);
+    return NULL;
+  }
+
+  if (connect(conn->fd, (struct sockaddr *)&server_addr,
+              sizeof(server_addr)) < 0 &&
+      errno != EINPROGRESS) {
+    int saved = errno;
+    close(conn->fd);
+    free(conn);
+    errno = saved;
+    return NULL;
+  }
+
+  conn->state = WHISP_CONNECTING;
+  if (callbacks) conn->callbacks = *callbacks;
+  conn->user_data = user_data;
+  conn->max_queue = WHISP_DEFAULT_MAX_QUEUE;
+  return conn;
+}
+
+/**
+ * @brief Escreve o restante da fila com um timeout curto e fecha a sessão.
+ * Assim um logout enfileirado logo antes do fechamento ainda é entregue.
+ *
+ * @param conn A sessão.
+ */
+void whisp_close(WhispConn *conn)
+{
+  if (!conn) return;
+
+  if (conn->state == WHISP_CONNECTED && conn->out_len > 0) {
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+    setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+    while (conn->out_len > 0) {
+      ssize_t n = send(conn->fd, conn->out + conn->out_head, conn->out_len,
+                       MSG_NOSIGNAL);
+      if (n <= 0) break;
+      conn->out_head += n;
+      conn->out_len -= n;
+    }
+  }
+
+  if (conn->fd >= 0) close(conn->fd);
+  free(conn->out);
+  free(conn->groups);
+  free(conn);
+}
+
+int whisp_fd(const WhispConn *conn)
+{
+  return conn->fd;
+}
+
+void *whisp_user_data(const WhispConn *conn)
+{
+  return conn->user_data;
+}
+
+bool whisp_is_connected(const WhispConn *conn)
+{
+  return conn->state == WHISP_CONNECTED;
+}
+
+size_t whisp_pending_bytes(const WhispConn *conn)
+{
+  return conn->out_len;
+}
+
+void whisp_set_max_queue(WhispConn *conn, size_t max_bytes)
+{
+  conn->max_queue = max_bytes;
+}
+
+bool whisp_set_request_ids(WhispConn *conn, bool enabled)
+{
+  bool previous = conn->request_ids;
+  conn->request_ids = enabled;
+  return previous;
+}
+
+uint32_t whisp_last_request(const WhispConn *conn, CommandType *type)
+{
+  if (type) *type = conn->last_type;
+  return conn->last_req_id;
+}
+
+/**
+ * @brief Retorna os eventos de poll() que a sessão precisa.
+ */
+short whisp_poll_events(const WhispConn *conn)
+{
+  if (conn->state == WHISP_CLOSED) return 0;
+  if (conn->state == WHISP_CONNECTING) return POLLOUT;
+  return conn->out_len > 0 ? (POLLIN | POLLOUT) : POLLIN;
+}
+
+/**
+ * @brief Tenta escrever a fila de saída sem bloquear.
+ *
+ * @return 0 em caso de sucesso, -1 se a conexão falhou.
+ */
+int whisp_flush(WhispConn *conn)
+{
+  if (conn->state == WHISP_CLOSED) return -1;
+  if (conn->state == WHISP_CONNECTING) return 0;
+
+  while (conn->out_len > 0) {
+    ssize_t n = send(conn->fd, conn->out + conn->out_head, conn->out_len,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      fail_connection(conn, errno);
+      return -1;
+    }
+    conn->out_head += n;
+    conn->out_len -= n;
+  }
+
+  if (conn->out_len == 0) conn->out_head = 0;
+  return 0;
+}
+
+static uint32_t next_request_id(WhispConn *conn)
+{
+  if (++conn->next_req_id == 0) conn->next_req_id = 1;
+  return conn->next_req_id;
+}
+
+/**
+ * @brief Copia uma mensagem para o fim da fila de saída, compactando ou
+ * aumentando o buffer se necessário, e tenta escrevê-la imediatamente.
+ * Mensagens internas da biblioteca (ACK, RESUME automático) não recebem
+ * req_id automático nem contam como o último comando do usuário.
+ *
+ * @return 0 em caso de sucesso, -1 em caso de erro.
+ */
+static int enqueue(WhispConn *conn, const Message *msg, bool command)
+{
+  if (conn->state == WHISP_CLOSED) {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  if (conn->out_len + sizeof(Message) > conn->max_queue) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  if (conn->out_head + conn->out_len + sizeof(Message) > conn->out_capacity) {
+    if (conn->out_head > 0) {
+      memmove(conn->out, conn->out + conn->out_head, conn->out_len);
+      conn->out_head = 0;
+    }
+
+    if (conn->out_len + sizeof(Message) > conn->out_capacity) {
+      size_t capacity = conn->out_capacity ? conn->out_capacity * 2
+                                           : sizeof(Message) * 4;
+      while (capacity < conn->out_len + sizeof(Message)) capacity *= 2;
+
+      char *out = realloc(conn->out, capacity);
+      if (!out) return -1;
+      conn->out = out;
+      conn->out_capacity = capacity;
+    }
+  }
+
+  char *frame = conn->out + conn->out_head + conn->out_len;
+  memcpy(frame, msg, sizeof(Message));
+  conn->out_len += sizeof(Message);
+
+  if (command) {
+    uint32_t req_id = msg->req_id;
+    if (req_id == 0 && conn->request_ids) {
+      req_id = next_request_id(conn);
+      memcpy(frame + offsetof(Message, req_id), &req_id, sizeof(req_id));
+    }
+    conn->last_req_id = req_id;
+    conn->last_type = msg->type;
+  }
+
+  return whisp_flush(conn);
+}
+
+int whisp_send(WhispConn *conn, const Message *msg)
+{
+  return enqueue(conn, msg, true);
+}
+
+static uint64_t monotonic_ms(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Retorna o progresso da sequência de um grupo, criando-o se
+ * 'create' for verdadeiro.
+ */
+static WhispGroupSeq *group_seq(WhispConn *conn, const char *groupname,
+                                bool create)
+{
+  for (size_t i = 0; i < conn->group_count; i++) {
+    if (strncmp(conn->groups[i].name, groupname, MAX_GROUPNAME) == 0)
+      return &conn->groups[i];
+  }
+  if (!create) return NULL;
+
+  WhispGroupSeq *groups =
+      realloc(conn->groups, (conn->group_count + 1) * sizeof(WhispGroupSeq));
+  if (!groups) return NULL;
+  conn->groups = groups;
+
+  WhispGroupSeq *group = &conn->groups[conn->group_count++];
+  memset(group, 0, sizeof(WhispGroupSeq));
+  strncpy(group->name, groupname, MAX_GROUPNAME - 1);
+  return group;
+}
+
+static int send_sequence(WhispConn *conn, CommandType type,
+                         const char *groupname, uint64_t seq, uint32_t req_id)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(Message));
+  msg.type = type;
+  msg.req_id = req_id;
+  msg.seq = seq;
+  strncpy(msg.groupname, groupname, MAX_GROUPNAME - 1);
+  return enqueue(conn, &msg, false);
+}
+
+static int send_resume(WhispConn *conn, WhispGroupSeq *group, uint64_t after)
+{
+  group->resume_req_id = next_request_id(conn);
+  group->resume_after = after;
+  group->acked_seq = after;
+  group->last_ack_ms = monotonic_ms();
+  return send_sequence(conn, CMD_RESUME, group->name, after,
+                       group->resume_req_id);
+}
+
+/**
+ * @brief Envia a confirmação cumulativa do grupo se há chat sem lacunas
+ * ainda não confirmado e é hora: WHISP_ACK_EVERY mensagens ou
+ * WHISP_ACK_INTERVAL_MS desde a última.
+ */
+static void maybe_ack(WhispConn *conn, WhispGroupSeq *group, uint64_t now)
+{
+  if (group->delivered_seq <= group->acked_seq) return;
+  if (group->delivered_seq - group->acked_seq >= WHISP_ACK_EVERY ||
+      now - group->last_ack_ms >= WHISP_ACK_INTERVAL_MS)
+    whisp_ack(conn, group->name, group->delivered_seq);
+}
+
+/**
+ * @brief Acompanha a sequência de uma mensagem de chat recebida: pede a
+ * retransmissão (CMD_RESUME) ao detectar uma lacuna e envia a confirmação
+ * cumulativa quando é hora. A confirmação nunca passa de uma lacuna: o que
+ * falta ainda está no histórico do servidor e chega pelo CMD_RESUME.
+ */
+static void track_sequence(WhispConn *conn, const Message *msg)
+{
+  if (msg->seq == 0 || msg->groupname[0] == '\0') return;
+
+  WhispGroupSeq *group = group_seq(conn, msg->groupname, true);
+  if (!group) return;
+
+  /* O primeiro chat depois de entrar no grupo marca o ponto de partida. */
+  if (group->last_seq == 0 && group->delivered_seq == 0)
+    group->delivered_seq = msg->seq - 1;
+
+  if (msg->seq == group->delivered_seq + 1)
+    group->delivered_seq = msg->seq;
+  else if (msg->seq > group->delivered_seq + 1 && group->resume_req_id == 0)
+    send_resume(conn, group, group->delivered_seq);
+
+  if (msg->seq > group->last_seq) group->last_seq = msg->seq;
+  if (group->delivered_seq > group->last_seq)
+    group->last_seq = group->delivered_seq;
+
+  maybe_ack(conn, group, monotonic_ms());
+}
+
+/**
+ * @brief Verifica se a mensagem é a resposta de um CMD_RESUME enviado pela
+ * biblioteca. A resposta traz em seq até onde a retransmissão chegou (o que
+ * saiu do histórico conta como entregue); se ela avançou, pede o resto. O
+ * sucesso é consumido aqui; avisos de mensagens perdidas e erros seguem para
+ * os callbacks.
+ *
+ * @return true se a mensagem foi consumida.
+ */
+static bool finish_resume(WhispConn *conn, const Message *msg)
+{
+  if (msg->req_id == 0) return false;
+
+  for (size_t i = 0; i < conn->group_count; i++) {
+    WhispGroupSeq *group = &conn->groups[i];
+    if (group->resume_req_id != msg->req_id) continue;
+
+    group->resume_req_id = 0;
+    if (msg->type != CMD_ERROR && msg->seq > group->resume_after) {
+      if (msg->seq > group->delivered_seq) group->delivered_seq = msg->seq;
+      if (group->delivered_seq > group->last_seq)
+        group->last_seq = group->delivered_seq;
+      /* A retransmissão para no orçamento da conexão no servidor, então
+       * enquanto ela avança pede a continuação; uma resposta sem avanço
+       * encerra. A de um canal chega pela leitura do anel, depois da
+       * resposta, e não traz seq. */
+      send_resume(conn, group, group->delivered_seq);
+    }
+    return msg->type == CMD_SUCCESS;
+  }
+  return false;
+}
+
+/**
+ * @brief Trata o aviso de coalesce do servidor: o chat do grupo até a
+ * sequência do aviso foi descartado porque a conexão estava lenta. Ele conta
+ * como entregue, para que a lacuna não vire um CMD_RESUME automático que
+ * devolveria a mesma carga à conexão.
+ */
+static void skip_coalesced(WhispConn *conn, const Message *msg)
+{
+  if (msg->req_id != 0 || msg->seq == 0 || msg->groupname[0] == '\0') return;
+
+  WhispGroupSeq *group = group_seq(conn, msg->groupname, true);
+  if (!group || msg->seq <= group->delivered_seq) return;
+
+  group->delivered_seq = msg->seq;
+  if (msg->seq > group->last_seq) group->last_seq = msg->seq;
+}
+
+/**
+ * @brief Envia as confirmações que venceram o WHISP_ACK_INTERVAL_MS sem chat
+ * novo.
+ */
+static void flush_acks(WhispConn *conn)
+{
+  if (conn->state != WHISP_CONNECTED) return;
+
+  uint64_t now = monotonic_ms();
+  for (size_t i = 0; i < conn->group_count; i++)
+    maybe_ack(conn, &conn->groups[i], now);
+}
+
+/**
+ * @brief Chama o callback correspondente ao tipo da mensagem recebida.
+ */
+static void dispatch_message(WhispConn *conn, Message *msg)
+{
+  msg->username[MAX_USERNAME - 1] = '\0';
+  msg->password[MAX_PASSWORD - 1] = '\0';
+  msg->groupname[MAX_GROUPNAME - 1] = '\0';
+  msg->message[MAX_BUFFER - 1] = '\0';
+
+  if (msg->type == CMD_MESSAGE) track_sequence(conn, msg);
+  if (msg->type == CMD_NOTIFICATION) skip_coalesced(conn, msg);
+  if (finish_resume(conn, msg)) return;
+
+  WhispMessageCallback callback = NULL;
+  switch (msg->type) {
+  case CMD_SUCCESS:
+    callback = conn->callbacks.on_success;
+    break;
+  case CMD_ERROR:
+    callback = conn->callbacks.on_error;
+    break;
+  case CMD_NOTIFICATION:
+    callback = conn->callbacks.on_notification;
+    break;
+  case CMD_MESSAGE:
+    callback = conn->callbacks.on_chat;
+    break;
+  case CMD_DIRECT_MESSAGE:
+    callback = conn->callbacks.on_direct;
+    break;
+  case CMD_LIST_PAGE:
+    callback = conn->callbacks.on_list;
+    break;
+  case CMD_PRESENCE:
+    callback = conn->callbacks.on_presence;
+    break;
+  default:
+    break;
+  }
+
+  if (callback) callback(conn, msg, conn->user_data);
+}
+
+/**
+ * @brief Lê tudo o que estiver disponível no socket e despacha cada mensagem
+ * completa.
+ *
+ * @return 0 se a sessão continua ativa, -1 se ela foi encerrada.
+ */
+static int read_messages(WhispConn *conn)
+{
+  while (conn->state == WHISP_CONNECTED) {
+    ssize_t n = recv(conn->fd, conn->in + conn->in_len,
+                     sizeof(conn->in) - conn->in_len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      fail_connection(conn, errno);
+      return -1;
+    }
+    if (n == 0) {
+      fail_connection(conn, 0);
+      return -1;
+    }
+
+    conn->in_len += n;
+
+    size_t offset = 0;
+    while (conn->in_len - offset >= sizeof(Message) &&
+           conn->state == WHISP_CONNECTED) {
+      Message msg;
+      memcpy(&msg, conn->in + offset, sizeof(Message));
+      offset += sizeof(Message);
+      dispatch_message(conn, &msg);
+    }
+
+    memmove(conn->in, conn->in + offset, conn->in_len - offset);
+    conn->in_len -= offset;
+  }
+
+  return conn->state == WHISP_CLOSED ? -1 : 0;
+}
+
+/**
+ * @brief Trata os eventos do poll() de uma sessão: conclui a conexão, escreve
+ * o que está pendente e lê as mensagens.
+ */
+static int process_events(WhispConn *conn, short revents)
+{
+  if (conn->state == WHISP_CLOSED) return -1;
+
+  if (conn->state == WHISP_CONNECTING) {
+    if (!(revents & (POLLOUT | POLLERR | POLLHUP))) return 0;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+      error = errno;
+    if (error != 0) {
+      fail_connection(conn, error);
+      return -1;
+    }
+
+    conn->state = WHISP_CONNECTED;
+    if (conn->callbacks.on_connect)
+      conn->callbacks.on_connect(conn, 0, conn->user_data);
+    if (whisp_flush(conn) < 0) return -1;
+  }
+
+  if ((revents & POLLOUT) && whisp_flush(conn) < 0) return -1;
+
+  if (revents & (POLLIN | POLLERR | POLLHUP)) return read_messages(conn);
+
+  return conn->state == WHISP_CLOSED ? -1 : 0;
+}
+
+/**
+ * @brief Processa os eventos retornados pelo poll() para a sessão e envia as
+ * confirmações vencidas. Chame também quando o poll() expirar sem eventos
+ * (revents 0), no máximo whisp_timeout_ms() depois.
+ *
+ * @param conn A sessão.
+ * @param revents Os eventos retornados pelo poll().
+ * @return 0 se a sessão continua ativa, -1 se ela foi encerrada.
+ */
+int whisp_process(WhispConn *conn, short revents)
+{
+  int result = process_events(conn, revents);
+  if (result == 0) flush_acks(conn);
+  return conn->state == WHISP_CLOSED ? -1 : result;
+}
+
+/**
+ * @brief Tempo até a próxima confirmação vencer sem chat novo.
+ *
+ * @param conn A sessão.
+ * @return Milissegundos, ou -1 se não há confirmação pendente.
+ */
+int whisp_timeout_ms(const WhispConn *conn)
+{
+  if (conn->state != WHISP_CONNECTED) return -1;
+
+  uint64_t now = monotonic_ms();
+  int timeout = -1;
+  for (size_t i = 0; i < conn->group_count; i++) {
+    const WhispGroupSeq *group = &conn->groups[i];
+    if (group->delivered_seq <= group->acked_seq) continue;
+
+    uint64_t due = group->last_ack_ms + WHISP_ACK_INTERVAL_MS;
+    int wait = due > now ? (int)(due - now) : 0;
+    if (timeout < 0 || wait < timeout) timeout = wait;
+  }
+  return timeout;
+}
+
+/**
+ * @brief Executa uma iteração de poll() sobre várias sessões e processa os
+ * eventos de cada uma.
+ *
+ * @param conns Array de sessões (entradas NULL são ignoradas).
+ * @param count Tamanho do array.
+ * @param timeout_ms Timeout do poll(), -1 para esperar indefinidamente.
+ * @return A quantidade de sessões com eventos, ou -1 em erro do poll().
+ */
+int whisp_run_once(WhispConn **conns, size_t count, int timeout_ms)
+{
+  struct pollfd *fds = malloc((count ? count : 1) * sizeof(struct pollfd));
+  if (!fds) return -1;
+
+  for (size_t i = 0; i < count; i++) {
+    bool active = conns[i] && conns[i]->state != WHISP_CLOSED;
+    fds[i].fd = active ? conns[i]->fd : -1;
+    fds[i].events = active ? whisp_poll_events(conns[i]) : 0;
+    fds[i].revents = 0;
+
+    int ack_timeout = active ? whisp_timeout_ms(conns[i]) : -1;
+    if (ack_timeout >= 0 && (timeout_ms < 0 || ack_timeout < timeout_ms))
+      timeout_ms = ack_timeout;
+  }
+
+  int ready = poll(fds, count, timeout_ms);
+  if (ready >= 0) {
+    for (size_t i = 0; i < count; i++) {
+      if (conns[i] && conns[i]->state != WHISP_CLOSED)
+        whisp_process(conns[i], fds[i].revents);
+    }
+  }
+
+  free(fds);
+  return ready;
+}
+
+/**
+ * @brief Copia uma string para um campo de tamanho fixo da Message, sempre
+ * terminando com '\0'.
+ */
+static void copy_field(char *field, size_t size, const char *value)
+{
+  strncpy(field, value, size - 1);
+  field[size - 1] = '\0';
+}
+
+/**
+ * @brief Monta e enfileira uma mensagem com os campos informados (NULL para
+ * campos não usados).
+ */
+static int send_command(WhispConn *conn, CommandType type,
+                        const char *username, const char *password,
+                        const char *groupname, const char *text)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(Message));
+  msg.type = type;
+
+  if (username) copy_field(msg.username, MAX_USERNAME, username);
+  if (password) copy_field(msg.password, MAX_PASSWORD, password);
+  if (groupname) copy_field(msg.groupname, MAX_GROUPNAME, groupname);
+  if (text) copy_field(msg.message, MAX_BUFFER, text);
+
+  return whisp_send(conn, &msg);
+}
+
+int whisp_register(WhispConn *conn, const char *username, const char *password)
+{
+  return send_command(conn, CMD_REGISTER, username, password, NULL, NULL);
+}
+
+int whisp_login(WhispConn *conn, const char *username, const char *password)
+{
+  return send_command(conn, CMD_LOGIN, username, password, NULL, NULL);
+}
+
+int whisp_logout(WhispConn *conn)
+{
+  return send_command(conn, CMD_LOGOUT, NULL, NULL, NULL, NULL);
+}
+
+int whisp_create_group(WhispConn *conn, const char *groupname,
+                       const char *password)
+{
+  return send_command(conn, CMD_CREATE, NULL, password, groupname, NULL);
+}
+
+int whisp_create_channel(WhispConn *conn, const char *groupname,
+                         const char *password)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(Message));
+  msg.type = CMD_CREATE;
+  msg.seq = 1;
+  copy_field(msg.groupname, MAX_GROUPNAME, groupname);
+  copy_field(msg.password, MAX_PASSWORD, password);
+
+  return whisp_send(conn, &msg);
+}
+
+int whisp_set_publisher(WhispConn *conn, const char *groupname,
+                        const char *username, bool enabled)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(Message));
+  msg.type = CMD_PUBLISHER;
+  msg.seq = enabled;
+  copy_field(msg.username, MAX_USERNAME, username);
+  if (groupname) copy_field(msg.groupname, MAX_GROUPNAME, groupname);
+
+  return whisp_send(conn, &msg);
+}
+
+int whisp_enter_group(WhispConn *conn, const char *groupname,
+                      const char *password)
+{
+  return send_command(conn, CMD_ENTER, NULL, password, groupname, NULL);
+}
+
+int whisp_leave_group(WhispConn *conn, const char *groupname)
+{
+  return send_command(conn, CMD_LEAVE, NULL, NULL, groupname, NULL);
+}
+
+int whisp_delete_group(WhispConn *conn, const char *groupname)
+{
+  return send_command(conn, CMD_DELETE, NULL, NULL, groupname, NULL);
+}
+
+int whisp_send_chat(WhispConn *conn, const char *message)
+{
+  return send_command(conn, CMD_MESSAGE, NULL, NULL, NULL, message);
+}
+
+int whisp_send_group_chat(WhispConn *conn, const char *groupname,
+                          const char *message)
+{
+  return send_command(conn, CMD_MESSAGE, NULL, NULL, groupname, message);
+}
+
+int whisp_send_direct(WhispConn *conn, const char *recipient,
+                      const char *message)
+{
+  return send_command(conn, CMD_DIRECT_MESSAGE, recipient, NULL, NULL, message);
+}
+
+int whisp_list_groups(WhispConn *conn)
+{
+  return send_command(conn, CMD_LIST_GROUPS, NULL, NULL, NULL, NULL);
+}
+
+int whisp_list_groups_after(WhispConn *conn, const char *cursor)
+{
+  return send_command(conn, CMD_LIST_GROUPS, NULL, NULL, NULL, cursor);
+}
+
+int whisp_list_members(WhispConn *conn, const char *groupname)
+{
+  return send_command(conn, CMD_LIST_MEMBERS, NULL, NULL, groupname, NULL);
+}
+
+int whisp_list_members_after(WhispConn *conn, const char *groupname,
+                             const char *cursor)
+{
+  return send_command(conn, CMD_LIST_MEMBERS, NULL, NULL, groupname, cursor);
+}
+
+int whisp_watch_presence(WhispConn *conn, const char *groupname, bool enabled)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(Message));
+  msg.type = CMD_PRESENCE;
+  msg.seq = enabled;
+  if (groupname) copy_field(msg.groupname, MAX_GROUPNAME, groupname);
+
+  return whisp_send(conn, &msg);
+}
+
+bool whisp_page_cursor(const Message *page, char *cursor)
+{
+  cursor[0] = '\0';
+  if (page->seq == 0) return false;
+
+  /* A última linha completa da página; o cursor é o seu primeiro campo. */
+  size_t len = strnlen(page->message, MAX_BUFFER);
+  if (len > 0 && page->message[len - 1] == '\n') len--;
+
+  size_t start = len;
+  while (start > 0 && page->message[start - 1] != '\n') start--;
+
+  size_t end = start;
+  while (end < len && page->message[end] != LIST_FIELD_SEP) end++;
+  if (end - start >= MAX_USERNAME) end = start + MAX_USERNAME - 1;
+
+  memcpy(cursor, page->message + start, end - start);
+  cursor[end - start] = '\0';
+  return true;
+}
+
+/**
+ * @brief Confirma ao servidor o recebimento de todo o chat do grupo até
+ * 'seq'. A biblioteca já faz isso automaticamente; a função é útil para
+ * forçar uma confirmação, por exemplo antes de fechar a sessão.
+ */
+int whisp_ack(WhispConn *conn, const char *groupname, uint64_t seq)
+{
+  WhispGroupSeq *group = group_seq(conn, groupname, true);
+  if (group) {
+    if (seq > group->delivered_seq) group->delivered_seq = seq;
+    if (seq > group->last_seq) group->last_seq = seq;
+    group->acked_seq = seq;
+    group->last_ack_ms = monotonic_ms();
+  }
+  return send_sequence(conn, CMD_ACK, groupname, seq, 0);
+}
+
+/**
+ * @brief Pede ao servidor as mensagens do grupo com sequência maior que
+ * 'after_seq'. Usado após reconectar, com o valor de whisp_group_seq() da
+ * sessão anterior.
+ */
+int whisp_resume(WhispConn *conn, const char *groupname, uint64_t after_seq)
+{
+  WhispGroupSeq *group = group_seq(conn, groupname, true);
+  if (!group) return -1;
+
+  if (after_seq > group->delivered_seq) group->delivered_seq = after_seq;
+  if (after_seq > group->last_seq) group->last_seq = after_seq;
+  return send_resume(conn, group, after_seq);
+}
+
+uint64_t whisp_group_seq(const WhispConn *conn, const char *groupname)
+{
+  for (size_t i = 0; i < conn->group_count; i++) {
+    if (strncmp(conn->groups[i].name, groupname, MAX_GROUPNAME) == 0)
+      return conn->groups[i].delivered_seq;
+  }
+  return 0;
+}
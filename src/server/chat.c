@@ -1,8 +1,20 @@
 #include "../../include/chat.h"
 #include "../../include/common.h"
-#include "../../include/network.h"
+#include "../../include/mirror.h"
+#include "../../include/outbound.h"
+#include "../../include/placement.h"
+#include "../../include/shard.h"
 #include <time.h>
 
+/* Frames necessários para a fila de presença cheia: uma linha "+nome" por
+ * mudança. */
+#define PRESENCE_FRAMES (PRESENCE_PENDING * (MAX_USERNAME + 1) / MAX_MESSAGE + 1)
+
+static _Atomic int presence_window_ms = PRESENCE_DEFAULT_WINDOW_MS;
+
+/* Frames do anel de cada grupo, uma potência de dois. */
+static size_t ring_frames = RING_DEFAULT_FRAMES;
+
 /**
  * @brief Inicializa o gerenciador de grupos, configurando a contagem de grupos
  * como zero e inicializando o mutex do gerenciador. Também inicializa os
@@ -14,10 +26,28 @@ void init_group_manager(GroupManager *gm)
 {
   gm->group_count = 0;
   pthread_mutex_init(&gm->mutex, NULL);
+  atomic_init(&gm->version, 0);
+  listing_cache_init(&gm->groups_listing);
 
   for (int i = 0; i < MAX_GROUPS; i++) {
+    atomic_init(&gm->groups[i].in_use, false);
+    atomic_init(&gm->groups[i].pins, 0);
+    atomic_init(&gm->groups[i].generation, 0);
     gm->groups[i].member_count = 0;
+    gm->groups[i].seq = 0;
+    gm->groups[i].history_first = 1;
+    gm->groups[i].cursor_count = 0;
+    gm->groups[i].presence_count = 0;
+    gm->groups[i].channel = false;
+    gm->groups[i].publisher_count = 0;
+    atomic_init(&gm->groups[i].subscriber_count, 0);
+    gm->groups[i].remote_count = 0;
+    gm->groups[i].owner = PLACEMENT_SELF;
+    gm->groups[i].ring = NULL;
+    atomic_init(&gm->groups[i].ring_head, 0);
     pthread_mutex_init(&gm->groups[i].mutex, NULL);
+    atomic_init(&gm->groups[i].members_version, 0);
+    listing_cache_init(&gm->groups[i].members_listing);
   }
 }
 
@@ -31,6 +61,111 @@ void init_client_manager(ClientManager *cm)
 {
   cm->client_count = 0;
   pthread_mutex_init(&cm->mutex, NULL);
+
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    cm->clients[i].authenticated = false;
+    cm->clients[i].sockfd = -1;
+    cm->clients[i].index = i;
+    cm->clients[i].group_count = 0;
+    pthread_mutex_init(&cm->clients[i].lock, NULL);
+  }
+}
+
+/**
+ * @brief Prepara o anel de um grupo novo: aloca o do slot na primeira vez e
+ * esvazia o que ele já tinha.
+ *
+ * @return false se falta memória.
+ */
+static bool reset_ring(Group *group)
+{
+  if (!group->ring) group->ring = calloc(ring_frames, sizeof(RingSlot));
+  if (!group->ring) return false;
+
+  for (size_t i = 0; i < ring_frames; i++) atomic_store(&group->ring[i].seq, 0);
+  atomic_store(&group->ring_head, 0);
+  return true;
+}
+
+/**
+ * @brief Acorda as conexões dos leitores do canal. Deve ser chamada com o
+ * mutex do grupo travado.
+ */
+static void wake_readers(Group *group)
+{
+  for (int word = 0; word < READER_WORDS; word++) {
+    for (uint64_t bits = group->readers[word]; bits; bits &= bits - 1) {
+      int index = word * 64 + __builtin_ctzll(bits);
+      outbound_wake(group->reader_fds[index]);
+    }
+  }
+}
+
+/**
+ * @brief Acorda as conexões dos membros e dos leitores do grupo para um chat
+ * novo no anel; num grupo grande, em paralelo pelos shards (shard_wake()).
+ * Deve ser chamada com o mutex do grupo travado.
+ */
+static void wake_subscribers(Group *group)
+{
+  int fds[MAX_CLIENTS * 2];
+  int count = 0;
+
+  for (int i = 0; i < group->member_count; i++)
+    fds[count++] = group->members[i]->sockfd;
+  for (int word = 0; word < READER_WORDS; word++) {
+    for (uint64_t bits = group->readers[word]; bits; bits &= bits - 1)
+      fds[count++] = group->reader_fds[word * 64 + __builtin_ctzll(bits)];
+  }
+
+  if (shard_wake(fds, count)) return;
+  for (int i = 0; i < count; i++) outbound_wake(fds[i]);
+}
+
+/**
+ * @brief Marca ou desmarca a conexão do usuário entre as que um post do canal
+ * acorda. Deve ser chamada com o mutex do grupo travado.
+ */
+static void set_reader(Group *group, const User *user, bool reading)
+{
+  uint64_t bit = 1ULL << (user->index % 64);
+  if (reading) {
+    group->readers[user->index / 64] |= bit;
+    group->reader_fds[user->index] = user->sockfd;
+  } else {
+    group->readers[user->index / 64] &= ~bit;
+  }
+}
+
+/**
+ * @brief Reserva um slot livre e não fixado para um grupo novo, com o anel
+ * vazio, e o põe no fim da lista. Deve ser chamada com o mutex do
+ * GroupManager travado.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ * @return O slot, ou NULL se não há slot livre ou falta memória para o anel.
+ */
+Group *claim_group_slot(GroupManager *gm)
+{
+  if (gm->group_count >= MAX_GROUPS) return NULL;
+
+  for (int i = 0; i < MAX_GROUPS; i++) {
+    Group *group = &gm->groups[i];
+    if (group->in_use) continue;
+
+    /* A geração muda antes de os pinos serem olhados: quem fixa o slot por
+     * um ponteiro guardado confere a geração depois de fixar (drain_rings()),
+     * então um dos dois sempre vê o outro. */
+    atomic_fetch_add(&group->generation, 1);
+    if (atomic_load(&group->pins) > 0) continue;
+    if (!reset_ring(group)) return NULL;
+
+    memset(group->readers, 0, sizeof(group->readers));
+    group->in_use = true;
+    gm->list[gm->group_count++] = group;
+    return group;
+  }
+  return NULL;
 }
 
 /**
@@ -42,30 +177,31 @@ void init_client_manager(ClientManager *cm)
  * @param name O nome do novo grupo.
  * @param password A senha do novo grupo.
  * @param creator O nome de usuário do criador do grupo.
+ * @param channel Cria um canal de anúncios em vez de um grupo comum.
  * @return true se o grupo for criado com sucesso, false caso contrário (nome
- * muito curto, grupo já existe, limite de grupos atingido).
+ * muito curto, grupo já existe, limite de grupos atingido, falta de memória
+ * para o anel).
  */
 bool create_group(GroupManager *gm, const char *name, const char *password,
-                  const char *creator)
+                  const char *creator, bool channel)
 {
   if (strlen(name) < 3) return false;
 
   pthread_mutex_lock(&gm->mutex);
 
   for (int i = 0; i < gm->group_count; i++) {
-    if (strcmp(gm->groups[i].name, name) == 0) {
+    if (strcmp(gm->list[i]->name, name) == 0) {
       pthread_mutex_unlock(&gm->mutex);
       return false;
     }
   }
 
-  if (gm->group_count >= MAX_GROUPS) {
+  Group *new_group = claim_group_slot(gm);
+  if (!new_group) {
     pthread_mutex_unlock(&gm->mutex);
     return false;
   }
 
-  Group *new_group = &gm->groups[gm->group_count++];
-
   strncpy(new_group->name, name, MAX_GROUPNAME - 1);
   new_group->name[MAX_GROUPNAME - 1] = '\0';
 
@@ -76,15 +212,30 @@ bool create_group(GroupManager *gm, const char *name, const char *password,
   new_group->creator[MAX_USERNAME - 1] = '\0';
 
   new_group->member_count = 0;
-
+  new_group->seq = 0;
+  new_group->history_first = 1;
+  new_group->cursor_count = 0;
+  new_group->presence_count = 0;
+  new_group->chat_rate.updated_ns = 0;
+  new_group->channel = channel;
+  new_group->publisher_count = 0;
+  atomic_store(&new_group->subscriber_count, 0);
+  new_group->remote_count = 0;
+  new_group->owner = PLACEMENT_SELF;
+  atomic_fetch_add(&new_group->members_version, 1);
+
+  mirror_group(new_group->name, new_group->creator, new_group->password,
+               channel);
+  atomic_fetch_add(&gm->version, 1);
   pthread_mutex_unlock(&gm->mutex);
   return true;
 }
 
 /**
  * @brief Remove um grupo existente. A remoção só é permitida se o usuário que
- * solicita for o criador do grupo. Reorganiza o array de grupos após a
- * remoção.
+ * solicita for o criador do grupo. Os membros perdem a assinatura; o slot é
+ * esvaziado no lugar e sai da lista, e quem ainda o tem fixado vê in_use
+ * false.
  *
  * @param gm Ponteiro para o GroupManager.
  * @param name O nome do grupo a ser deletado.
@@ -97,20 +248,48 @@ bool delete_group(GroupManager *gm, const char *name, const char *username)
   pthread_mutex_lock(&gm->mutex);
 
   for (int i = 0; i < gm->group_count; i++) {
-    if (strcmp(gm->groups[i].name, name) == 0) {
-      if (strcmp(gm->groups[i].creator, username) != 0) {
-        pthread_mutex_unlock(&gm->mutex);
-        return false;
-      }
-
-      for (int j = i; j < gm->group_count - 1; j++) {
-        memcpy(&gm->groups[j], &gm->groups[j + 1], sizeof(Group));
-      }
+    Group *group = gm->list[i];
+    if (strcmp(group->name, name) != 0) continue;
 
-      gm->group_count--;
+    if (strcmp(group->creator, username) != 0) {
       pthread_mutex_unlock(&gm->mutex);
-      return true;
+      return false;
     }
+
+    mirror_group_deleted(group->name, group->creator);
+
+    /* Os leitores fixados continuam lendo o anel do grupo apagado: ele só é
+     * esvaziado quando o slot for reaproveitado (claim_group_slot()). Os de
+     * um canal são acordados para descobrir que ele sumiu. */
+    pthread_mutex_lock(&group->mutex);
+    wake_readers(group);
+    memset(group->readers, 0, sizeof(group->readers));
+    for (int m = 0; m < group->member_count; m++)
+      remove_subscription(group->members[m], group->name);
+    for (uint64_t seq = group->history_first; seq <= group->seq; seq++)
+      free(group->history[seq % GROUP_HISTORY].text);
+    memset(group->history, 0, sizeof(group->history));
+    listing_cache_clear(&group->members_listing);
+    group->in_use = false;
+    group->member_count = 0;
+    group->seq = 0;
+    group->history_first = 1;
+    group->cursor_count = 0;
+    group->presence_count = 0;
+    group->chat_rate.updated_ns = 0;
+    group->channel = false;
+    group->publisher_count = 0;
+    atomic_store(&group->subscriber_count, 0);
+    group->remote_count = 0;
+    group->owner = PLACEMENT_SELF;
+    pthread_mutex_unlock(&group->mutex);
+
+    memmove(&gm->list[i], &gm->list[i + 1],
+            (gm->group_count - i - 1) * sizeof(Group *));
+    gm->group_count--;
+    atomic_fetch_add(&gm->version, 1);
+    pthread_mutex_unlock(&gm->mutex);
+    return true;
   }
 
   pthread_mutex_unlock(&gm->mutex);
@@ -131,9 +310,10 @@ Group *find_group(GroupManager *gm, const char *name)
   pthread_mutex_lock(&gm->mutex);
 
   for (int i = 0; i < gm->group_count; i++) {
-    if (strcmp(gm->groups[i].name, name) == 0) {
+    if (strcmp(gm->list[i]->name, name) == 0) {
+      Group *group = gm->list[i];
       pthread_mutex_unlock(&gm->mutex);
-      return &gm->groups[i];
+      return group;
     }
   }
 
@@ -141,6 +321,30 @@ Group *find_group(GroupManager *gm, const char *name)
   return NULL;
 }
 
+/**
+ * @brief Como find_group(), mas fixa o grupo: o slot não é reaproveitado por
+ * outro grupo até unpin_group(), mesmo que este seja apagado no meio.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ * @param name O nome do grupo.
+ * @return O grupo fixado, ou NULL se não existe.
+ */
+Group *pin_group(GroupManager *gm, const char *name)
+{
+  pthread_mutex_lock(&gm->mutex);
+
+  Group *group = NULL;
+  for (int i = 0; i < gm->group_count && !group; i++) {
+    if (strcmp(gm->list[i]->name, name) == 0) group = gm->list[i];
+  }
+  if (group) atomic_fetch_add(&group->pins, 1);
+
+  pthread_mutex_unlock(&gm->mutex);
+  return group;
+}
+
+void unpin_group(Group *group) { atomic_fetch_sub(&group->pins, 1); }
+
 /**
  * @brief Compara a senha fornecida com a senha armazenada do grupo.
  * Garante a atomicidade da verificação usando o mutex do grupo.
@@ -161,63 +365,343 @@ bool verify_group_password(Group *group, const char *password)
   return result;
 }
 
+/**
+ * @brief Busca o cursor de um usuário no grupo. Deve ser chamada com o mutex
+ * do grupo travado.
+ */
+static GroupCursor *find_cursor(Group *group, const char *username)
+{
+  for (int i = 0; i < group->cursor_count; i++) {
+    if (strcmp(group->cursors[i].username, username) == 0)
+      return &group->cursors[i];
+  }
+  return NULL;
+}
+
+static void remove_cursor(Group *group, GroupCursor *cursor)
+{
+  *cursor = group->cursors[--group->cursor_count];
+}
+
+/**
+ * @brief Descarta os cursores desconectados há mais de CURSOR_GRACE_SECONDS e
+ * libera as mensagens do histórico já confirmadas por todos os cursores
+ * restantes. Deve ser chamada com o mutex do grupo travado.
+ */
+static void trim_history(Group *group)
+{
+  time_t now = time(NULL);
+  uint64_t min_acked = group->seq;
+
+  for (int i = 0; i < group->cursor_count;) {
+    GroupCursor *cursor = &group->cursors[i];
+    if (cursor->detached_at != 0 &&
+        now - cursor->detached_at > CURSOR_GRACE_SECONDS) {
+      remove_cursor(group, cursor);
+      continue;
+    }
+    if (cursor->acked < min_acked) min_acked = cursor->acked;
+    i++;
+  }
+
+  while (group->history_first <= min_acked) {
+    GroupHistoryEntry *entry =
+        &group->history[group->history_first % GROUP_HISTORY];
+    free(entry->text);
+    entry->text = NULL;
+    group->history_first++;
+  }
+}
+
+/**
+ * @brief Cria ou reativa o cursor de um membro que entrou no grupo. Um cursor
+ * novo começa na sequência atual: o histórico anterior não é enviado a quem
+ * acabou de entrar. Deve ser chamada com o mutex do grupo travado.
+ */
+static void attach_cursor(Group *group, const char *username)
+{
+  GroupCursor *cursor = find_cursor(group, username);
+  if (cursor) {
+    cursor->detached_at = 0;
+    return;
+  }
+
+  if (group->cursor_count == MAX_CLIENTS) {
+    /* Sem espaço: descarta o cursor desconectado mais antigo. */
+    GroupCursor *oldest = NULL;
+    for (int i = 0; i < group->cursor_count; i++) {
+      GroupCursor *candidate = &group->cursors[i];
+      if (candidate->detached_at != 0 &&
+          (!oldest || candidate->detached_at < oldest->detached_at))
+        oldest = candidate;
+    }
+    if (!oldest) return;
+    remove_cursor(group, oldest);
+  }
+
+  cursor = &group->cursors[group->cursor_count++];
+  strncpy(cursor->username, username, MAX_USERNAME - 1);
+  cursor->username[MAX_USERNAME - 1] = '\0';
+  cursor->acked = group->seq;
+  cursor->detached_at = 0;
+}
+
+/**
+ * @brief Verifica se o usuário assina o grupo.
+ *
+ * @param user Ponteiro para a estrutura User.
+ * @param groupname O nome do grupo.
+ * @return true se o grupo está entre as assinaturas do usuário.
+ */
+bool is_subscribed(User *user, const char *groupname)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count && !found; i++) {
+    found = strncmp(user->groups[i], groupname, MAX_GROUPNAME) == 0;
+  }
+  pthread_mutex_unlock(&user->lock);
+
+  return found;
+}
+
+/**
+ * @brief Adiciona o grupo às assinaturas do usuário (se ainda não estiver lá)
+ * e o torna o grupo atual. A leitura do anel começa no último chat publicado:
+ * o que veio antes não é entregue. Deve ser chamada com o mutex do grupo travado.
+ *
+ * @return false se o usuário já assina MAX_SUBSCRIPTIONS grupos.
+ */
+static bool add_subscription(User *user, const Group *group)
+{
+  const char *groupname = group->name;
+
+  pthread_mutex_lock(&user->lock);
+
+  int index = -1;
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], groupname, MAX_GROUPNAME) == 0) index = i;
+  }
+
+  if (index == -1) {
+    if (user->group_count == MAX_SUBSCRIPTIONS) {
+      pthread_mutex_unlock(&user->lock);
+      return false;
+    }
+    index = user->group_count++;
+    strncpy(user->groups[index], groupname, MAX_GROUPNAME - 1);
+    user->groups[index][MAX_GROUPNAME - 1] = '\0';
+    user->presence[index] = false;
+    user->channel[index] = group->channel;
+    user->ring_read[index] = group->seq;
+    user->ring_group[index] = NULL;
+  }
+  memcpy(user->current_group, user->groups[index], MAX_GROUPNAME);
+
+  pthread_mutex_unlock(&user->lock);
+  return true;
+}
+
+/**
+ * @brief Retira o grupo das assinaturas do usuário. Se era o grupo atual, o
+ * grupo assinado mais recentemente passa a ser o atual.
+ *
+ * @param user Ponteiro para a estrutura User.
+ * @param groupname O nome do grupo.
+ */
+void remove_subscription(User *user, const char *groupname)
+{
+  pthread_mutex_lock(&user->lock);
+
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], groupname, MAX_GROUPNAME) != 0) continue;
+
+    memmove(user->groups[i], user->groups[i + 1],
+            (user->group_count - i - 1) * MAX_GROUPNAME);
+    memmove(&user->presence[i], &user->presence[i + 1],
+            (user->group_count - i - 1) * sizeof(bool));
+    memmove(&user->channel[i], &user->channel[i + 1],
+            (user->group_count - i - 1) * sizeof(bool));
+    memmove(&user->ring_read[i], &user->ring_read[i + 1],
+            (user->group_count - i - 1) * sizeof(uint64_t));
+    memmove(&user->ring_group[i], &user->ring_group[i + 1],
+            (user->group_count - i - 1) * sizeof(Group *));
+    memmove(&user->ring_generation[i], &user->ring_generation[i + 1],
+            (user->group_count - i - 1) * sizeof(uint64_t));
+    user->group_count--;
+    break;
+  }
+
+  if (strncmp(user->current_group, groupname, MAX_GROUPNAME) == 0) {
+    if (user->group_count > 0)
+      memcpy(user->current_group, user->groups[user->group_count - 1],
+             MAX_GROUPNAME);
+    else
+      user->current_group[0] = '\0';
+  }
+
+  pthread_mutex_unlock(&user->lock);
+}
+
+/**
+ * @brief Copia as assinaturas do usuário, para que possam ser percorridas
+ * enquanto o usuário sai dos grupos.
+ *
+ * @param user Ponteiro para a estrutura User.
+ * @param groups Saída com os nomes dos grupos.
+ * @return A quantidade de grupos copiados.
+ */
+int copy_subscriptions(User *user, char groups[][MAX_GROUPNAME])
+{
+  pthread_mutex_lock(&user->lock);
+  int count = user->group_count;
+  memcpy(groups, user->groups, count * MAX_GROUPNAME);
+  pthread_mutex_unlock(&user->lock);
+
+  return count;
+}
+
+/**
+ * @brief Copia o grupo atual do usuário ('\0' se nenhum).
+ */
+void copy_current_group(User *user, char *groupname)
+{
+  pthread_mutex_lock(&user->lock);
+  memcpy(groupname, user->current_group, MAX_GROUPNAME);
+  pthread_mutex_unlock(&user->lock);
+}
+
+/**
+ * @brief Liga ou desliga os deltas de presença de um grupo para o usuário.
+ *
+ * @param user Ponteiro para a estrutura User.
+ * @param groupname O nome do grupo.
+ * @param enabled true para receber os deltas completos no lugar do resumo.
+ * @return false se o usuário não assina o grupo.
+ */
+bool set_presence_watch(User *user, const char *groupname, bool enabled)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count && !found; i++) {
+    if (strncmp(user->groups[i], groupname, MAX_GROUPNAME) != 0) continue;
+    user->presence[i] = enabled;
+    found = true;
+  }
+  pthread_mutex_unlock(&user->lock);
+
+  return found;
+}
+
+static bool watches_presence(User *user, const char *groupname)
+{
+  bool enabled = false;
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], groupname, MAX_GROUPNAME) == 0)
+      enabled = user->presence[i];
+  }
+  pthread_mutex_unlock(&user->lock);
+
+  return enabled;
+}
+
+/**
+ * @brief Assina um canal: só a assinatura do usuário e o contador mudam, sem
+ * percorrer os outros leitores.
+ */
+static bool join_channel(GroupManager *gm, Group *group, User *user)
+{
+  pthread_mutex_lock(&group->mutex);
+  if (!group->in_use) {
+    pthread_mutex_unlock(&group->mutex);
+    return false;
+  }
+
+  bool known = is_subscribed(user, group->name);
+  bool joined = add_subscription(user, group);
+  if (joined && !known) {
+    atomic_fetch_add(&group->subscriber_count, 1);
+    atomic_fetch_add(&gm->version, 1);
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+  return joined;
+}
+
 /**
  * @brief Lida com a tentativa de um usuário entrar em um grupo.
  * Verifica se o grupo existe, se o usuário já está no grupo, e se há espaço.
- * Adiciona o usuário ao grupo e atualiza seu grupo atual.
+ * Adiciona o usuário ao grupo, sem sair dos outros que ele assina, e torna o
+ * grupo o seu grupo atual.
  *
- * @param gm Ponteiro para o GroupManager (não utilizado diretamente nesta
- * função, mas comum na assinatura).
+ * @param gm Ponteiro para o GroupManager (sua versão de listagem é
+ * incrementada).
  * @param group Ponteiro para a estrutura Group em que o usuário deseja entrar.
  * @param user Ponteiro para a estrutura User que está tentando entrar.
- * @return true se o usuário entrar no grupo com sucesso, false caso contrário.
+ * @return true se o usuário entrar no grupo com sucesso, false caso contrário
+ * (grupo cheio ou limite de assinaturas do usuário atingido).
  */
 bool join_group(GroupManager *gm, Group *group, User *user)
 {
-  (void)gm;
-
   if (!group) return false;
 
+  if (group->channel) return join_channel(gm, group, user);
+
   pthread_mutex_lock(&group->mutex);
 
+  if (!group->in_use) {
+    pthread_mutex_unlock(&group->mutex);
+    return false;
+  }
+
   for (int i = 0; i < group->member_count; i++) {
     if (group->members[i] == user) {
+      add_subscription(user, group);
       pthread_mutex_unlock(&group->mutex);
       return true;
     }
   }
 
-  if (group->member_count >= MAX_CLIENTS) {
+  if (group->member_count >= MAX_CLIENTS ||
+      !add_subscription(user, group)) {
     pthread_mutex_unlock(&group->mutex);
     return false;
   }
 
   group->members[group->member_count++] = user;
-
-  strncpy(user->current_group, group->name, MAX_GROUPNAME - 1);
-  user->current_group[MAX_GROUPNAME - 1] = '\0';
+  attach_cursor(group, user->username);
+  atomic_fetch_add(&group->members_version, 1);
+  atomic_fetch_add(&gm->version, 1);
 
   pthread_mutex_unlock(&group->mutex);
   return true;
 }
 
 /**
- * @brief Lida com a tentativa de um usuário sair de um grupo.
- * Remove o usuário da lista de membros do grupo e limpa seu grupo atual.
- *
- * @param gm Ponteiro para o GroupManager (não utilizado diretamente nesta
- * função, mas comum na assinatura).
- * @param group Ponteiro para a estrutura Group do qual o usuário deseja sair.
- * @param user Ponteiro para a estrutura User que está tentando sair.
- * @return true se o usuário sair do grupo com sucesso, false caso contrário
- * (grupo não existe, usuário não está no grupo).
+ * @brief Remove o usuário da lista de membros do grupo e o grupo das suas
+ * assinaturas. O cursor é descartado ou, se 'keep_cursor', mantido como
+ * desconectado para uma futura retomada.
  */
-bool leave_group(GroupManager *gm, Group *group, User *user)
+static bool remove_member(GroupManager *gm, Group *group, User *user,
+                          bool keep_cursor)
 {
-  (void)gm;
-
   if (!group) return false;
 
+  if (group->channel) {
+    if (!is_subscribed(user, group->name)) return false;
+    remove_subscription(user, group->name);
+    pthread_mutex_lock(&group->mutex);
+    set_reader(group, user, false);
+    pthread_mutex_unlock(&group->mutex);
+    atomic_fetch_sub(&group->subscriber_count, 1);
+    atomic_fetch_add(&gm->version, 1);
+    return true;
+  }
+
   pthread_mutex_lock(&group->mutex);
 
   int user_index = -1;
@@ -239,12 +723,56 @@ bool leave_group(GroupManager *gm, Group *group, User *user)
   }
 
   group->member_count--;
-  user->current_group[0] = '\0';
+  remove_subscription(user, group->name);
+  atomic_fetch_add(&group->members_version, 1);
+  atomic_fetch_add(&gm->version, 1);
+
+  GroupCursor *cursor = find_cursor(group, user->username);
+  if (cursor) {
+    if (keep_cursor)
+      cursor->detached_at = time(NULL);
+    else
+      remove_cursor(group, cursor);
+  }
+  trim_history(group);
 
   pthread_mutex_unlock(&group->mutex);
   return true;
 }
 
+/**
+ * @brief Lida com a tentativa de um usuário sair de um grupo.
+ * Remove o usuário da lista de membros do grupo, retira o grupo das suas
+ * assinaturas e descarta seu cursor de confirmação.
+ *
+ * @param gm Ponteiro para o GroupManager (sua versão de listagem é
+ * incrementada).
+ * @param group Ponteiro para a estrutura Group do qual o usuário deseja sair.
+ * @param user Ponteiro para a estrutura User que está tentando sair.
+ * @return true se o usuário sair do grupo com sucesso, false caso contrário
+ * (grupo não existe, usuário não está no grupo).
+ */
+bool leave_group(GroupManager *gm, Group *group, User *user)
+{
+  return remove_member(gm, group, user, false);
+}
+
+/**
+ * @brief Remove do grupo um usuário cuja conexão caiu, mantendo seu cursor
+ * por CURSOR_GRACE_SECONDS para que ele possa pedir as mensagens perdidas
+ * (CMD_RESUME) ao reconectar.
+ *
+ * @param gm Ponteiro para o GroupManager (sua versão de listagem é
+ * incrementada).
+ * @param group Ponteiro para a estrutura Group.
+ * @param user Ponteiro para a estrutura User desconectada.
+ * @return true se o usuário era membro do grupo, false caso contrário.
+ */
+bool disconnect_from_group(GroupManager *gm, Group *group, User *user)
+{
+  return remove_member(gm, group, user, true);
+}
+
 /**
  * @brief Adiciona um timestamp (tempo atual) à mensagem.
  *
@@ -275,8 +803,8 @@ void format_message_with_time(char *buffer, size_t size, const Message *msg)
 
 /**
  * @brief Envia uma mensagem para todos os membros de um grupo, excluindo um
- * determinado socket. A mensagem original é modificada para incluir o
- * timestamp antes de ser enviada.
+ * determinado socket. A cópia enviada recebe o timestamp e o nome do grupo,
+ * para que clientes em vários grupos saibam de onde o aviso veio.
  *
  * @param group Ponteiro para a estrutura Group.
  * @param original_msg Ponteiro para a mensagem original a ser transmitida.
@@ -292,10 +820,11 @@ void broadcast_to_group(Group *group, const Message *original_msg,
 
   Message msg_with_time = *original_msg;
   add_timestamp_to_message(&msg_with_time);
+  memcpy(msg_with_time.groupname, group->name, MAX_GROUPNAME);
 
   for (int i = 0; i < group->member_count; i++) {
     if (group->members[i]->sockfd != exclude_sockfd) {
-      send_message(group->members[i]->sockfd, &msg_with_time);
+      outbound_send(group->members[i]->sockfd, &msg_with_time);
     }
   }
 
@@ -303,61 +832,989 @@ void broadcast_to_group(Group *group, const Message *original_msg,
 }
 
 /**
- * @brief Adiciona um novo cliente autenticado ao gerenciador de clientes.
- * Atribui nome de usuário, socket, e inicializa o grupo atual como vazio.
- *
- * @param cm Ponteiro para o ClientManager.
- * @param username O nome de usuário do cliente.
- * @param sockfd O descritor de arquivo do socket do cliente.
- * @return Um ponteiro para a estrutura User recém-adicionada, ou NULL se o
- * limite de clientes for atingido.
+ * @brief Avança a sequência do grupo até 'seq' sem publicar nada: as
+ * sequências puladas ficam no histórico sem texto. Deve ser chamada com o
+ * mutex do grupo travado.
  */
-User *add_client(ClientManager *cm, const char *username, int sockfd)
+static void skip_to_seq(Group *group, uint64_t seq)
 {
-  pthread_mutex_lock(&cm->mutex);
+  if (seq <= group->seq) return;
 
-  if (cm->client_count >= MAX_CLIENTS) {
-    pthread_mutex_unlock(&cm->mutex);
-    return NULL;
+  if (seq - group->seq >= GROUP_HISTORY) {
+    for (uint64_t s = group->history_first; s <= group->seq; s++) {
+      free(group->history[s % GROUP_HISTORY].text);
+      group->history[s % GROUP_HISTORY].text = NULL;
+    }
+    group->seq = seq;
+    group->history_first = seq + 1;
+    return;
   }
 
-  User *user = &cm->clients[cm->client_count++];
-
-  strncpy(user->username, username, MAX_USERNAME - 1);
-  user->username[MAX_USERNAME - 1] = '\0';
-  user->sockfd = sockfd;
-  user->authenticated = true;
-  user->current_group[0] = '\0';
+  while (group->seq < seq) {
+    uint64_t next = ++group->seq;
+    if (next - group->history_first >= GROUP_HISTORY) {
+      GroupHistoryEntry *oldest =
+          &group->history[group->history_first % GROUP_HISTORY];
+      free(oldest->text);
+      oldest->text = NULL;
+      group->history_first++;
+    }
+    GroupHistoryEntry *entry = &group->history[next % GROUP_HISTORY];
+    entry->seq = next;
+    entry->text = NULL;
+  }
+}
 
-  pthread_mutex_unlock(&cm->mutex);
-  return user;
+/**
+ * @brief Leva a sequência de uma réplica até a do dono do grupo, para que o
+ * próximo chat vindo dele continue a numeração (relay.h); no standby, até a
+ * do primário (mirror.h).
+ *
+ * @param group Ponteiro para a estrutura Group.
+ * @param seq A última sequência atribuída pelo dono.
+ */
+void advance_group_seq(Group *group, uint64_t seq)
+{
+  pthread_mutex_lock(&group->mutex);
+  if (seq > group->seq) {
+    skip_to_seq(group, seq);
+    mirror_seq(group->name, seq);
+  }
+  pthread_mutex_unlock(&group->mutex);
 }
 
 /**
- * @brief Remove um cliente do gerenciador de clientes com base no seu socket.
- * Reorganiza o array de clientes após a remoção.
+ * @brief Publica uma mensagem de chat no grupo: atribui a próxima sequência,
+ * guarda a mensagem no histórico para retransmissão e a coloca no anel, de
+ * onde a conexão de cada assinante, inclusive o remetente, a envia
+ * (drain_rings()); assim cada cliente recebe a sequência completa e pode
+ * confirmá-la de forma cumulativa. Se o histórico estiver cheio, a mensagem
+ * mais antiga é descartada mesmo sem confirmação. Numa réplica, o chat já
+ * vem do dono com a sequência (msg->seq != 0), que é mantida; um chat
+ * repetido ou atrasado é descartado. Um timestamp já preenchido (o chat
+ * vindo do primário, mirror.h) também é mantido.
  *
- * @param cm Ponteiro para o ClientManager.
- * @param sockfd O descritor de arquivo do socket do cliente a ser removido.
+ * @param group Ponteiro para a estrutura Group.
+ * @param msg A mensagem de chat; recebe a sequência e, se não tem, o
+ * timestamp.
+ * @return A sequência atribuída, ou 0 se o chat foi descartado.
  */
-void remove_client(ClientManager *cm, int sockfd)
+uint64_t publish_to_group(Group *group, Message *msg)
 {
-  pthread_mutex_lock(&cm->mutex);
+  pthread_mutex_lock(&group->mutex);
 
-  int client_index = -1;
+  if (!group->in_use) {
+    pthread_mutex_unlock(&group->mutex);
+    return 0;
+  }
 
-  for (int i = 0; i < cm->client_count; i++) {
-    if (cm->clients[i].sockfd == sockfd) {
-      client_index = i;
-      break;
+  if (msg->seq != 0) {
+    if (msg->seq <= group->seq) {
+      pthread_mutex_unlock(&group->mutex);
+      return 0;
     }
+    skip_to_seq(group, msg->seq - 1);
+  }
+
+  uint64_t seq = ++group->seq;
+  if (seq - group->history_first >= GROUP_HISTORY) {
+    GroupHistoryEntry *oldest =
+        &group->history[group->history_first % GROUP_HISTORY];
+    free(oldest->text);
+    oldest->text = NULL;
+    group->history_first++;
   }
 
-  if (client_index != -1) {
-    for (int i = client_index; i < cm->client_count - 1; i++) {
-      memcpy(&cm->clients[i], &cm->clients[i + 1], sizeof(User));
+  if (msg->timestamp == 0) add_timestamp_to_message(msg);
+  msg->seq = seq;
+
+  GroupHistoryEntry *entry = &group->history[seq % GROUP_HISTORY];
+  entry->seq = seq;
+  entry->timestamp = msg->timestamp;
+  memcpy(entry->username, msg->username, MAX_USERNAME);
+  entry->text = strdup(msg->message);
+
+  /* Só o dono do mutex escreve no anel. O slot fica com sequência 0 enquanto
+   * é reescrito, e o frame só passa a existir para os leitores quando
+   * ring_head avança. */
+  RingSlot *slot = &group->ring[seq & (ring_frames - 1)];
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->frame = *msg;
+  atomic_store_explicit(&slot->seq, seq, memory_order_release);
+  atomic_store(&group->ring_head, seq);
+  mirror_chat(group->name, msg);
+
+  wake_subscribers(group);
+
+  pthread_mutex_unlock(&group->mutex);
+  return seq;
+}
+
+/**
+ * @brief Consome um token do limite de chat do grupo (rate_config.group),
+ * compartilhado por todos os membros.
+ *
+ * @param group Ponteiro para a estrutura Group.
+ * @param now_ns O instante atual (relógio monotônico).
+ * @return 0 se o token foi consumido, ou a espera em ns até haver um.
+ */
+uint64_t take_group_token(Group *group, uint64_t now_ns)
+{
+  pthread_mutex_lock(&group->mutex);
+
+  uint64_t wait = bucket_wait(&group->chat_rate, &rate_config.group, now_ns);
+  if (wait == 0) bucket_take(&group->chat_rate, &rate_config.group);
+
+  pthread_mutex_unlock(&group->mutex);
+  return wait;
+}
+
+/**
+ * @brief Registra a confirmação cumulativa de um membro (tudo até 'seq' foi
+ * recebido) e libera o histórico que todos já confirmaram.
+ *
+ * @param group Ponteiro para a estrutura Group.
+ * @param username O usuário que confirmou.
+ * @param seq A maior sequência recebida sem lacunas.
+ */
+void ack_group(Group *group, const char *username, uint64_t seq)
+{
+  pthread_mutex_lock(&group->mutex);
+
+  GroupCursor *cursor = group->in_use ? find_cursor(group, username) : NULL;
+  if (cursor && seq > cursor->acked) {
+    cursor->acked = seq < group->seq ? seq : group->seq;
+    trim_history(group);
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+}
+
+/**
+ * @brief Copia as mensagens do histórico com sequência maior que 'after',
+ * para serem retransmitidas fora do mutex do grupo.
+ *
+ * @param group Ponteiro para a estrutura Group.
+ * @param after A última sequência que o cliente recebeu.
+ * @param entries Saída com o array de entradas (liberar com
+ * free_group_history()).
+ * @param missed Saída com a quantidade de mensagens que já saíram do
+ * histórico e não podem mais ser retransmitidas.
+ * @return A quantidade de entradas copiadas.
+ */
+size_t copy_group_history(Group *group, uint64_t after,
+                          GroupHistoryEntry **entries, uint64_t *missed)
+{
+  *entries = NULL;
+  *missed = 0;
+
+  pthread_mutex_lock(&group->mutex);
+
+  uint64_t first = after + 1;
+  if (first < group->history_first) {
+    *missed = group->history_first - first;
+    first = group->history_first;
+  }
+
+  size_t count = first <= group->seq ? group->seq - first + 1 : 0;
+  if (count > 0) *entries = malloc(count * sizeof(GroupHistoryEntry));
+  if (!*entries) count = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    GroupHistoryEntry *entry = &group->history[(first + i) % GROUP_HISTORY];
+    (*entries)[i] = *entry;
+    (*entries)[i].text = entry->text ? strdup(entry->text) : NULL;
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+  return count;
+}
+
+void free_group_history(GroupHistoryEntry *entries, size_t count)
+{
+  for (size_t i = 0; i < count; i++) free(entries[i].text);
+  free(entries);
+}
+
+/**
+ * @brief Verifica se o usuário pode postar no canal: o criador e os
+ * publicadores designados.
+ */
+bool is_channel_publisher(Group *group, const char *username)
+{
+  pthread_mutex_lock(&group->mutex);
+
+  bool found = strcmp(group->creator, username) == 0;
+  for (int i = 0; i < group->publisher_count && !found; i++) {
+    found = strncmp(group->publishers[i], username, MAX_USERNAME) == 0;
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+  return found;
+}
+
+/**
+ * @brief Designa ou retira um publicador do canal.
+ *
+ * @param group Ponteiro para o canal.
+ * @param username O usuário.
+ * @param enabled true para designar, false para retirar.
+ * @return false se o canal já tem CHANNEL_PUBLISHERS publicadores.
+ */
+bool set_channel_publisher(Group *group, const char *username, bool enabled)
+{
+  pthread_mutex_lock(&group->mutex);
+
+  int index = -1;
+  for (int i = 0; i < group->publisher_count && index == -1; i++) {
+    if (strncmp(group->publishers[i], username, MAX_USERNAME) == 0) index = i;
+  }
+
+  bool changed = true;
+  if (enabled && index == -1) {
+    if (group->publisher_count == CHANNEL_PUBLISHERS) {
+      pthread_mutex_unlock(&group->mutex);
+      return false;
+    }
+    char *slot = group->publishers[group->publisher_count++];
+    strncpy(slot, username, MAX_USERNAME - 1);
+    slot[MAX_USERNAME - 1] = '\0';
+  } else if (!enabled && index != -1) {
+    memcpy(group->publishers[index],
+           group->publishers[--group->publisher_count], MAX_USERNAME);
+  } else {
+    changed = false;
+  }
+  if (changed) {
+    atomic_fetch_add(&group->members_version, 1);
+    mirror_publisher(group->name, username, enabled);
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+  return true;
+}
+
+/**
+ * @brief Volta a leitura do canal para depois de 'after' (CMD_RESUME), para
+ * que os posts perdidos durante uma reconexão sejam lidos de novo do anel. A
+ * leitura nunca volta para antes do que o anel ainda guarda: o que já saiu
+ * dele só é contado.
+ *
+ * @return Quantos posts depois de 'after' já saíram do anel.
+ */
+uint64_t resume_channel(Group *group, User *user, uint64_t after)
+{
+  uint64_t head = atomic_load(&group->ring_head);
+  uint64_t first = head >= ring_frames ? head - ring_frames + 1 : 1;
+  uint64_t gone = 0;
+
+  if (after > head) after = head;
+  if (after + 1 < first) {
+    gone = first - 1 - after;
+    after = first - 1;
+  }
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], group->name, MAX_GROUPNAME) == 0 &&
+        user->ring_read[i] > after)
+      user->ring_read[i] = after;
+  }
+  pthread_mutex_unlock(&user->lock);
+  return gone;
+}
+
+/**
+ * @brief Registra a entrada ou a saída de um membro conectado a outro nó.
+ *
+ * @param gm Ponteiro para o GroupManager (sua versão de listagem é
+ * incrementada).
+ * @param group O grupo.
+ * @param username O membro.
+ * @param node O nó em que ele está.
+ * @param joined true para entrada, false para saída.
+ * @return true se a lista mudou; quem chama registra a presença.
+ */
+bool set_remote_member(GroupManager *gm, Group *group, const char *username,
+                       int node, bool joined)
+{
+  pthread_mutex_lock(&group->mutex);
+
+  int index = -1;
+  for (int i = 0; i < group->remote_count && index == -1; i++) {
+    if (group->remote[i].node == node &&
+        strncmp(group->remote[i].username, username, MAX_USERNAME) == 0)
+      index = i;
+  }
+
+  bool changed = false;
+  if (joined && index == -1 && group->remote_count < REMOTE_MEMBERS) {
+    RemoteMember *member = &group->remote[group->remote_count++];
+    strncpy(member->username, username, MAX_USERNAME - 1);
+    member->username[MAX_USERNAME - 1] = '\0';
+    member->node = node;
+    changed = true;
+  } else if (!joined && index != -1) {
+    group->remote[index] = group->remote[--group->remote_count];
+    changed = true;
+  }
+
+  if (changed) {
+    atomic_fetch_add(&group->members_version, 1);
+    atomic_fetch_add(&gm->version, 1);
+  }
+
+  pthread_mutex_unlock(&group->mutex);
+  return changed;
+}
+
+/**
+ * @brief Retorna os nós que têm membros no grupo, um bit por índice de nó.
+ */
+uint32_t remote_node_mask(Group *group)
+{
+  uint32_t mask = 0;
+
+  pthread_mutex_lock(&group->mutex);
+  for (int i = 0; i < group->remote_count; i++)
+    mask |= 1u << group->remote[i].node;
+  pthread_mutex_unlock(&group->mutex);
+
+  return mask;
+}
+
+/**
+ * @brief Tira de todos os grupos os membros de um nó que ficou fora do ar,
+ * registrando a saída de cada um na presença do grupo.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ * @param node O nó.
+ */
+void drop_remote_node(GroupManager *gm, int node)
+{
+  pthread_mutex_lock(&gm->mutex);
+
+  for (int g = 0; g < gm->group_count; g++) {
+    Group *group = gm->list[g];
+    char gone[REMOTE_MEMBERS][MAX_USERNAME];
+    int gone_count = 0;
+
+    pthread_mutex_lock(&group->mutex);
+    for (int i = 0; i < group->remote_count;) {
+      if (group->remote[i].node != node) {
+        i++;
+        continue;
+      }
+      memcpy(gone[gone_count++], group->remote[i].username, MAX_USERNAME);
+      group->remote[i] = group->remote[--group->remote_count];
+    }
+    if (gone_count > 0) {
+      atomic_fetch_add(&group->members_version, 1);
+      atomic_fetch_add(&gm->version, 1);
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    for (int i = 0; i < gone_count; i++)
+      record_presence(group, gone[i], false);
+  }
+
+  pthread_mutex_unlock(&gm->mutex);
+}
+
+/**
+ * @brief Avisa os membros de que o grupo vai ser apagado e o apaga, pelo dono
+ * do grupo quando há shards, depois dos chats já enfileirados. Usada quando o
+ * criador apaga o grupo aqui ou em outro nó.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ * @param group O grupo, fixado por quem chama.
+ * @param creator O criador que pediu a exclusão.
+ * @return true se o grupo foi apagado.
+ */
+bool evict_group(GroupManager *gm, Group *group, const char *creator)
+{
+  Message notification;
+  memset(&notification, 0, sizeof(Message));
+  notification.type = CMD_NOTIFICATION;
+  snprintf(
+      notification.message, MAX_BUFFER,
+      "Group '%s' is being deleted by owner. You have been removed from it.",
+      group->name);
+
+  bool deleted;
+  if (shard_delete(group, creator, &notification, &deleted)) return deleted;
+
+  broadcast_to_group(group, &notification, -1);
+  return delete_group(gm, group->name, creator);
+}
+
+/**
+ * @brief Define o tamanho do anel dos grupos criados daqui em diante. Só
+ * pode ser chamada antes de qualquer grupo existir.
+ *
+ * @param frames Uma potência de dois entre RING_MIN_FRAMES e GROUP_HISTORY
+ * (o anel é reconstruído do histórico numa troca de processo).
+ * @return false se o tamanho não é aceito.
+ */
+bool set_ring_frames(size_t frames)
+{
+  if (frames < RING_MIN_FRAMES || frames > GROUP_HISTORY ||
+      (frames & (frames - 1)) != 0)
+    return false;
+
+  ring_frames = frames;
+  return true;
+}
+
+/**
+ * @brief Reconstrói o anel de um grupo recebido de outro processo a partir
+ * do seu histórico, para que as assinaturas continuem de onde pararam.
+ *
+ * @return false se falta memória.
+ */
+bool rebuild_group_ring(Group *group)
+{
+  if (!reset_ring(group)) return false;
+
+  uint64_t first = group->history_first;
+  if (group->seq >= ring_frames && first <= group->seq - ring_frames)
+    first = group->seq - ring_frames + 1;
+
+  for (uint64_t seq = first; seq <= group->seq; seq++) {
+    const GroupHistoryEntry *entry = &group->history[seq % GROUP_HISTORY];
+    if (!entry->text) continue;
+
+    RingSlot *slot = &group->ring[seq & (ring_frames - 1)];
+    memset(&slot->frame, 0, sizeof(Message));
+    slot->frame.type = CMD_MESSAGE;
+    slot->frame.seq = seq;
+    slot->frame.timestamp = entry->timestamp;
+    memcpy(slot->frame.groupname, group->name, MAX_GROUPNAME);
+    memcpy(slot->frame.username, entry->username, MAX_USERNAME);
+    strncpy(slot->frame.message, entry->text, MAX_BUFFER - 1);
+    atomic_store(&slot->seq, seq);
+  }
+
+  atomic_store(&group->ring_head, group->seq);
+  return true;
+}
+
+/**
+ * @brief Atraso, em frames, a partir do qual uma conexão é tratada como
+ * consumidor lento: o orçamento da fila de saída, limitado a meio anel para
+ * que a política aja antes de o publicador alcançar o leitor.
+ */
+static uint64_t ring_limit(void)
+{
+  uint64_t limit = outbound_config.budget / sizeof(Message);
+  if (limit > ring_frames / 2) limit = ring_frames / 2;
+  return limit > 0 ? limit : 1;
+}
+
+/**
+ * @brief Escreve no socket os frames do anel depois de *position, em lotes de
+ * até RING_DRAIN_BATCH por writev, até chegar ao fim do anel ou o socket não
+ * aceitar mais. Só então o atraso conta: passando de ring_limit(), a política
+ * de consumidor lento decide quantos frames pular. Um frame que o publicador
+ * já sobrescreveu é pulado (o cliente vê a lacuna na sequência e pede
+ * CMD_RESUME); se isso acontece enquanto o frame é escrito, a conexão é
+ * derrubada, porque o cliente recebeu bytes misturados.
+ *
+ * @param position Entrada e saída com a última sequência enviada.
+ * @return true se a conexão chegou ao fim do anel.
+ */
+static bool drain_ring(Group *group, int sockfd, uint64_t *position)
+{
+  uint64_t head;
+  while (*position < (head = atomic_load(&group->ring_head))) {
+    if (head - *position > ring_frames) *position = head - ring_frames;
+
+    RingSlot *slots[RING_DRAIN_BATCH];
+    const Message *frames[RING_DRAIN_BATCH];
+    int count = 0;
+    for (uint64_t seq = *position + 1; seq <= head && count < RING_DRAIN_BATCH;
+         seq++) {
+      RingSlot *slot = &group->ring[seq & (ring_frames - 1)];
+      if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+        if (count > 0) break;
+        (*position)++;
+        continue;
+      }
+      slots[count] = slot;
+      frames[count++] = &slot->frame;
+    }
+    if (count == 0) continue;
+
+    int written = outbound_writev(sockfd, frames, count);
+    if (written < 0) return true;
+
+    atomic_thread_fence(memory_order_acquire);
+    for (int i = 0; i < written; i++) {
+      if (atomic_load_explicit(&slots[i]->seq, memory_order_relaxed) !=
+          *position + 1 + i) {
+        outbound_fail(sockfd, "group ring overwritten mid-write");
+        return true;
+      }
+    }
+
+    *position += written;
+    if (written < count) {
+      *position += outbound_lagging(sockfd, head - *position, ring_limit());
+      return false;
+    }
+  }
+
+  outbound_lagging(sockfd, 0, ring_limit());
+  return true;
+}
+
+static void store_ring_read(User *user, const char *groupname, uint64_t seq)
+{
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], groupname, MAX_GROUPNAME) == 0)
+      user->ring_read[i] = seq;
+  }
+  pthread_mutex_unlock(&user->lock);
+}
+
+/**
+ * @brief Guarda o grupo achado pelo nome na assinatura do usuário e, num
+ * canal, passa a ser acordado pelos seus posts. 'group' está fixado.
+ */
+static void watch_group(Group *group, User *user)
+{
+  pthread_mutex_lock(&group->mutex);
+  if (group->in_use && group->channel) set_reader(group, user, true);
+  uint64_t generation = atomic_load(&group->generation);
+  pthread_mutex_unlock(&group->mutex);
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count; i++) {
+    if (strncmp(user->groups[i], group->name, MAX_GROUPNAME) != 0) continue;
+    user->ring_group[i] = group;
+    user->ring_generation[i] = generation;
+  }
+  pthread_mutex_unlock(&user->lock);
+}
+
+/**
+ * @brief Fixa o grupo guardado numa assinatura, se o slot ainda é o do mesmo
+ * grupo e ele não foi apagado.
+ *
+ * @return O grupo fixado, ou NULL se a assinatura tem de ser buscada pelo nome.
+ */
+static Group *pin_watched(Group *group, uint64_t generation)
+{
+  if (!group) return NULL;
+
+  atomic_fetch_add(&group->pins, 1);
+  if (atomic_load(&group->generation) == generation && group->in_use)
+    return group;
+  unpin_group(group);
+  return NULL;
+}
+
+/**
+ * @brief Diz, sem travar o GroupManager nem os grupos, se algum grupo ou
+ * canal que o usuário assina tem chat que ele ainda não recebeu (ou mudou
+ * de um jeito que só drain_rings() resolve: apagado, ainda não achado).
+ *
+ * @param user O usuário da conexão.
+ * @return true se drain_rings() tem o que fazer.
+ */
+bool rings_pending(User *user)
+{
+  bool pending = false;
+
+  pthread_mutex_lock(&user->lock);
+  for (int i = 0; i < user->group_count && !pending; i++) {
+    Group *group = user->ring_group[i];
+    pending = !group || !group->in_use ||
+              atomic_load(&group->generation) != user->ring_generation[i] ||
+              atomic_load(&group->ring_head) > user->ring_read[i];
+  }
+  pthread_mutex_unlock(&user->lock);
+  return pending;
+}
+
+/**
+ * @brief Envia ao usuário o chat novo dos grupos e canais que ele assina,
+ * direto dos anéis. A escrita para quando o socket não aceita mais: a conexão
+ * fica para trás no anel em vez de acumular frames na fila de saída, e quem
+ * passa de ring_limit() frames de atraso recebe a política de consumidor
+ * lento (outbound_lagging()). Cada assinatura guarda o seu grupo: o
+ * GroupManager só é travado para achar um grupo pela primeira vez ou para
+ * confirmar que ele foi apagado. Só a thread da conexão do usuário pode
+ * chamá-la.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ * @param user O usuário da conexão.
+ * @return true se a conexão está em dia com todos os anéis.
+ */
+bool drain_rings(GroupManager *gm, User *user)
+{
+  char groups[MAX_SUBSCRIPTIONS][MAX_GROUPNAME];
+  bool channels[MAX_SUBSCRIPTIONS];
+  uint64_t positions[MAX_SUBSCRIPTIONS];
+  Group *watched[MAX_SUBSCRIPTIONS];
+  uint64_t generations[MAX_SUBSCRIPTIONS];
+
+  pthread_mutex_lock(&user->lock);
+  int count = user->group_count;
+  memcpy(groups, user->groups, count * MAX_GROUPNAME);
+  memcpy(channels, user->channel, count * sizeof(bool));
+  memcpy(positions, user->ring_read, count * sizeof(uint64_t));
+  memcpy(watched, user->ring_group, count * sizeof(Group *));
+  memcpy(generations, user->ring_generation, count * sizeof(uint64_t));
+  pthread_mutex_unlock(&user->lock);
+
+  bool caught_up = true;
+  for (int i = 0; i < count; i++) {
+    Group *group = pin_watched(watched[i], generations[i]);
+    if (!group) {
+      group = pin_group(gm, groups[i]);
+      if (group) watch_group(group, user);
+    }
+    if (!group) {
+      /* Os membros de um grupo apagado perdem a assinatura no
+       * CMD_DELETE_GROUP; os leitores de um canal descobrem aqui. */
+      remove_subscription(user, groups[i]);
+      if (!channels[i]) continue;
+
+      Message notice = {.type = CMD_NOTIFICATION};
+      add_timestamp_to_message(&notice);
+      memcpy(notice.groupname, groups[i], MAX_GROUPNAME);
+      snprintf(notice.message, MAX_BUFFER, "Channel '%s' was deleted",
+               groups[i]);
+      outbound_send(user->sockfd, &notice);
+      continue;
+    }
+
+    uint64_t position = positions[i];
+    if (!drain_ring(group, user->sockfd, &position)) caught_up = false;
+    unpin_group(group);
+    if (position != positions[i]) store_ring_read(user, groups[i], position);
+  }
+
+  return caught_up;
+}
+
+/**
+ * @brief Define a janela de acúmulo das mudanças de presença.
+ *
+ * @param window_ms A janela em milissegundos; 0 envia cada mudança na hora.
+ */
+void set_presence_window(int window_ms)
+{
+  atomic_store(&presence_window_ms, window_ms < 0 ? 0 : window_ms);
+}
+
+int get_presence_window(void) { return atomic_load(&presence_window_ms); }
+
+/* Presença retirada de um grupo para ser enviada depois de soltar os locks:
+ * as mudanças pendentes e, de cada membro, o socket e se ele assina os
+ * deltas. */
+typedef struct {
+  int sockfd;
+  char username[MAX_USERNAME];
+  bool deltas;
+} PresenceTarget;
+
+typedef struct {
+  char groupname[MAX_GROUPNAME];
+  PresenceChange changes[PRESENCE_PENDING];
+  int change_count;
+  PresenceTarget targets[MAX_CLIENTS];
+  int target_count;
+} PresenceBatch;
+
+/**
+ * @brief Monta o resumo da presença acumulada visto por um membro, sem a
+ * mudança do próprio membro: o aviso antigo se resta uma só mudança, ou as
+ * contagens ("+12 joined, -3 left").
+ *
+ * @param batch A presença retirada do grupo.
+ * @param username O membro que vai receber o resumo.
+ * @param out O texto do resumo (MAX_MESSAGE bytes).
+ * @return false se não resta nada a avisar ao membro.
+ */
+static bool format_presence_summary(const PresenceBatch *batch,
+                                    const char *username, char *out)
+{
+  int joined = 0, left = 0;
+  const PresenceChange *last = NULL;
+
+  for (int i = 0; i < batch->change_count; i++) {
+    const PresenceChange *change = &batch->changes[i];
+    if (strncmp(change->username, username, MAX_USERNAME) == 0) continue;
+
+    if (change->joined)
+      joined++;
+    else
+      left++;
+    last = change;
+  }
+
+  if (joined + left == 0) return false;
+
+  if (joined + left == 1)
+    snprintf(out, MAX_MESSAGE, "%s has %s the group", last->username,
+             last->joined ? "joined" : "left");
+  else if (joined && left)
+    snprintf(out, MAX_MESSAGE, "+%d joined, -%d left", joined, left);
+  else if (joined)
+    snprintf(out, MAX_MESSAGE, "+%d joined", joined);
+  else
+    snprintf(out, MAX_MESSAGE, "-%d left", left);
+
+  return true;
+}
+
+/**
+ * @brief Divide a presença acumulada em frames CMD_PRESENCE, com uma linha
+ * "+nome" ou "-nome" por usuário.
+ *
+ * @return A quantidade de frames montados.
+ */
+static int build_presence_deltas(const PresenceBatch *batch, time_t timestamp,
+                                 Message *frames)
+{
+  int count = 0;
+  size_t used = 0;
+
+  for (int i = 0; i < batch->change_count; i++) {
+    const PresenceChange *change = &batch->changes[i];
+    size_t line = strlen(change->username) + 2;
+
+    if (count == 0 || used + line >= MAX_MESSAGE) {
+      frames[count] = (Message){.type = CMD_PRESENCE, .timestamp = timestamp};
+      memcpy(frames[count].groupname, batch->groupname, MAX_GROUPNAME);
+      count++;
+      used = 0;
+    }
+
+    Message *frame = &frames[count - 1];
+    used += snprintf(frame->message + used, MAX_MESSAGE - used, "%s%c%s",
+                     used ? "\n" : "", change->joined ? '+' : '-',
+                     change->username);
+  }
+
+  return count;
+}
+
+/**
+ * @brief Retira a presença acumulada do grupo para o lote e esvazia a fila.
+ * Deve ser chamada com o mutex do grupo travado; o envio (send_presence())
+ * fica para depois dele solto.
+ */
+static void take_presence(Group *group, PresenceBatch *batch)
+{
+  batch->change_count = group->presence_count;
+  batch->target_count = 0;
+  if (group->presence_count == 0) return;
+
+  memcpy(batch->groupname, group->name, MAX_GROUPNAME);
+  memcpy(batch->changes, group->presence,
+         group->presence_count * sizeof(PresenceChange));
+
+  for (int m = 0; m < group->member_count; m++) {
+    User *member = group->members[m];
+    PresenceTarget *target = &batch->targets[batch->target_count++];
+
+    target->sockfd = member->sockfd;
+    memcpy(target->username, member->username, MAX_USERNAME);
+    target->deltas = watches_presence(member, group->name);
+  }
+
+  group->presence_count = 0;
+}
+
+/**
+ * @brief Envia aos membros a presença retirada do grupo. Quem assina os
+ * deltas recebe os frames CMD_PRESENCE; os demais recebem um único aviso com
+ * o resumo. Chamada sem locks, para um cliente lento não segurar o grupo.
+ */
+static void send_presence(const PresenceBatch *batch)
+{
+  if (batch->change_count == 0) return;
+
+  Message summary = {.type = CMD_NOTIFICATION};
+  add_timestamp_to_message(&summary);
+  memcpy(summary.groupname, batch->groupname, MAX_GROUPNAME);
+
+  /* Os deltas só são montados se algum membro os assina. */
+  Message deltas[PRESENCE_FRAMES];
+  int delta_count = 0;
+
+  for (int m = 0; m < batch->target_count; m++) {
+    const PresenceTarget *target = &batch->targets[m];
+
+    if (!target->deltas) {
+      if (format_presence_summary(batch, target->username, summary.message))
+        outbound_send(target->sockfd, &summary);
+      continue;
+    }
+
+    if (delta_count == 0)
+      delta_count = build_presence_deltas(batch, summary.timestamp, deltas);
+    for (int i = 0; i < delta_count; i++) {
+      outbound_send(target->sockfd, &deltas[i]);
+    }
+  }
+}
+
+/**
+ * @brief Registra a entrada ou saída de um membro para o próximo envio de
+ * presença. Uma mudança que desfaz outra ainda pendente do mesmo usuário
+ * cancela as duas. Se a janela for 0 ou a fila encher, envia na hora, depois
+ * de soltar o mutex do grupo.
+ *
+ * @param group Ponteiro para a estrutura Group.
+ * @param username O usuário que entrou ou saiu.
+ * @param joined true para entrada, false para saída.
+ */
+void record_presence(Group *group, const char *username, bool joined)
+{
+  if (group->channel) return;
+
+  PresenceBatch *batch = NULL;
+
+  pthread_mutex_lock(&group->mutex);
+
+  int index = -1;
+  for (int i = 0; i < group->presence_count && index == -1; i++) {
+    if (strncmp(group->presence[i].username, username, MAX_USERNAME) == 0)
+      index = i;
+  }
+
+  if (index != -1 && group->presence[index].joined != joined) {
+    group->presence[index] = group->presence[--group->presence_count];
+  } else if (index == -1) {
+    if (group->presence_count == PRESENCE_PENDING &&
+        (batch = malloc(sizeof(PresenceBatch))))
+      take_presence(group, batch);
+
+    /* Sem memória para o lote, a mudança mais antiga é descartada. */
+    if (group->presence_count == PRESENCE_PENDING)
+      memmove(group->presence, group->presence + 1,
+              --group->presence_count * sizeof(PresenceChange));
+
+    PresenceChange *change = &group->presence[group->presence_count++];
+    strncpy(change->username, username, MAX_USERNAME - 1);
+    change->username[MAX_USERNAME - 1] = '\0';
+    change->joined = joined;
+  }
+
+  /* Com a janela 0 a fila nunca acumula, então não há lote anterior. */
+  if (atomic_load(&presence_window_ms) == 0 && !batch &&
+      (batch = malloc(sizeof(PresenceBatch))))
+    take_presence(group, batch);
+
+  pthread_mutex_unlock(&group->mutex);
+
+  if (batch) {
+    send_presence(batch);
+    free(batch);
+  }
+}
+
+/**
+ * @brief Envia a presença acumulada de todos os grupos. Chamada ao fim de
+ * cada janela pela thread de presença do servidor. Cada grupo é retirado com
+ * os locks travados e enviado depois de soltá-los.
+ *
+ * @param gm Ponteiro para o GroupManager.
+ */
+void flush_presence(GroupManager *gm)
+{
+  PresenceBatch *batch = malloc(sizeof(PresenceBatch));
+  if (!batch) return;
+
+  for (int i = 0;; i++) {
+    pthread_mutex_lock(&gm->mutex);
+    if (i >= gm->group_count) {
+      pthread_mutex_unlock(&gm->mutex);
+      break;
+    }
+
+    Group *group = gm->list[i];
+    pthread_mutex_lock(&group->mutex);
+    take_presence(group, batch);
+    pthread_mutex_unlock(&group->mutex);
+    pthread_mutex_unlock(&gm->mutex);
+
+    send_presence(batch);
+  }
+
+  free(batch);
+}
+
+/**
+ * @brief Adiciona um novo cliente autenticado ao gerenciador de clientes.
+ * Atribui nome de usuário, socket, e começa sem nenhum grupo assinado.
+ * Usa o primeiro slot livre: os slots nunca são movidos, porque os grupos
+ * guardam ponteiros para eles.
+ *
+ * @param cm Ponteiro para o ClientManager.
+ * @param username O nome de usuário do cliente.
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @return Um ponteiro para a estrutura User recém-adicionada, ou NULL se o
+ * limite de clientes for atingido.
+ */
+User *add_client(ClientManager *cm, const char *username, int sockfd)
+{
+  pthread_mutex_lock(&cm->mutex);
+
+  if (cm->client_count >= MAX_CLIENTS) {
+    pthread_mutex_unlock(&cm->mutex);
+    return NULL;
+  }
+
+  User *user = NULL;
+  for (int i = 0; i < MAX_CLIENTS && !user; i++) {
+    if (!cm->clients[i].authenticated) user = &cm->clients[i];
+  }
+  cm->client_count++;
+
+  strncpy(user->username, username, MAX_USERNAME - 1);
+  user->username[MAX_USERNAME - 1] = '\0';
+  user->sockfd = sockfd;
+  user->authenticated = true;
+
+  pthread_mutex_lock(&user->lock);
+  user->group_count = 0;
+  user->current_group[0] = '\0';
+  pthread_mutex_unlock(&user->lock);
+
+  pthread_mutex_unlock(&cm->mutex);
+  return user;
+}
+
+/**
+ * @brief Remove um cliente do gerenciador de clientes com base no seu socket.
+ * O slot é apenas marcado como livre, para que ponteiros para os demais
+ * clientes continuem válidos.
+ *
+ * @param cm Ponteiro para o ClientManager.
+ * @param sockfd O descritor de arquivo do socket do cliente a ser removido.
+ */
+void remove_client(ClientManager *cm, int sockfd)
+{
+  pthread_mutex_lock(&cm->mutex);
+
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (cm->clients[i].authenticated && cm->clients[i].sockfd == sockfd) {
+      cm->clients[i].authenticated = false;
+      cm->clients[i].sockfd = -1;
+      pthread_mutex_lock(&cm->clients[i].lock);
+      cm->clients[i].group_count = 0;
+      cm->clients[i].current_group[0] = '\0';
+      pthread_mutex_unlock(&cm->clients[i].lock);
+      cm->client_count--;
+      break;
     }
-    cm->client_count--;
   }
 
   pthread_mutex_unlock(&cm->mutex);
@@ -376,8 +1833,8 @@ User *find_client_by_sockfd(ClientManager *cm, int sockfd)
 {
   pthread_mutex_lock(&cm->mutex);
 
-  for (int i = 0; i < cm->client_count; i++) {
-    if (cm->clients[i].sockfd == sockfd) {
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (cm->clients[i].authenticated && cm->clients[i].sockfd == sockfd) {
       pthread_mutex_unlock(&cm->mutex);
       return &cm->clients[i];
     }
@@ -400,8 +1857,9 @@ User *find_client_by_username(ClientManager *cm, const char *username)
 {
   pthread_mutex_lock(&cm->mutex);
 
-  for (int i = 0; i < cm->client_count; i++) {
-    if (strcmp(cm->clients[i].username, username) == 0) {
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (cm->clients[i].authenticated &&
+        strcmp(cm->clients[i].username, username) == 0) {
       pthread_mutex_unlock(&cm->mutex);
       return &cm->clients[i];
     }
@@ -1,4 +1,5 @@
 #include "../../include/db.h"
+#include "../../include/mirror.h"
 
 /**
  * @brief Callback padrão para execuções SQLite que não retornam dados.
@@ -124,6 +125,7 @@ bool add_user(Database *db, const char *username, const char *hashed_password)
 
     if (sqlite3_step(stmt) == SQLITE_DONE) {
       success = true;
+      mirror_user(username, hashed_password);
     } else {
       fprintf(stderr, "SQL error inserting user: %s\n",
               sqlite3_errmsg(db->db));
@@ -175,3 +177,36 @@ bool verify_user(Database *db, const char *username, const char *password)
 
   return success;
 }
+
+/**
+ * @brief Percorre os usuários cadastrados, com o mutex do banco travado.
+ *
+ * @param db Ponteiro para a estrutura Database.
+ * @param visit Chamada com o nome e a senha hash de cada usuário.
+ * @param arg Repassado a visit.
+ * @return false se a consulta falhou.
+ */
+bool for_each_user(Database *db, UserVisitor visit, void *arg)
+{
+  sqlite3_stmt *stmt;
+  bool success = false;
+  const char *sql = "SELECT username, password FROM users;";
+
+  pthread_mutex_lock(&db->mutex);
+
+  if (sqlite3_prepare_v2(db->db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+      visit((const char *)sqlite3_column_text(stmt, 0),
+            (const char *)sqlite3_column_text(stmt, 1), arg);
+    success = rc == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+  } else {
+    fprintf(stderr, "Failed to prepare statement for for_each_user: %s\n",
+            sqlite3_errmsg(db->db));
+  }
+
+  pthread_mutex_unlock(&db->mutex);
+
+  return success;
+}
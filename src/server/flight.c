@@ -0,0 +1,156 @@
+#include "../../include/flight.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static FlightHeader *flight_header = NULL;
+static FlightEvent *flight_events = NULL;
+static size_t flight_map_size = 0;
+
+/**
+ * @brief Retorna o tempo monotônico atual em nanossegundos.
+ */
+uint64_t flight_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * @brief Retorna o horário atual (relógio de parede) em nanossegundos.
+ */
+static uint64_t wall_now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/**
+ * @brief Cria (ou reutiliza) o arquivo do flight recorder e o mapeia em
+ * memória com MAP_SHARED, de modo que os eventos já escritos sobrevivam a um
+ * crash do processo. Um arquivo existente e compatível é continuado.
+ *
+ * @param path Caminho do arquivo.
+ * @param capacity Quantidade de eventos mantidos no ring.
+ * @return true em caso de sucesso, false caso contrário.
+ */
+bool flight_open(const char *path, uint32_t capacity)
+{
+  if (capacity == 0) return false;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror("Failed to open flight recorder file");
+    return false;
+  }
+
+  size_t size = sizeof(FlightHeader) + (size_t)capacity * sizeof(FlightEvent);
+
+  struct stat st;
+  bool reuse = fstat(fd, &st) == 0 && (size_t)st.st_size == size;
+
+  if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0)) {
+    perror("Failed to size flight recorder file");
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("Failed to map flight recorder file");
+    return false;
+  }
+
+  FlightHeader *header = map;
+  if (!reuse || header->magic != FLIGHT_MAGIC ||
+      header->version != FLIGHT_VERSION || header->capacity != capacity ||
+      header->event_size != sizeof(FlightEvent)) {
+    memset(map, 0, size);
+    header->version = FLIGHT_VERSION;
+    header->capacity = capacity;
+    header->event_size = sizeof(FlightEvent);
+    header->created_ns = wall_now_ns();
+    atomic_store(&header->head, 0);
+    header->magic = FLIGHT_MAGIC;
+  }
+
+  flight_events = (FlightEvent *)(header + 1);
+  flight_map_size = size;
+  flight_header = header;
+  return true;
+}
+
+/**
+ * @brief Sincroniza o mapeamento com o arquivo e o desfaz.
+ */
+void flight_close(void)
+{
+  if (!flight_header) return;
+
+  FlightHeader *header = flight_header;
+  flight_header = NULL;
+  msync(header, flight_map_size, MS_SYNC);
+  munmap(header, flight_map_size);
+  flight_events = NULL;
+}
+
+/**
+ * @brief Indica se o flight recorder está ativo.
+ */
+bool flight_enabled(void)
+{
+  return flight_header != NULL;
+}
+
+/**
+ * @brief Registra um evento no ring. Reserva o slot com um único incremento
+ * atômico e publica o evento escrevendo 'seq' por último.
+ *
+ * @param kind Tipo do evento.
+ * @param conn Descritor de arquivo da conexão.
+ * @param command O comando processado (ou -1).
+ * @param result O tipo da resposta enviada (ou -1).
+ * @param username O usuário envolvido (pode ser NULL).
+ * @param groupname O grupo envolvido (pode ser NULL).
+ * @param start_ns Início do evento, obtido de flight_now_ns().
+ */
+void flight_record(FlightEventKind kind, int conn, int command, int result,
+                   const char *username, const char *groupname,
+                   uint64_t start_ns)
+{
+  FlightHeader *header = flight_header;
+  if (!header) return;
+
+  uint64_t index =
+      atomic_fetch_add_explicit(&header->head, 1, memory_order_relaxed);
+  FlightEvent *event = &flight_events[index % header->capacity];
+
+  atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  uint64_t now = flight_now_ns();
+  event->wall_ns = wall_now_ns();
+  event->duration_ns = now > start_ns ? now - start_ns : 0;
+  event->conn = conn;
+  event->kind = (uint8_t)kind;
+  event->command = (uint8_t)command;
+  event->result = (uint8_t)result;
+
+  if (username) {
+    strncpy(event->username, username, MAX_USERNAME - 1);
+    event->username[MAX_USERNAME - 1] = '\0';
+  } else {
+    event->username[0] = '\0';
+  }
+
+  if (groupname) {
+    strncpy(event->groupname, groupname, MAX_GROUPNAME - 1);
+    event->groupname[MAX_GROUPNAME - 1] = '\0';
+  } else {
+    event->groupname[0] = '\0';
+  }
+
+  atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+}
@@ -0,0 +1,607 @@
+#include "../../include/handoff.h"
+#include "../../include/chat.h"
+#include "../../include/log.h"
+#include "../../include/outbound.h"
+#include "../../include/session.h"
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define HANDOFF_MAGIC   0x57485046u /* "WHPF" */
+#define HANDOFF_VERSION 3
+
+extern ClientManager client_manager;
+extern GroupManager group_manager;
+
+/* Enviado pelo processo novo ao se conectar. Frames e structs de estado vão
+ * crus pelo socket, então os dois lados precisam do mesmo layout. */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t message_size;
+} HandoffHello;
+
+/* Acompanha os sockets de escuta (SCM_RIGHTS). */
+typedef struct {
+  uint32_t listeners;
+  uint32_t sessions;
+  uint32_t groups;
+} HandoffHeader;
+
+/* Uma conexão; acompanha o seu socket e é seguida por inbound_len bytes de
+ * entrada e outbound_count frames da fila de saída. */
+typedef struct {
+  int32_t sockfd; /* no processo antigo: identifica o membro nos grupos */
+  uint32_t inbound_len;
+  uint32_t outbound_count;
+  uint32_t head_offset;
+  bool authenticated;
+  char username[MAX_USERNAME];
+  char groups[MAX_SUBSCRIPTIONS][MAX_GROUPNAME];
+  bool presence[MAX_SUBSCRIPTIONS];
+  bool channel[MAX_SUBSCRIPTIONS];
+  uint64_t ring_read[MAX_SUBSCRIPTIONS];
+  int32_t group_count;
+  char current_group[MAX_GROUPNAME];
+} HandoffSession;
+
+/* Um grupo; seguido pelos sockets (antigos) dos membros, pelos cursores, pela
+ * presença pendente e pelo histórico (history_first .. seq), cada entrada um
+ * HandoffHistory mais o texto. */
+typedef struct {
+  char name[MAX_GROUPNAME];
+  char creator[MAX_USERNAME];
+  char password[MAX_PASSWORD];
+  uint64_t seq;
+  uint64_t history_first;
+  int32_t member_count;
+  int32_t cursor_count;
+  int32_t presence_count;
+  bool channel;
+  int32_t publisher_count;
+  int32_t subscriber_count;
+  char publishers[CHANNEL_PUBLISHERS][MAX_USERNAME];
+} HandoffGroup;
+
+typedef struct {
+  uint64_t seq;
+  time_t timestamp;
+  char username[MAX_USERNAME];
+  uint32_t text_len;
+} HandoffHistory;
+
+/* ---- socket ---- */
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t len)
+{
+  char *p = data;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief Envia um registro com descritores anexados. Os descritores chegam
+ * junto com o primeiro byte do registro.
+ */
+static bool send_with_fds(int fd, const void *data, size_t len,
+                          const int *fds, int nfds)
+{
+  char control[CMSG_SPACE(sizeof(int) * MAX_CLIENTS)];
+  if (nfds < 0 || (size_t)nfds > MAX_CLIENTS) return false;
+
+  struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (nfds > 0) {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+  }
+
+  ssize_t n;
+  do {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) return false;
+
+  return write_all(fd, (const char *)data + n, len - n);
+}
+
+/**
+ * @brief Lê um registro enviado com send_with_fds().
+ *
+ * @param nfds Saída com a quantidade de descritores recebidos (no máximo
+ * max_fds; os excedentes são fechados).
+ */
+static bool recv_with_fds(int fd, void *data, size_t len, int *fds,
+                          int max_fds, int *nfds)
+{
+  char control[CMSG_SPACE(sizeof(int) * MAX_CLIENTS)];
+  struct iovec iov = {.iov_base = data, .iov_len = len};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+  *nfds = 0;
+
+  ssize_t n;
+  do {
+    n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) return false;
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int received[MAX_CLIENTS];
+    memcpy(received, CMSG_DATA(cmsg), sizeof(int) * count);
+    for (int i = 0; i < count; i++) {
+      if (*nfds < max_fds)
+        fds[(*nfds)++] = received[i];
+      else
+        close(received[i]);
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) return false;
+
+  return read_all(fd, (char *)data + n, len - n);
+}
+
+static void set_timeouts(int fd)
+{
+  struct timeval timeout = {.tv_sec = HANDOFF_TIMEOUT_MS / 1000,
+                            .tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static bool unix_address(const char *path, struct sockaddr_un *addr)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) return false;
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+int handoff_listen(const char *path)
+{
+  struct sockaddr_un addr;
+  if (!unix_address(path, &addr)) {
+    LOG_ERROR("Handoff socket path too long: %s", path);
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_ERROR("Handoff socket failed: %s", strerror(errno));
+    return -1;
+  }
+
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 1) < 0) {
+    LOG_ERROR("Handoff socket %s failed: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  chmod(path, 0600);
+  return fd;
+}
+
+/* ---- processo antigo ---- */
+
+/* Trava o estado compartilhado na ordem usada pela thread de presença:
+ * clientes, grupos, cada grupo. */
+static void lock_state(void)
+{
+  pthread_mutex_lock(&client_manager.mutex);
+  pthread_mutex_lock(&group_manager.mutex);
+  for (int i = 0; i < group_manager.group_count; i++)
+    pthread_mutex_lock(&group_manager.list[i]->mutex);
+}
+
+static void unlock_state(void)
+{
+  for (int i = group_manager.group_count - 1; i >= 0; i--)
+    pthread_mutex_unlock(&group_manager.list[i]->mutex);
+  pthread_mutex_unlock(&group_manager.mutex);
+  pthread_mutex_unlock(&client_manager.mutex);
+}
+
+static bool count_session(int sockfd, const char *inbound, size_t inbound_len,
+                          void *arg)
+{
+  (void)sockfd;
+  (void)inbound;
+  (void)inbound_len;
+  (*(uint32_t *)arg)++;
+  return true;
+}
+
+/**
+ * @brief Envia uma conexão estacionada: socket, usuário, entrada parcial e
+ * fila de saída. Chamada com o estado travado.
+ */
+static bool send_session(int sockfd, const char *inbound, size_t inbound_len,
+                         void *arg)
+{
+  int conn_fd = *(int *)arg;
+  HandoffSession record;
+  memset(&record, 0, sizeof(record));
+  record.sockfd = sockfd;
+  record.inbound_len = (uint32_t)inbound_len;
+
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    User *user = &client_manager.clients[i];
+    if (!user->authenticated || user->sockfd != sockfd) continue;
+
+    record.authenticated = true;
+    memcpy(record.username, user->username, MAX_USERNAME);
+    memcpy(record.groups, user->groups, sizeof(record.groups));
+    memcpy(record.presence, user->presence, sizeof(record.presence));
+    memcpy(record.channel, user->channel, sizeof(record.channel));
+    memcpy(record.ring_read, user->ring_read, sizeof(record.ring_read));
+    record.group_count = user->group_count;
+    memcpy(record.current_group, user->current_group, MAX_GROUPNAME);
+    break;
+  }
+
+  Message *frames;
+  size_t head_offset;
+  size_t count = outbound_export(sockfd, &frames, &head_offset);
+  record.outbound_count = (uint32_t)count;
+  record.head_offset = (uint32_t)head_offset;
+
+  bool sent = send_with_fds(conn_fd, &record, sizeof(record), &sockfd, 1) &&
+              write_all(conn_fd, inbound, inbound_len) &&
+              write_all(conn_fd, frames, count * sizeof(Message));
+  free(frames);
+  return sent;
+}
+
+static bool send_group(int conn_fd, const Group *group)
+{
+  HandoffGroup record;
+  memset(&record, 0, sizeof(record));
+  memcpy(record.name, group->name, MAX_GROUPNAME);
+  memcpy(record.creator, group->creator, MAX_USERNAME);
+  memcpy(record.password, group->password, MAX_PASSWORD);
+  record.seq = group->seq;
+  record.history_first = group->history_first;
+  record.member_count = group->member_count;
+  record.cursor_count = group->cursor_count;
+  record.presence_count = group->presence_count;
+  record.channel = group->channel;
+  record.publisher_count = group->publisher_count;
+  record.subscriber_count = atomic_load(&group->subscriber_count);
+  memcpy(record.publishers, group->publishers, sizeof(record.publishers));
+
+  int32_t members[MAX_CLIENTS];
+  for (int i = 0; i < group->member_count; i++)
+    members[i] = group->members[i]->sockfd;
+
+  if (!write_all(conn_fd, &record, sizeof(record)) ||
+      !write_all(conn_fd, members, sizeof(int32_t) * group->member_count) ||
+      !write_all(conn_fd, group->cursors,
+                 sizeof(GroupCursor) * group->cursor_count) ||
+      !write_all(conn_fd, group->presence,
+                 sizeof(PresenceChange) * group->presence_count))
+    return false;
+
+  for (uint64_t seq = group->history_first; seq <= group->seq; seq++) {
+    const GroupHistoryEntry *entry = &group->history[seq % GROUP_HISTORY];
+    HandoffHistory history = {.seq = entry->seq,
+                              .timestamp = entry->timestamp,
+                              .text_len = entry->text
+                                              ? (uint32_t)strlen(entry->text)
+                                              : 0};
+    memcpy(history.username, entry->username, MAX_USERNAME);
+
+    if (!write_all(conn_fd, &history, sizeof(history)) ||
+        !write_all(conn_fd, entry->text, history.text_len))
+      return false;
+  }
+  return true;
+}
+
+bool handoff_serve(int conn_fd, const int *listen_fds, int listeners)
+{
+  set_timeouts(conn_fd);
+
+  HandoffHello hello;
+  if (!read_all(conn_fd, &hello, sizeof(hello)) ||
+      hello.magic != HANDOFF_MAGIC || hello.version != HANDOFF_VERSION ||
+      hello.message_size != sizeof(Message)) {
+    LOG_WARN("Handoff refused: incompatible or missing hello");
+    return false;
+  }
+
+  lock_state();
+
+  HandoffHeader header = {.listeners = (uint32_t)listeners,
+                          .groups = (uint32_t)group_manager.group_count};
+  for_each_parked_session(count_session, &header.sessions);
+
+  bool sent =
+      send_with_fds(conn_fd, &header, sizeof(header), listen_fds, listeners) &&
+      for_each_parked_session(send_session, &conn_fd);
+  for (int i = 0; sent && i < group_manager.group_count; i++)
+    sent = send_group(conn_fd, group_manager.list[i]);
+
+  uint32_t ack = 0;
+  if (!sent || !read_all(conn_fd, &ack, sizeof(ack)) || ack != HANDOFF_MAGIC) {
+    LOG_WARN("Handoff aborted: %s",
+             sent ? "no confirmation from the new process"
+                  : "failed to send state");
+    unlock_state();
+    return false;
+  }
+
+  LOG_INFO("Handed off %u sessions and %u groups on %d listeners",
+           header.sessions, header.groups, listeners);
+  return true;
+}
+
+/* ---- processo novo ---- */
+
+typedef struct {
+  int32_t old_sockfd;
+  User *user;
+  ClientArgs *args;
+} RestoredSession;
+
+static bool receive_session(int conn_fd, RestoredSession *restored)
+{
+  HandoffSession record;
+  int fd = -1, nfds;
+  if (!recv_with_fds(conn_fd, &record, sizeof(record), &fd, 1, &nfds) ||
+      nfds != 1) {
+    if (nfds == 1) close(fd);
+    return false;
+  }
+
+  ClientArgs *args = calloc(1, sizeof(ClientArgs));
+  if (!args) {
+    close(fd);
+    return false;
+  }
+  args->sockfd = fd;
+  restored->old_sockfd = record.sockfd;
+  restored->args = args;
+
+  if (record.inbound_len > sizeof(Message) * 8 ||
+      record.head_offset >= sizeof(Message) ||
+      record.group_count < 0 || record.group_count > MAX_SUBSCRIPTIONS)
+    return false;
+
+  args->inbound_len = record.inbound_len;
+  if (record.inbound_len > 0) args->inbound = malloc(record.inbound_len);
+  Message *outbound = NULL;
+  if (record.outbound_count > 0)
+    outbound = malloc(record.outbound_count * sizeof(Message));
+  bool ok = (record.inbound_len == 0 || args->inbound) &&
+            (record.outbound_count == 0 || outbound) &&
+            read_all(conn_fd, args->inbound, record.inbound_len) &&
+            read_all(conn_fd, outbound,
+                     record.outbound_count * sizeof(Message));
+
+  /* A fila é registrada já restaurada, antes de o usuário e os grupos
+   * ficarem visíveis: nenhum envio passa à frente do que ela guardava. */
+  ok = ok && outbound_adopt(fd, outbound, record.outbound_count,
+                            record.head_offset);
+  free(outbound);
+  if (!ok) return false;
+  args->outbound_open = true;
+
+  if (!record.authenticated) return true;
+
+  record.username[MAX_USERNAME - 1] = '\0';
+  User *user = add_client(&client_manager, record.username, fd);
+  if (!user) return false;
+
+  pthread_mutex_lock(&user->lock);
+  memcpy(user->groups, record.groups, sizeof(user->groups));
+  memcpy(user->presence, record.presence, sizeof(user->presence));
+  memcpy(user->channel, record.channel, sizeof(user->channel));
+  memcpy(user->ring_read, record.ring_read, sizeof(user->ring_read));
+  memset(user->ring_group, 0, sizeof(user->ring_group));
+  user->group_count = record.group_count;
+  memcpy(user->current_group, record.current_group, MAX_GROUPNAME);
+  pthread_mutex_unlock(&user->lock);
+
+  outbound_set_name(fd, user->username);
+  restored->user = user;
+  return true;
+}
+
+static User *restored_user(const RestoredSession *sessions, uint32_t count,
+                           int32_t old_sockfd)
+{
+  for (uint32_t i = 0; i < count; i++) {
+    if (sessions[i].old_sockfd == old_sockfd) return sessions[i].user;
+  }
+  return NULL;
+}
+
+static bool receive_group(int conn_fd, const RestoredSession *sessions,
+                          uint32_t session_count)
+{
+  HandoffGroup record;
+  if (!read_all(conn_fd, &record, sizeof(record)) ||
+      record.member_count < 0 || record.member_count > MAX_CLIENTS ||
+      record.cursor_count < 0 || record.cursor_count > MAX_CLIENTS ||
+      record.presence_count < 0 || record.presence_count > PRESENCE_PENDING ||
+      record.publisher_count < 0 ||
+      record.publisher_count > CHANNEL_PUBLISHERS ||
+      record.seq + 1 < record.history_first ||
+      record.seq + 1 - record.history_first > GROUP_HISTORY)
+    return false;
+
+  Group *group = claim_group_slot(&group_manager);
+  if (!group) return false;
+  memcpy(group->name, record.name, MAX_GROUPNAME);
+  memcpy(group->creator, record.creator, MAX_USERNAME);
+  memcpy(group->password, record.password, MAX_PASSWORD);
+  group->seq = record.seq;
+  group->history_first = record.history_first;
+  group->chat_rate.updated_ns = 0;
+  group->channel = record.channel;
+  group->publisher_count = record.publisher_count;
+  memcpy(group->publishers, record.publishers, sizeof(group->publishers));
+  atomic_store(&group->subscriber_count, record.subscriber_count);
+
+  int32_t members[MAX_CLIENTS];
+  if (!read_all(conn_fd, members, sizeof(int32_t) * record.member_count))
+    return false;
+
+  group->member_count = 0;
+  for (int i = 0; i < record.member_count; i++) {
+    User *user = restored_user(sessions, session_count, members[i]);
+    if (user) group->members[group->member_count++] = user;
+  }
+
+  group->cursor_count = record.cursor_count;
+  group->presence_count = record.presence_count;
+  if (!read_all(conn_fd, group->cursors,
+                sizeof(GroupCursor) * record.cursor_count) ||
+      !read_all(conn_fd, group->presence,
+                sizeof(PresenceChange) * record.presence_count))
+    return false;
+
+  for (uint64_t seq = record.history_first; seq <= record.seq; seq++) {
+    HandoffHistory history;
+    if (!read_all(conn_fd, &history, sizeof(history)) ||
+        history.text_len >= MAX_MESSAGE)
+      return false;
+
+    GroupHistoryEntry *entry = &group->history[seq % GROUP_HISTORY];
+    entry->seq = history.seq;
+    entry->timestamp = history.timestamp;
+    memcpy(entry->username, history.username, MAX_USERNAME);
+    entry->text = NULL;
+    if (history.text_len == 0) continue; /* sequência pulada numa réplica */
+
+    entry->text = malloc(history.text_len + 1);
+    if (!entry->text || !read_all(conn_fd, entry->text, history.text_len))
+      return false;
+    entry->text[history.text_len] = '\0';
+  }
+
+  /* O anel não viaja: é refeito do histórico, que guarda tudo o que algum
+   * assinante ainda não confirmou. */
+  if (!rebuild_group_ring(group)) return false;
+
+  atomic_fetch_add(&group->members_version, 1);
+  atomic_fetch_add(&group_manager.version, 1);
+  return true;
+}
+
+bool handoff_receive(const char *path, int *listen_fds, int max_listeners,
+                     int *listeners)
+{
+  *listeners = 0;
+
+  struct sockaddr_un addr;
+  if (!unix_address(path, &addr)) {
+    LOG_ERROR("Handoff socket path too long: %s", path);
+    return false;
+  }
+
+  int conn_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (conn_fd < 0 ||
+      connect(conn_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG_ERROR("Cannot reach the running server at %s: %s", path,
+              strerror(errno));
+    if (conn_fd >= 0) close(conn_fd);
+    return false;
+  }
+  set_timeouts(conn_fd);
+
+  HandoffHello hello = {.magic = HANDOFF_MAGIC,
+                        .version = HANDOFF_VERSION,
+                        .message_size = sizeof(Message)};
+  HandoffHeader header = {0};
+  RestoredSession *sessions = NULL;
+  uint32_t received = 0;
+  bool ok =
+      write_all(conn_fd, &hello, sizeof(hello)) &&
+      recv_with_fds(conn_fd, &header, sizeof(header), listen_fds,
+                    max_listeners, listeners) &&
+      header.listeners == (uint32_t)*listeners && *listeners > 0;
+
+  if (ok && header.sessions > 0) {
+    sessions = calloc(header.sessions, sizeof(RestoredSession));
+    ok = sessions != NULL;
+  }
+
+  for (; ok && received < header.sessions; received++)
+    ok = receive_session(conn_fd, &sessions[received]);
+
+  pthread_mutex_lock(&group_manager.mutex);
+  for (uint32_t i = 0; ok && i < header.groups; i++)
+    ok = receive_group(conn_fd, sessions, header.sessions);
+  pthread_mutex_unlock(&group_manager.mutex);
+
+  uint32_t ack = HANDOFF_MAGIC;
+  ok = ok && write_all(conn_fd, &ack, sizeof(ack));
+  close(conn_fd);
+
+  if (!ok) {
+    LOG_ERROR("Handoff from %s failed, the running server keeps serving",
+              path);
+    for (int i = 0; i < *listeners; i++) close(listen_fds[i]);
+    *listeners = 0;
+    for (uint32_t i = 0; sessions && i < header.sessions; i++) {
+      if (!sessions[i].args) continue;
+      if (sessions[i].args->outbound_open)
+        outbound_close(sessions[i].args->sockfd);
+      close(sessions[i].args->sockfd);
+      free(sessions[i].args->inbound);
+      free(sessions[i].args);
+    }
+    free(sessions);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.sessions; i++) {
+    ClientArgs *args = sessions[i].args;
+    if (!spawn_session(args)) {
+      LOG_WARN("Failed to start the session on fd %d", args->sockfd);
+      outbound_close(args->sockfd);
+      close(args->sockfd);
+      free(args->inbound);
+      free(args);
+    }
+  }
+  free(sessions);
+
+  LOG_INFO("Took over %u sessions and %u groups on %d listeners from %s",
+           header.sessions, header.groups, *listeners, path);
+  return true;
+}
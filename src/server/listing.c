@@ -0,0 +1,138 @@
+#include "../../include/listing.h"
+
+void listing_cache_init(ListingCache *cache)
+{
+  pthread_mutex_init(&cache->mutex, NULL);
+  cache->snapshot = NULL;
+}
+
+void listing_cache_clear(ListingCache *cache)
+{
+  pthread_mutex_lock(&cache->mutex);
+  ListingSnapshot *old = cache->snapshot;
+  cache->snapshot = NULL;
+  pthread_mutex_unlock(&cache->mutex);
+
+  if (old) listing_release(old);
+}
+
+ListingSnapshot *listing_acquire(ListingCache *cache, uint64_t version)
+{
+  pthread_mutex_lock(&cache->mutex);
+  ListingSnapshot *snapshot = cache->snapshot;
+  if (snapshot && snapshot->version == version)
+    atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+  else
+    snapshot = NULL;
+  pthread_mutex_unlock(&cache->mutex);
+
+  return snapshot;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  return strcmp(((const ListEntry *)a)->name, ((const ListEntry *)b)->name);
+}
+
+ListingSnapshot *listing_build(ListEntry *entries, size_t count,
+                               ListFormatter format, uint64_t version)
+{
+  qsort(entries, count, sizeof(ListEntry), compare_entries);
+
+  ListingSnapshot *snapshot = calloc(1, sizeof(ListingSnapshot));
+  if (!snapshot) return NULL;
+
+  char line[sizeof(ListEntry) + 16];
+  size_t capacity = count * 32 + 1;
+
+  snapshot->names = malloc((count ? count : 1) * MAX_USERNAME);
+  snapshot->offsets = malloc((count + 1) * sizeof(size_t));
+  snapshot->text = malloc(capacity);
+  if (!snapshot->names || !snapshot->offsets || !snapshot->text) {
+    listing_release(snapshot);
+    return NULL;
+  }
+  atomic_init(&snapshot->refs, 1);
+  snapshot->version = version;
+
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++) {
+    int n = format(line, sizeof(line), &entries[i]);
+    if (n < 0) n = 0;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+
+    if (len + n + 1 > capacity) {
+      while (len + n + 1 > capacity) capacity *= 2;
+      char *text = realloc(snapshot->text, capacity);
+      if (!text) {
+        listing_release(snapshot);
+        return NULL;
+      }
+      snapshot->text = text;
+    }
+
+    memcpy(snapshot->names[i], entries[i].name, MAX_USERNAME);
+    snapshot->offsets[i] = len;
+    memcpy(snapshot->text + len, line, n);
+    len += n;
+  }
+  snapshot->offsets[count] = len;
+  snapshot->text[len] = '\0';
+  snapshot->count = count;
+
+  return snapshot;
+}
+
+void listing_publish(ListingCache *cache, ListingSnapshot *snapshot)
+{
+  ListingSnapshot *old = NULL;
+
+  pthread_mutex_lock(&cache->mutex);
+  if (!cache->snapshot || cache->snapshot->version <= snapshot->version) {
+    old = cache->snapshot;
+    atomic_fetch_add_explicit(&snapshot->refs, 1, memory_order_relaxed);
+    cache->snapshot = snapshot;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+
+  if (old) listing_release(old);
+}
+
+void listing_release(ListingSnapshot *snapshot)
+{
+  if (atomic_fetch_sub_explicit(&snapshot->refs, 1, memory_order_acq_rel) > 1)
+    return;
+
+  free(snapshot->names);
+  free(snapshot->offsets);
+  free(snapshot->text);
+  free(snapshot);
+}
+
+size_t listing_page(const ListingSnapshot *snapshot, const char *cursor,
+                    size_t limit, char *out, size_t size)
+{
+  /* Primeira entrada com nome maior que o cursor. */
+  size_t first = 0;
+  if (cursor[0] != '\0') {
+    size_t high = snapshot->count;
+    while (first < high) {
+      size_t mid = first + (high - first) / 2;
+      if (strcmp(snapshot->names[mid], cursor) <= 0)
+        first = mid + 1;
+      else
+        high = mid;
+    }
+  }
+
+  size_t end = first;
+  while (end < snapshot->count && (limit == 0 || end - first < limit) &&
+         snapshot->offsets[end + 1] - snapshot->offsets[first] < size)
+    end++;
+
+  size_t len = snapshot->offsets[end] - snapshot->offsets[first];
+  memcpy(out, snapshot->text + snapshot->offsets[first], len);
+  out[len] = '\0';
+
+  return snapshot->count - end;
+}
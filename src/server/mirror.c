@@ -0,0 +1,1004 @@
+#define _GNU_SOURCE
+#include "../../include/mirror.h"
+#include "../../include/chat.h"
+#include "../../include/db.h"
+#include "../../include/log.h"
+#include "../../include/peer.h"
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+extern GroupManager group_manager;
+extern Database database;
+
+MirrorConfig mirror_config = {.port = 0,
+                              .primary = "",
+                              .failover_ms = MIRROR_FAILOVER_MS,
+                              .standbys = {.count = 0}};
+
+/* Um registro do feed é o cabeçalho seguido de campos de texto terminados em
+ * '\0', na ordem indicada em cada tipo, como os frames do relay. */
+typedef enum {
+  MIRROR_HEARTBEAT = 1, /* nada: o feed está vivo */
+  MIRROR_SYNCED,        /* fim do snapshot */
+  MIRROR_USER,          /* usuário, senha hash */
+  MIRROR_GROUP,         /* grupo, criador, senha; flag = canal */
+  MIRROR_DELETE,        /* grupo, criador */
+  MIRROR_PUBLISHER,     /* canal, usuário; flag = designado */
+  MIRROR_SEQ,           /* grupo, última sequência atribuída */
+  MIRROR_CHAT,          /* grupo, sequência, timestamp, remetente, texto */
+  MIRROR_HELLO,         /* nonce; o primeiro registro de cada lado */
+  MIRROR_AUTH,          /* prova do segredo sobre os dois nonces (peer.h) */
+} MirrorType;
+
+typedef struct {
+  uint32_t length; /* bytes dos campos, em ordem de rede */
+  uint8_t type;
+  uint8_t flag;
+  uint16_t reserved;
+} MirrorHeader;
+
+/* Cabe um chat com o texto inteiro. */
+#define MIRROR_MAX_DATA 8192
+#define MIRROR_MAX_HASH 128
+
+typedef struct {
+  MirrorHeader header;
+  char data[MIRROR_MAX_DATA];
+  size_t length;
+} MirrorRecord;
+
+/* Registros serializados, à espera do socket. */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} MirrorBuffer;
+
+/* Um standby conectado. A thread dele manda o snapshot e depois escreve a
+ * fila, que os registros do feed alimentam. */
+typedef struct Standby {
+  int fd;
+  char address[MIRROR_MAX_ADDRESS];
+  MirrorBuffer queue;
+  bool closing;
+  pthread_cond_t cond;
+  struct Standby *next;
+} Standby;
+
+/* Protege a lista de standbys e as suas filas. Travado depois do mutex do
+ * banco, do GroupManager ou de um grupo; com ele travado, nenhum outro é. */
+static pthread_mutex_t feed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Standby *standbys = NULL;
+static _Atomic int standby_count = 0; /* lida sem feed_mutex pelos registros */
+
+static _Atomic bool mirror_running = false;
+static int listen_fd = -1;
+static pthread_t accept_thread;
+
+/* Threads de standbys ainda vivas; mirror_stop() espera por elas. */
+static pthread_mutex_t standby_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t standby_cond = PTHREAD_COND_INITIALIZER;
+static int standby_threads = 0;
+
+/* ---- registros ---- */
+
+static void record_init(MirrorRecord *record, MirrorType type, bool flag)
+{
+  record->header = (MirrorHeader){.type = type, .flag = flag};
+  record->length = 0;
+}
+
+static void record_add(MirrorRecord *record, const char *field, size_t max)
+{
+  size_t len = strnlen(field, max - 1);
+  if (record->length + len + 1 > MIRROR_MAX_DATA) return; /* não cabe */
+  memcpy(record->data + record->length, field, len);
+  record->data[record->length + len] = '\0';
+  record->length += len + 1;
+}
+
+static void record_add_number(MirrorRecord *record, uint64_t number)
+{
+  char text[24];
+  snprintf(text, sizeof(text), "%llu", (unsigned long long)number);
+  record_add(record, text, sizeof(text));
+}
+
+/**
+ * @brief Lê o próximo campo de um registro recebido.
+ *
+ * @return O campo, ou NULL se ele falta ou passa de max - 1 bytes.
+ */
+static const char *record_field(const char **cursor, const char *end,
+                                size_t max)
+{
+  const char *field = *cursor;
+  if (field >= end) return NULL;
+
+  const char *nul = memchr(field, '\0', end - field);
+  if (!nul || (size_t)(nul - field) >= max) return NULL;
+
+  *cursor = nul + 1;
+  return field;
+}
+
+static void record_user(MirrorRecord *record, const char *username,
+                        const char *hashed_password)
+{
+  record_init(record, MIRROR_USER, false);
+  record_add(record, username, MAX_USERNAME);
+  record_add(record, hashed_password, MIRROR_MAX_HASH);
+}
+
+static void record_group(MirrorRecord *record, const char *name,
+                         const char *creator, const char *password,
+                         bool channel)
+{
+  record_init(record, MIRROR_GROUP, channel);
+  record_add(record, name, MAX_GROUPNAME);
+  record_add(record, creator, MAX_USERNAME);
+  record_add(record, password, MAX_PASSWORD);
+}
+
+static void record_publisher(MirrorRecord *record, const char *groupname,
+                             const char *username, bool enabled)
+{
+  record_init(record, MIRROR_PUBLISHER, enabled);
+  record_add(record, groupname, MAX_GROUPNAME);
+  record_add(record, username, MAX_USERNAME);
+}
+
+static void record_seq(MirrorRecord *record, const char *groupname,
+                       uint64_t seq)
+{
+  record_init(record, MIRROR_SEQ, false);
+  record_add(record, groupname, MAX_GROUPNAME);
+  record_add_number(record, seq);
+}
+
+static void record_chat(MirrorRecord *record, const char *groupname,
+                        uint64_t seq, time_t timestamp, const char *username,
+                        const char *text)
+{
+  record_init(record, MIRROR_CHAT, false);
+  record_add(record, groupname, MAX_GROUPNAME);
+  record_add_number(record, seq);
+  record_add_number(record, (uint64_t)timestamp);
+  record_add(record, username, MAX_USERNAME);
+  record_add(record, text, MAX_BUFFER);
+}
+
+/**
+ * @brief Acrescenta um registro serializado ao buffer.
+ *
+ * @return false se falta memória.
+ */
+static bool buffer_append(MirrorBuffer *buffer, const MirrorRecord *record)
+{
+  size_t size = sizeof(MirrorHeader) + record->length;
+  if (buffer->length + size > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+    while (capacity < buffer->length + size) capacity *= 2;
+    char *data = realloc(buffer->data, capacity);
+    if (!data) return false;
+    buffer->data = data;
+    buffer->capacity = capacity;
+  }
+
+  MirrorHeader header = record->header;
+  header.length = htonl((uint32_t)record->length);
+  memcpy(buffer->data + buffer->length, &header, sizeof(header));
+  memcpy(buffer->data + buffer->length + sizeof(header), record->data,
+         record->length);
+  buffer->length += size;
+  return true;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t len)
+{
+  char *p = data;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_record(int fd, const MirrorRecord *record)
+{
+  MirrorHeader header = record->header;
+  header.length = htonl((uint32_t)record->length);
+  return write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, record->data, record->length);
+}
+
+/**
+ * @brief Lê um registro inteiro, esperando até o SO_RCVTIMEO do socket.
+ *
+ * @return false se a conexão caiu ou o registro não cabe em data.
+ */
+static bool read_record(int fd, MirrorHeader *header, char *data, size_t max,
+                        size_t *length)
+{
+  if (!read_all(fd, header, sizeof(*header))) return false;
+  *length = ntohl(header->length);
+  return *length <= max && read_all(fd, data, *length);
+}
+
+/**
+ * @brief Apresenta este lado ao outro antes de qualquer estado passar: cada
+ * um manda um MIRROR_HELLO com um nonce novo e responde ao do outro com a
+ * prova do segredo (MIRROR_AUTH). O primário e o standby provam com nomes
+ * diferentes, então um não serve a prova do outro.
+ *
+ * @param fd A conexão, com SO_RCVTIMEO.
+ * @param self "primary" ou "standby".
+ * @param other O nome com que o outro lado prova.
+ * @return false se o outro lado não provou o segredo.
+ */
+static bool handshake(int fd, const char *self, const char *other)
+{
+  char nonce[PEER_HEX], other_nonce[PEER_HEX], proof[PEER_HEX];
+  char data[2 * PEER_HEX];
+  MirrorRecord record;
+  MirrorHeader header;
+  size_t length;
+
+  peer_nonce(nonce);
+  record_init(&record, MIRROR_HELLO, false);
+  record_add(&record, nonce, PEER_HEX);
+  if (!write_record(fd, &record)) return false;
+
+  if (!read_record(fd, &header, data, sizeof(data), &length) ||
+      header.type != MIRROR_HELLO)
+    return false;
+  const char *cursor = data;
+  const char *field = record_field(&cursor, data + length, PEER_HEX);
+  if (!field) return false;
+  strcpy(other_nonce, field);
+
+  peer_proof("mirror", other_nonce, nonce, self, proof);
+  record_init(&record, MIRROR_AUTH, false);
+  record_add(&record, proof, PEER_HEX);
+  if (!write_record(fd, &record)) return false;
+
+  if (!read_record(fd, &header, data, sizeof(data), &length) ||
+      header.type != MIRROR_AUTH)
+    return false;
+  cursor = data;
+  field = record_field(&cursor, data + length, PEER_HEX);
+  return field && peer_verify("mirror", nonce, other_nonce, other, field);
+}
+
+/* ---- primário ---- */
+
+/**
+ * @brief Coloca um registro na fila de cada standby. Um standby cuja fila
+ * passa de MIRROR_QUEUE_BYTES é derrubado: ele está parado, e ao reconectar
+ * recebe um snapshot novo.
+ */
+static void feed(const MirrorRecord *record)
+{
+  pthread_mutex_lock(&feed_mutex);
+
+  for (Standby *standby = standbys; standby; standby = standby->next) {
+    if (standby->closing) continue;
+    if (standby->queue.length + sizeof(MirrorHeader) + record->length >
+            MIRROR_QUEUE_BYTES ||
+        !buffer_append(&standby->queue, record)) {
+      LOG_WARN("Standby %s fell behind, dropping it", standby->address);
+      standby->closing = true;
+      shutdown(standby->fd, SHUT_RDWR);
+    }
+    pthread_cond_signal(&standby->cond);
+  }
+
+  pthread_mutex_unlock(&feed_mutex);
+}
+
+/* O buffer de um snapshot e se ele coube na memória. */
+typedef struct {
+  MirrorBuffer buffer;
+  bool ok;
+} Snapshot;
+
+static void snapshot_user(const char *username, const char *hashed_password,
+                          void *arg)
+{
+  Snapshot *snapshot = arg;
+  MirrorRecord record;
+  record_user(&record, username, hashed_password);
+  snapshot->ok = snapshot->ok && buffer_append(&snapshot->buffer, &record);
+}
+
+/**
+ * @brief Serializa um grupo: criação, publicadores e o histórico que ele
+ * ainda guarda, entre duas sequências. Deve ser chamada com o mutex do grupo
+ * travado.
+ */
+static bool snapshot_group(MirrorBuffer *buffer, Group *group)
+{
+  MirrorRecord record;
+  bool ok = true;
+
+  record_group(&record, group->name, group->creator, group->password,
+               group->channel);
+  ok = ok && buffer_append(buffer, &record);
+
+  for (int i = 0; i < group->publisher_count; i++) {
+    record_publisher(&record, group->name, group->publishers[i], true);
+    ok = ok && buffer_append(buffer, &record);
+  }
+
+  record_seq(&record, group->name, group->history_first - 1);
+  ok = ok && buffer_append(buffer, &record);
+
+  for (uint64_t seq = group->history_first; seq <= group->seq && ok; seq++) {
+    GroupHistoryEntry *entry = &group->history[seq % GROUP_HISTORY];
+    if (!entry->text) continue;
+    record_chat(&record, group->name, seq, entry->timestamp, entry->username,
+                entry->text);
+    ok = buffer_append(buffer, &record);
+  }
+
+  record_seq(&record, group->name, group->seq);
+  return ok && buffer_append(buffer, &record);
+}
+
+/**
+ * @brief Monta o snapshot do estado para um standby que acabou de entrar na
+ * lista: o que muda enquanto ele é montado também vai para a fila, e
+ * aplicar de novo não muda nada.
+ *
+ * Só os nomes dos grupos são copiados com o mutex do GroupManager; cada
+ * grupo é serializado depois, com o seu mutex, então criar, apagar e achar
+ * grupos não espera pelo histórico de todos. Um grupo criado ou apagado no
+ * meio chega pela fila, na ordem certa em relação ao seu chat.
+ *
+ * @return false se falta memória.
+ */
+static bool build_snapshot(MirrorBuffer *buffer)
+{
+  Snapshot snapshot = {.buffer = *buffer, .ok = true};
+  if (!for_each_user(&database, snapshot_user, &snapshot)) snapshot.ok = false;
+
+  char names[MAX_GROUPS][MAX_GROUPNAME];
+  pthread_mutex_lock(&group_manager.mutex);
+  int count = group_manager.group_count;
+  for (int i = 0; i < count; i++)
+    memcpy(names[i], group_manager.list[i]->name, MAX_GROUPNAME);
+  pthread_mutex_unlock(&group_manager.mutex);
+
+  for (int i = 0; i < count && snapshot.ok; i++) {
+    Group *group = pin_group(&group_manager, names[i]);
+    if (!group) continue; /* apagado: o aviso está na fila */
+    pthread_mutex_lock(&group->mutex);
+    if (group->in_use)
+      snapshot.ok = snapshot_group(&snapshot.buffer, group);
+    pthread_mutex_unlock(&group->mutex);
+    unpin_group(group);
+  }
+
+  MirrorRecord synced;
+  record_init(&synced, MIRROR_SYNCED, false);
+  snapshot.ok = snapshot.ok && buffer_append(&snapshot.buffer, &synced);
+
+  *buffer = snapshot.buffer;
+  return snapshot.ok;
+}
+
+/**
+ * @brief Libera um standby e conta a sua thread como terminada.
+ */
+static void standby_exit(Standby *standby)
+{
+  close(standby->fd);
+  free(standby->queue.data);
+  pthread_cond_destroy(&standby->cond);
+  free(standby);
+
+  pthread_mutex_lock(&standby_mutex);
+  standby_threads--;
+  pthread_cond_broadcast(&standby_cond);
+  pthread_mutex_unlock(&standby_mutex);
+}
+
+/**
+ * @brief Thread de um standby: confere o segredo, manda o snapshot e depois
+ * a fila, tudo o que se acumulou numa escrita só, com um MIRROR_HEARTBEAT a
+ * cada MIRROR_HEARTBEAT_MS sem registros.
+ */
+static void *standby_loop(void *arg)
+{
+  Standby *standby = arg;
+
+  if (!handshake(standby->fd, "primary", "standby")) {
+    LOG_WARN("Standby %s failed to prove the shared secret",
+             standby->address);
+    standby_exit(standby);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&feed_mutex);
+  standby->next = standbys;
+  standbys = standby;
+  atomic_fetch_add(&standby_count, 1);
+  pthread_mutex_unlock(&feed_mutex);
+
+  MirrorBuffer batch = {0};
+  bool ok = build_snapshot(&batch) &&
+            write_all(standby->fd, batch.data, batch.length);
+  if (ok)
+    LOG_INFO("Standby %s: sent a %zu-byte snapshot", standby->address,
+             batch.length);
+  batch.length = 0;
+
+  pthread_mutex_lock(&feed_mutex);
+  while (ok && !standby->closing) {
+    if (standby->queue.length == 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += MIRROR_HEARTBEAT_MS / 1000;
+      deadline.tv_nsec += (MIRROR_HEARTBEAT_MS % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      if (pthread_cond_timedwait(&standby->cond, &feed_mutex, &deadline) ==
+              ETIMEDOUT &&
+          standby->queue.length == 0) {
+        MirrorRecord heartbeat;
+        record_init(&heartbeat, MIRROR_HEARTBEAT, false);
+        buffer_append(&standby->queue, &heartbeat);
+      }
+      continue;
+    }
+
+    MirrorBuffer pending = standby->queue;
+    standby->queue = batch;
+    batch = pending;
+    pthread_mutex_unlock(&feed_mutex);
+
+    ok = write_all(standby->fd, batch.data, batch.length);
+    batch.length = 0;
+
+    pthread_mutex_lock(&feed_mutex);
+  }
+
+  for (Standby **p = &standbys; *p; p = &(*p)->next) {
+    if (*p == standby) {
+      *p = standby->next;
+      break;
+    }
+  }
+  atomic_fetch_sub(&standby_count, 1);
+  pthread_mutex_unlock(&feed_mutex);
+
+  LOG_INFO("Standby %s disconnected", standby->address);
+  free(batch.data);
+  standby_exit(standby);
+  return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+  (void)arg;
+
+  while (atomic_load(&mirror_running)) {
+    struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+    if (poll(&pfd, 1, 100) <= 0) continue;
+
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    int fd = accept4(listen_fd, (struct sockaddr *)&peer, &peer_len,
+                     SOCK_CLOEXEC);
+    if (fd < 0) continue;
+
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+    if (!peer_allowed(&mirror_config.standbys, peer.sin_addr)) {
+      LOG_WARN("Standby %s refused: not a --standby host", ip);
+      close(fd);
+      continue;
+    }
+
+    Standby *standby = calloc(1, sizeof(Standby));
+    if (!standby) {
+      close(fd);
+      continue;
+    }
+    standby->fd = fd;
+    snprintf(standby->address, sizeof(standby->address), "%s:%d", ip,
+             ntohs(peer.sin_port));
+    pthread_cond_init(&standby->cond, NULL);
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    /* Quem conecta e não se apresenta não prende a thread. */
+    struct timeval timeout = {.tv_sec = MIRROR_TIMEOUT_MS / 1000,
+                              .tv_usec = (MIRROR_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    LOG_INFO("Standby %s connected", standby->address);
+
+    pthread_mutex_lock(&standby_mutex);
+    standby_threads++;
+    pthread_mutex_unlock(&standby_mutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, standby_loop, standby) != 0) {
+      close(fd);
+      pthread_cond_destroy(&standby->cond);
+      free(standby);
+      pthread_mutex_lock(&standby_mutex);
+      standby_threads--;
+      pthread_mutex_unlock(&standby_mutex);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  return NULL;
+}
+
+static int mirror_listen(const char *ip, int port)
+{
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_port = htons(port)};
+  if (inet_pton(AF_INET, ip, &address.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int opt = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, 4) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* ---- standby ---- */
+
+/**
+ * @brief Conecta a "host:porta", esperando até MIRROR_CONNECT_MS.
+ *
+ * @return O socket (bloqueante), ou -1.
+ */
+static int connect_primary(const char *address)
+{
+  char host[MIRROR_MAX_ADDRESS];
+  strncpy(host, address, sizeof(host) - 1);
+  host[sizeof(host) - 1] = '\0';
+  char *colon = strrchr(host, ':');
+  if (!colon) return -1;
+  *colon = '\0';
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *result;
+  if (getaddrinfo(host, colon + 1, &hints, &result) != 0) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd >= 0 &&
+      connect(fd, result->ai_addr, result->ai_addrlen) < 0 &&
+      errno != EINPROGRESS) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd < 0) return -1;
+
+  struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  if (poll(&pfd, 1, MIRROR_CONNECT_MS) != 1 ||
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 ||
+      error != 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* Um registro pela metade não prende o standby além do MIRROR_TIMEOUT_MS. */
+  struct timeval timeout = {.tv_sec = MIRROR_TIMEOUT_MS / 1000,
+                            .tv_usec = (MIRROR_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+}
+
+/**
+ * @brief Apaga todos os grupos, antes de um snapshot novo.
+ */
+static void reset_groups(void)
+{
+  char name[MAX_GROUPNAME], creator[MAX_USERNAME];
+
+  for (;;) {
+    pthread_mutex_lock(&group_manager.mutex);
+    bool empty = group_manager.group_count == 0;
+    if (!empty) {
+      memcpy(name, group_manager.list[0]->name, MAX_GROUPNAME);
+      memcpy(creator, group_manager.list[0]->creator, MAX_USERNAME);
+    }
+    pthread_mutex_unlock(&group_manager.mutex);
+
+    if (empty) return;
+    delete_group(&group_manager, name, creator);
+  }
+}
+
+/**
+ * @brief Aplica um registro do feed ao banco e ao GroupManager.
+ *
+ * @return false se o registro é inválido e o feed deve ser fechado.
+ */
+static bool apply(const MirrorHeader *header, const char *data, size_t length)
+{
+  const char *cursor = data, *end = data + length;
+
+  switch (header->type) {
+  case MIRROR_HEARTBEAT:
+  case MIRROR_SYNCED:
+    return true;
+
+  case MIRROR_USER: {
+    const char *username = record_field(&cursor, end, MAX_USERNAME);
+    const char *hashed = record_field(&cursor, end, MIRROR_MAX_HASH);
+    if (!username || !hashed) return false;
+    add_user(&database, username, hashed); /* já existe: nada muda */
+    return true;
+  }
+
+  case MIRROR_GROUP: {
+    const char *name = record_field(&cursor, end, MAX_GROUPNAME);
+    const char *creator = record_field(&cursor, end, MAX_USERNAME);
+    const char *password = record_field(&cursor, end, MAX_PASSWORD);
+    if (!name || !creator || !password) return false;
+    create_group(&group_manager, name, password, creator, header->flag);
+    return true;
+  }
+
+  case MIRROR_DELETE: {
+    const char *name = record_field(&cursor, end, MAX_GROUPNAME);
+    const char *creator = record_field(&cursor, end, MAX_USERNAME);
+    if (!name || !creator) return false;
+    delete_group(&group_manager, name, creator);
+    return true;
+  }
+
+  case MIRROR_PUBLISHER: {
+    const char *name = record_field(&cursor, end, MAX_GROUPNAME);
+    const char *username = record_field(&cursor, end, MAX_USERNAME);
+    if (!name || !username) return false;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+    set_channel_publisher(group, username, header->flag);
+    unpin_group(group);
+    return true;
+  }
+
+  case MIRROR_SEQ: {
+    const char *name = record_field(&cursor, end, MAX_GROUPNAME);
+    const char *seq = record_field(&cursor, end, 24);
+    if (!name || !seq) return false;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+    advance_group_seq(group, strtoull(seq, NULL, 10));
+    unpin_group(group);
+    return true;
+  }
+
+  case MIRROR_CHAT: {
+    const char *name = record_field(&cursor, end, MAX_GROUPNAME);
+    const char *seq = record_field(&cursor, end, 24);
+    const char *timestamp = record_field(&cursor, end, 24);
+    const char *username = record_field(&cursor, end, MAX_USERNAME);
+    const char *text = record_field(&cursor, end, MAX_BUFFER);
+    if (!name || !seq || !timestamp || !username || !text) return false;
+
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+
+    Message chat_msg;
+    memset(&chat_msg, 0, sizeof(Message));
+    chat_msg.type = CMD_MESSAGE;
+    chat_msg.seq = strtoull(seq, NULL, 10);
+    chat_msg.timestamp = (time_t)strtoll(timestamp, NULL, 10);
+    strcpy(chat_msg.groupname, name);
+    strcpy(chat_msg.username, username);
+    strcpy(chat_msg.message, text);
+    publish_to_group(group, &chat_msg);
+    unpin_group(group);
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Troca o estado pelo de um snapshot completo: apaga os grupos e
+ * aplica os registros guardados até o MIRROR_SYNCED.
+ *
+ * @param synced Fica false enquanto o estado está pela metade, e também se
+ * um registro for inválido.
+ * @return false se um registro é inválido.
+ */
+static bool apply_snapshot(const MirrorBuffer *staged, bool *synced)
+{
+  *synced = false;
+  reset_groups();
+
+  for (size_t offset = 0; offset < staged->length;) {
+    MirrorHeader header;
+    memcpy(&header, staged->data + offset, sizeof(header));
+    size_t length = ntohl(header.length);
+    const char *data = staged->data + offset + sizeof(header);
+    if (!apply(&header, data, length)) {
+      LOG_WARN("Invalid record type %d in the snapshot from primary %s",
+               header.type, mirror_config.primary);
+      return false;
+    }
+    offset += sizeof(header) + length;
+  }
+
+  *synced = true;
+  return true;
+}
+
+/**
+ * @brief Aplica o feed de um primário até ele cair, ficar mudo por
+ * MIRROR_TIMEOUT_MS ou o servidor ser interrompido.
+ *
+ * O snapshot é guardado inteiro antes de tocar no estado: se o primário cai
+ * no meio dele, o standby continua com o último snapshot completo, que é de
+ * onde ele pode assumir. Depois do MIRROR_SYNCED, cada registro é aplicado
+ * ao chegar.
+ *
+ * @param synced true enquanto o estado vem de um snapshot completo.
+ */
+static void apply_feed(int fd, volatile sig_atomic_t *running, bool *synced)
+{
+  MirrorRecord record;
+  MirrorBuffer staged = {0};
+  bool staging = true;
+  int idle_ms = 0;
+
+  while (*running) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, 100);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready < 0) break;
+    if (ready == 0) {
+      idle_ms += 100;
+      if (idle_ms < MIRROR_TIMEOUT_MS) continue;
+      LOG_WARN("Primary %s went silent", mirror_config.primary);
+      break;
+    }
+    idle_ms = 0;
+
+    if (!read_record(fd, &record.header, record.data, MIRROR_MAX_DATA,
+                     &record.length))
+      break;
+
+    if (staging && record.header.type != MIRROR_SYNCED) {
+      if (record.header.type == MIRROR_HEARTBEAT) continue;
+      if (!buffer_append(&staged, &record)) {
+        LOG_WARN("No memory for the snapshot from primary %s",
+                 mirror_config.primary);
+        break;
+      }
+    } else if (staging) {
+      staging = false;
+      if (!apply_snapshot(&staged, synced)) break;
+      free(staged.data);
+      staged = (MirrorBuffer){0};
+      LOG_INFO("In sync with primary %s: %d groups", mirror_config.primary,
+               group_manager.group_count);
+    } else if (!apply(&record.header, record.data, record.length)) {
+      LOG_WARN("Invalid record type %d from primary %s", record.header.type,
+               mirror_config.primary);
+      break;
+    }
+  }
+
+  free(staged.data);
+}
+
+/**
+ * @brief Espera até ms milissegundos, acordando antes se o servidor parar.
+ */
+static void follow_sleep(volatile sig_atomic_t *running, int ms)
+{
+  for (int waited = 0; waited < ms && *running; waited += 100) {
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 100 * 1000000L};
+    nanosleep(&pause, NULL);
+  }
+}
+
+/* ---- API ---- */
+
+bool mirror_follow(volatile sig_atomic_t *running)
+{
+  bool synced = false; /* algum snapshot completo */
+  int down_ms = 0;     /* desde a queda do último feed */
+  bool warned = false;
+  bool refused = false; /* já avisou que o primário não prova o segredo */
+
+  LOG_INFO("Standing by for primary %s", mirror_config.primary);
+
+  while (*running) {
+    int fd = connect_primary(mirror_config.primary);
+    if (fd >= 0 && !handshake(fd, "standby", "primary")) {
+      /* Ele está no ar, só não prova o segredo: não é hora de assumir. */
+      if (!refused)
+        LOG_WARN("Primary %s failed to prove the shared secret",
+                 mirror_config.primary);
+      close(fd);
+      down_ms = 0;
+      refused = true;
+    } else if (fd >= 0) {
+      refused = false;
+      LOG_INFO("Following primary %s", mirror_config.primary);
+      apply_feed(fd, running, &synced);
+      close(fd);
+      if (!*running) break;
+      LOG_WARN("Lost the feed from primary %s", mirror_config.primary);
+      down_ms = 0;
+      warned = false;
+    } else if (!warned) {
+      LOG_INFO("Primary %s unreachable, retrying every %d ms",
+               mirror_config.primary, MIRROR_RETRY_MS);
+      warned = true;
+    }
+
+    if (synced && down_ms >= mirror_config.failover_ms) {
+      LOG_WARN("Primary %s down for %d ms, taking over",
+               mirror_config.primary, down_ms);
+      return true;
+    }
+
+    follow_sleep(running, MIRROR_RETRY_MS);
+    down_ms += MIRROR_RETRY_MS;
+  }
+
+  return false;
+}
+
+bool mirror_allow_standby(const char *host)
+{
+  return peer_allow(&mirror_config.standbys, host);
+}
+
+bool mirror_start(const char *ip)
+{
+  if (mirror_config.port == 0) return true;
+  if (!peer_has_secret()) {
+    LOG_ERROR("The mirror port needs a shared secret (--secret-file)");
+    return false;
+  }
+
+  listen_fd = mirror_listen(ip, mirror_config.port);
+  if (listen_fd < 0) {
+    LOG_ERROR("Mirror port %s:%d: %s", ip, mirror_config.port,
+              strerror(errno));
+    return false;
+  }
+
+  atomic_store(&mirror_running, true);
+  if (pthread_create(&accept_thread, NULL, accept_loop, NULL) != 0) {
+    atomic_store(&mirror_running, false);
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  LOG_INFO("Accepting standbys on %s:%d (%d allowed hosts)", ip,
+           mirror_config.port, mirror_config.standbys.count);
+  return true;
+}
+
+void mirror_stop(void)
+{
+  if (listen_fd < 0) return;
+
+  atomic_store(&mirror_running, false);
+  pthread_join(accept_thread, NULL);
+  close(listen_fd);
+  listen_fd = -1;
+
+  pthread_mutex_lock(&feed_mutex);
+  for (Standby *standby = standbys; standby; standby = standby->next) {
+    standby->closing = true;
+    shutdown(standby->fd, SHUT_RDWR);
+    pthread_cond_signal(&standby->cond);
+  }
+  pthread_mutex_unlock(&feed_mutex);
+
+  pthread_mutex_lock(&standby_mutex);
+  while (standby_threads > 0)
+    pthread_cond_wait(&standby_cond, &standby_mutex);
+  pthread_mutex_unlock(&standby_mutex);
+}
+
+void mirror_user(const char *username, const char *hashed_password)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_user(&record, username, hashed_password);
+  feed(&record);
+}
+
+void mirror_group(const char *name, const char *creator, const char *password,
+                  bool channel)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_group(&record, name, creator, password, channel);
+  feed(&record);
+}
+
+void mirror_group_deleted(const char *name, const char *creator)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_init(&record, MIRROR_DELETE, false);
+  record_add(&record, name, MAX_GROUPNAME);
+  record_add(&record, creator, MAX_USERNAME);
+  feed(&record);
+}
+
+void mirror_publisher(const char *groupname, const char *username,
+                      bool enabled)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_publisher(&record, groupname, username, enabled);
+  feed(&record);
+}
+
+void mirror_seq(const char *groupname, uint64_t seq)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_seq(&record, groupname, seq);
+  feed(&record);
+}
+
+void mirror_chat(const char *groupname, const Message *msg)
+{
+  if (atomic_load(&standby_count) == 0) return;
+
+  MirrorRecord record;
+  record_chat(&record, groupname, msg->seq, msg->timestamp, msg->username,
+              msg->message);
+  feed(&record);
+}
@@ -0,0 +1,693 @@
+#include "../../include/outbound.h"
+#include "../../include/log.h"
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+OutboundConfig outbound_config = {.budget = OUTBOUND_DEFAULT_BUDGET,
+                                  .policy = SLOW_COALESCE,
+                                  .grace_ms = OUTBOUND_DEFAULT_GRACE_MS};
+
+static const char *policy_names[] = {
+    [SLOW_DROP] = "drop",
+    [SLOW_COALESCE] = "coalesce",
+    [SLOW_DISCONNECT] = "disconnect",
+};
+
+/* Fila de saída de uma conexão: um anel de frames completos. O primeiro pode
+ * estar parcialmente escrito (head_offset). */
+typedef struct {
+  pthread_mutex_t mutex;
+  int sockfd;
+  int wake_fd;           /* eventfd de outbound_wake() */
+  _Atomic bool waiting;  /* a thread da conexão vai dormir ou está dormindo */
+  char username[MAX_USERNAME];
+  Message *frames; /* alocado no primeiro frame que não coube no socket */
+  size_t capacity; /* orçamento, em frames */
+  size_t head;
+  size_t count;
+  size_t head_offset;
+  int marker;      /* posição do aviso de coalesce na fila, -1 se nenhum */
+  uint64_t missed; /* chats resumidos no aviso */
+  char marker_group[MAX_GROUPNAME]; /* grupo dos chats resumidos */
+  uint64_t marker_seq;              /* maior sequência resumida */
+  uint64_t full_since_ns; /* 0 = a fila não está cheia */
+  uint64_t lagging_since_ns; /* 0 = em dia com os anéis dos grupos */
+  bool blocked; /* o último outbound_writev() não coube no socket */
+  bool failed;
+
+  /* Métricas para nomear os consumidores lentos. */
+  size_t peak;
+  uint64_t dropped;
+  uint64_t reported_dropped;
+} OutboundConn;
+
+static pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+static OutboundConn *registry[OUTBOUND_MAX_FDS];
+static int registry_end = 0; /* maior descritor registrado + 1 */
+
+static uint64_t monotonic_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+bool slow_policy_from_string(const char *name, SlowPolicy *policy)
+{
+  for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+    if (strcmp(name, policy_names[i]) == 0) {
+      *policy = (SlowPolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char *conn_name(const OutboundConn *conn)
+{
+  return conn->username[0] ? conn->username : "(not logged in)";
+}
+
+/**
+ * @brief Busca a fila da conexão e a retorna travada. O lock do registro é
+ * mantido até a fila estar travada, para que outbound_close() não a libere
+ * no meio do caminho.
+ */
+static OutboundConn *lock_conn(int sockfd)
+{
+  if (sockfd < 0 || sockfd >= OUTBOUND_MAX_FDS) return NULL;
+
+  pthread_rwlock_rdlock(&registry_lock);
+  OutboundConn *conn = registry[sockfd];
+  if (conn) pthread_mutex_lock(&conn->mutex);
+  pthread_rwlock_unlock(&registry_lock);
+
+  return conn;
+}
+
+static Message *frame_at(OutboundConn *conn, size_t index)
+{
+  return &conn->frames[(conn->head + index) % conn->capacity];
+}
+
+static size_t queued_bytes(const OutboundConn *conn)
+{
+  return conn->count * sizeof(Message) - conn->head_offset;
+}
+
+static void pop_front(OutboundConn *conn)
+{
+  conn->head = (conn->head + 1) % conn->capacity;
+  conn->count--;
+  conn->head_offset = 0;
+  if (conn->marker >= 0) conn->marker--;
+}
+
+static void remove_at(OutboundConn *conn, size_t index)
+{
+  for (size_t i = index; i + 1 < conn->count; i++) {
+    *frame_at(conn, i) = *frame_at(conn, i + 1);
+  }
+  conn->count--;
+  if (conn->marker > (int)index) conn->marker--;
+}
+
+static bool append(OutboundConn *conn, const Message *msg, size_t written)
+{
+  if (!conn->frames) {
+    conn->frames = malloc(conn->capacity * sizeof(Message));
+    if (!conn->frames) return false;
+  }
+
+  *frame_at(conn, conn->count) = *msg;
+  if (conn->count++ == 0) conn->head_offset = written;
+  if (conn->count > conn->peak) conn->peak = conn->count;
+  return true;
+}
+
+/**
+ * @brief Escreve o que couber da fila no socket, sem bloquear.
+ *
+ * @return false se o socket falhou.
+ */
+static bool write_queue(OutboundConn *conn)
+{
+  while (conn->count > 0) {
+    const char *data = (const char *)frame_at(conn, 0) + conn->head_offset;
+    ssize_t n = send(conn->sockfd, data, sizeof(Message) - conn->head_offset,
+                     MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      conn->failed = true;
+      return false;
+    }
+
+    conn->head_offset += n;
+    if (conn->head_offset == sizeof(Message)) pop_front(conn);
+  }
+
+  if (conn->full_since_ns != 0 && conn->count <= conn->capacity / 2) {
+    LOG_INFO("Slow consumer %s (fd %d) caught up, %llu frames dropped so far",
+             conn_name(conn), conn->sockfd,
+             (unsigned long long)conn->dropped);
+    conn->full_since_ns = 0;
+  }
+  return true;
+}
+
+/**
+ * @brief Acha o primeiro chat da fila a partir de 'from', de qualquer grupo
+ * (groupname NULL) ou só do grupo dado.
+ */
+static int find_chat(OutboundConn *conn, size_t from, const char *groupname)
+{
+  for (size_t i = from; i < conn->count; i++) {
+    const Message *frame = frame_at(conn, i);
+    if (frame->type == CMD_MESSAGE &&
+        (!groupname ||
+         strncmp(frame->groupname, groupname, MAX_GROUPNAME) == 0))
+      return (int)i;
+  }
+  return -1;
+}
+
+/**
+ * @brief Começa o aviso de coalesce de um grupo. Cada aviso resume um só
+ * grupo: o cliente (whisp.h) toma a sequência do aviso como entregue e não
+ * pede a retransmissão do que foi descartado.
+ */
+static void start_marker(OutboundConn *conn, int position,
+                         const char *groupname)
+{
+  conn->marker = position;
+  conn->missed = 0;
+  conn->marker_seq = 0;
+  memcpy(conn->marker_group, groupname, MAX_GROUPNAME);
+  conn->marker_group[MAX_GROUPNAME - 1] = '\0';
+}
+
+static bool marker_matches(const OutboundConn *conn, const char *groupname)
+{
+  return conn->marker >= 0 &&
+         strncmp(conn->marker_group, groupname, MAX_GROUPNAME) == 0;
+}
+
+static void update_marker(OutboundConn *conn)
+{
+  Message *marker = frame_at(conn, conn->marker);
+  memset(marker, 0, sizeof(Message));
+  marker->type = CMD_NOTIFICATION;
+  marker->timestamp = time(NULL);
+  marker->seq = conn->marker_seq;
+  memcpy(marker->groupname, conn->marker_group, MAX_GROUPNAME);
+  if (conn->marker_group[0])
+    snprintf(marker->message, MAX_BUFFER,
+             "You missed %llu messages in '%s' (connection too slow)",
+             (unsigned long long)conn->missed, conn->marker_group);
+  else
+    snprintf(marker->message, MAX_BUFFER,
+             "You missed %llu messages (connection too slow)",
+             (unsigned long long)conn->missed);
+}
+
+/**
+ * @brief Derruba a conexão se a fila está cheia, ou a conexão atrasada nos
+ * anéis dos grupos, há mais que o período de tolerância (SLOW_DISCONNECT).
+ * O shutdown() faz a thread da conexão sair do recv() e encerrar a sessão
+ * normalmente.
+ */
+static void check_grace(OutboundConn *conn, uint64_t now)
+{
+  uint64_t since = conn->full_since_ns;
+  if (conn->lagging_since_ns != 0 &&
+      (since == 0 || conn->lagging_since_ns < since))
+    since = conn->lagging_since_ns;
+
+  if (outbound_config.policy != SLOW_DISCONNECT || conn->failed ||
+      since == 0 ||
+      now - since < (uint64_t)outbound_config.grace_ms * 1000000)
+    return;
+
+  LOG_WARN("Disconnecting slow consumer %s (fd %d): behind for %d ms, "
+           "%llu frames dropped",
+           conn_name(conn), conn->sockfd, outbound_config.grace_ms,
+           (unsigned long long)conn->dropped);
+  conn->failed = true;
+  shutdown(conn->sockfd, SHUT_RDWR);
+}
+
+/**
+ * @brief Abre espaço na fila cheia conforme a política, descartando o chat
+ * mais antigo (nunca o frame que está sendo escrito).
+ *
+ * @return false se não há o que descartar e o frame novo deve ser perdido.
+ */
+static bool make_room(OutboundConn *conn)
+{
+  uint64_t now = monotonic_ns();
+  if (conn->full_since_ns == 0) {
+    conn->full_since_ns = now;
+    LOG_WARN("Slow consumer %s (fd %d): %zu bytes queued, applying '%s'",
+             conn_name(conn), conn->sockfd, queued_bytes(conn),
+             policy_names[outbound_config.policy]);
+  }
+
+  if (outbound_config.policy == SLOW_DISCONNECT) {
+    check_grace(conn, now);
+    return false;
+  }
+
+  /* O aviso anterior já começou a ser escrito: os próximos descartes vão
+   * para um aviso novo. */
+  if (conn->marker == 0 && conn->head_offset > 0) conn->marker = -1;
+
+  int victim = find_chat(conn, conn->head_offset > 0 ? 1 : 0, NULL);
+  if (victim < 0) return false;
+
+  if (outbound_config.policy == SLOW_COALESCE &&
+      !marker_matches(conn, frame_at(conn, victim)->groupname)) {
+    /* O chat mais antigo vira o aviso do seu grupo; o seguinte do mesmo
+     * grupo é que abre espaço. */
+    const Message *oldest = frame_at(conn, victim);
+    uint64_t seq = oldest->seq;
+    start_marker(conn, victim, oldest->groupname);
+    conn->missed = 1;
+    conn->marker_seq = seq;
+    conn->dropped++;
+    update_marker(conn);
+
+    victim = find_chat(conn, victim + 1, conn->marker_group);
+    if (victim < 0) return false;
+  }
+
+  uint64_t seq = frame_at(conn, victim)->seq;
+  conn->dropped++;
+  remove_at(conn, victim);
+  if (outbound_config.policy == SLOW_COALESCE) {
+    conn->missed++;
+    if (seq > conn->marker_seq) conn->marker_seq = seq;
+    update_marker(conn);
+  }
+  return true;
+}
+
+/**
+ * @brief Envia a mensagem direto se a fila está vazia, ou a enfileira. Deve
+ * ser chamada com a fila travada.
+ */
+static int send_locked(OutboundConn *conn, const Message *msg)
+{
+  if (conn->failed) return -1;
+
+  if (conn->count == 0) {
+    ssize_t n;
+    do {
+      n = send(conn->sockfd, msg, sizeof(Message), MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n == (ssize_t)sizeof(Message)) return 0;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      conn->failed = true;
+      return -1;
+    }
+    return append(conn, msg, n < 0 ? 0 : (size_t)n) ? 0 : -1;
+  }
+
+  if (!write_queue(conn)) return -1;
+
+  if (conn->count >= conn->capacity && !make_room(conn)) {
+    conn->dropped++;
+    if (msg->type == CMD_MESSAGE && conn->marker >= 0) {
+      conn->missed++;
+      update_marker(conn);
+    }
+    return -1;
+  }
+
+  return append(conn, msg, 0) ? 0 : -1;
+}
+
+static void destroy_conn(OutboundConn *conn)
+{
+  pthread_mutex_destroy(&conn->mutex);
+  close(conn->wake_fd);
+  free(conn->frames);
+  free(conn);
+}
+
+/**
+ * @brief Cria a fila de uma conexão, ainda fora do registro.
+ */
+static OutboundConn *create_conn(int sockfd)
+{
+  if (sockfd < 0 || sockfd >= OUTBOUND_MAX_FDS) return NULL;
+
+  OutboundConn *conn = calloc(1, sizeof(OutboundConn));
+  if (!conn) return NULL;
+
+  conn->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (conn->wake_fd < 0) {
+    free(conn);
+    return NULL;
+  }
+
+  pthread_mutex_init(&conn->mutex, NULL);
+  conn->sockfd = sockfd;
+  atomic_init(&conn->waiting, false);
+  conn->marker = -1;
+  conn->capacity = outbound_config.budget / sizeof(Message);
+  if (conn->capacity < 2) conn->capacity = 2;
+  return conn;
+}
+
+static void register_conn(OutboundConn *conn)
+{
+  pthread_rwlock_wrlock(&registry_lock);
+  registry[conn->sockfd] = conn;
+  if (conn->sockfd >= registry_end) registry_end = conn->sockfd + 1;
+  pthread_rwlock_unlock(&registry_lock);
+}
+
+bool outbound_open(int sockfd)
+{
+  OutboundConn *conn = create_conn(sockfd);
+  if (!conn) return false;
+
+  register_conn(conn);
+  return true;
+}
+
+bool outbound_adopt(int sockfd, const Message *frames, size_t count,
+                    size_t head_offset)
+{
+  OutboundConn *conn = create_conn(sockfd);
+  if (!conn) return false;
+
+  /* Ninguém vê a fila antes do registro, então ela é montada sem lock. */
+  if (count > conn->capacity) conn->capacity = count;
+  for (size_t i = 0; i < count; i++) {
+    if (!append(conn, &frames[i], i == 0 ? head_offset : 0)) {
+      destroy_conn(conn);
+      return false;
+    }
+  }
+
+  register_conn(conn);
+  return true;
+}
+
+void outbound_close(int sockfd)
+{
+  if (sockfd < 0 || sockfd >= OUTBOUND_MAX_FDS) return;
+
+  pthread_rwlock_wrlock(&registry_lock);
+  OutboundConn *conn = registry[sockfd];
+  registry[sockfd] = NULL;
+  pthread_rwlock_unlock(&registry_lock);
+
+  if (!conn) return;
+
+  /* Espera quem ainda está enviando para esta fila. */
+  pthread_mutex_lock(&conn->mutex);
+  if (conn->dropped > 0)
+    LOG_INFO("Connection of %s (fd %d) closed with %llu frames dropped",
+             conn_name(conn), sockfd, (unsigned long long)conn->dropped);
+  pthread_mutex_unlock(&conn->mutex);
+
+  destroy_conn(conn);
+}
+
+void outbound_set_name(int sockfd, const char *username)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return;
+
+  strncpy(conn->username, username, MAX_USERNAME - 1);
+  conn->username[MAX_USERNAME - 1] = '\0';
+  pthread_mutex_unlock(&conn->mutex);
+}
+
+int outbound_send(int sockfd, const Message *msg)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return -1;
+
+  int result = send_locked(conn, msg);
+  pthread_mutex_unlock(&conn->mutex);
+  return result;
+}
+
+size_t outbound_space(int sockfd)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return 0;
+
+  size_t space = conn->capacity - conn->count;
+  pthread_mutex_unlock(&conn->mutex);
+  return space;
+}
+
+int outbound_writev(int sockfd, const Message *const *frames, int count)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return -1;
+
+  int consumed = 0;
+  if (conn->failed || (conn->count > 0 && !write_queue(conn))) {
+    consumed = -1;
+  } else if (conn->count == 0 && count > 0) {
+    struct iovec iov[OUTBOUND_WRITEV_MAX];
+    if (count > OUTBOUND_WRITEV_MAX) count = OUTBOUND_WRITEV_MAX;
+    for (int i = 0; i < count; i++) {
+      iov[i].iov_base = (void *)frames[i];
+      iov[i].iov_len = sizeof(Message);
+    }
+
+    ssize_t n;
+    do {
+      n = writev(sockfd, iov, count);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      conn->failed = true;
+      consumed = -1;
+    } else if (n > 0) {
+      consumed = (int)(n / sizeof(Message));
+      size_t written = (size_t)n % sizeof(Message);
+      if (written > 0 && append(conn, frames[consumed], written)) consumed++;
+    }
+    conn->blocked = consumed >= 0 && consumed < count;
+  }
+
+  pthread_mutex_unlock(&conn->mutex);
+  return consumed;
+}
+
+uint64_t outbound_lagging(int sockfd, uint64_t lag, uint64_t limit)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return 0;
+
+  uint64_t skip = 0;
+  if (lag <= limit) {
+    if (conn->lagging_since_ns != 0 && lag <= limit / 2) {
+      LOG_INFO("Slow consumer %s (fd %d) caught up, %llu frames dropped so far",
+               conn_name(conn), conn->sockfd,
+               (unsigned long long)conn->dropped);
+      conn->lagging_since_ns = 0;
+    }
+    pthread_mutex_unlock(&conn->mutex);
+    return 0;
+  }
+
+  uint64_t now = monotonic_ns();
+  if (conn->lagging_since_ns == 0) {
+    conn->lagging_since_ns = now;
+    LOG_WARN("Slow consumer %s (fd %d): %llu frames behind, applying '%s'",
+             conn_name(conn), conn->sockfd, (unsigned long long)lag,
+             policy_names[outbound_config.policy]);
+  }
+
+  if (outbound_config.policy == SLOW_DISCONNECT) {
+    check_grace(conn, now);
+  } else {
+    skip = lag - limit;
+    conn->dropped += skip;
+  }
+
+  /* Os descartes somam no aviso ainda não escrito ou num novo, no fim da
+   * fila, que sai antes dos próximos frames do anel. */
+  if (outbound_config.policy == SLOW_COALESCE) {
+    if (conn->marker == 0 && conn->head_offset > 0) conn->marker = -1;
+    if (conn->marker < 0 && conn->count < conn->capacity) {
+      Message notice;
+      memset(&notice, 0, sizeof(Message));
+      if (append(conn, &notice, 0)) {
+        conn->marker = (int)conn->count - 1;
+        conn->missed = 0;
+      }
+    }
+    if (conn->marker >= 0) {
+      conn->missed += skip;
+      update_marker(conn);
+    }
+  }
+
+  pthread_mutex_unlock(&conn->mutex);
+  return skip;
+}
+
+void outbound_fail(int sockfd, const char *reason)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return;
+
+  if (!conn->failed) {
+    LOG_WARN("Disconnecting %s (fd %d): %s", conn_name(conn), sockfd, reason);
+    conn->failed = true;
+    shutdown(sockfd, SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&conn->mutex);
+}
+
+void outbound_wake(int sockfd)
+{
+  if (sockfd < 0 || sockfd >= OUTBOUND_MAX_FDS) return;
+
+  pthread_rwlock_rdlock(&registry_lock);
+  OutboundConn *conn = registry[sockfd];
+  if (conn && atomic_exchange(&conn->waiting, false)) {
+    uint64_t one = 1;
+    ssize_t n = write(conn->wake_fd, &one, sizeof(one));
+    (void)n;
+  }
+  pthread_rwlock_unlock(&registry_lock);
+}
+
+void outbound_wait(int sockfd, int timeout_ms, bool (*idle)(void))
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return;
+  bool pending = conn->count > 0 || conn->blocked;
+  pthread_mutex_unlock(&conn->mutex);
+
+  /* Só esta thread fecha a fila, então 'conn' continua válida. A espera é
+   * anunciada antes de idle(): um outbound_wake() depois disso escreve no
+   * eventfd e o poll() não dorme. Com a fila pendente ou o socket cheio, o
+   * POLLOUT já acorda a thread quando há o que fazer. */
+  atomic_store(&conn->waiting, true);
+  if (!pending && idle && !idle()) {
+    atomic_store(&conn->waiting, false);
+    return;
+  }
+
+  struct pollfd pfds[2] = {
+      {.fd = sockfd, .events = POLLIN | (pending ? POLLOUT : 0)},
+      {.fd = conn->wake_fd, .events = POLLIN},
+  };
+  poll(pfds, 2, timeout_ms);
+
+  /* A próxima escrita do anel descobre se o socket ainda está cheio. */
+  pthread_mutex_lock(&conn->mutex);
+  conn->blocked = false;
+  pthread_mutex_unlock(&conn->mutex);
+
+  uint64_t wakeups;
+  ssize_t n = read(conn->wake_fd, &wakeups, sizeof(wakeups));
+  (void)n;
+  atomic_store(&conn->waiting, false);
+}
+
+int outbound_reply(int sockfd, const Message *msg)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return -1;
+
+  uint64_t deadline =
+      monotonic_ns() + (uint64_t)OUTBOUND_REPLY_TIMEOUT_MS * 1000000;
+  while (!conn->failed && conn->count >= conn->capacity) {
+    if (!write_queue(conn) || conn->count < conn->capacity) break;
+
+    uint64_t now = monotonic_ns();
+    if (now >= deadline) break;
+
+    /* Só a thread da conexão chama esta função, então a fila não é liberada
+     * enquanto esperamos sem o lock. */
+    pthread_mutex_unlock(&conn->mutex);
+    struct pollfd pfd = {.fd = sockfd, .events = POLLOUT};
+    poll(&pfd, 1, (int)((deadline - now) / 1000000) + 1);
+    pthread_mutex_lock(&conn->mutex);
+  }
+
+  int result = send_locked(conn, msg);
+  pthread_mutex_unlock(&conn->mutex);
+  return result;
+}
+
+int outbound_flush(int sockfd)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return -1;
+
+  if (conn->count > 0) write_queue(conn);
+  check_grace(conn, monotonic_ns());
+
+  int result = conn->failed ? -1 : 0;
+  pthread_mutex_unlock(&conn->mutex);
+  return result;
+}
+
+bool outbound_pending(int sockfd)
+{
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return false;
+
+  bool pending = conn->count > 0;
+  pthread_mutex_unlock(&conn->mutex);
+  return pending;
+}
+
+size_t outbound_export(int sockfd, Message **frames, size_t *head_offset)
+{
+  *frames = NULL;
+  *head_offset = 0;
+
+  OutboundConn *conn = lock_conn(sockfd);
+  if (!conn) return 0;
+
+  size_t count = conn->count;
+  if (count > 0) *frames = malloc(count * sizeof(Message));
+  if (!*frames) count = 0;
+
+  for (size_t i = 0; i < count; i++) (*frames)[i] = *frame_at(conn, i);
+  if (count > 0) *head_offset = conn->head_offset;
+
+  pthread_mutex_unlock(&conn->mutex);
+  return count;
+}
+
+void outbound_report(void)
+{
+  pthread_rwlock_rdlock(&registry_lock);
+
+  for (int fd = 0; fd < registry_end; fd++) {
+    OutboundConn *conn = registry[fd];
+    if (!conn) continue;
+
+    pthread_mutex_lock(&conn->mutex);
+    uint64_t dropped = conn->dropped - conn->reported_dropped;
+    if (dropped > 0 || conn->count > conn->capacity / 2)
+      LOG_WARN("Slow consumer %s (fd %d): %zu bytes queued (peak %zu), "
+               "%llu frames dropped (%llu since last report)",
+               conn_name(conn), fd, queued_bytes(conn),
+               conn->peak * sizeof(Message),
+               (unsigned long long)conn->dropped, (unsigned long long)dropped);
+    conn->reported_dropped = conn->dropped;
+    pthread_mutex_unlock(&conn->mutex);
+  }
+
+  pthread_rwlock_unlock(&registry_lock);
+}
@@ -0,0 +1,135 @@
+#include "../../include/peer.h"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#define PEER_NONCE_BYTES 32
+
+static unsigned char secret[PEER_SECRET_MAX];
+static size_t secret_length = 0;
+
+/**
+ * @brief Escreve bytes em hexadecimal, terminando com '\0'.
+ */
+static void to_hex(const unsigned char *bytes, size_t count, char *out)
+{
+  for (size_t i = 0; i < count; i++) sprintf(out + i * 2, "%02x", bytes[i]);
+  out[count * 2] = '\0';
+}
+
+bool peer_load_secret(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) return false;
+
+  size_t length = fread(secret, 1, sizeof(secret), file);
+  bool whole = feof(file) && !ferror(file);
+  fclose(file);
+
+  while (length > 0 &&
+         (secret[length - 1] == '\n' || secret[length - 1] == '\r'))
+    length--;
+  if (!whole || length < PEER_SECRET_MIN) {
+    OPENSSL_cleanse(secret, sizeof(secret));
+    return false;
+  }
+
+  secret_length = length;
+  return true;
+}
+
+bool peer_has_secret(void)
+{
+  return secret_length > 0;
+}
+
+bool peer_allow(PeerAllowlist *list, const char *host)
+{
+  char name[NI_MAXHOST];
+  strncpy(name, host, sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  char *colon = strrchr(name, ':');
+  if (colon) *colon = '\0';
+  if (name[0] == '\0') return false;
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *result;
+  if (getaddrinfo(name, NULL, &hints, &result) != 0) return false;
+
+  bool ok = true;
+  for (struct addrinfo *ai = result; ai && ok; ai = ai->ai_next) {
+    struct in_addr address = ((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+    if (peer_allowed(list, address)) continue;
+    if (list->count >= PEER_MAX_ALLOWED)
+      ok = false;
+    else
+      list->addresses[list->count++] = address;
+  }
+  freeaddrinfo(result);
+  return ok;
+}
+
+bool peer_allowed(const PeerAllowlist *list, struct in_addr address)
+{
+  for (int i = 0; i < list->count; i++) {
+    if (list->addresses[i].s_addr == address.s_addr) return true;
+  }
+  return false;
+}
+
+void peer_nonce(char nonce[PEER_HEX])
+{
+  unsigned char bytes[PEER_NONCE_BYTES];
+  if (RAND_bytes(bytes, sizeof(bytes)) != 1) {
+    /* Sem entropia não há nonce que preste: nenhuma prova vai conferir. */
+    memset(nonce, 0, PEER_HEX);
+    return;
+  }
+  to_hex(bytes, sizeof(bytes), nonce);
+}
+
+void peer_proof(const char *context, const char *verifier_nonce,
+                const char *prover_nonce, const char *prover,
+                char proof[PEER_HEX])
+{
+  /* Os campos vão com o '\0', para que não se confundam as fronteiras. */
+  unsigned char message[16 + 2 * PEER_HEX + MAX_USERNAME];
+  size_t length = 0;
+  const char *fields[] = {context, verifier_nonce, prover_nonce, prover};
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    size_t field = strlen(fields[i]) + 1;
+    if (length + field > sizeof(message)) {
+      memset(proof, 0, PEER_HEX);
+      return;
+    }
+    memcpy(message + length, fields[i], field);
+    length += field;
+  }
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_length = 0;
+  if (secret_length == 0 ||
+      !HMAC(EVP_sha256(), secret, (int)secret_length, message, length, digest,
+            &digest_length)) {
+    memset(proof, 0, PEER_HEX);
+    return;
+  }
+  to_hex(digest, digest_length, proof);
+}
+
+bool peer_verify(const char *context, const char *verifier_nonce,
+                 const char *prover_nonce, const char *prover,
+                 const char *proof)
+{
+  if (strlen(verifier_nonce) != PEER_HEX - 1 ||
+      strlen(prover_nonce) != PEER_HEX - 1 ||
+      strcmp(verifier_nonce, prover_nonce) == 0 ||
+      strlen(proof) != PEER_HEX - 1)
+    return false;
+
+  char expected[PEER_HEX];
+  peer_proof(context, verifier_nonce, prover_nonce, prover, expected);
+  return expected[0] != '\0' &&
+         CRYPTO_memcmp(expected, proof, PEER_HEX - 1) == 0;
+}
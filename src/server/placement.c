@@ -0,0 +1,82 @@
+#include "../../include/placement.h"
+
+typedef struct {
+  uint32_t point;
+  int id;
+} PlacementPoint;
+
+static pthread_rwlock_t placement_lock = PTHREAD_RWLOCK_INITIALIZER;
+static PlacementPoint points[PLACEMENT_MAX_NODES * PLACEMENT_VNODES];
+static int point_count = 0;
+
+/* FNV-1a seguido do finalizador do murmur3, que espalha os nomes parecidos
+ * ("sala1", "sala2") pelo anel. */
+static uint32_t placement_hash(const char *text)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *p = text; *p; p++) {
+    hash ^= (unsigned char)*p;
+    hash *= 16777619u;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+static int compare_points(const void *a, const void *b)
+{
+  const PlacementPoint *left = a, *right = b;
+  if (left->point != right->point) return left->point < right->point ? -1 : 1;
+  return left->id - right->id;
+}
+
+void placement_set(const char (*names)[MAX_USERNAME], const int *ids,
+                   int count)
+{
+  if (count > PLACEMENT_MAX_NODES) count = PLACEMENT_MAX_NODES;
+
+  PlacementPoint ring[PLACEMENT_MAX_NODES * PLACEMENT_VNODES];
+  int ring_count = 0;
+  char label[MAX_USERNAME + 8];
+
+  for (int n = 0; n < count; n++) {
+    for (int v = 0; v < PLACEMENT_VNODES; v++) {
+      snprintf(label, sizeof(label), "%s#%d", names[n], v);
+      ring[ring_count++] =
+          (PlacementPoint){.point = placement_hash(label), .id = ids[n]};
+    }
+  }
+  qsort(ring, ring_count, sizeof(PlacementPoint), compare_points);
+
+  pthread_rwlock_wrlock(&placement_lock);
+  memcpy(points, ring, sizeof(PlacementPoint) * ring_count);
+  point_count = ring_count;
+  pthread_rwlock_unlock(&placement_lock);
+}
+
+int placement_owner(const char *groupname)
+{
+  uint32_t hash = placement_hash(groupname);
+  int owner = PLACEMENT_SELF;
+
+  pthread_rwlock_rdlock(&placement_lock);
+  if (point_count > 0) {
+    /* Primeiro ponto >= hash, dando a volta no fim do anel. */
+    int low = 0, high = point_count;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (points[mid].point < hash)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    owner = points[low == point_count ? 0 : low].id;
+  }
+  pthread_rwlock_unlock(&placement_lock);
+
+  return owner;
+}
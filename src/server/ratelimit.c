@@ -0,0 +1,151 @@
+#include "../../include/ratelimit.h"
+
+/* Padrões folgados para uso normal, mas que impedem uma única sessão de
+ * ocupar o fanout do servidor ou de testar senhas sem parar. */
+RateConfig rate_config = {
+    .connection = {.rate = 200, .burst = 400},
+    .command = {[CMD_REGISTER] = {.rate = 2, .burst = 5},
+                [CMD_LOGIN] = {.rate = 2, .burst = 5}},
+    .group = {.rate = 500, .burst = 1000},
+    .policy = RATE_REJECT,
+    .max_delay_ms = RATE_DEFAULT_MAX_DELAY_MS};
+
+typedef struct {
+  char key[RATE_MAX_KEY]; /* vazio = slot livre */
+  RateBuckets buckets;
+  uint64_t used_ns;
+} RateEntry;
+
+static RateEntry rate_table[RATE_TABLE_SLOTS];
+static pthread_mutex_t rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t bucket_wait(TokenBucket *bucket, const RateLimit *limit,
+                     uint64_t now_ns)
+{
+  if (limit->rate <= 0) return 0;
+
+  if (bucket->updated_ns == 0) {
+    bucket->tokens = limit->burst;
+  } else if (now_ns > bucket->updated_ns) {
+    bucket->tokens += (now_ns - bucket->updated_ns) / 1e9 * limit->rate;
+    if (bucket->tokens > limit->burst) bucket->tokens = limit->burst;
+  }
+  bucket->updated_ns = now_ns;
+
+  if (bucket->tokens >= 1) return 0;
+  return (uint64_t)((1 - bucket->tokens) / limit->rate * 1e9) + 1;
+}
+
+void bucket_take(TokenBucket *bucket, const RateLimit *limit)
+{
+  if (limit->rate > 0) bucket->tokens -= 1;
+}
+
+static uint32_t rate_hash(const char *key)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *p = key; *p; p++) {
+    hash ^= (unsigned char)*p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Acha os buckets da chave, ou ocupa para ela o slot livre ou o menos
+ * usado da vizinhança. Deve ser chamada com rate_mutex travado.
+ */
+static RateBuckets *rate_lookup(const char *key, uint64_t now_ns)
+{
+  uint32_t start = rate_hash(key) % RATE_TABLE_SLOTS;
+  RateEntry *victim = NULL;
+
+  for (uint32_t i = 0; i < RATE_TABLE_PROBE; i++) {
+    RateEntry *entry = &rate_table[(start + i) % RATE_TABLE_SLOTS];
+    if (strncmp(entry->key, key, RATE_MAX_KEY) == 0) {
+      if (now_ns) entry->used_ns = now_ns;
+      return &entry->buckets;
+    }
+    if (!victim || entry->used_ns < victim->used_ns) victim = entry;
+  }
+
+  memset(victim, 0, sizeof(RateEntry));
+  strncpy(victim->key, key, RATE_MAX_KEY - 1);
+  victim->used_ns = now_ns;
+  return &victim->buckets;
+}
+
+uint64_t rate_wait(const char *key, CommandType type, uint64_t now_ns)
+{
+  bool known = (int)type >= 0 && type < CMD_TYPE_COUNT;
+
+  pthread_mutex_lock(&rate_mutex);
+  RateBuckets *buckets = rate_lookup(key, now_ns);
+  uint64_t wait =
+      bucket_wait(&buckets->connection, &rate_config.connection, now_ns);
+  if (known) {
+    uint64_t command_wait = bucket_wait(&buckets->command[type],
+                                        &rate_config.command[type], now_ns);
+    if (command_wait > wait) wait = command_wait;
+  }
+  pthread_mutex_unlock(&rate_mutex);
+
+  return wait;
+}
+
+void rate_take(const char *key, CommandType type)
+{
+  bool known = (int)type >= 0 && type < CMD_TYPE_COUNT;
+
+  pthread_mutex_lock(&rate_mutex);
+  RateBuckets *buckets = rate_lookup(key, 0);
+  bucket_take(&buckets->connection, &rate_config.connection);
+  if (known) bucket_take(&buckets->command[type], &rate_config.command[type]);
+  pthread_mutex_unlock(&rate_mutex);
+}
+
+bool rate_parse_limit(const char *spec, RateLimit *limit)
+{
+  char *end;
+  double rate = strtod(spec, &end);
+  double burst = 2 * rate;
+
+  if (end == spec || rate < 0) return false;
+  if (*end == ':') {
+    const char *burst_spec = end + 1;
+    burst = strtod(burst_spec, &end);
+    if (end == burst_spec || burst < 1) return false;
+  }
+  if (*end != '\0') return false;
+
+  limit->rate = rate;
+  limit->burst = burst < 1 ? 1 : burst;
+  return true;
+}
+
+bool rate_parse_command(const char *spec)
+{
+  const char *equals = strchr(spec, '=');
+  if (!equals || equals == spec) return false;
+
+  char name[32];
+  size_t len = equals - spec;
+  if (len >= sizeof(name)) return false;
+  memcpy(name, spec, len);
+  name[len] = '\0';
+
+  CommandType type;
+  if (!command_from_name(name, &type)) return false;
+  return rate_parse_limit(equals + 1, &rate_config.command[type]);
+}
+
+bool rate_parse_policy(const char *name, RatePolicy *policy)
+{
+  if (strcmp(name, "reject") == 0)
+    *policy = RATE_REJECT;
+  else if (strcmp(name, "delay") == 0)
+    *policy = RATE_DELAY;
+  else
+    return false;
+  return true;
+}
@@ -0,0 +1,1641 @@
+#define _GNU_SOURCE
+#include "../../include/relay.h"
+#include "../../include/log.h"
+#include "../../include/outbound.h"
+#include "../../include/peer.h"
+#include "../../include/placement.h"
+#include "../../include/shard.h"
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+extern ClientManager client_manager;
+extern GroupManager group_manager;
+
+RelayConfig relay_config = {
+    .node = "", .port = 0, .peer_count = 0, .allowed = {.count = 0}};
+
+/* Um frame do relay é o cabeçalho seguido de campos de texto terminados em
+ * '\0', na ordem indicada em cada tipo. Um pedido ao dono de um grupo leva um
+ * número de chamada e recebe um RELAY_RESULT com o mesmo número e o
+ * RelayStatus em flag. */
+typedef enum {
+  RELAY_HELLO = 1, /* nó, nonce; flag = RELAY_VERSION */
+  RELAY_AUTH,      /* prova do segredo sobre os dois nonces (peer.h) */
+  RELAY_RESULT,    /* campos da resposta; flag = RelayStatus */
+  RELAY_USER,      /* usuário; flag = logado */
+  RELAY_DIRECT,    /* destinatário, remetente, texto */
+  RELAY_CREATE,    /* pedido: grupo, criador, senha; flag = canal */
+  RELAY_FETCH,     /* pedido: grupo, senha; resposta: o estado do grupo */
+  RELAY_LIST,      /* pedido; resposta: grupo, criador, membros, ... */
+  RELAY_DELETE,    /* grupo, criador: pedido, ou aviso do dono */
+  RELAY_PUBLISHER, /* canal, usuário[, quem pediu]; flag = designado */
+  RELAY_MEMBER,    /* grupo, usuário, nó (vazio = quem envia); flag = entrou */
+  RELAY_CHAT,      /* grupo, remetente, texto, sequência (0 = ao dono) */
+  RELAY_STATE,     /* o estado de um grupo, ao seu novo dono */
+} RelayType;
+
+typedef struct {
+  uint32_t length; /* bytes dos campos, em ordem de rede */
+  uint8_t type;
+  uint8_t flag;
+  uint16_t call; /* número do pedido, em ordem de rede; 0 = sem resposta */
+} RelayHeader;
+
+/* Cabe o estado de um grupo com todos os membros (add_group_state()). */
+#define RELAY_MAX_DATA 16384
+
+typedef struct {
+  RelayHeader header;
+  char data[RELAY_MAX_DATA];
+  size_t length;
+} RelayFrame;
+
+/* Um link TCP com outro nó. A thread que o abriu (conector ou aceitação) lê
+ * os frames; uma thread própria escreve a fila de saída, para que quem
+ * publica nunca espere pelo socket. */
+typedef struct RelayLink {
+  int fd;
+  int node; /* -1 até o par provar o segredo (RELAY_AUTH) */
+  char address[RELAY_MAX_ADDRESS];
+  char nonce[PEER_HEX];             /* o deste lado */
+  char peer_name[MAX_USERNAME];     /* do HELLO; vazio até lá */
+  char peer_nonce[PEER_HEX];
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  char *queue;
+  size_t queued;
+  size_t capacity;
+  bool closing;
+  pthread_t writer;
+
+  struct RelayLink *next;
+} RelayLink;
+
+/* Um nó conhecido. O índice é estável (Group.remote guarda o índice) e os
+ * nós nunca saem da tabela. */
+typedef struct {
+  char name[MAX_USERNAME];
+  RelayLink *link; /* link por onde os frames saem; NULL = fora do ar */
+  char users[MAX_CLIENTS][MAX_USERNAME];
+  int user_count;
+} RelayNode;
+
+/* Protege a tabela de nós e a lista de links. Pode ser travado com os mutexes
+ * do GroupManager e de um grupo e antes do mutex de um link; com ele travado,
+ * nenhum desses é travado. */
+static pthread_mutex_t relay_lock = PTHREAD_MUTEX_INITIALIZER;
+static RelayNode nodes[RELAY_MAX_NODES];
+static _Atomic int node_count = 0; /* lida sem relay_lock pelos anúncios */
+static RelayLink *links = NULL;
+
+static _Atomic bool relay_running = false;
+static bool relay_started = false;
+static int listen_fd = -1;
+static pthread_t accept_thread;
+static pthread_t connectors[RELAY_MAX_NODES];
+
+/* Threads de links aceitos ainda vivas; relay_stop() espera por elas. */
+static pthread_mutex_t inbound_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inbound_cond = PTHREAD_COND_INITIALIZER;
+static int inbound_threads = 0;
+
+/* Um pedido esperando a resposta do dono. */
+typedef struct {
+  uint16_t id; /* 0 = livre */
+  bool done;
+  RelayStatus status;
+  char *data; /* recebe os campos da resposta; NULL = descarta */
+  size_t length;
+} RelayCall;
+
+static pthread_mutex_t call_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t call_cond = PTHREAD_COND_INITIALIZER;
+static RelayCall calls[RELAY_MAX_CALLS];
+static uint16_t next_call = 0;
+
+/* ---- frames ---- */
+
+static void frame_init(RelayFrame *frame, RelayType type, bool flag)
+{
+  frame->header = (RelayHeader){.type = type, .flag = flag};
+  frame->length = 0;
+}
+
+static void frame_add(RelayFrame *frame, const char *field, size_t max)
+{
+  size_t len = strnlen(field, max - 1);
+  if (frame->length + len + 1 > RELAY_MAX_DATA) return; /* não cabe */
+  memcpy(frame->data + frame->length, field, len);
+  frame->data[frame->length + len] = '\0';
+  frame->length += len + 1;
+}
+
+static void frame_add_number(RelayFrame *frame, uint64_t number)
+{
+  char text[24];
+  snprintf(text, sizeof(text), "%llu", (unsigned long long)number);
+  frame_add(frame, text, sizeof(text));
+}
+
+/**
+ * @brief Lê o próximo campo de um frame recebido.
+ *
+ * @return O campo, ou NULL se ele falta ou passa de max - 1 bytes.
+ */
+static const char *frame_field(const char **cursor, const char *end,
+                               size_t max)
+{
+  const char *field = *cursor;
+  if (field >= end) return NULL;
+
+  const char *nul = memchr(field, '\0', end - field);
+  if (!nul || (size_t)(nul - field) >= max) return NULL;
+
+  *cursor = nul + 1;
+  return field;
+}
+
+static bool write_all(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t len)
+{
+  char *p = data;
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/* ---- links ---- */
+
+/**
+ * @brief Coloca um frame na fila de saída do link. Um link cuja fila passa
+ * de RELAY_QUEUE_BYTES é derrubado: o par está parado, e ele se reconecta e
+ * se ressincroniza do zero.
+ */
+static void link_send(RelayLink *link, const RelayFrame *frame)
+{
+  RelayHeader header = frame->header;
+  header.length = htonl((uint32_t)frame->length);
+  size_t size = sizeof(header) + frame->length;
+
+  pthread_mutex_lock(&link->mutex);
+
+  if (link->closing) {
+    pthread_mutex_unlock(&link->mutex);
+    return;
+  }
+
+  if (link->queued + size > RELAY_QUEUE_BYTES) {
+    LOG_WARN("Relay link %s is not draining, dropping it", link->address);
+    link->closing = true;
+    shutdown(link->fd, SHUT_RDWR);
+    pthread_cond_signal(&link->cond);
+    pthread_mutex_unlock(&link->mutex);
+    return;
+  }
+
+  if (link->queued + size > link->capacity) {
+    size_t capacity = link->capacity ? link->capacity : 65536;
+    while (capacity < link->queued + size) capacity *= 2;
+    char *queue = realloc(link->queue, capacity);
+    if (!queue) {
+      pthread_mutex_unlock(&link->mutex);
+      return;
+    }
+    link->queue = queue;
+    link->capacity = capacity;
+  }
+
+  memcpy(link->queue + link->queued, &header, sizeof(header));
+  memcpy(link->queue + link->queued + sizeof(header), frame->data,
+         frame->length);
+  link->queued += size;
+
+  pthread_cond_signal(&link->cond);
+  pthread_mutex_unlock(&link->mutex);
+}
+
+/**
+ * @brief Thread de escrita de um link: troca a fila cheia por uma vazia e a
+ * escreve fora do mutex.
+ */
+static void *link_writer(void *arg)
+{
+  RelayLink *link = arg;
+  char *spare = NULL;
+  size_t spare_capacity = 0;
+
+  pthread_mutex_lock(&link->mutex);
+  while (1) {
+    while (!link->closing && link->queued == 0)
+      pthread_cond_wait(&link->cond, &link->mutex);
+    if (link->closing) break;
+
+    char *batch = link->queue;
+    size_t len = link->queued;
+    size_t capacity = link->capacity;
+    link->queue = spare;
+    link->capacity = spare_capacity;
+    link->queued = 0;
+    pthread_mutex_unlock(&link->mutex);
+
+    bool written = write_all(link->fd, batch, len);
+    spare = batch;
+    spare_capacity = capacity;
+
+    pthread_mutex_lock(&link->mutex);
+    if (!written) {
+      link->closing = true;
+      shutdown(link->fd, SHUT_RDWR);
+    }
+  }
+  pthread_mutex_unlock(&link->mutex);
+
+  free(spare);
+  return NULL;
+}
+
+/**
+ * @brief Envia um frame a cada nó do conjunto (um bit por índice) que está
+ * no ar.
+ */
+static void send_to_nodes(uint32_t mask, const RelayFrame *frame)
+{
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count; i++) {
+    if ((mask & (1u << i)) && nodes[i].link) link_send(nodes[i].link, frame);
+  }
+  pthread_mutex_unlock(&relay_lock);
+}
+
+static void send_to_all(const RelayFrame *frame)
+{
+  send_to_nodes(UINT32_MAX, frame);
+}
+
+/**
+ * @brief Envia um frame a um nó.
+ *
+ * @return false se o nó está fora do ar.
+ */
+static bool send_to_node(int node, const RelayFrame *frame)
+{
+  pthread_mutex_lock(&relay_lock);
+  bool up = node >= 0 && node < node_count && nodes[node].link;
+  if (up) link_send(nodes[node].link, frame);
+  pthread_mutex_unlock(&relay_lock);
+  return up;
+}
+
+/**
+ * @brief Retorna o índice do nó com esse nome, ou -1 se é este nó ou um nó
+ * desconhecido.
+ */
+static int node_index(const char *name)
+{
+  int index = -1;
+
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count && index == -1; i++) {
+    if (strcmp(nodes[i].name, name) == 0) index = i;
+  }
+  pthread_mutex_unlock(&relay_lock);
+
+  return index;
+}
+
+/* ---- pedidos ---- */
+
+/**
+ * @brief Faz um pedido a um nó e espera a resposta por até RELAY_CALL_MS.
+ *
+ * @param node O nó.
+ * @param frame O pedido (recebe o número da chamada).
+ * @param data Recebe os campos da resposta (RELAY_MAX_DATA bytes), ou NULL.
+ * @param length Recebe o tamanho da resposta, ou NULL.
+ * @return O status da resposta, ou RELAY_UNAVAILABLE se o nó está fora do ar
+ * ou não respondeu.
+ */
+static RelayStatus relay_call(int node, RelayFrame *frame, char *data,
+                              size_t *length)
+{
+  pthread_mutex_lock(&call_mutex);
+  RelayCall *call = NULL;
+  for (int i = 0; i < RELAY_MAX_CALLS && !call; i++) {
+    if (calls[i].id == 0) call = &calls[i];
+  }
+  if (!call) {
+    pthread_mutex_unlock(&call_mutex);
+    return RELAY_UNAVAILABLE;
+  }
+  do next_call++;
+  while (next_call == 0);
+  *call = (RelayCall){.id = next_call, .data = data};
+  frame->header.call = htons(call->id);
+  pthread_mutex_unlock(&call_mutex);
+
+  bool sent = send_to_node(node, frame);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += RELAY_CALL_MS / 1000;
+  deadline.tv_nsec += (RELAY_CALL_MS % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&call_mutex);
+  while (sent && !call->done) {
+    if (pthread_cond_timedwait(&call_cond, &call_mutex, &deadline) ==
+        ETIMEDOUT)
+      break;
+  }
+  bool done = call->done;
+  RelayStatus status = done ? call->status : RELAY_UNAVAILABLE;
+  if (length) *length = done ? call->length : 0;
+  call->id = 0;
+  pthread_mutex_unlock(&call_mutex);
+
+  if (sent && !done)
+    LOG_WARN("Relay node %s did not answer in %d ms", nodes[node].name,
+             RELAY_CALL_MS);
+  return status;
+}
+
+/**
+ * @brief Entrega uma resposta ao pedido que a espera. Uma resposta atrasada,
+ * cujo pedido já desistiu, é descartada.
+ */
+static void complete_call(const RelayHeader *header, const char *data,
+                          size_t length)
+{
+  uint16_t id = ntohs(header->call);
+  if (id == 0) return;
+
+  pthread_mutex_lock(&call_mutex);
+  for (int i = 0; i < RELAY_MAX_CALLS; i++) {
+    RelayCall *call = &calls[i];
+    if (call->id != id || call->done) continue;
+    if (call->data) memcpy(call->data, data, length);
+    call->length = length;
+    call->status = header->flag;
+    call->done = true;
+    pthread_cond_broadcast(&call_cond);
+    break;
+  }
+  pthread_mutex_unlock(&call_mutex);
+}
+
+/**
+ * @brief Responde a um pedido pelo link de saída do nó que pediu, para que a
+ * resposta chegue depois do que este nó já mandou a ele (o aviso de
+ * RELAY_DELETE antes do RELAY_OK de quem pediu para apagar, por exemplo).
+ */
+static void respond(RelayLink *link, const RelayHeader *request,
+                    RelayStatus status, RelayFrame *result)
+{
+  result->header.type = RELAY_RESULT;
+  result->header.flag = status;
+  result->header.call = request->call;
+
+  pthread_mutex_lock(&relay_lock);
+  RelayLink *out = nodes[link->node].link ? nodes[link->node].link : link;
+  link_send(out, result);
+  pthread_mutex_unlock(&relay_lock);
+}
+
+/* ---- grupos ---- */
+
+/**
+ * @brief Acrescenta ao frame o estado de um grupo: nome, criador, senha,
+ * canal, sequência, o número de publicadores e os publicadores, e os membros
+ * em pares (usuário, nó).
+ */
+static void add_group_state(RelayFrame *frame, Group *group)
+{
+  pthread_mutex_lock(&group->mutex);
+  frame_add(frame, group->name, MAX_GROUPNAME);
+  frame_add(frame, group->creator, MAX_USERNAME);
+  frame_add(frame, group->password, MAX_PASSWORD);
+  frame_add_number(frame, group->channel);
+  frame_add_number(frame, group->seq);
+  frame_add_number(frame, group->publisher_count);
+  for (int i = 0; i < group->publisher_count; i++)
+    frame_add(frame, group->publishers[i], MAX_USERNAME);
+  for (int i = 0; i < group->member_count; i++) {
+    frame_add(frame, group->members[i]->username, MAX_USERNAME);
+    frame_add(frame, relay_config.node, MAX_USERNAME);
+  }
+  /* O nome de um nó não muda depois de registrado. */
+  for (int i = 0; i < group->remote_count; i++) {
+    frame_add(frame, group->remote[i].username, MAX_USERNAME);
+    frame_add(frame, nodes[group->remote[i].node].name, MAX_USERNAME);
+  }
+  pthread_mutex_unlock(&group->mutex);
+}
+
+/**
+ * @brief Aplica o estado de um grupo (add_group_state()), criando o grupo se
+ * ele não existe aqui. A sequência só avança; os membros deste nó, que
+ * vêm com o nome dele, são ignorados.
+ *
+ * @param data Os campos.
+ * @param length O tamanho.
+ * @param replace Substitui os publicadores e os membros de outros nós em vez
+ * de somar a eles (réplica atualizada pelo dono).
+ * @return O grupo, fixado (pin_group()), ou NULL se o estado é inválido ou
+ * não há espaço.
+ */
+static Group *apply_state(const char *data, size_t length, bool replace)
+{
+  const char *cursor = data;
+  const char *end = data + length;
+  const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+  const char *creator = frame_field(&cursor, end, MAX_USERNAME);
+  const char *password = frame_field(&cursor, end, MAX_PASSWORD);
+  const char *channel = frame_field(&cursor, end, 24);
+  const char *seq = frame_field(&cursor, end, 24);
+  const char *publishers = frame_field(&cursor, end, 24);
+  if (!name || !creator || !password || !channel || !seq || !publishers)
+    return NULL;
+
+  /* Falha quando o grupo já existe, que é o caso de uma atualização. */
+  create_group(&group_manager, name, password, creator, atoi(channel) != 0);
+  Group *group = pin_group(&group_manager, name);
+  if (!group) return NULL;
+
+  advance_group_seq(group, strtoull(seq, NULL, 10));
+
+  if (replace) {
+    pthread_mutex_lock(&group->mutex);
+    group->publisher_count = 0;
+    group->remote_count = 0;
+    atomic_fetch_add(&group->members_version, 1);
+    atomic_fetch_add(&group_manager.version, 1);
+    pthread_mutex_unlock(&group->mutex);
+  }
+
+  for (int i = atoi(publishers); i > 0; i--) {
+    const char *publisher = frame_field(&cursor, end, MAX_USERNAME);
+    if (!publisher) break;
+    if (group->channel) set_channel_publisher(group, publisher, true);
+  }
+
+  const char *username, *node;
+  while ((username = frame_field(&cursor, end, MAX_USERNAME)) &&
+         (node = frame_field(&cursor, end, MAX_USERNAME))) {
+    int index = node_index(node);
+    if (index >= 0)
+      set_remote_member(&group_manager, group, username, index, true);
+  }
+
+  return group;
+}
+
+/**
+ * @brief Confere o dono de cada grupo depois de uma mudança no anel. O estado
+ * de um grupo que mudou de dono é enviado ao novo dono, que o soma ao que já
+ * tem (do dono anterior e de cada réplica), e a cópia daqui é descartada se
+ * não tem membros locais.
+ */
+static void reconcile_groups(void)
+{
+  RelayFrame *frame = malloc(sizeof(RelayFrame));
+  if (!frame) return;
+
+  char released[MAX_GROUPS][MAX_GROUPNAME];
+  char creators[MAX_GROUPS][MAX_USERNAME];
+  int released_count = 0;
+
+  pthread_mutex_lock(&group_manager.mutex);
+  for (int g = 0; g < group_manager.group_count; g++) {
+    Group *group = group_manager.list[g];
+    int owner = placement_owner(group->name);
+    if (owner == group->owner) continue;
+
+    group->owner = owner;
+    atomic_fetch_add(&group_manager.version, 1);
+    if (owner == PLACEMENT_SELF) {
+      LOG_INFO("Group '%s' is now owned by this node", group->name);
+      continue;
+    }
+
+    frame_init(frame, RELAY_STATE, false);
+    add_group_state(frame, group);
+    send_to_node(owner, frame);
+    LOG_INFO("Group '%s' moved to node %s", group->name, nodes[owner].name);
+
+    if (group->member_count == 0 &&
+        atomic_load(&group->subscriber_count) == 0) {
+      memcpy(released[released_count], group->name, MAX_GROUPNAME);
+      memcpy(creators[released_count++], group->creator, MAX_USERNAME);
+    }
+  }
+  pthread_mutex_unlock(&group_manager.mutex);
+
+  for (int i = 0; i < released_count; i++)
+    delete_group(&group_manager, released[i], creators[i]);
+  free(frame);
+}
+
+/**
+ * @brief Refaz o anel de placement.h com este nó e os nós no ar e confere o
+ * dono de cada grupo.
+ */
+static void update_placement(void)
+{
+  char names[RELAY_MAX_NODES + 1][MAX_USERNAME];
+  int ids[RELAY_MAX_NODES + 1];
+  int count = 0;
+
+  /* Com relay_lock, para que duas mudanças seguidas cheguem ao anel na
+   * ordem. */
+  pthread_mutex_lock(&relay_lock);
+  memcpy(names[count], relay_config.node, MAX_USERNAME);
+  ids[count++] = PLACEMENT_SELF;
+  for (int i = 0; i < node_count; i++) {
+    if (!nodes[i].link) continue;
+    memcpy(names[count], nodes[i].name, MAX_USERNAME);
+    ids[count++] = i;
+  }
+  placement_set((const char(*)[MAX_USERNAME])names, ids, count);
+  pthread_mutex_unlock(&relay_lock);
+
+  reconcile_groups();
+}
+
+/**
+ * @brief Retorna o grupo, fixado, se este nó é o dono dele; senão NULL, com o
+ * status da resposta ao pedido.
+ */
+static Group *owned_group(const char *name, RelayStatus *status)
+{
+  Group *group = pin_group(&group_manager, name);
+  if (group && group->owner == PLACEMENT_SELF) return group;
+  if (group) unpin_group(group);
+
+  /* Quem pediu e este nó ainda não concordam sobre o anel. */
+  *status = group || placement_owner(name) != PLACEMENT_SELF
+                ? RELAY_UNAVAILABLE
+                : RELAY_NO_GROUP;
+  return NULL;
+}
+
+static void frame_chat(RelayFrame *frame, const char *groupname,
+                       const Message *msg, bool forwarded)
+{
+  frame_init(frame, RELAY_CHAT, forwarded);
+  frame_add(frame, groupname, MAX_GROUPNAME);
+  frame_add(frame, msg->username, MAX_USERNAME);
+  frame_add(frame, msg->message, MAX_MESSAGE);
+  frame_add_number(frame, msg->seq);
+}
+
+/**
+ * @brief Envia pelo link os usuários logados neste nó. Os grupos não vão:
+ * cada nó busca no dono os que precisa.
+ */
+static void send_state(RelayLink *link)
+{
+  RelayFrame frame;
+
+  pthread_mutex_lock(&client_manager.mutex);
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (!client_manager.clients[i].authenticated) continue;
+    frame_init(&frame, RELAY_USER, true);
+    frame_add(&frame, client_manager.clients[i].username, MAX_USERNAME);
+    link_send(link, &frame);
+  }
+  pthread_mutex_unlock(&client_manager.mutex);
+}
+
+/**
+ * @brief Guarda o nome e o nonce com que o par se apresentou e responde com
+ * a prova deste nó. O nó só entra na tabela quando a prova dele confere
+ * (node_hello()).
+ *
+ * @return false se o link deve ser fechado.
+ */
+static bool link_hello(RelayLink *link, const char *name, const char *nonce,
+                       int version)
+{
+  if (version != RELAY_VERSION) {
+    LOG_WARN("Relay peer %s speaks version %d, expected %d", link->address,
+             version, RELAY_VERSION);
+    return false;
+  }
+  if (link->peer_name[0] != '\0' || name[0] == '\0') return false;
+  if (strcmp(name, relay_config.node) == 0) {
+    LOG_WARN("Relay peer %s is this node, ignoring it", link->address);
+    return false;
+  }
+
+  strcpy(link->peer_name, name);
+  strncpy(link->peer_nonce, nonce, PEER_HEX - 1);
+
+  RelayFrame auth;
+  char proof[PEER_HEX];
+  peer_proof("relay", link->peer_nonce, link->nonce, relay_config.node, proof);
+  frame_init(&auth, RELAY_AUTH, false);
+  frame_add(&auth, proof, PEER_HEX);
+  link_send(link, &auth);
+  return true;
+}
+
+/**
+ * @brief Registra o nó que se apresentou no link e provou o segredo. O
+ * primeiro link com um nó passa a ser o de saída, recebe os usuários deste
+ * nó e põe o nó no anel; links a mais (os dois lados com --peer) só
+ * recebem.
+ *
+ * @return false se o link deve ser fechado.
+ */
+static bool node_hello(RelayLink *link, const char *proof)
+{
+  const char *name = link->peer_name;
+  if (name[0] == '\0') return false;
+  if (!peer_verify("relay", link->nonce, link->peer_nonce, name, proof)) {
+    LOG_WARN("Relay peer %s failed to prove the shared secret as %s",
+             link->address, name);
+    return false;
+  }
+
+  pthread_mutex_lock(&relay_lock);
+
+  int index = -1;
+  for (int i = 0; i < node_count && index == -1; i++) {
+    if (strcmp(nodes[i].name, name) == 0) index = i;
+  }
+  if (index == -1 && node_count < RELAY_MAX_NODES) {
+    index = node_count++;
+    RelayNode *node = &nodes[index];
+    strncpy(node->name, name, MAX_USERNAME - 1);
+    node->name[MAX_USERNAME - 1] = '\0';
+    node->link = NULL;
+    node->user_count = 0;
+  }
+  if (index == -1) {
+    pthread_mutex_unlock(&relay_lock);
+    LOG_WARN("Relay node %s refused: already %d nodes", name,
+             RELAY_MAX_NODES);
+    return false;
+  }
+
+  link->node = index;
+  bool first = nodes[index].link == NULL;
+  if (first) nodes[index].link = link;
+
+  pthread_mutex_unlock(&relay_lock);
+
+  LOG_INFO("Relay link with node %s up (%s)", name, link->address);
+  if (first) {
+    send_state(link);
+    update_placement();
+  }
+  return true;
+}
+
+/**
+ * @brief Atualiza a lista de usuários logados num nó.
+ */
+static void node_user(int node, const char *username, bool online)
+{
+  pthread_mutex_lock(&relay_lock);
+
+  RelayNode *entry = &nodes[node];
+  int index = -1;
+  for (int i = 0; i < entry->user_count && index == -1; i++) {
+    if (strcmp(entry->users[i], username) == 0) index = i;
+  }
+
+  if (online && index == -1 && entry->user_count < MAX_CLIENTS) {
+    strncpy(entry->users[entry->user_count], username, MAX_USERNAME - 1);
+    entry->users[entry->user_count++][MAX_USERNAME - 1] = '\0';
+  } else if (!online && index != -1) {
+    memcpy(entry->users[index], entry->users[--entry->user_count],
+           MAX_USERNAME);
+  }
+
+  pthread_mutex_unlock(&relay_lock);
+}
+
+/**
+ * @brief Publica aqui um chat vindo de outro nó e, se este nó é o dono, o
+ * leva aos nós com membros. 'group' está fixado.
+ */
+static void publish_chat(Group *group, Message *msg)
+{
+  if (!shard_publish(group, msg) && publish_to_group(group, msg))
+    relay_chat(group, msg);
+}
+
+/**
+ * @brief Atende um pedido ao dono de um grupo.
+ *
+ * @return false se o pedido é inválido e o link deve ser fechado.
+ */
+static bool serve_call(RelayLink *link, const RelayHeader *header,
+                       const char *cursor, const char *end)
+{
+  RelayFrame result;
+  frame_init(&result, RELAY_RESULT, false);
+  RelayStatus status = RELAY_OK;
+
+  switch (header->type) {
+  case RELAY_CREATE: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *creator = frame_field(&cursor, end, MAX_USERNAME);
+    const char *password = frame_field(&cursor, end, MAX_PASSWORD);
+    if (!name || !creator || !password) return false;
+    if (placement_owner(name) != PLACEMENT_SELF)
+      status = RELAY_UNAVAILABLE;
+    else if (!create_group(&group_manager, name, password, creator,
+                           header->flag))
+      status = RELAY_FAILED;
+    break;
+  }
+  case RELAY_FETCH: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *password = frame_field(&cursor, end, MAX_PASSWORD);
+    if (!name || !password) return false;
+    Group *group = owned_group(name, &status);
+    if (!group) break;
+    if (!verify_group_password(group, password))
+      status = RELAY_DENIED;
+    else
+      add_group_state(&result, group);
+    unpin_group(group);
+    break;
+  }
+  case RELAY_LIST: {
+    pthread_mutex_lock(&group_manager.mutex);
+    for (int g = 0; g < group_manager.group_count; g++) {
+      Group *group = group_manager.list[g];
+      if (group->owner != PLACEMENT_SELF) continue;
+      frame_add(&result, group->name, MAX_GROUPNAME);
+      frame_add(&result, group->creator, MAX_USERNAME);
+      frame_add_number(&result,
+                       group->channel ? atomic_load(&group->subscriber_count)
+                                      : group->member_count +
+                                            group->remote_count);
+    }
+    pthread_mutex_unlock(&group_manager.mutex);
+    break;
+  }
+  case RELAY_DELETE: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *creator = frame_field(&cursor, end, MAX_USERNAME);
+    if (!name || !creator) return false;
+    Group *group = owned_group(name, &status);
+    if (!group) break;
+    if (strcmp(group->creator, creator) != 0) {
+      status = RELAY_DENIED;
+    } else {
+      relay_group_deleted(group);
+      if (!evict_group(&group_manager, group, creator)) status = RELAY_FAILED;
+    }
+    unpin_group(group);
+    break;
+  }
+  case RELAY_PUBLISHER: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *username = frame_field(&cursor, end, MAX_USERNAME);
+    const char *requester = frame_field(&cursor, end, MAX_USERNAME);
+    if (!name || !username || !requester) return false;
+    Group *group = owned_group(name, &status);
+    if (!group) break;
+    if (!group->channel)
+      status = RELAY_NOT_CHANNEL;
+    else if (strcmp(group->creator, requester) != 0)
+      status = RELAY_DENIED;
+    else if (!set_channel_publisher(group, username, header->flag))
+      status = RELAY_FAILED;
+    else
+      relay_publisher(group, username, header->flag);
+    unpin_group(group);
+    break;
+  }
+  default:
+    LOG_WARN("Relay peer %s sent unknown request type %d", link->address,
+             header->type);
+    return false;
+  }
+
+  respond(link, header, status, &result);
+  return true;
+}
+
+/**
+ * @brief Aplica um frame recebido de um nó já apresentado.
+ *
+ * @return false se o frame é inválido e o link deve ser fechado.
+ */
+static bool dispatch(RelayLink *link, const RelayHeader *header,
+                     const char *data, size_t length)
+{
+  const char *cursor = data;
+  const char *end = data + length;
+
+  if (header->type == RELAY_HELLO) {
+    const char *name = frame_field(&cursor, end, MAX_USERNAME);
+    const char *nonce = frame_field(&cursor, end, PEER_HEX);
+    return name && nonce && link->node == -1 &&
+           link_hello(link, name, nonce, header->flag);
+  }
+  if (header->type == RELAY_AUTH) {
+    const char *proof = frame_field(&cursor, end, PEER_HEX);
+    return proof && link->node == -1 && node_hello(link, proof);
+  }
+  if (link->node == -1) return false;
+
+  if (header->type == RELAY_RESULT) {
+    complete_call(header, data, length);
+    return true;
+  }
+  if (header->call != 0) return serve_call(link, header, cursor, end);
+
+  switch (header->type) {
+  case RELAY_USER: {
+    const char *username = frame_field(&cursor, end, MAX_USERNAME);
+    if (!username) return false;
+    node_user(link->node, username, header->flag);
+    return true;
+  }
+  case RELAY_STATE: {
+    Group *group = apply_state(data, length, false);
+    if (group) {
+      LOG_DEBUG("Relay: state of '%s' from node %s", group->name,
+                nodes[link->node].name);
+      unpin_group(group);
+    }
+    /* O grupo novo nasce como deste nó; o anel daqui pode discordar. */
+    reconcile_groups();
+    return true;
+  }
+  case RELAY_DELETE: {
+    /* O dono apagou o grupo: a réplica daqui vai junto. */
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *creator = frame_field(&cursor, end, MAX_USERNAME);
+    if (!name || !creator) return false;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+    if (group->owner != PLACEMENT_SELF && strcmp(group->creator, creator) == 0)
+      evict_group(&group_manager, group, creator);
+    unpin_group(group);
+    return true;
+  }
+  case RELAY_MEMBER: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *username = frame_field(&cursor, end, MAX_USERNAME);
+    const char *node_name = frame_field(&cursor, end, MAX_USERNAME);
+    if (!name || !username || !node_name) return false;
+    int node = node_name[0] ? node_index(node_name) : link->node;
+    if (node < 0) return true;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+    if (group->channel) {
+      unpin_group(group);
+      return true;
+    }
+
+    if (set_remote_member(&group_manager, group, username, node,
+                          header->flag))
+      record_presence(group, username, header->flag);
+
+    /* O dono repassa o que uma réplica contou aos outros nós com membros. */
+    if (group->owner == PLACEMENT_SELF && node == link->node) {
+      uint32_t mask = remote_node_mask(group) & ~(1u << node);
+      if (mask) {
+        RelayFrame frame;
+        frame_init(&frame, RELAY_MEMBER, header->flag);
+        frame_add(&frame, group->name, MAX_GROUPNAME);
+        frame_add(&frame, username, MAX_USERNAME);
+        frame_add(&frame, nodes[node].name, MAX_USERNAME);
+        send_to_nodes(mask, &frame);
+      }
+    }
+    unpin_group(group);
+    return true;
+  }
+  case RELAY_PUBLISHER: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *username = frame_field(&cursor, end, MAX_USERNAME);
+    if (!name || !username) return false;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+    if (group->channel && group->owner != PLACEMENT_SELF)
+      set_channel_publisher(group, username, header->flag);
+    unpin_group(group);
+    return true;
+  }
+  case RELAY_CHAT: {
+    const char *name = frame_field(&cursor, end, MAX_GROUPNAME);
+    const char *username = frame_field(&cursor, end, MAX_USERNAME);
+    const char *text = frame_field(&cursor, end, MAX_MESSAGE);
+    const char *seq = frame_field(&cursor, end, 24);
+    if (!name || !username || !text || !seq) return false;
+    Group *group = pin_group(&group_manager, name);
+    if (!group) return true;
+
+    Message chat_msg;
+    memset(&chat_msg, 0, sizeof(Message));
+    chat_msg.type = CMD_MESSAGE;
+    strcpy(chat_msg.username, username);
+    memcpy(chat_msg.groupname, group->name, MAX_GROUPNAME);
+    strcpy(chat_msg.message, text);
+    chat_msg.seq = strtoull(seq, NULL, 10);
+
+    /* Um chat ainda sem sequência é para o dono. Se o anel de quem mandou
+     * estava atrasado, ele segue um salto até o dono que este nó conhece. */
+    if (chat_msg.seq == 0 && group->owner != PLACEMENT_SELF) {
+      if (!header->flag) {
+        RelayFrame frame;
+        frame_chat(&frame, group->name, &chat_msg, true);
+        send_to_node(group->owner, &frame);
+      }
+      unpin_group(group);
+      return true;
+    }
+
+    publish_chat(group, &chat_msg);
+    unpin_group(group);
+    return true;
+  }
+  case RELAY_DIRECT: {
+    const char *recipient = frame_field(&cursor, end, MAX_USERNAME);
+    const char *sender = frame_field(&cursor, end, MAX_USERNAME);
+    const char *text = frame_field(&cursor, end, MAX_MESSAGE);
+    if (!recipient || !sender || !text) return false;
+    User *user = find_client_by_username(&client_manager, recipient);
+    if (!user) return true;
+
+    Message dm_msg;
+    memset(&dm_msg, 0, sizeof(Message));
+    dm_msg.type = CMD_DIRECT_MESSAGE;
+    strcpy(dm_msg.username, sender);
+    strcpy(dm_msg.message, text);
+    outbound_send(user->sockfd, &dm_msg);
+    return true;
+  }
+  default:
+    LOG_WARN("Relay peer %s sent unknown frame type %d", link->address,
+             header->type);
+    return false;
+  }
+}
+
+/**
+ * @brief Tira o link da lista. Se era o de saída de um nó, outro link com o
+ * mesmo nó assume; se não há outro, o nó está fora do ar e seus usuários e
+ * membros somem.
+ */
+static void link_down(RelayLink *link)
+{
+  pthread_mutex_lock(&relay_lock);
+
+  for (RelayLink **p = &links; *p; p = &(*p)->next) {
+    if (*p == link) {
+      *p = link->next;
+      break;
+    }
+  }
+
+  int node = link->node;
+  bool offline = false;
+  if (node >= 0 && nodes[node].link == link) {
+    nodes[node].link = NULL;
+    for (RelayLink *other = links; other; other = other->next) {
+      if (other->node == node) {
+        nodes[node].link = other;
+        break;
+      }
+    }
+    offline = nodes[node].link == NULL;
+    if (offline) nodes[node].user_count = 0;
+  }
+  const char *name = node >= 0 ? nodes[node].name : link->address;
+
+  pthread_mutex_unlock(&relay_lock);
+
+  if (offline) {
+    LOG_INFO("Relay node %s down", name);
+    drop_remote_node(&group_manager, node);
+    update_placement();
+  } else if (node >= 0) {
+    LOG_INFO("Relay link with node %s closed (%s)", name, link->address);
+  }
+
+  pthread_mutex_lock(&link->mutex);
+  link->closing = true;
+  pthread_cond_signal(&link->cond);
+  pthread_mutex_unlock(&link->mutex);
+  pthread_join(link->writer, NULL);
+}
+
+/**
+ * @brief Atende um link recém-aberto até ele cair: apresenta este nó e
+ * aplica os frames recebidos. Roda na thread que abriu o link.
+ */
+static void run_link(int fd, const char *address)
+{
+  int opt = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+
+  RelayLink *link = calloc(1, sizeof(RelayLink));
+  char *data = malloc(RELAY_MAX_DATA);
+  if (!link || !data) {
+    free(link);
+    free(data);
+    close(fd);
+    return;
+  }
+
+  link->fd = fd;
+  link->node = -1;
+  strncpy(link->address, address, RELAY_MAX_ADDRESS - 1);
+  peer_nonce(link->nonce);
+  pthread_mutex_init(&link->mutex, NULL);
+  pthread_cond_init(&link->cond, NULL);
+  if (pthread_create(&link->writer, NULL, link_writer, link) != 0) {
+    LOG_WARN("Failed to create relay writer for %s", address);
+    free(link);
+    free(data);
+    close(fd);
+    return;
+  }
+
+  /* Entra na lista e confere relay_running com relay_lock: ou relay_stop()
+   * encontra o link, ou o link vê o fim. */
+  pthread_mutex_lock(&relay_lock);
+  link->next = links;
+  links = link;
+  bool running = atomic_load(&relay_running);
+  pthread_mutex_unlock(&relay_lock);
+
+  if (running) {
+    RelayFrame hello;
+    frame_init(&hello, RELAY_HELLO, false);
+    hello.header.flag = RELAY_VERSION;
+    frame_add(&hello, relay_config.node, MAX_USERNAME);
+    frame_add(&hello, link->nonce, PEER_HEX);
+    link_send(link, &hello);
+
+    RelayHeader header;
+    while (read_all(fd, &header, sizeof(header))) {
+      size_t length = ntohl(header.length);
+      if (length > RELAY_MAX_DATA || !read_all(fd, data, length) ||
+          !dispatch(link, &header, data, length))
+        break;
+    }
+  }
+
+  link_down(link);
+  close(fd);
+  free(data);
+  free(link->queue);
+  pthread_mutex_destroy(&link->mutex);
+  pthread_cond_destroy(&link->cond);
+  free(link);
+}
+
+/* ---- conexões ---- */
+
+/**
+ * @brief Espera até ms milissegundos, acordando antes se o relay parar.
+ */
+static void relay_sleep(int ms)
+{
+  for (int waited = 0; waited < ms && atomic_load(&relay_running);
+       waited += 100) {
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 100 * 1000000L};
+    nanosleep(&pause, NULL);
+  }
+}
+
+/**
+ * @brief Conecta a "host:porta", esperando até RELAY_CONNECT_MS.
+ *
+ * @return O socket (bloqueante), ou -1.
+ */
+static int connect_peer(const char *address)
+{
+  char host[RELAY_MAX_ADDRESS];
+  strncpy(host, address, sizeof(host) - 1);
+  host[sizeof(host) - 1] = '\0';
+  char *colon = strrchr(host, ':');
+  if (!colon) return -1;
+  *colon = '\0';
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *result;
+  if (getaddrinfo(host, colon + 1, &hints, &result) != 0) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd >= 0 &&
+      connect(fd, result->ai_addr, result->ai_addrlen) < 0 &&
+      errno != EINPROGRESS) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd < 0) return -1;
+
+  struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  if (poll(&pfd, 1, RELAY_CONNECT_MS) != 1 ||
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 ||
+      error != 0) {
+    close(fd);
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+}
+
+/**
+ * @brief Thread de um par (--peer): mantém um link com ele, reconectando
+ * RELAY_RETRY_MS depois de cada queda ou falha.
+ */
+static void *connector_loop(void *arg)
+{
+  const char *address = arg;
+  bool warned = false;
+
+  while (atomic_load(&relay_running)) {
+    int fd = connect_peer(address);
+    if (fd >= 0) {
+      warned = false;
+      run_link(fd, address);
+    } else if (!warned) {
+      LOG_INFO("Relay peer %s unreachable, retrying every %d ms", address,
+               RELAY_RETRY_MS);
+      warned = true;
+    }
+    relay_sleep(RELAY_RETRY_MS);
+  }
+
+  return NULL;
+}
+
+typedef struct {
+  int fd;
+  char address[RELAY_MAX_ADDRESS];
+} InboundLink;
+
+static void *inbound_loop(void *arg)
+{
+  InboundLink *inbound = arg;
+  run_link(inbound->fd, inbound->address);
+  free(inbound);
+
+  pthread_mutex_lock(&inbound_mutex);
+  inbound_threads--;
+  pthread_cond_broadcast(&inbound_cond);
+  pthread_mutex_unlock(&inbound_mutex);
+  return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+  (void)arg;
+
+  while (atomic_load(&relay_running)) {
+    struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+    if (poll(&pfd, 1, 100) <= 0) continue;
+
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    int fd = accept4(listen_fd, (struct sockaddr *)&peer, &peer_len,
+                     SOCK_CLOEXEC);
+    if (fd < 0) continue;
+
+    char ip[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+    if (!peer_allowed(&relay_config.allowed, peer.sin_addr)) {
+      LOG_WARN("Relay link from %s refused: not a --peer or --relay-allow "
+               "host",
+               ip);
+      close(fd);
+      continue;
+    }
+
+    InboundLink *inbound = malloc(sizeof(InboundLink));
+    if (!inbound) {
+      close(fd);
+      continue;
+    }
+    inbound->fd = fd;
+    snprintf(inbound->address, sizeof(inbound->address), "%s:%d", ip,
+             ntohs(peer.sin_port));
+
+    pthread_mutex_lock(&inbound_mutex);
+    inbound_threads++;
+    pthread_mutex_unlock(&inbound_mutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, inbound_loop, inbound) != 0) {
+      close(fd);
+      free(inbound);
+      pthread_mutex_lock(&inbound_mutex);
+      inbound_threads--;
+      pthread_mutex_unlock(&inbound_mutex);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  return NULL;
+}
+
+static int relay_listen(const char *ip, int port)
+{
+  struct sockaddr_in address = {.sin_family = AF_INET,
+                                .sin_port = htons(port)};
+  if (inet_pton(AF_INET, ip, &address.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int opt = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, RELAY_MAX_NODES) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* ---- API ---- */
+
+bool relay_add_peer(const char *address)
+{
+  const char *colon = strrchr(address, ':');
+  if (!colon || colon == address || atoi(colon + 1) <= 0 ||
+      strlen(address) >= RELAY_MAX_ADDRESS ||
+      relay_config.peer_count >= RELAY_MAX_NODES ||
+      !peer_allow(&relay_config.allowed, address))
+    return false;
+
+  strcpy(relay_config.peers[relay_config.peer_count++], address);
+  return true;
+}
+
+bool relay_allow(const char *host)
+{
+  return peer_allow(&relay_config.allowed, host);
+}
+
+bool relay_start(const char *ip, const char *default_node)
+{
+  if (relay_config.port == 0 && relay_config.peer_count == 0) return true;
+  if (!peer_has_secret()) {
+    LOG_ERROR("Relay links need a shared secret (--secret-file)");
+    return false;
+  }
+
+  if (relay_config.node[0] == '\0') {
+    strncpy(relay_config.node, default_node, MAX_USERNAME - 1);
+    relay_config.node[MAX_USERNAME - 1] = '\0';
+  }
+
+  if (relay_config.port > 0) {
+    listen_fd = relay_listen(ip, relay_config.port);
+    if (listen_fd < 0) {
+      LOG_ERROR("Relay port %s:%d: %s", ip, relay_config.port,
+                strerror(errno));
+      return false;
+    }
+  }
+
+  atomic_store(&relay_running, true);
+  if (listen_fd >= 0 &&
+      pthread_create(&accept_thread, NULL, accept_loop, NULL) != 0) {
+    atomic_store(&relay_running, false);
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  int connected = 0;
+  for (int i = 0; i < relay_config.peer_count; i++) {
+    if (pthread_create(&connectors[connected], NULL, connector_loop,
+                       relay_config.peers[i]) == 0)
+      connected++;
+    else
+      LOG_WARN("Failed to create relay connector for %s",
+               relay_config.peers[i]);
+  }
+  relay_config.peer_count = connected;
+  relay_started = true;
+
+  LOG_INFO("Relay node %s: port %s:%d, %d peers, %d allowed hosts",
+           relay_config.node, ip, relay_config.port, connected,
+           relay_config.allowed.count);
+  return true;
+}
+
+void relay_stop(void)
+{
+  if (!relay_started) return;
+  relay_started = false;
+
+  atomic_store(&relay_running, false);
+  if (listen_fd >= 0) {
+    pthread_join(accept_thread, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+  }
+
+  pthread_mutex_lock(&relay_lock);
+  for (RelayLink *link = links; link; link = link->next)
+    shutdown(link->fd, SHUT_RDWR);
+  pthread_mutex_unlock(&relay_lock);
+
+  for (int i = 0; i < relay_config.peer_count; i++)
+    pthread_join(connectors[i], NULL);
+
+  pthread_mutex_lock(&inbound_mutex);
+  while (inbound_threads > 0) pthread_cond_wait(&inbound_cond, &inbound_mutex);
+  pthread_mutex_unlock(&inbound_mutex);
+}
+
+void relay_user(const char *username, bool online)
+{
+  if (node_count == 0) return;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_USER, online);
+  frame_add(&frame, username, MAX_USERNAME);
+  send_to_all(&frame);
+}
+
+bool relay_user_online(const char *username)
+{
+  bool online = false;
+
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count && !online; i++) {
+    if (!nodes[i].link) continue;
+    for (int u = 0; u < nodes[i].user_count && !online; u++)
+      online = strcmp(nodes[i].users[u], username) == 0;
+  }
+  pthread_mutex_unlock(&relay_lock);
+
+  return online;
+}
+
+RelayStatus relay_create_group(const char *name, const char *password,
+                               const char *creator, bool channel)
+{
+  RelayFrame frame;
+  frame_init(&frame, RELAY_CREATE, channel);
+  frame_add(&frame, name, MAX_GROUPNAME);
+  frame_add(&frame, creator, MAX_USERNAME);
+  frame_add(&frame, password, MAX_PASSWORD);
+  return relay_call(placement_owner(name), &frame, NULL, NULL);
+}
+
+RelayStatus relay_fetch_group(const char *name, const char *password,
+                              Group **group)
+{
+  int owner = placement_owner(name);
+  if (owner == PLACEMENT_SELF) return RELAY_NO_GROUP;
+
+  char *data = malloc(RELAY_MAX_DATA);
+  if (!data) return RELAY_FAILED;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_FETCH, false);
+  frame_add(&frame, name, MAX_GROUPNAME);
+  frame_add(&frame, password, MAX_PASSWORD);
+
+  size_t length;
+  RelayStatus status = relay_call(owner, &frame, data, &length);
+  if (status == RELAY_OK) {
+    Group *replica = apply_state(data, length, true);
+    if (replica) {
+      replica->owner = owner;
+      *group = replica;
+    } else {
+      status = RELAY_FAILED;
+    }
+  }
+
+  free(data);
+  return status;
+}
+
+RelayStatus relay_delete_group(const char *name, const char *username)
+{
+  Group *group = pin_group(&group_manager, name);
+  int owner = group ? group->owner : placement_owner(name);
+  if (group) unpin_group(group);
+  if (owner == PLACEMENT_SELF) return RELAY_NO_GROUP;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_DELETE, false);
+  frame_add(&frame, name, MAX_GROUPNAME);
+  frame_add(&frame, username, MAX_USERNAME);
+  return relay_call(owner, &frame, NULL, NULL);
+}
+
+void relay_group_deleted(Group *group)
+{
+  if (node_count == 0) return;
+
+  /* A todos, e não só aos nós com membros: uma réplica parada (só com
+   * cursores de quem caiu) também precisa sumir. */
+  RelayFrame frame;
+  frame_init(&frame, RELAY_DELETE, false);
+  frame_add(&frame, group->name, MAX_GROUPNAME);
+  frame_add(&frame, group->creator, MAX_USERNAME);
+  send_to_all(&frame);
+}
+
+RelayStatus relay_set_publisher(const char *name, const char *requester,
+                                const char *username, bool enabled)
+{
+  Group *group = pin_group(&group_manager, name);
+  int owner = group ? group->owner : placement_owner(name);
+  if (group) unpin_group(group);
+  if (owner == PLACEMENT_SELF) return RELAY_NO_GROUP;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_PUBLISHER, enabled);
+  frame_add(&frame, name, MAX_GROUPNAME);
+  frame_add(&frame, username, MAX_USERNAME);
+  frame_add(&frame, requester, MAX_USERNAME);
+  return relay_call(owner, &frame, NULL, NULL);
+}
+
+void relay_publisher(Group *group, const char *username, bool enabled)
+{
+  if (node_count == 0 || group->owner != PLACEMENT_SELF) return;
+
+  /* Os leitores de um canal não são contados entre os nós. */
+  RelayFrame frame;
+  frame_init(&frame, RELAY_PUBLISHER, enabled);
+  frame_add(&frame, group->name, MAX_GROUPNAME);
+  frame_add(&frame, username, MAX_USERNAME);
+  send_to_all(&frame);
+}
+
+void relay_membership(Group *group, const char *username, bool joined)
+{
+  if (node_count == 0 || group->channel) return;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_MEMBER, joined);
+  frame_add(&frame, group->name, MAX_GROUPNAME);
+  frame_add(&frame, username, MAX_USERNAME);
+
+  if (group->owner != PLACEMENT_SELF) {
+    frame_add(&frame, "", MAX_USERNAME);
+    send_to_node(group->owner, &frame);
+    return;
+  }
+
+  uint32_t mask = remote_node_mask(group);
+  if (mask == 0) return;
+  frame_add(&frame, relay_config.node, MAX_USERNAME);
+  send_to_nodes(mask, &frame);
+}
+
+void relay_release_group(Group *group)
+{
+  if (group->owner == PLACEMENT_SELF || group->member_count > 0 ||
+      atomic_load(&group->subscriber_count) > 0)
+    return;
+
+  char name[MAX_GROUPNAME], creator[MAX_USERNAME];
+  memcpy(name, group->name, MAX_GROUPNAME);
+  memcpy(creator, group->creator, MAX_USERNAME);
+  delete_group(&group_manager, name, creator);
+}
+
+bool relay_post(Group *group, const Message *msg)
+{
+  if (node_count == 0 || group->owner == PLACEMENT_SELF) return false;
+
+  RelayFrame frame;
+  frame_chat(&frame, group->name, msg, false);
+  return send_to_node(group->owner, &frame);
+}
+
+void relay_chat(Group *group, const Message *msg)
+{
+  if (node_count == 0 || group->owner != PLACEMENT_SELF) return;
+
+  /* Os leitores de um canal não são contados entre os nós. */
+  uint32_t mask = group->channel ? UINT32_MAX : remote_node_mask(group);
+  if (mask == 0) return;
+
+  RelayFrame frame;
+  frame_chat(&frame, group->name, msg, false);
+  send_to_nodes(mask, &frame);
+}
+
+bool relay_clustered(void)
+{
+  bool clustered = false;
+
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count && !clustered; i++)
+    clustered = nodes[i].link != NULL;
+  pthread_mutex_unlock(&relay_lock);
+
+  return clustered;
+}
+
+size_t relay_list_groups(ListEntry *entries, size_t max)
+{
+  int up[RELAY_MAX_NODES];
+  int up_count = 0;
+
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count; i++) {
+    if (nodes[i].link) up[up_count++] = i;
+  }
+  pthread_mutex_unlock(&relay_lock);
+
+  char *data = malloc(RELAY_MAX_DATA);
+  if (!data) return 0;
+
+  size_t count = 0;
+  for (int n = 0; n < up_count; n++) {
+    RelayFrame frame;
+    frame_init(&frame, RELAY_LIST, false);
+    size_t length;
+    if (relay_call(up[n], &frame, data, &length) != RELAY_OK) continue;
+
+    const char *cursor = data;
+    const char *end = data + length;
+    const char *name, *creator, *members;
+    while (count < max &&
+           (name = frame_field(&cursor, end, MAX_GROUPNAME)) &&
+           (creator = frame_field(&cursor, end, MAX_USERNAME)) &&
+           (members = frame_field(&cursor, end, 24))) {
+      ListEntry *entry = &entries[count++];
+      memset(entry, 0, sizeof(ListEntry));
+      strcpy(entry->name, name);
+      strcpy(entry->creator, creator);
+      entry->members = atoi(members);
+    }
+  }
+
+  free(data);
+  return count;
+}
+
+bool relay_direct(const char *recipient, const char *sender,
+                  const char *text)
+{
+  if (node_count == 0) return false;
+
+  RelayFrame frame;
+  frame_init(&frame, RELAY_DIRECT, false);
+  frame_add(&frame, recipient, MAX_USERNAME);
+  frame_add(&frame, sender, MAX_USERNAME);
+  frame_add(&frame, text, MAX_MESSAGE);
+
+  bool sent = false;
+  pthread_mutex_lock(&relay_lock);
+  for (int i = 0; i < node_count && !sent; i++) {
+    if (!nodes[i].link) continue;
+    for (int u = 0; u < nodes[i].user_count && !sent; u++) {
+      if (strcmp(nodes[i].users[u], recipient) == 0) {
+        link_send(nodes[i].link, &frame);
+        sent = true;
+      }
+    }
+  }
+  pthread_mutex_unlock(&relay_lock);
+
+  return sent;
+}
@@ -1,19 +1,47 @@
+#define _GNU_SOURCE
+#include "../../include/capture.h"
 #include "../../include/chat.h"
 #include "../../include/common.h"
 #include "../../include/db.h"
+#include "../../include/flight.h"
+#include "../../include/handoff.h"
+#include "../../include/log.h"
+#include "../../include/mirror.h"
+#include "../../include/outbound.h"
+#include "../../include/peer.h"
+#include "../../include/ratelimit.h"
+#include "../../include/relay.h"
+#include "../../include/session.h"
+#include "../../include/shard.h"
 #include <arpa/inet.h>
+#include <getopt.h>
 #include <ifaddrs.h>
-#include <sys/select.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 
 ClientManager client_manager;
 GroupManager group_manager;
 Database database;
 
-void *client_handler(void *arg);
+#define MAX_LISTENERS 64
+#define ACCEPT_BATCH  64 /* conexões aceitas por acordada do poll() */
 
 typedef struct {
-  int sockfd;
-} ClientArgs;
+  int count;          /* sockets de escuta (SO_REUSEPORT), um por acceptor */
+  int backlog;        /* fila de conexões completas de cada socket */
+  int defer_accept_s; /* TCP_DEFER_ACCEPT em segundos; 0 = desligado */
+} ListenConfig;
+
+typedef struct {
+  int index;
+  int listen_fd;
+  pthread_t thread;
+  uint64_t accepted;
+} Acceptor;
+
+/* Acorda os acceptors no encerramento: o handler de sinal escreve no pipe e
+ * nenhum acceptor o esvazia, então todos veem o fim. */
+static int shutdown_pipe[2] = {-1, -1};
 
 /**
  * @brief Uma variável "booleana" para marcar se o servidor está rodando ou
@@ -31,9 +59,157 @@ void handle_signal(int sig)
 {
   (void)sig;
   server_running = 0;
+  if (shutdown_pipe[1] >= 0) {
+    ssize_t written = write(shutdown_pipe[1], "", 1);
+    (void)written;
+  }
   printf("\n[SERVER] Shutting down...\n");
 }
 
+/**
+ * @brief Handler de sinal para alterar o nível de log em tempo de execução:
+ * SIGUSR1 torna o log mais verboso e SIGUSR2 menos verboso.
+ *
+ * @param sig O número do sinal recebido.
+ */
+void handle_log_level_signal(int sig)
+{
+  LogLevel level = log_get_level();
+  /* LogLevel não tem sinal: DEBUG - 1 daria a volta e desligaria o log. */
+  if (sig == SIGUSR1 && level > LOG_LEVEL_DEBUG)
+    log_set_level(level - 1);
+  else if (sig == SIGUSR2 && level < LOG_LEVEL_OFF)
+    log_set_level(level + 1);
+}
+
+/**
+ * @brief Thread de presença: ao fim de cada janela, envia as entradas e saídas
+ * acumuladas em cada grupo.
+ *
+ * @param arg Não utilizado.
+ * @return NULL.
+ */
+static void *presence_loop(void *arg)
+{
+  (void)arg;
+
+  int window_ms = get_presence_window();
+  struct timespec window = {.tv_sec = window_ms / 1000,
+                            .tv_nsec = (long)(window_ms % 1000) * 1000000L};
+
+  while (server_running) {
+    nanosleep(&window, NULL);
+    flush_presence(&group_manager);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Imprime as opções de linha de comando do servidor.
+ *
+ * @param prog O nome do executável.
+ */
+static void print_usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] [port]\n"
+          "  -l, --log-file <path>    Log file, '-' for stderr (default: "
+          "whisp.log)\n"
+          "  -L, --log-level <level>  debug, info, warn, error or off "
+          "(default: info)\n"
+          "      --log-max-size <MB>  Rotate the log after this size "
+          "(default: 16)\n"
+          "      --log-files <n>      Rotated files to keep (default: 4)\n"
+          "      --flight-file <path> Flight recorder file, 'none' to disable "
+          "(default: whisp.flight)\n"
+          "      --flight-events <n>  Events kept by the flight recorder "
+          "(default: 4096)\n"
+          "      --capture <path>     Record inbound frames for whisp_replay\n"
+          "      --presence-window <ms>  Batch join/leave notices per group "
+          "(default: 1000, 0 = send each one)\n"
+          "      --rate-connection <rate[:burst]>  Commands per second per "
+          "user (default: 200:400, 0 = no limit)\n"
+          "      --rate-group <rate[:burst]>  Chat messages per second per "
+          "group (default: 500:1000)\n"
+          "      --rate-command <NAME=rate[:burst]>  Limit one command type "
+          "per user\n"
+          "                           (LOGIN and REGISTER per client address),"
+          "\n"
+          "                           e.g. MESSAGE=20:40 (default: LOGIN=2:5, "
+          "REGISTER=2:5)\n"
+          "      --rate-policy <reject|delay>  What to do with commands over "
+          "the limit\n"
+          "                           (default: reject; delay holds the "
+          "session up to 1 s)\n"
+          "      --outbound-budget <KB>  Bytes queued per connection before "
+          "the slow-consumer\n"
+          "                           policy applies (default: 512)\n"
+          "      --slow-policy <drop|coalesce|disconnect>  What to do with "
+          "a full queue\n"
+          "                           (default: coalesce)\n"
+          "      --slow-grace <ms>    How long a queue may stay full before "
+          "'disconnect'\n"
+          "                           drops the connection (default: 5000)\n"
+          "      --listeners <n>      Listening sockets (SO_REUSEPORT), each "
+          "with its own\n"
+          "                           accept thread (default: online CPUs)\n"
+          "      --backlog <n>        Pending connections per listener "
+          "(default: SOMAXCONN)\n"
+          "      --defer-accept <s>   Wake the acceptor only once the client "
+          "has sent data,\n"
+          "                           waiting up to s seconds (default: 0 = "
+          "off)\n"
+          "      --handoff-socket <path>  Unix socket where a new server "
+          "binary can take\n"
+          "                           over, 'none' to disable (default: "
+          "whisp.handoff)\n"
+          "      --takeover <path>    Take over the listeners, connections "
+          "and state of the\n"
+          "                           server running at this handoff socket\n"
+          "      --group-shards <n>   Threads that own the groups and publish "
+          "their chat\n"
+          "                           (default: online CPUs, 0 = publish on "
+          "the sender's thread)\n"
+          "      --fanout-threshold <n>  Subscribers from which a group's "
+          "chat wakes them from\n"
+          "                           all shards in parallel (default: %d, "
+          "0 = never)\n"
+          "      --group-ring <n>     Chat frames kept in each group's ring, "
+          "a power of two\n"
+          "                           from %d to %d (default: %d)\n"
+          "      --node <name>        Name of this server among its relay "
+          "peers\n"
+          "                           (default: ip:port)\n"
+          "      --relay-port <port>  Accept relay links from other servers "
+          "on this port\n"
+          "                           (default: 0 = only connect to peers)\n"
+          "      --peer <host:port>   Keep a relay link to another server's "
+          "relay port;\n"
+          "                           repeat for each peer (up to %d)\n"
+          "      --relay-allow <host> Also accept relay links from this host "
+          "(the --peer\n"
+          "                           hosts always are); repeatable\n"
+          "      --secret-file <path> Shared secret that relay peers, the "
+          "primary and its\n"
+          "                           standbys prove to each other (at least "
+          "%d bytes)\n"
+          "      --mirror-port <port> Stream the accounts and groups to "
+          "standby servers\n"
+          "                           connecting on this port\n"
+          "      --standby <host>     Let this host follow the mirror port; "
+          "repeatable\n"
+          "      --standby-of <host:port>  Follow the primary at this mirror "
+          "port and take\n"
+          "                           over its clients when it goes down\n"
+          "      --failover-after <ms>  How long the primary must be down "
+          "before the\n"
+          "                           standby takes over (default: %d)\n",
+          prog, FANOUT_DEFAULT_THRESHOLD, RING_MIN_FRAMES, GROUP_HISTORY,
+          RING_DEFAULT_FRAMES, RELAY_MAX_NODES, PEER_SECRET_MIN,
+          MIRROR_FAILOVER_MS);
+}
+
 /**
  * @brief Busca pelo IP da rede local e o retorna.
  * Iterates through network interfaces to find a non-loopback IPv4 address.
@@ -66,53 +242,233 @@ char *get_local_ip()
 }
 
 /**
- * @brief Configura um socket TCP para escuta em um IP e porta específicos.
+ * @brief Configura um socket TCP não-bloqueante para escuta em um IP e porta
+ * específicos. Com mais de um listener, o socket usa SO_REUSEPORT e o kernel
+ * distribui as conexões entre todos os sockets ligados à mesma porta.
  *
  * @param port A porta em que o servidor irá escutar.
  * @param ip_addr O endereço IP no qual o servidor irá se ligar.
- * @return O descritor de arquivo para o socket do servidor.
+ * @param config Número de listeners, backlog e TCP_DEFER_ACCEPT.
+ * @return O descritor de arquivo para o socket do servidor, ou -1 em caso de
+ * falha.
  */
-int setup_server_with_ip(int port, const char *ip_addr)
+int setup_server_with_ip(int port, const char *ip_addr,
+                         const ListenConfig *config)
 {
   int server_fd;
   struct sockaddr_in address;
 
-  if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+  if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          0)) < 0) {
     perror("socket failed");
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
   int opt = 1;
   if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
     perror("setsockopt");
     close(server_fd);
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
+  if (config->count > 1 &&
+      setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+    perror("setsockopt SO_REUSEPORT");
+    close(server_fd);
+    return -1;
+  }
+
+  if (config->defer_accept_s > 0 &&
+      setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                 &config->defer_accept_s, sizeof(config->defer_accept_s)))
+    LOG_WARN("TCP_DEFER_ACCEPT not available: %s", strerror(errno));
+
+  memset(&address, 0, sizeof(address));
   address.sin_family = AF_INET;
   address.sin_port = htons(port);
 
   if (inet_pton(AF_INET, ip_addr, &address.sin_addr) <= 0) {
     perror("Invalid address/Address not supported");
     close(server_fd);
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
   if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
     perror("bind failed");
     close(server_fd);
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
-  if (listen(server_fd, 10) < 0) {
+  if (listen(server_fd, config->backlog) < 0) {
     perror("listen");
     close(server_fd);
-    exit(EXIT_FAILURE);
+    return -1;
   }
 
   return server_fd;
 }
 
+/**
+ * @brief Registra uma conexão aceita e cria a thread que vai atendê-la.
+ *
+ * @param client_fd O socket da conexão, já não-bloqueante.
+ * @param client_addr O endereço do cliente.
+ * @param listener O índice do listener que aceitou a conexão.
+ */
+static void start_client(int client_fd, const struct sockaddr_in *client_addr,
+                         int listener)
+{
+  if (log_enabled(LOG_LEVEL_INFO)) {
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr->sin_addr, client_ip, INET_ADDRSTRLEN);
+    LOG_INFO("New connection from %s (fd %d, listener %d)", client_ip,
+             client_fd, listener);
+  }
+  flight_record(FLIGHT_CONNECT, client_fd, -1, -1, NULL, NULL,
+                flight_now_ns());
+
+  ClientArgs *client_args = calloc(1, sizeof(ClientArgs));
+  if (client_args == NULL) {
+    perror("Failed to allocate memory for client_args");
+    close(client_fd);
+    return;
+  }
+  client_args->sockfd = client_fd;
+
+  if (!spawn_session(client_args)) {
+    perror("Failed to create thread for client");
+    close(client_fd);
+    free(client_args);
+  }
+}
+
+/**
+ * @brief Thread de um listener: espera o socket ficar legível e aceita em
+ * lote, com accept4(), até esvaziar a fila ou completar ACCEPT_BATCH
+ * conexões, antes de voltar ao poll().
+ *
+ * @param arg O Acceptor desta thread.
+ * @return NULL.
+ */
+static void *acceptor_loop(void *arg)
+{
+  Acceptor *acceptor = arg;
+  struct pollfd fds[2] = {{.fd = acceptor->listen_fd, .events = POLLIN},
+                          {.fd = shutdown_pipe[0], .events = POLLIN}};
+
+  while (server_running) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      LOG_ERROR("poll failed on listener %d: %s", acceptor->index,
+                strerror(errno));
+      break;
+    }
+    if (fds[1].revents) break;
+    if (!(fds[0].revents & POLLIN)) continue;
+
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+      struct sockaddr_in client_addr;
+      socklen_t client_addr_len = sizeof(client_addr);
+
+      int client_fd = accept4(acceptor->listen_fd,
+                              (struct sockaddr *)&client_addr,
+                              &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (client_fd < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+        LOG_WARN("accept failed on listener %d: %s", acceptor->index,
+                 strerror(errno));
+        /* Sem descritores livres, a fila continua cheia e o poll() voltaria
+         * na hora: espera um pouco antes de tentar de novo. */
+        if (errno == EMFILE || errno == ENFILE) {
+          struct timespec pause = {.tv_sec = 0, .tv_nsec = 100000000L};
+          nanosleep(&pause, NULL);
+        }
+        break;
+      }
+
+      acceptor->accepted++;
+      start_client(client_fd, &client_addr, acceptor->index);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Cria as threads de aceitação.
+ *
+ * @return Quantas threads foram criadas (as primeiras 'count' em caso de
+ * sucesso).
+ */
+static int start_acceptors(Acceptor *acceptors, int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (pthread_create(&acceptors[i].thread, NULL, acceptor_loop,
+                       &acceptors[i]) != 0) {
+      perror("Failed to create acceptor thread");
+      return i;
+    }
+  }
+  return count;
+}
+
+static void stop_acceptors(Acceptor *acceptors, int count)
+{
+  ssize_t written = write(shutdown_pipe[1], "", 1);
+  (void)written;
+  for (int i = 0; i < count; i++) pthread_join(acceptors[i].thread, NULL);
+}
+
+/**
+ * @brief Atende um pedido de troca de processo: para de aceitar, estaciona
+ * as conexões e entrega tudo ao processo novo. Se a troca falhar, volta a
+ * aceitar e a atender como antes.
+ *
+ * @param conn_fd A conexão do processo novo no socket de handoff.
+ * @param acceptors As threads de aceitação em execução.
+ * @param listeners Quantas são; atualizado se alguma não puder ser recriada.
+ * @param ip O endereço do servidor, onde as portas do relay e do mirror
+ * reabrem.
+ * @return true se o processo novo assumiu e este deve sair.
+ */
+static bool hand_off(int conn_fd, Acceptor *acceptors, int *listeners,
+                     const char *ip)
+{
+  LOG_INFO("Handoff requested, pausing listeners and sessions");
+  stop_acceptors(acceptors, *listeners);
+  /* Os links da federação não passam para o processo novo: ele reconecta
+   * aos pares e se ressincroniza. */
+  relay_stop();
+  /* Os standbys também: eles reconectam ao processo novo e recebem um
+   * snapshot dele. */
+  mirror_stop();
+
+  int listen_fds[MAX_LISTENERS];
+  for (int i = 0; i < *listeners; i++) listen_fds[i] = acceptors[i].listen_fd;
+
+  bool frozen = freeze_sessions(HANDOFF_FREEZE_MS);
+  if (frozen) shard_drain();
+  bool handed_off = frozen && handoff_serve(conn_fd, listen_fds, *listeners);
+  close(conn_fd);
+  if (handed_off) return true;
+
+  thaw_sessions();
+  relay_start(ip, NULL);
+  mirror_start(ip);
+
+  char drain[16];
+  while (read(shutdown_pipe[0], drain, sizeof(drain)) > 0)
+    ;
+  int started = start_acceptors(acceptors, *listeners);
+  for (int i = started; i < *listeners; i++) close(acceptors[i].listen_fd);
+  *listeners = started;
+
+  LOG_WARN("Handoff failed, resumed serving on %d listeners", started);
+  return false;
+}
+
 /**
  * @brief Função principal do servidor Whisp.
  * Inicializa o banco de dados, gerenciadores, configura o servidor e entra no
@@ -125,21 +481,314 @@ int setup_server_with_ip(int port, const char *ip_addr)
 int main(int argc, char *argv[])
 {
   int port = DEFAULT_PORT;
+  LogConfig log_config = {.path = "whisp.log",
+                          .level = LOG_LEVEL_INFO,
+                          .max_bytes = LOG_DEFAULT_MAX_SIZE,
+                          .max_files = LOG_DEFAULT_FILES};
+  const char *flight_path = FLIGHT_DEFAULT_PATH;
+  int flight_events = FLIGHT_DEFAULT_EVENTS;
+  const char *capture_path = NULL;
+  const char *handoff_path = HANDOFF_DEFAULT_PATH;
+  const char *takeover_path = NULL;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int group_shards = cpus > 0 ? (int)cpus : 1;
+  ListenConfig listen_config = {.count = cpus > 0 ? (int)cpus : 1,
+                                .backlog = SOMAXCONN,
+                                .defer_accept_s = 0};
+
+  enum {
+    OPT_LOG_MAX_SIZE = 256,
+    OPT_LOG_FILES,
+    OPT_FLIGHT_FILE,
+    OPT_FLIGHT_EVENTS,
+    OPT_CAPTURE,
+    OPT_PRESENCE_WINDOW,
+    OPT_RATE_CONNECTION,
+    OPT_RATE_GROUP,
+    OPT_RATE_COMMAND,
+    OPT_RATE_POLICY,
+    OPT_OUTBOUND_BUDGET,
+    OPT_SLOW_POLICY,
+    OPT_SLOW_GRACE,
+    OPT_LISTENERS,
+    OPT_BACKLOG,
+    OPT_DEFER_ACCEPT,
+    OPT_HANDOFF_SOCKET,
+    OPT_TAKEOVER,
+    OPT_GROUP_SHARDS,
+    OPT_FANOUT_THRESHOLD,
+    OPT_GROUP_RING,
+    OPT_NODE,
+    OPT_RELAY_PORT,
+    OPT_PEER,
+    OPT_RELAY_ALLOW,
+    OPT_SECRET_FILE,
+    OPT_MIRROR_PORT,
+    OPT_STANDBY,
+    OPT_STANDBY_OF,
+    OPT_FAILOVER_AFTER
+  };
+  static const struct option long_options[] = {
+      {"log-file", required_argument, NULL, 'l'},
+      {"log-level", required_argument, NULL, 'L'},
+      {"log-max-size", required_argument, NULL, OPT_LOG_MAX_SIZE},
+      {"log-files", required_argument, NULL, OPT_LOG_FILES},
+      {"flight-file", required_argument, NULL, OPT_FLIGHT_FILE},
+      {"flight-events", required_argument, NULL, OPT_FLIGHT_EVENTS},
+      {"capture", required_argument, NULL, OPT_CAPTURE},
+      {"presence-window", required_argument, NULL, OPT_PRESENCE_WINDOW},
+      {"rate-connection", required_argument, NULL, OPT_RATE_CONNECTION},
+      {"rate-group", required_argument, NULL, OPT_RATE_GROUP},
+      {"rate-command", required_argument, NULL, OPT_RATE_COMMAND},
+      {"rate-policy", required_argument, NULL, OPT_RATE_POLICY},
+      {"outbound-budget", required_argument, NULL, OPT_OUTBOUND_BUDGET},
+      {"slow-policy", required_argument, NULL, OPT_SLOW_POLICY},
+      {"slow-grace", required_argument, NULL, OPT_SLOW_GRACE},
+      {"listeners", required_argument, NULL, OPT_LISTENERS},
+      {"backlog", required_argument, NULL, OPT_BACKLOG},
+      {"defer-accept", required_argument, NULL, OPT_DEFER_ACCEPT},
+      {"handoff-socket", required_argument, NULL, OPT_HANDOFF_SOCKET},
+      {"takeover", required_argument, NULL, OPT_TAKEOVER},
+      {"group-shards", required_argument, NULL, OPT_GROUP_SHARDS},
+      {"fanout-threshold", required_argument, NULL, OPT_FANOUT_THRESHOLD},
+      {"group-ring", required_argument, NULL, OPT_GROUP_RING},
+      {"node", required_argument, NULL, OPT_NODE},
+      {"relay-port", required_argument, NULL, OPT_RELAY_PORT},
+      {"peer", required_argument, NULL, OPT_PEER},
+      {"relay-allow", required_argument, NULL, OPT_RELAY_ALLOW},
+      {"secret-file", required_argument, NULL, OPT_SECRET_FILE},
+      {"mirror-port", required_argument, NULL, OPT_MIRROR_PORT},
+      {"standby", required_argument, NULL, OPT_STANDBY},
+      {"standby-of", required_argument, NULL, OPT_STANDBY_OF},
+      {"failover-after", required_argument, NULL, OPT_FAILOVER_AFTER},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "l:L:h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'l':
+      log_config.path = optarg;
+      break;
+    case 'L':
+      if (!log_level_from_string(optarg, &log_config.level)) {
+        fprintf(stderr, "Invalid log level: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_LOG_MAX_SIZE:
+      log_config.max_bytes = (size_t)atoi(optarg) * 1024 * 1024;
+      break;
+    case OPT_LOG_FILES:
+      log_config.max_files = atoi(optarg);
+      break;
+    case OPT_FLIGHT_FILE:
+      flight_path = optarg;
+      break;
+    case OPT_FLIGHT_EVENTS:
+      flight_events = atoi(optarg);
+      break;
+    case OPT_CAPTURE:
+      capture_path = optarg;
+      break;
+    case OPT_PRESENCE_WINDOW:
+      set_presence_window(atoi(optarg));
+      break;
+    case OPT_RATE_CONNECTION:
+    case OPT_RATE_GROUP:
+      if (!rate_parse_limit(optarg, opt == OPT_RATE_GROUP
+                                        ? &rate_config.group
+                                        : &rate_config.connection)) {
+        fprintf(stderr, "Invalid rate limit: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_RATE_COMMAND:
+      if (!rate_parse_command(optarg)) {
+        fprintf(stderr, "Invalid command rate limit: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_RATE_POLICY:
+      if (!rate_parse_policy(optarg, &rate_config.policy)) {
+        fprintf(stderr, "Invalid rate policy: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_OUTBOUND_BUDGET:
+      outbound_config.budget = (size_t)atoi(optarg) * 1024;
+      break;
+    case OPT_SLOW_POLICY:
+      if (!slow_policy_from_string(optarg, &outbound_config.policy)) {
+        fprintf(stderr, "Invalid slow-consumer policy: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_SLOW_GRACE:
+      outbound_config.grace_ms = atoi(optarg);
+      break;
+    case OPT_LISTENERS:
+      listen_config.count = atoi(optarg);
+      if (listen_config.count < 1 || listen_config.count > MAX_LISTENERS) {
+        fprintf(stderr, "Invalid listener count (1-%d): %s\n", MAX_LISTENERS,
+                optarg);
+        return 1;
+      }
+      break;
+    case OPT_BACKLOG:
+      listen_config.backlog = atoi(optarg);
+      break;
+    case OPT_DEFER_ACCEPT:
+      listen_config.defer_accept_s = atoi(optarg);
+      break;
+    case OPT_HANDOFF_SOCKET:
+      handoff_path = optarg;
+      break;
+    case OPT_TAKEOVER:
+      takeover_path = optarg;
+      break;
+    case OPT_GROUP_SHARDS:
+      group_shards = atoi(optarg);
+      if (group_shards < 0 || group_shards > SHARD_MAX) {
+        fprintf(stderr, "Invalid group shard count (0-%d): %s\n", SHARD_MAX,
+                optarg);
+        return 1;
+      }
+      break;
+    case OPT_FANOUT_THRESHOLD:
+      set_fanout_threshold(atoi(optarg));
+      break;
+    case OPT_GROUP_RING:
+      if (!set_ring_frames((size_t)atoi(optarg))) {
+        fprintf(stderr, "Invalid group ring size (power of two, %d-%d): %s\n",
+                RING_MIN_FRAMES, GROUP_HISTORY, optarg);
+        return 1;
+      }
+      break;
+    case OPT_NODE:
+      if (strlen(optarg) == 0 || strlen(optarg) >= MAX_USERNAME) {
+        fprintf(stderr, "Invalid node name (1-%d characters): %s\n",
+                MAX_USERNAME - 1, optarg);
+        return 1;
+      }
+      strcpy(relay_config.node, optarg);
+      break;
+    case OPT_RELAY_PORT:
+      relay_config.port = atoi(optarg);
+      break;
+    case OPT_PEER:
+      if (!relay_add_peer(optarg)) {
+        fprintf(stderr, "Invalid relay peer (host:port, up to %d): %s\n",
+                RELAY_MAX_NODES, optarg);
+        return 1;
+      }
+      break;
+    case OPT_RELAY_ALLOW:
+      if (!relay_allow(optarg)) {
+        fprintf(stderr, "Invalid relay host (up to %d addresses): %s\n",
+                PEER_MAX_ALLOWED, optarg);
+        return 1;
+      }
+      break;
+    case OPT_SECRET_FILE:
+      if (!peer_load_secret(optarg)) {
+        fprintf(stderr, "Invalid secret file (%d-%d bytes): %s\n",
+                PEER_SECRET_MIN, PEER_SECRET_MAX - 1, optarg);
+        return 1;
+      }
+      break;
+    case OPT_MIRROR_PORT:
+      mirror_config.port = atoi(optarg);
+      break;
+    case OPT_STANDBY:
+      if (!mirror_allow_standby(optarg)) {
+        fprintf(stderr, "Invalid standby host (up to %d addresses): %s\n",
+                PEER_MAX_ALLOWED, optarg);
+        return 1;
+      }
+      break;
+    case OPT_STANDBY_OF: {
+      const char *colon = strrchr(optarg, ':');
+      if (!colon || colon == optarg || atoi(colon + 1) <= 0 ||
+          strlen(optarg) >= MIRROR_MAX_ADDRESS) {
+        fprintf(stderr, "Invalid primary (host:port): %s\n", optarg);
+        return 1;
+      }
+      strcpy(mirror_config.primary, optarg);
+      break;
+    }
+    case OPT_FAILOVER_AFTER:
+      mirror_config.failover_ms = atoi(optarg);
+      if (mirror_config.failover_ms < 0) mirror_config.failover_ms = 0;
+      break;
+    default:
+      print_usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind < argc) port = atoi(argv[optind]);
+  if (listen_config.count > MAX_LISTENERS) listen_config.count = MAX_LISTENERS;
+
+  if ((relay_config.port > 0 || relay_config.peer_count > 0) &&
+      !peer_has_secret()) {
+    fprintf(stderr, "--relay-port and --peer need --secret-file\n");
+    return 1;
+  }
+  if (relay_config.port > 0 && relay_config.allowed.count == 0) {
+    fprintf(stderr, "--relay-port needs --peer or --relay-allow\n");
+    return 1;
+  }
+  if ((mirror_config.port > 0 || mirror_config.primary[0] != '\0') &&
+      !peer_has_secret()) {
+    fprintf(stderr, "--mirror-port and --standby-of need --secret-file\n");
+    return 1;
+  }
+  if (mirror_config.port > 0 && mirror_config.standbys.count == 0) {
+    fprintf(stderr, "--mirror-port needs --standby\n");
+    return 1;
+  }
 
-  if (argc > 1) port = atoi(argv[1]);
+  if (pipe2(shutdown_pipe, O_CLOEXEC | O_NONBLOCK) < 0) error_exit("pipe");
 
   signal(SIGPIPE, SIG_IGN);
 
   signal(SIGINT, handle_signal);
+  signal(SIGUSR1, handle_log_level_signal);
+  signal(SIGUSR2, handle_log_level_signal);
+
+  if (!log_init(&log_config)) {
+    fprintf(stderr, "Failed to initialize logging\n");
+    return 1;
+  }
 
   if (!init_database(&database, "whisp.db")) {
     fprintf(stderr, "Failed to initialize database\n");
+    log_shutdown();
+    return 1;
+  }
+
+  if (strcmp(flight_path, "none") != 0 && flight_events > 0 &&
+      !flight_open(flight_path, (uint32_t)flight_events))
+    fprintf(stderr, "Flight recorder disabled\n");
+
+  if (capture_path && !capture_start(capture_path)) {
+    close_database(&database);
+    log_shutdown();
     return 1;
   }
 
   init_client_manager(&client_manager);
   init_group_manager(&group_manager);
 
+  if (!shard_start(group_shards))
+    LOG_WARN("No group shards, publishing on the connection threads");
+
+  pthread_t presence_thread;
+  bool presence_running =
+      get_presence_window() > 0 &&
+      pthread_create(&presence_thread, NULL, presence_loop, NULL) == 0;
+
   char *local_ip = get_local_ip();
   if (!local_ip || strlen(local_ip) == 0) {
     fprintf(stderr, "Failed to get local IP address\n");
@@ -148,65 +797,133 @@ int main(int argc, char *argv[])
     printf("[SERVER] Using fallback IP: %s\n", local_ip);
   }
 
-  int server_fd = setup_server_with_ip(port, local_ip);
-  printf("Whisp server started on %s:%d\n", local_ip, port);
-
-  fd_set read_fds;
-  struct timeval timeout;
-
-  while (server_running) {
-    FD_ZERO(&read_fds);
-    FD_SET(server_fd, &read_fds);
-
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
-
-    int activity = select(server_fd + 1, &read_fds, NULL, NULL, &timeout);
-    if (activity < 0 && errno != EINTR) {
-      perror("select error");
-      break;
-    }
-
-    if (!server_running) break;
-
-    if (FD_ISSET(server_fd, &read_fds)) {
-      struct sockaddr_in client_addr;
-      socklen_t client_addr_len = sizeof(client_addr);
+  Acceptor acceptors[MAX_LISTENERS];
+  int listen_fds[MAX_LISTENERS];
+  int listeners = 0;
+  int status = 0;
+
+  /* O standby só abre as portas quando assume, já com o estado do
+   * primário. */
+  if (mirror_config.primary[0] != '\0' && !takeover_path) {
+    printf("Whisp server standing by for %s\n", mirror_config.primary);
+    fflush(stdout);
+    if (mirror_follow(&server_running))
+      printf("Primary %s is down, taking over\n", mirror_config.primary);
+  }
 
-      int client_fd =
-          accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-      if (client_fd < 0) {
-        perror("accept failed");
-        continue;
+  if (!server_running) {
+    /* Interrompido antes de assumir. */
+  } else if (takeover_path) {
+    if (handoff_receive(takeover_path, listen_fds, MAX_LISTENERS,
+                        &listeners)) {
+      /* O endereço e a porta são os do servidor substituído. */
+      struct sockaddr_in bound;
+      socklen_t bound_len = sizeof(bound);
+      static char bound_ip[INET_ADDRSTRLEN];
+      if (getsockname(listen_fds[0], (struct sockaddr *)&bound, &bound_len) ==
+          0) {
+        inet_ntop(AF_INET, &bound.sin_addr, bound_ip, sizeof(bound_ip));
+        local_ip = bound_ip;
+        port = ntohs(bound.sin_port);
       }
+    }
+  } else {
+    for (int i = 0; i < listen_config.count; i++) {
+      int listen_fd = setup_server_with_ip(port, local_ip, &listen_config);
+      if (listen_fd < 0) break;
+      listen_fds[listeners++] = listen_fd;
+    }
+  }
 
-      char client_ip[INET_ADDRSTRLEN];
-      inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-      printf("New connection from %s\n", client_ip);
-
-      ClientArgs *client_args = malloc(sizeof(ClientArgs));
-      if (client_args == NULL) {
-        perror("Failed to allocate memory for client_args");
-        close(client_fd);
-        continue;
-      }
-      client_args->sockfd = client_fd;
+  int wanted = takeover_path ? listeners : listen_config.count;
+  for (int i = 0; i < listeners; i++)
+    acceptors[i] = (Acceptor){.index = i, .listen_fd = listen_fds[i]};
+  int started = start_acceptors(acceptors, listeners);
+  for (int i = started; i < listeners; i++) close(listen_fds[i]);
+  if (started > 0 && started < wanted)
+    LOG_WARN("Only %d of %d listeners started", started, wanted);
+  listeners = started;
+
+  int handoff_fd = -1;
+  if (!server_running) {
+    /* Nada foi aberto. */
+  } else if (listeners == 0) {
+    fprintf(stderr, "Failed to listen on %s:%d\n", local_ip, port);
+    server_running = 0;
+    status = 1;
+  } else {
+    printf("Whisp server started on %s:%d\n", local_ip, port);
+    LOG_INFO("Server started on %s:%d (%d listeners, backlog %d)", local_ip,
+             port, listeners, listen_config.backlog);
+    if (strcmp(handoff_path, "none") != 0)
+      handoff_fd = handoff_listen(handoff_path);
+
+    char node[MAX_USERNAME];
+    snprintf(node, sizeof(node), "%s:%d", local_ip, port);
+    if (!relay_start(local_ip, node)) {
+      fprintf(stderr, "Failed to open relay port %d\n", relay_config.port);
+      server_running = 0;
+      status = 1;
+    }
+    if (!mirror_start(local_ip)) {
+      fprintf(stderr, "Failed to open mirror port %d\n", mirror_config.port);
+      server_running = 0;
+      status = 1;
+    }
+  }
 
-      pthread_t thread_id;
+  time_t last_report = time(NULL);
+  bool handed_off = false;
+  struct pollfd handoff_pfd = {.fd = handoff_fd, .events = POLLIN};
 
-      if (pthread_create(&thread_id, NULL, client_handler, client_args) != 0) {
-        perror("Failed to create thread for client");
-        close(client_fd);
-        free(client_args);
-        continue;
+  while (server_running) {
+    /* Sem socket de handoff (fd -1), o poll() só espera o segundo. */
+    if (poll(&handoff_pfd, 1, 1000) > 0 && (handoff_pfd.revents & POLLIN)) {
+      int conn_fd = accept4(handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (conn_fd >= 0 &&
+          hand_off(conn_fd, acceptors, &listeners, local_ip)) {
+        handed_off = true;
+        break;
       }
+    }
 
-      pthread_detach(thread_id);
+    if (time(NULL) - last_report >= OUTBOUND_REPORT_SECONDS) {
+      outbound_report();
+      last_report = time(NULL);
     }
   }
 
-  close(server_fd);
+  if (handed_off) {
+    /* O processo novo já atende os sockets: sai sem fechá-los nem tocar no
+     * estado, que ficou travado depois de enviado. */
+    flight_close();
+    capture_stop();
+    LOG_INFO("Exiting after handoff");
+    log_shutdown();
+    printf("[SERVER] Handed off to the new process.\n");
+    fflush(stdout);
+    _exit(0);
+  }
+
+  if (handoff_fd >= 0) {
+    close(handoff_fd);
+    unlink(handoff_path);
+  }
+  stop_acceptors(acceptors, listeners);
+  for (int i = 0; i < listeners; i++) {
+    close(acceptors[i].listen_fd);
+    LOG_INFO("Listener %d accepted %llu connections", i,
+             (unsigned long long)acceptors[i].accepted);
+  }
+  relay_stop();
+  mirror_stop();
+  if (presence_running) pthread_join(presence_thread, NULL);
+  shard_stop();
   close_database(&database);
+  flight_close();
+  capture_stop();
+  LOG_INFO("Shutdown complete");
+  log_shutdown();
   printf("[SERVER] Shutdown complete.\n");
-  return 0;
+  return status;
 }
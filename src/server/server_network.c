@@ -1,51 +1,157 @@
 #include "../../include/auth.h"
+#include "../../include/capture.h"
 #include "../../include/chat.h"
 #include "../../include/common.h"
 #include "../../include/db.h"
+#include "../../include/flight.h"
+#include "../../include/log.h"
 #include "../../include/network.h"
+#include "../../include/outbound.h"
+#include "../../include/placement.h"
+#include "../../include/ratelimit.h"
+#include "../../include/relay.h"
+#include "../../include/session.h"
+#include "../../include/shard.h"
+#include <stdarg.h>
 
 extern ClientManager client_manager;
 extern GroupManager group_manager;
 extern Database database;
 
+/* Bytes recebidos do cliente que ainda não formam uma Message completa. */
 typedef struct {
+  char data[sizeof(Message) * 8];
+  size_t len;
+} InboundBuffer;
+
+/* Conexão estacionada durante uma troca de processo; vive na pilha da sua
+ * thread. */
+typedef struct ParkedSession {
   int sockfd;
-} ClientArgs;
+  const InboundBuffer *in;
+  struct ParkedSession *next;
+} ParkedSession;
+
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+static _Atomic bool freeze_requested = false;
+static int live_sessions = 0; /* threads de conexão criadas e não encerradas */
+static int parked_count = 0;
+static ParkedSession *parked_sessions = NULL;
+
+/* Id do comando sendo processado pela thread e se ele já foi respondido.
+ * reply() ecoa o id para que o cliente possa casar respostas de comandos
+ * enviados em pipeline. */
+static _Thread_local uint32_t current_req_id = 0;
+static _Thread_local bool current_replied = false;
+
+/* O usuário autenticado na conexão da thread, de quem drain_subscriptions()
+ * lê os anéis sem passar pelo ClientManager; NULL antes do login. */
+static _Thread_local User *ring_user = NULL;
 
 /**
- * @brief Processa uma solicitação de registro, tentando cadastrar o usuário no
- * banco de dados. Responde ao cliente com sucesso ou erro, dependendo da
- * disponibilidade do nome de usuário e validade das credenciais.
+ * @brief Envia uma resposta formatada ao cliente e devolve o seu tipo, para
+ * que os handlers possam responder e retornar o resultado em um só passo.
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
- * @param msg Um ponteiro para a mensagem de registro recebida.
+ * @param type O tipo da resposta (CMD_SUCCESS, CMD_ERROR, CMD_NOTIFICATION).
+ * @param fmt String de formato no estilo printf para o texto da resposta.
+ * @return O próprio tipo da resposta.
  */
-void handle_register(int sockfd, const Message *msg)
+static CommandType reply(int sockfd, CommandType type, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static CommandType send_reply(int sockfd, CommandType type, uint64_t seq,
+                              const char *fmt, va_list args)
 {
   Message response;
   memset(&response, 0, sizeof(Message));
+  response.type = type;
+  response.req_id = current_req_id;
+  response.seq = seq;
+  current_replied = true;
 
-  if (strlen(msg->username) < 3 || strlen(msg->username) >= MAX_USERNAME ||
-      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid username or password length.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
+  vsnprintf(response.message, MAX_BUFFER, fmt, args);
+
+  outbound_reply(sockfd, &response);
+  return type;
+}
+
+static CommandType reply(int sockfd, CommandType type, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  send_reply(sockfd, type, 0, fmt, args);
+  va_end(args);
+  return type;
+}
+
+/**
+ * @brief Como reply(), com a sequência até onde a resposta cobre o chat do
+ * grupo (CMD_RESUME) em seq.
+ */
+static CommandType reply_seq(int sockfd, CommandType type, uint64_t seq,
+                             const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static CommandType reply_seq(int sockfd, CommandType type, uint64_t seq,
+                             const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  send_reply(sockfd, type, seq, fmt, args);
+  va_end(args);
+  return type;
+}
+
+/**
+ * @brief Responde que o nó dono do grupo (relay.h) não atendeu.
+ */
+static CommandType owner_unavailable(int sockfd)
+{
+  return reply(sockfd, CMD_ERROR,
+               "The server holding this group is unreachable, try again");
+}
+
+/**
+ * @brief Resolve o grupo alvo de um comando: o groupname da mensagem, ou o
+ * grupo atual do usuário se ele vier vazio.
+ *
+ * @param user O usuário que enviou o comando.
+ * @param msg A mensagem recebida.
+ * @param groupname Saída com o nome do grupo ('\0' se nenhum).
+ */
+static void target_group(User *user, const Message *msg, char *groupname)
+{
+  if (msg->groupname[0] == '\0') {
+    copy_current_group(user, groupname);
     return;
   }
+  strncpy(groupname, msg->groupname, MAX_GROUPNAME - 1);
+  groupname[MAX_GROUPNAME - 1] = '\0';
+}
 
-  if (register_user(&database, msg->username, msg->password)) {
-    response.type = CMD_SUCCESS;
-    strncpy(response.message, "Registration successful", MAX_BUFFER - 1);
-  } else {
-    response.type = CMD_ERROR;
-    strncpy(
-        response.message,
-        "Registration failed: Username already exists or invalid credentials",
-        MAX_BUFFER - 1);
-  }
+/**
+ * @brief Processa uma solicitação de registro, tentando cadastrar o usuário no
+ * banco de dados. Responde ao cliente com sucesso ou erro, dependendo da
+ * disponibilidade do nome de usuário e validade das credenciais.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem de registro recebida.
+ * @return O tipo da resposta enviada.
+ */
+CommandType handle_register(int sockfd, const Message *msg)
+{
+  if (strlen(msg->username) < 3 || strlen(msg->username) >= MAX_USERNAME ||
+      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD)
+    return reply(sockfd, CMD_ERROR, "Invalid username or password length.");
 
-  send_message(sockfd, &response);
+  if (register_user(&database, msg->username, msg->password))
+    return reply(sockfd, CMD_SUCCESS, "Registration successful");
+
+  return reply(
+      sockfd, CMD_ERROR,
+      "Registration failed: Username already exists or invalid credentials");
 }
 
 /**
@@ -55,225 +161,199 @@ void handle_register(int sockfd, const Message *msg)
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
  * @param msg Um ponteiro para a mensagem de login recebida.
+ * @return O tipo da resposta enviada.
  */
-void handle_login(int sockfd, const Message *msg)
+CommandType handle_login(int sockfd, const Message *msg)
 {
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
   if (strlen(msg->username) < 3 || strlen(msg->username) >= MAX_USERNAME ||
-      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid username or password length.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD)
+    return reply(sockfd, CMD_ERROR, "Invalid username or password length.");
 
-  if (find_client_by_username(&client_manager, msg->username)) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "User already logged in", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (find_client_by_username(&client_manager, msg->username) ||
+      relay_user_online(msg->username))
+    return reply(sockfd, CMD_ERROR, "User already logged in");
 
-  if (authenticate_user(&database, msg->username, msg->password)) {
-    User *user = add_client(&client_manager, msg->username, sockfd);
+  if (!authenticate_user(&database, msg->username, msg->password))
+    return reply(sockfd, CMD_ERROR, "Invalid username or password");
 
-    if (user) {
-      response.type = CMD_SUCCESS;
-      strncpy(response.message, "Login successful", MAX_BUFFER - 1);
-    } else {
-      response.type = CMD_ERROR;
-      strncpy(response.message, "Server full, try again later",
-              MAX_BUFFER - 1);
-    }
-  } else {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid username or password", MAX_BUFFER - 1);
-  }
+  ring_user = add_client(&client_manager, msg->username, sockfd);
+  if (!ring_user)
+    return reply(sockfd, CMD_ERROR, "Server full, try again later");
 
-  send_message(sockfd, &response);
+  outbound_set_name(sockfd, msg->username);
+  relay_user(msg->username, true);
+  return reply(sockfd, CMD_SUCCESS, "Login successful");
 }
 
 /**
  * @brief Cria um novo grupo com nome, senha e criador, se o usuário estiver
- * autenticado. Responde com sucesso ou falha dependendo da existência ou
- * limite de grupos, e validade das credenciais.
+ * autenticado; com msg->seq != 0, cria um canal de anúncios. Responde com
+ * sucesso ou falha dependendo da existência ou limite de grupos, e validade
+ * das credenciais.
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
  * @param msg Um ponteiro para a mensagem de criação de grupo recebida.
+ * @return O tipo da resposta enviada.
  */
-void handle_create_group(int sockfd, const Message *msg)
+CommandType handle_create_group(int sockfd, const Message *msg)
 {
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
   if (strlen(msg->groupname) < 3 || strlen(msg->groupname) >= MAX_GROUPNAME ||
-      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid groupname or password length.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD)
+    return reply(sockfd, CMD_ERROR, "Invalid groupname or password length.");
 
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
-
-  if (create_group(&group_manager, msg->groupname, msg->password,
-                   user->username)) {
-    response.type = CMD_SUCCESS;
-    strncpy(response.message, "Group created successfully", MAX_BUFFER - 1);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  bool channel = msg->seq != 0;
+  bool created;
+  if (placement_owner(msg->groupname) == PLACEMENT_SELF) {
+    created = create_group(&group_manager, msg->groupname, msg->password,
+                           user->username, channel);
   } else {
-    response.type = CMD_ERROR;
-    strncpy(response.message,
-            "Failed to create group (name exists or server full)",
-            MAX_BUFFER - 1);
+    RelayStatus status = relay_create_group(msg->groupname, msg->password,
+                                            user->username, channel);
+    if (status == RELAY_UNAVAILABLE) return owner_unavailable(sockfd);
+    created = status == RELAY_OK;
   }
 
-  send_message(sockfd, &response);
+  if (created)
+    return reply(sockfd, CMD_SUCCESS, "%s created successfully",
+                 channel ? "Channel" : "Group");
+
+  return reply(sockfd, CMD_ERROR,
+               "Failed to create group (name exists or server full)");
+}
+
+/**
+ * @brief Entra no grupo pelo dono do seu shard (shard.h) ou, sem shards, na
+ * hora.
+ */
+static bool enter_group(Group *group, User *user)
+{
+  bool joined;
+  if (!shard_join(group, user, &joined))
+    joined = join_group(&group_manager, group, user);
+  return joined;
+}
+
+/**
+ * @brief Sai do grupo pelo dono do seu shard ou, sem shards, na hora. Com
+ * 'keep_cursor' o cursor fica para a retomada (disconnect_from_group()).
+ */
+static bool exit_group(Group *group, User *user, bool keep_cursor)
+{
+  bool left;
+  if (shard_leave(group, user, keep_cursor, &left)) return left;
+  if (keep_cursor) return disconnect_from_group(&group_manager, group, user);
+  return leave_group(&group_manager, group, user);
 }
 
 /**
  * @brief Permite que um usuário autenticado entre em um grupo existente.
- * Verifica a senha, remove de grupo anterior se necessário, e envia
- * notificação aos membros do novo grupo.
+ * Verifica a senha e registra a entrada para o próximo aviso de presença do
+ * grupo. O usuário
+ * continua nos grupos em que já estava; o novo grupo passa a ser o seu grupo
+ * atual.
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
  * @param msg Um ponteiro para a mensagem de entrada em grupo recebida.
+ * @return O tipo da resposta enviada.
  */
-void handle_enter_group(int sockfd, const Message *msg)
+CommandType handle_enter_group(int sockfd, const Message *msg)
 {
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
   if (strlen(msg->groupname) < 3 || strlen(msg->groupname) >= MAX_GROUPNAME ||
-      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid groupname or password length.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+      strlen(msg->password) < 4 || strlen(msg->password) >= MAX_PASSWORD)
+    return reply(sockfd, CMD_ERROR, "Invalid groupname or password length.");
 
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
-
-  if (user->current_group[0] != '\0') {
-    Group *old_group = find_group(&group_manager, user->current_group);
-    if (old_group) {
-      Message old_notification;
-      memset(&old_notification, 0, sizeof(Message));
-      old_notification.type = CMD_NOTIFICATION;
-      snprintf(old_notification.message, MAX_BUFFER,
-               "%s has left the group %s", user->username, old_group->name);
-      broadcast_to_group(old_group, &old_notification, sockfd);
-      leave_group(&group_manager, old_group, user);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  /* Uma réplica sem membros daqui pode estar velha: o dono confere a senha
+   * e manda o estado atual. */
+  Group *group = pin_group(&group_manager, msg->groupname);
+  if (!group || (group->owner != PLACEMENT_SELF && group->member_count == 0 &&
+                 atomic_load(&group->subscriber_count) == 0)) {
+    if (group) unpin_group(group);
+    switch (relay_fetch_group(msg->groupname, msg->password, &group)) {
+    case RELAY_OK:
+      break;
+    case RELAY_DENIED:
+      return reply(sockfd, CMD_ERROR, "Incorrect group password");
+    case RELAY_UNAVAILABLE:
+      return owner_unavailable(sockfd);
+    case RELAY_FAILED:
+      return reply(sockfd, CMD_ERROR, "Failed to join group (server full)");
+    default:
+      return reply(sockfd, CMD_ERROR, "Group does not exist");
     }
+  } else if (!verify_group_password(group, msg->password)) {
+    unpin_group(group);
+    return reply(sockfd, CMD_ERROR, "Incorrect group password");
   }
 
-  Group *group = find_group(&group_manager, msg->groupname);
-  if (!group) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Group does not exist", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
-
-  if (!verify_group_password(group, msg->password)) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Incorrect group password", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
-
-  if (join_group(&group_manager, group, user)) {
-    response.type = CMD_SUCCESS;
-    strncpy(response.message, "Joined group successfully", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-
-    Message notification;
-    memset(&notification, 0, sizeof(Message));
-    notification.type = CMD_NOTIFICATION;
-    snprintf(notification.message, MAX_BUFFER, "%s has joined the group",
-             user->username);
-    broadcast_to_group(group, &notification, sockfd);
+  CommandType type;
+  if (is_subscribed(user, group->name)) {
+    enter_group(group, user);
+    type = reply(sockfd, CMD_SUCCESS, "Already in group '%s'", group->name);
+  } else if (!enter_group(group, user)) {
+    relay_release_group(group);
+    type = reply(sockfd, CMD_ERROR,
+                 "Failed to join group (group full or already in %d groups)",
+                 MAX_SUBSCRIPTIONS);
   } else {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Failed to join group (group full)",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
+    type = reply(sockfd, CMD_SUCCESS, "Joined group successfully");
+    record_presence(group, user->username, true);
+    relay_membership(group, user->username, true);
   }
+
+  unpin_group(group);
+  return type;
 }
 
 /**
- * @brief Lida com a solicitação de um usuário para sair do seu grupo atual.
- * Envia notificação aos membros do grupo se o usuário sair com sucesso.
+ * @brief Lida com a solicitação de um usuário para sair de um grupo (o
+ * informado na mensagem ou, se vazio, o grupo atual). A saída entra no
+ * próximo aviso de presença do grupo.
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
- * @param msg Um ponteiro para a mensagem de saída de grupo recebida (não
- * utilizado diretamente).
+ * @param msg Um ponteiro para a mensagem de saída de grupo recebida.
+ * @return O tipo da resposta enviada.
  */
-void handle_leave_group(int sockfd, const Message *msg)
+CommandType handle_leave_group(int sockfd, const Message *msg)
 {
-  (void)msg;
-
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
 
-  if (user->current_group[0] == '\0') {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not in any group", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  char groupname[MAX_GROUPNAME];
+  target_group(user, msg, groupname);
+  if (groupname[0] == '\0')
+    return reply(sockfd, CMD_ERROR, "Not in any group");
+
+  if (!is_subscribed(user, groupname))
+    return reply(sockfd, CMD_ERROR, "Not in group '%s'", groupname);
 
-  Group *group = find_group(&group_manager, user->current_group);
+  Group *group = pin_group(&group_manager, groupname);
   if (!group) {
-    response.type = CMD_ERROR;
-    strncpy(response.message,
-            "Current group not found (might have been deleted)",
-            MAX_BUFFER - 1);
-    user->current_group[0] = '\0';
-    send_message(sockfd, &response);
-    return;
+    remove_subscription(user, groupname);
+    return reply(sockfd, CMD_ERROR,
+                 "Group not found (might have been deleted)");
   }
 
-  Message notification;
-  memset(&notification, 0, sizeof(Message));
-  notification.type = CMD_NOTIFICATION;
-  snprintf(notification.message, MAX_BUFFER, "%s has left the group",
-           user->username);
-  broadcast_to_group(group, &notification, sockfd);
-
-  if (leave_group(&group_manager, group, user)) {
-    response.type = CMD_SUCCESS;
-    strncpy(response.message, "Left group successfully", MAX_BUFFER - 1);
+  CommandType type;
+  if (exit_group(group, user, false)) {
+    record_presence(group, user->username, false);
+    relay_membership(group, user->username, false);
+    relay_release_group(group);
+    type = reply(sockfd, CMD_SUCCESS, "Left group successfully");
   } else {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Failed to leave group", MAX_BUFFER - 1);
+    type = reply(sockfd, CMD_ERROR, "Failed to leave group");
   }
 
-  send_message(sockfd, &response);
+  unpin_group(group);
+  return type;
 }
 
 /**
@@ -283,121 +363,87 @@ void handle_leave_group(int sockfd, const Message *msg)
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
  * @param msg Um ponteiro para a mensagem de exclusão de grupo recebida.
+ * @return O tipo da resposta enviada.
  */
-void handle_delete_group(int sockfd, const Message *msg)
+CommandType handle_delete_group(int sockfd, const Message *msg)
 {
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
-  if (strlen(msg->groupname) < 3 || strlen(msg->groupname) >= MAX_GROUPNAME) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid groupname length.", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (strlen(msg->groupname) < 3 || strlen(msg->groupname) >= MAX_GROUPNAME)
+    return reply(sockfd, CMD_ERROR, "Invalid groupname length.");
 
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
-
-  Group *group = find_group(&group_manager, msg->groupname);
-  if (!group) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Group does not exist", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  Group *group = pin_group(&group_manager, msg->groupname);
+  if (!group || group->owner != PLACEMENT_SELF) {
+    if (group) unpin_group(group);
+    switch (relay_delete_group(msg->groupname, user->username)) {
+    case RELAY_OK:
+      return reply(sockfd, CMD_SUCCESS, "Group deleted successfully");
+    case RELAY_DENIED:
+      return reply(sockfd, CMD_ERROR, "Failed to delete group: not owner");
+    case RELAY_UNAVAILABLE:
+      return owner_unavailable(sockfd);
+    default:
+      return reply(sockfd, CMD_ERROR, "Group does not exist");
+    }
   }
 
   if (strcmp(group->creator, user->username) != 0) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Failed to delete group: not owner",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
+    unpin_group(group);
+    return reply(sockfd, CMD_ERROR, "Failed to delete group: not owner");
   }
 
-  Message notification;
-  memset(&notification, 0, sizeof(Message));
-  notification.type = CMD_NOTIFICATION;
-  snprintf(
-      notification.message, MAX_BUFFER,
-      "Group '%s' is being deleted by owner. You have been removed from it.",
-      group->name);
-  broadcast_to_group(group, &notification, -1);
-
-  pthread_mutex_lock(&group->mutex);
-  for (int i = 0; i < group->member_count; i++) {
-    group->members[i]->current_group[0] = '\0';
-  }
-  group->member_count = 0;
-  pthread_mutex_unlock(&group->mutex);
+  relay_group_deleted(group);
 
-  if (delete_group(&group_manager, msg->groupname, user->username)) {
-    response.type = CMD_SUCCESS;
-    strncpy(response.message, "Group deleted successfully", MAX_BUFFER - 1);
-  } else {
-    response.type = CMD_ERROR;
-    strncpy(response.message,
-            "Failed to delete group: an internal error occurred",
-            MAX_BUFFER - 1);
-  }
+  /* Pelo dono, depois dos chats que o criador enviou antes. */
+  bool deleted = evict_group(&group_manager, group, user->username);
+  unpin_group(group);
+  if (deleted)
+    return reply(sockfd, CMD_SUCCESS, "Group deleted successfully");
 
-  send_message(sockfd, &response);
+  return reply(sockfd, CMD_ERROR,
+               "Failed to delete group: an internal error occurred");
 }
 
 /**
  * @brief Encaminha uma mensagem de chat de um usuário autenticado para todos
- * os membros do grupo em que ele está.
+ * os membros de um grupo que ele assina: o informado na mensagem ou, se
+ * vazio, o grupo atual.
  *
  * @param sockfd O descritor de arquivo do socket do remetente.
  * @param msg Um ponteiro para a mensagem de chat recebida (original).
+ * @return CMD_SUCCESS se a mensagem foi encaminhada, ou o tipo da resposta de
+ * erro enviada.
  */
-void handle_message(int sockfd, const Message *msg)
+CommandType handle_message(int sockfd, const Message *msg)
 {
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    Message response;
-    memset(&response, 0, sizeof(Message));
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
 
-  if (strlen(msg->message) == 0 || strlen(msg->message) >= MAX_MESSAGE) {
-    Message response;
-    memset(&response, 0, sizeof(Message));
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid message length.", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (strlen(msg->message) == 0 || strlen(msg->message) >= MAX_MESSAGE)
+    return reply(sockfd, CMD_ERROR, "Invalid message length.");
 
-  if (user->current_group[0] == '\0') {
-    Message response;
-    memset(&response, 0, sizeof(Message));
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not in any group", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  char groupname[MAX_GROUPNAME];
+  target_group(user, msg, groupname);
+  if (groupname[0] == '\0')
+    return reply(sockfd, CMD_ERROR, "Not in any group");
+
+  if (!is_subscribed(user, groupname))
+    return reply(sockfd, CMD_ERROR, "Not in group '%s'", groupname);
 
-  Group *group = find_group(&group_manager, user->current_group);
+  Group *group = pin_group(&group_manager, groupname);
   if (!group) {
-    Message response;
-    memset(&response, 0, sizeof(Message));
-    response.type = CMD_ERROR;
-    strncpy(
-        response.message,
-        "Your current group no longer exists. Please leave and join another.",
-        MAX_BUFFER - 1);
-    user->current_group[0] = '\0';
-    send_message(sockfd, &response);
-    return;
+    remove_subscription(user, groupname);
+    return reply(sockfd, CMD_ERROR, "Group '%s' no longer exists.",
+                 groupname);
+  }
+
+  if (group->channel && !is_channel_publisher(group, user->username)) {
+    unpin_group(group);
+    return reply(sockfd, CMD_ERROR, "Only publishers can post in '%s'",
+                 group->name);
   }
 
   Message chat_msg;
@@ -405,11 +451,223 @@ void handle_message(int sockfd, const Message *msg)
   chat_msg.type = CMD_MESSAGE;
   strncpy(chat_msg.username, user->username, MAX_USERNAME - 1);
   chat_msg.username[MAX_USERNAME - 1] = '\0';
+  memcpy(chat_msg.groupname, group->name, MAX_GROUPNAME);
 
   strncpy(chat_msg.message, msg->message, MAX_BUFFER - 1);
   chat_msg.message[MAX_BUFFER - 1] = '\0';
 
-  broadcast_to_group(group, &chat_msg, sockfd);
+  /* Numa réplica, o dono numera e publica; aqui o chat chega de volta. */
+  if (!relay_post(group, &chat_msg) && !shard_publish(group, &chat_msg) &&
+      publish_to_group(group, &chat_msg))
+    relay_chat(group, &chat_msg);
+  unpin_group(group);
+  return CMD_SUCCESS;
+}
+
+/**
+ * @brief Registra a confirmação cumulativa do chat de um grupo. Não envia
+ * resposta, a não ser que o comando tenha req_id.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg A mensagem com o grupo e a maior sequência recebida.
+ * @return CMD_SUCCESS, ou CMD_ERROR se o usuário ou o grupo não existem.
+ */
+CommandType handle_ack(int sockfd, const Message *msg)
+{
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (!user || !user->authenticated) return CMD_ERROR;
+
+  Group *group = pin_group(&group_manager, msg->groupname);
+  if (!group) return CMD_ERROR;
+
+  if (!shard_ack(group, user->username, msg->seq))
+    ack_group(group, user->username, msg->seq);
+  unpin_group(group);
+  return CMD_SUCCESS;
+}
+
+/**
+ * @brief Liga (msg->seq != 0) ou desliga os deltas completos de presença de um
+ * grupo que o usuário assina (msg->groupname, ou o grupo atual se vazio).
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg A mensagem com o grupo e o estado desejado.
+ * @return O tipo da resposta enviada.
+ */
+CommandType handle_presence(int sockfd, const Message *msg)
+{
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  char groupname[MAX_GROUPNAME];
+  target_group(user, msg, groupname);
+  if (groupname[0] == '\0')
+    return reply(sockfd, CMD_ERROR, "Not in any group");
+
+  if (!set_presence_watch(user, groupname, msg->seq != 0))
+    return reply(sockfd, CMD_ERROR, "Not in group '%s'", groupname);
+
+  return reply(sockfd, CMD_SUCCESS, "Presence updates for '%s' %s", groupname,
+               msg->seq ? "on" : "off");
+}
+
+/**
+ * @brief Designa (msg->seq != 0) ou retira o publicador msg->username de um
+ * canal (msg->groupname, ou o grupo atual se vazio). Só o criador pode.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg A mensagem com o canal, o usuário e o estado desejado.
+ * @return O tipo da resposta enviada.
+ */
+CommandType handle_publisher(int sockfd, const Message *msg)
+{
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  if (strlen(msg->username) < 3 || strlen(msg->username) >= MAX_USERNAME)
+    return reply(sockfd, CMD_ERROR, "Invalid username length.");
+
+  char groupname[MAX_GROUPNAME];
+  target_group(user, msg, groupname);
+  if (groupname[0] == '\0')
+    return reply(sockfd, CMD_ERROR, "Not in any group");
+
+  Group *group = pin_group(&group_manager, groupname);
+  if (!group || group->owner != PLACEMENT_SELF) {
+    if (group) unpin_group(group);
+    switch (relay_set_publisher(groupname, user->username, msg->username,
+                                msg->seq != 0)) {
+    case RELAY_OK:
+      break;
+    case RELAY_NOT_CHANNEL:
+      return reply(sockfd, CMD_ERROR, "'%s' is not a channel", groupname);
+    case RELAY_DENIED:
+      return reply(sockfd, CMD_ERROR,
+                   "Only the creator can change publishers of '%s'",
+                   groupname);
+    case RELAY_FAILED:
+      return reply(sockfd, CMD_ERROR, "'%s' already has %d publishers",
+                   groupname, CHANNEL_PUBLISHERS);
+    case RELAY_UNAVAILABLE:
+      return owner_unavailable(sockfd);
+    default:
+      return reply(sockfd, CMD_ERROR, "Group does not exist");
+    }
+    return reply(sockfd, CMD_SUCCESS, "%s %s publisher of '%s'",
+                 msg->username, msg->seq ? "is now a" : "is no longer a",
+                 groupname);
+  }
+
+  CommandType type;
+  if (!group->channel)
+    type = reply(sockfd, CMD_ERROR, "'%s' is not a channel", groupname);
+  else if (strcmp(group->creator, user->username) != 0)
+    type = reply(sockfd, CMD_ERROR,
+                 "Only the creator can change publishers of '%s'", groupname);
+  else if (!set_channel_publisher(group, msg->username, msg->seq != 0))
+    type = reply(sockfd, CMD_ERROR, "'%s' already has %d publishers",
+                 groupname, CHANNEL_PUBLISHERS);
+  else {
+    relay_publisher(group, msg->username, msg->seq != 0);
+    type = reply(sockfd, CMD_SUCCESS, "%s %s publisher of '%s'",
+                 msg->username, msg->seq ? "is now a" : "is no longer a",
+                 groupname);
+  }
+
+  unpin_group(group);
+  return type;
+}
+
+/**
+ * @brief Retransmite as mensagens do grupo com sequência maior que msg->seq,
+ * guardadas no histórico, e trata msg->seq como confirmação cumulativa.
+ * Responde com CMD_SUCCESS, ou com CMD_NOTIFICATION se parte da lacuna já
+ * saiu do histórico; a resposta traz em seq a última sequência retransmitida
+ * ou perdida, para o cliente saber até onde o chat chegou sem lacunas. A
+ * retransmissão para no que cabe na fila de saída da conexão (ao menos uma
+ * mensagem, esperando espaço se preciso); o cliente pede o resto depois.
+ * Num canal, a leitura do anel volta para depois de msg->seq e os posts
+ * seguem pela leitura normal (drain_rings()).
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg A mensagem com o grupo e a última sequência recebida.
+ * @return O tipo da resposta enviada.
+ */
+static CommandType resume_group(int sockfd, const Message *msg, User *user,
+                                Group *group);
+
+CommandType handle_resume(int sockfd, const Message *msg)
+{
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
+
+  if (!is_subscribed(user, msg->groupname))
+    return reply(sockfd, CMD_ERROR, "Not in group '%.*s'", MAX_GROUPNAME - 1,
+                 msg->groupname);
+
+  Group *group = pin_group(&group_manager, msg->groupname);
+  if (!group) return reply(sockfd, CMD_ERROR, "Group does not exist");
+
+  CommandType type = resume_group(sockfd, msg, user, group);
+  unpin_group(group);
+  return type;
+}
+
+/**
+ * @brief A retomada de handle_resume(), com o grupo fixado.
+ */
+static CommandType resume_group(int sockfd, const Message *msg, User *user,
+                                Group *group)
+{
+  if (group->channel) {
+    uint64_t gone = resume_channel(group, user, msg->seq);
+    if (gone > 0)
+      return reply(sockfd, CMD_NOTIFICATION,
+                   "%llu messages in '%s' are no longer available",
+                   (unsigned long long)gone, group->name);
+    return reply(sockfd, CMD_SUCCESS, "Resuming '%s'", group->name);
+  }
+
+  if (!shard_ack(group, user->username, msg->seq))
+    ack_group(group, user->username, msg->seq);
+
+  GroupHistoryEntry *entries;
+  uint64_t missed;
+  size_t count = copy_group_history(group, msg->seq, &entries, &missed);
+
+  Message chat_msg;
+  memset(&chat_msg, 0, sizeof(Message));
+  chat_msg.type = CMD_MESSAGE;
+  memcpy(chat_msg.groupname, group->name, MAX_GROUPNAME);
+
+  /* Uma vaga fica para a resposta. */
+  size_t space = outbound_space(sockfd);
+  size_t budget = space > 2 ? space - 1 : 1;
+
+  uint64_t covered = msg->seq + missed;
+  for (size_t i = 0; i < count && budget > 0; i++) {
+    if (entries[i].text) {
+      chat_msg.seq = entries[i].seq;
+      chat_msg.timestamp = entries[i].timestamp;
+      memcpy(chat_msg.username, entries[i].username, MAX_USERNAME);
+      strncpy(chat_msg.message, entries[i].text, MAX_BUFFER - 1);
+      if (outbound_reply(sockfd, &chat_msg) < 0) break;
+      budget--;
+    }
+    covered = entries[i].seq;
+  }
+  free_group_history(entries, count);
+
+  if (missed > 0)
+    return reply_seq(sockfd, CMD_NOTIFICATION, covered,
+                     "%llu messages in '%s' are no longer available",
+                     (unsigned long long)missed, group->name);
+
+  return reply_seq(sockfd, CMD_SUCCESS, covered, "Resumed %llu messages",
+                   (unsigned long long)(covered - msg->seq));
 }
 
 /**
@@ -418,44 +676,28 @@ void handle_message(int sockfd, const Message *msg)
  *
  * @param sockfd O descritor de arquivo do socket do remetente.
  * @param msg Um ponteiro para a mensagem direta recebida (original).
+ * @return O tipo da resposta enviada.
  */
-void handle_direct_message(int sockfd, const Message *msg)
+CommandType handle_direct_message(int sockfd, const Message *msg)
 {
-  Message response;
-  memset(&response, 0, sizeof(Message));
-
   User *sender = find_client_by_sockfd(&client_manager, sockfd);
-  if (!sender || !sender->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (!sender || !sender->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
 
   if (strlen(msg->username) == 0 || strlen(msg->username) >= MAX_USERNAME ||
-      strlen(msg->message) == 0 || strlen(msg->message) >= MAX_MESSAGE) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Invalid recipient username or message length.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+      strlen(msg->message) == 0 || strlen(msg->message) >= MAX_MESSAGE)
+    return reply(sockfd, CMD_ERROR,
+                 "Invalid recipient username or message length.");
 
-  if (strcmp(sender->username, msg->username) == 0) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Cannot send direct message to yourself.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (strcmp(sender->username, msg->username) == 0)
+    return reply(sockfd, CMD_ERROR, "Cannot send direct message to yourself.");
 
   User *recipient = find_client_by_username(&client_manager, msg->username);
   if (!recipient) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Recipient not found or not online.",
-            MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
+    if (relay_direct(msg->username, sender->username, msg->message))
+      return reply(sockfd, CMD_SUCCESS, "Direct message sent to %s",
+                   msg->username);
+    return reply(sockfd, CMD_ERROR, "Recipient not found or not online.");
   }
 
   Message dm_msg;
@@ -467,120 +709,287 @@ void handle_direct_message(int sockfd, const Message *msg)
   strncpy(dm_msg.message, msg->message, MAX_BUFFER - 1);
   dm_msg.message[MAX_BUFFER - 1] = '\0';
 
-  send_message(recipient->sockfd, &dm_msg);
+  outbound_send(recipient->sockfd, &dm_msg);
 
-  response.type = CMD_SUCCESS;
-  snprintf(response.message, MAX_BUFFER, "Direct message sent to %s",
-           recipient->username);
-  send_message(sockfd, &response);
+  return reply(sockfd, CMD_SUCCESS, "Direct message sent to %s",
+               recipient->username);
+}
+
+static int format_group_entry(char *line, size_t size, const ListEntry *entry)
+{
+  return snprintf(line, size, "%s%c%s%c%d\n", entry->name, LIST_FIELD_SEP,
+                  entry->creator, LIST_FIELD_SEP, entry->members);
+}
+
+static int format_member_entry(char *line, size_t size, const ListEntry *entry)
+{
+  return snprintf(line, size, "%s%c%s\n", entry->name, LIST_FIELD_SEP,
+                  entry->is_creator     ? "creator"
+                  : entry->is_publisher ? "publisher"
+                                        : "member");
 }
 
 /**
- * @brief Lida com a solicitação para listar todos os grupos de chat
- * disponíveis no servidor.
+ * @brief Responde a um pedido de listagem com uma página (CMD_LIST_PAGE)
+ * tirada da listagem já serializada.
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
- * @param msg Um ponteiro para a mensagem de listagem de grupos (não utilizado
- * diretamente).
+ * @param request O pedido (cursor em 'message', limite em 'seq').
+ * @param groupname O grupo listado (NULL para a lista de grupos).
+ * @param listing A listagem.
+ * @return CMD_LIST_PAGE.
  */
-void handle_list_groups(int sockfd, const Message *msg)
+static CommandType send_list_page(int sockfd, const Message *request,
+                                  const char *groupname,
+                                  const ListingSnapshot *listing)
 {
-  (void)msg;
-
-  Message response;
-  memset(&response, 0, sizeof(Message));
+  char cursor[MAX_USERNAME];
+  strncpy(cursor, request->message, MAX_USERNAME - 1);
+  cursor[MAX_USERNAME - 1] = '\0';
+
+  Message page;
+  memset(&page, 0, sizeof(Message));
+  page.type = CMD_LIST_PAGE;
+  page.req_id = current_req_id;
+  current_replied = true;
+  if (groupname) memcpy(page.groupname, groupname, MAX_GROUPNAME);
+
+  page.seq = listing_page(listing, cursor, request->seq, page.message,
+                          MAX_BUFFER);
+
+  outbound_reply(sockfd, &page);
+  return CMD_LIST_PAGE;
+}
 
-  User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
+/**
+ * @brief Retorna a listagem de grupos, reaproveitando a guardada se nenhum
+ * grupo foi criado, apagado ou mudou de membros desde que ela foi gerada.
+ * Caso contrário os grupos são copiados com o mutex travado só durante a
+ * cópia, e a nova listagem é ordenada e serializada fora dele. Numa
+ * federação, cada nó lista os grupos de que é dono e a listagem junta a de
+ * todos; ela é gerada a cada pedido, já que as mudanças nos outros nós não
+ * passam por aqui.
+ *
+ * @return Uma referência à listagem (liberar com listing_release()), ou NULL
+ * se faltar memória.
+ */
+static ListingSnapshot *group_listing(void)
+{
+  bool clustered = relay_clustered();
+  uint64_t version = atomic_load(&group_manager.version);
+  ListingSnapshot *listing = NULL;
+  if (!clustered) {
+    listing = listing_acquire(&group_manager.groups_listing, version);
+    if (listing) return listing;
   }
 
+  size_t max = clustered ? MAX_GROUPS * RELAY_MAX_NODES : MAX_GROUPS;
+  ListEntry *entries = malloc(sizeof(ListEntry) * max);
+  if (!entries) return NULL;
+  size_t count = 0;
+
   pthread_mutex_lock(&group_manager.mutex);
-  if (group_manager.group_count == 0) {
-    strncpy(response.message, "No groups available.", MAX_BUFFER - 1);
-  } else {
-    char group_list[MAX_BUFFER];
-    int current_len =
-        snprintf(group_list, sizeof(group_list),
-                 "Available groups (%d):", group_manager.group_count);
-    for (int i = 0; i < group_manager.group_count; i++) {
-      current_len += snprintf(
-          group_list + current_len, sizeof(group_list) - current_len,
-          "\n- %s (Creator: %s, Members: %d/%d)", group_manager.groups[i].name,
-          group_manager.groups[i].creator,
-          group_manager.groups[i].member_count, MAX_CLIENTS);
-      if ((unsigned long)current_len >= sizeof(group_list) - 1) break;
-    }
-    strncpy(response.message, group_list, MAX_BUFFER - 1);
+  version = atomic_load(&group_manager.version);
+  for (int i = 0; i < group_manager.group_count; i++) {
+    Group *group = group_manager.list[i];
+    if (group->owner != PLACEMENT_SELF) continue; /* listado pelo dono */
+    ListEntry *entry = &entries[count++];
+    memcpy(entry->name, group->name, MAX_GROUPNAME);
+    memcpy(entry->creator, group->creator, MAX_USERNAME);
+    entry->members = group->channel
+                         ? atomic_load(&group->subscriber_count)
+                         : group->member_count + group->remote_count;
   }
   pthread_mutex_unlock(&group_manager.mutex);
 
-  response.type = CMD_NOTIFICATION;
-  send_message(sockfd, &response);
+  if (clustered) {
+    /* Enquanto o anel muda, um grupo pode vir de dois donos. */
+    size_t local = count;
+    size_t remote = relay_list_groups(entries + count, max - count);
+    for (size_t i = local; i < local + remote; i++) {
+      bool seen = false;
+      for (size_t j = 0; j < count && !seen; j++)
+        seen = strcmp(entries[j].name, entries[i].name) == 0;
+      if (!seen) entries[count++] = entries[i];
+    }
+  }
+
+  listing = listing_build(entries, count, format_group_entry, version);
+  free(entries);
+  if (listing && !clustered)
+    listing_publish(&group_manager.groups_listing, listing);
+  return listing;
 }
 
 /**
- * @brief Lida com a solicitação para listar os membros do grupo atual do
- * usuário.
+ * @brief Retorna a listagem de membros do grupo, reaproveitando a guardada
+ * se ninguém entrou ou saiu desde que ela foi gerada. Os membros em outros
+ * nós da federação são listados junto. Num canal, os membros listados são o
+ * criador e os publicadores.
+ *
+ * @return Uma referência à listagem (liberar com listing_release()), ou NULL
+ * se faltar memória.
+ */
+static ListingSnapshot *member_listing(Group *group)
+{
+  uint64_t version = atomic_load(&group->members_version);
+  ListingSnapshot *listing = listing_acquire(&group->members_listing, version);
+  if (listing) return listing;
+
+  ListEntry entries[MAX_CLIENTS + REMOTE_MEMBERS];
+  size_t count = 0;
+
+  pthread_mutex_lock(&group->mutex);
+  version = atomic_load(&group->members_version);
+  if (group->channel) {
+    ListEntry *entry = &entries[count++];
+    memset(entry, 0, sizeof(ListEntry));
+    memcpy(entry->name, group->creator, MAX_USERNAME);
+    entry->is_creator = true;
+    for (int i = 0; i < group->publisher_count; i++) {
+      /* O criador já foi listado, mesmo que também seja publicador. */
+      if (strncmp(group->publishers[i], group->creator, MAX_USERNAME) == 0)
+        continue;
+      entry = &entries[count++];
+      memset(entry, 0, sizeof(ListEntry));
+      memcpy(entry->name, group->publishers[i], MAX_USERNAME);
+      entry->is_publisher = true;
+    }
+  }
+  for (int i = 0; i < group->member_count; i++) {
+    ListEntry *entry = &entries[count++];
+    memcpy(entry->name, group->members[i]->username, MAX_USERNAME);
+    entry->is_creator =
+        strcmp(group->members[i]->username, group->creator) == 0;
+    entry->is_publisher = false;
+  }
+  for (int i = 0; i < group->remote_count; i++) {
+    ListEntry *entry = &entries[count++];
+    memcpy(entry->name, group->remote[i].username, MAX_USERNAME);
+    entry->is_creator = strcmp(group->remote[i].username, group->creator) == 0;
+    entry->is_publisher = false;
+  }
+  pthread_mutex_unlock(&group->mutex);
+
+  listing = listing_build(entries, count, format_member_entry, version);
+  if (listing) listing_publish(&group->members_listing, listing);
+  return listing;
+}
+
+/**
+ * @brief Lida com a solicitação para listar os grupos de chat do servidor.
+ * Responde com uma página da listagem (ver send_list_page()).
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
- * @param msg Um ponteiro para a mensagem de listagem de membros (não utilizado
- * diretamente).
+ * @param msg Um ponteiro para a mensagem de listagem de grupos (cursor e
+ * limite da página).
+ * @return O tipo da resposta enviada.
  */
-void handle_list_members(int sockfd, const Message *msg)
+CommandType handle_list_groups(int sockfd, const Message *msg)
 {
-  (void)msg;
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
 
-  Message response;
-  memset(&response, 0, sizeof(Message));
+  ListingSnapshot *listing = group_listing();
+  if (!listing) return reply(sockfd, CMD_ERROR, "Server out of memory");
 
+  CommandType result = send_list_page(sockfd, msg, NULL, listing);
+  listing_release(listing);
+  return result;
+}
+
+/**
+ * @brief Lida com a solicitação para listar os membros de um grupo que o
+ * usuário assina (o informado na mensagem ou, se vazio, o grupo atual).
+ * Responde com uma página da listagem (ver send_list_page()).
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem de listagem de membros (grupo, cursor
+ * e limite da página).
+ * @return O tipo da resposta enviada.
+ */
+CommandType handle_list_members(int sockfd, const Message *msg)
+{
   User *user = find_client_by_sockfd(&client_manager, sockfd);
-  if (!user || !user->authenticated) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Not authenticated", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  if (!user || !user->authenticated)
+    return reply(sockfd, CMD_ERROR, "Not authenticated");
 
-  if (user->current_group[0] == '\0') {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "You are not in any group.", MAX_BUFFER - 1);
-    send_message(sockfd, &response);
-    return;
-  }
+  char groupname[MAX_GROUPNAME];
+  target_group(user, msg, groupname);
+  if (groupname[0] == '\0')
+    return reply(sockfd, CMD_ERROR, "You are not in any group.");
 
-  Group *group = find_group(&group_manager, user->current_group);
+  if (!is_subscribed(user, groupname))
+    return reply(sockfd, CMD_ERROR, "Not in group '%s'", groupname);
+
+  Group *group = pin_group(&group_manager, groupname);
   if (!group) {
-    response.type = CMD_ERROR;
-    strncpy(response.message, "Your current group no longer exists.",
-            MAX_BUFFER - 1);
-    user->current_group[0] = '\0';
-    send_message(sockfd, &response);
-    return;
+    remove_subscription(user, groupname);
+    return reply(sockfd, CMD_ERROR, "Group '%s' no longer exists.",
+                 groupname);
   }
 
-  pthread_mutex_lock(&group->mutex);
-  char member_list[MAX_BUFFER];
-  int current_len = snprintf(member_list, sizeof(member_list),
-                             "Members in '%s' (%d/%d):", group->name,
-                             group->member_count, MAX_CLIENTS);
-  for (int i = 0; i < group->member_count; i++) {
-    current_len +=
-        snprintf(member_list + current_len, sizeof(member_list) - current_len,
-                 "\n- %s %s", group->members[i]->username,
-                 (strcmp(group->members[i]->username, group->creator) == 0)
-                     ? "(Creator)"
-                     : "");
-    if ((unsigned long)current_len >= sizeof(member_list) - 1) break;
+  ListingSnapshot *listing = member_listing(group);
+  unpin_group(group);
+  if (!listing) return reply(sockfd, CMD_ERROR, "Server out of memory");
+
+  CommandType result = send_list_page(sockfd, msg, groupname, listing);
+  listing_release(listing);
+  return result;
+}
+
+/**
+ * @brief Tira o usuário de todos os grupos que ele assina, registrando a saída
+ * na presença de cada um. Usado no logout e na desconexão, para que os grupos
+ * não fiquem com um membro que já saiu do gerenciador de clientes.
+ *
+ * @param user O usuário.
+ * @param keep_cursor Mantém o cursor de confirmação para uma retomada após
+ * reconexão.
+ */
+static void leave_all_groups(User *user, bool keep_cursor)
+{
+  char groups[MAX_SUBSCRIPTIONS][MAX_GROUPNAME];
+  int count = copy_subscriptions(user, groups);
+
+  for (int i = 0; i < count; i++) {
+    Group *group = pin_group(&group_manager, groups[i]);
+    if (!group) {
+      remove_subscription(user, groups[i]);
+      continue;
+    }
+
+    exit_group(group, user, keep_cursor);
+    record_presence(group, user->username, false);
+    relay_membership(group, user->username, false);
+    /* Na desconexão a réplica fica, com o cursor, para a retomada. */
+    if (!keep_cursor) relay_release_group(group);
+    unpin_group(group);
+  }
+}
+
+/**
+ * @brief Encerra a sessão do usuário, saindo de todos os seus grupos.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem de logout (não utilizado).
+ * @return CMD_SUCCESS.
+ */
+CommandType handle_logout(int sockfd, const Message *msg)
+{
+  (void)msg;
+
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (user) {
+    leave_all_groups(user, false);
+    relay_user(user->username, false);
   }
-  pthread_mutex_unlock(&group->mutex);
 
-  strncpy(response.message, member_list, MAX_BUFFER - 1);
-  response.type = CMD_NOTIFICATION;
-  send_message(sockfd, &response);
+  remove_client(&client_manager, sockfd);
+  ring_user = NULL;
+  outbound_set_name(sockfd, "");
+  return CMD_SUCCESS;
 }
 
 /**
@@ -589,100 +998,411 @@ void handle_list_members(int sockfd, const Message *msg)
  *
  * @param sockfd O descritor de arquivo do socket do cliente.
  * @param msg Um ponteiro para a mensagem recebida.
+ * @return O resultado do handler, ou -1 para comandos desconhecidos.
  */
-void handle_client_message(int sockfd, const Message *msg)
+static int dispatch_command(int sockfd, const Message *msg)
 {
   switch (msg->type) {
   case CMD_REGISTER:
-    handle_register(sockfd, msg);
-    break;
+    return handle_register(sockfd, msg);
   case CMD_LOGIN:
-    handle_login(sockfd, msg);
-    break;
+    return handle_login(sockfd, msg);
   case CMD_LOGOUT:
-    remove_client(&client_manager, sockfd);
-    break;
+    return handle_logout(sockfd, msg);
   case CMD_CREATE:
-    handle_create_group(sockfd, msg);
-    break;
+    return handle_create_group(sockfd, msg);
   case CMD_ENTER:
-    handle_enter_group(sockfd, msg);
-    break;
+    return handle_enter_group(sockfd, msg);
   case CMD_LEAVE:
-    handle_leave_group(sockfd, msg);
-    break;
+    return handle_leave_group(sockfd, msg);
   case CMD_DELETE:
-    handle_delete_group(sockfd, msg);
-    break;
+    return handle_delete_group(sockfd, msg);
   case CMD_MESSAGE:
-    handle_message(sockfd, msg);
-    break;
+    return handle_message(sockfd, msg);
   case CMD_DIRECT_MESSAGE:
-    handle_direct_message(sockfd, msg);
-    break;
+    return handle_direct_message(sockfd, msg);
   case CMD_LIST_GROUPS:
-    handle_list_groups(sockfd, msg);
-    break;
+    return handle_list_groups(sockfd, msg);
   case CMD_LIST_MEMBERS:
-    handle_list_members(sockfd, msg);
-    break;
+    return handle_list_members(sockfd, msg);
+  case CMD_ACK:
+    return handle_ack(sockfd, msg);
+  case CMD_RESUME:
+    return handle_resume(sockfd, msg);
+  case CMD_PRESENCE:
+    return handle_presence(sockfd, msg);
+  case CMD_PUBLISHER:
+    return handle_publisher(sockfd, msg);
   default:
+    return -1;
+  }
+}
 
-    break;
+/**
+ * @brief Aplica os limites de taxa ao comando antes de executá-lo: o da
+ * sessão e o do tipo do comando, contados por usuário (ou por endereço antes
+ * do login e para LOGIN e REGISTER), e, para chat de grupo, o do grupo. Os
+ * tokens só são consumidos se todos os limites permitirem.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem recebida.
+ * @param peer O endereço do cliente.
+ * @return 0 se o comando pode ser executado, ou quanto falta, em ns, para que
+ * possa.
+ */
+static uint64_t rate_check(int sockfd, const Message *msg, const char *peer)
+{
+  uint64_t now = flight_now_ns();
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  bool authenticated = user && user->authenticated;
+
+  char key[RATE_MAX_KEY];
+  if (authenticated && msg->type != CMD_LOGIN && msg->type != CMD_REGISTER)
+    snprintf(key, sizeof(key), "user:%s", user->username);
+  else
+    snprintf(key, sizeof(key), "addr:%s", peer);
+
+  uint64_t wait = rate_wait(key, msg->type, now);
+  if (wait) return wait;
+
+  if (msg->type == CMD_MESSAGE && authenticated) {
+    char groupname[MAX_GROUPNAME];
+    target_group(user, msg, groupname);
+    Group *group = groupname[0] ? pin_group(&group_manager, groupname) : NULL;
+    if (group) {
+      wait = take_group_token(group, now);
+      unpin_group(group);
+      if (wait) return wait;
+    }
   }
+
+  rate_take(key, msg->type);
+  return 0;
+}
+
+/**
+ * @brief Executa um comando. Se ele tem req_id, garante exatamente uma
+ * resposta com o mesmo id: comandos que não respondem por conta própria
+ * (chat, logout, ack) recebem um CMD_SUCCESS vazio, ou um CMD_ERROR se
+ * falharam ou são desconhecidos. Um comando acima do limite de taxa é
+ * rejeitado com CMD_ERROR ou, com RATE_DELAY, espera o seu token.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem recebida.
+ * @param peer O endereço do cliente, para o limite de taxa.
+ * @return O resultado do handler, ou -1 para comandos desconhecidos.
+ */
+static int process_command(int sockfd, const Message *msg, const char *peer)
+{
+  current_req_id = msg->req_id;
+  current_replied = false;
+
+  uint64_t wait = rate_check(sockfd, msg, peer);
+  uint64_t waited = 0;
+  while (wait && rate_config.policy == RATE_DELAY &&
+         waited + wait <= rate_config.max_delay_ms * 1000000ull) {
+    struct timespec delay = {.tv_sec = wait / 1000000000ull,
+                             .tv_nsec = wait % 1000000000ull};
+    nanosleep(&delay, NULL);
+    waited += wait;
+    wait = rate_check(sockfd, msg, peer);
+  }
+
+  int result;
+  if (wait) {
+    LOG_DEBUG("Rate limited %s from fd %d", command_name(msg->type), sockfd);
+    result = reply(sockfd, CMD_ERROR, "Rate limit exceeded, retry in %llu ms",
+                   (unsigned long long)(wait / 1000000 + 1));
+  } else {
+    result = dispatch_command(sockfd, msg);
+  }
+
+  if (msg->req_id != 0 && !current_replied) {
+    if (result < 0)
+      reply(sockfd, CMD_ERROR, "Unknown command");
+    else if (result == CMD_ERROR)
+      reply(sockfd, CMD_ERROR, "Command failed");
+    else
+      reply(sockfd, CMD_SUCCESS, "%s", "");
+  }
+
+  current_req_id = 0;
+  return result;
+}
+
+/**
+ * @brief Processa uma mensagem do cliente e registra o comando, o resultado e
+ * a duração no flight recorder.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param msg Um ponteiro para a mensagem recebida.
+ * @param peer O endereço do cliente, para o limite de taxa.
+ */
+void handle_client_message(int sockfd, const Message *msg, const char *peer)
+{
+  if (!flight_enabled()) {
+    process_command(sockfd, msg, peer);
+    return;
+  }
+
+  char username[MAX_USERNAME] = "";
+  char groupname[MAX_GROUPNAME] = "";
+  User *user = find_client_by_sockfd(&client_manager, sockfd);
+  if (user) {
+    memcpy(username, user->username, MAX_USERNAME);
+    copy_current_group(user, groupname);
+  } else if (msg->type == CMD_REGISTER || msg->type == CMD_LOGIN) {
+    strncpy(username, msg->username, MAX_USERNAME - 1);
+  }
+  if (msg->groupname[0] != '\0')
+    strncpy(groupname, msg->groupname, MAX_GROUPNAME - 1);
+
+  uint64_t start = flight_now_ns();
+  int result = process_command(sockfd, msg, peer);
+
+  flight_record(FLIGHT_COMMAND, sockfd, msg->type, result, username, groupname,
+                start);
+}
+
+/**
+ * @brief Lê o que estiver disponível no socket (não-bloqueante) para o buffer
+ * de entrada da conexão.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ * @param in O buffer de entrada da conexão.
+ * @return A quantidade de bytes lidos, 0 se não há dados, ou -1 se o cliente
+ * fechou a conexão ou houve erro.
+ */
+static ssize_t read_inbound(int sockfd, InboundBuffer *in)
+{
+  ssize_t n = recv(sockfd, in->data + in->len, sizeof(in->data) - in->len, 0);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+    return -1;
+  }
+  if (n == 0) return -1;
+
+  in->len += n;
+  return n;
+}
+
+/**
+ * @brief Envia o chat novo dos grupos e canais que o usuário da conexão
+ * assina, se algum dos seus anéis andou desde a última vez que ele ficou em
+ * dia.
+ */
+static void drain_subscriptions(void)
+{
+  if (ring_user && rings_pending(ring_user))
+    drain_rings(&group_manager, ring_user);
+}
+
+static bool rings_idle(void) { return !ring_user || !rings_pending(ring_user); }
+
+/**
+ * @brief Espera o socket ter dados para ler, espaço para escrever (se a fila
+ * de saída tem frames pendentes) ou chat novo num grupo assinado, cujo post
+ * acorda a conexão. O timeout curto mantém a fila andando quando outra
+ * thread enfileira enquanto esperamos.
+ *
+ * @param sockfd O descritor de arquivo do socket do cliente.
+ */
+static void wait_for_socket(int sockfd)
+{
+  outbound_wait(sockfd, 10, rings_idle);
+}
+
+/**
+ * @brief Estaciona a thread enquanto houver um pedido de congelamento,
+ * expondo o buffer de entrada para a troca de processo.
+ */
+static void park_session(int sockfd, const InboundBuffer *in)
+{
+  ParkedSession self = {.sockfd = sockfd, .in = in};
+
+  pthread_mutex_lock(&park_mutex);
+  self.next = parked_sessions;
+  parked_sessions = &self;
+  parked_count++;
+  pthread_cond_broadcast(&park_cond);
+
+  while (atomic_load(&freeze_requested))
+    pthread_cond_wait(&park_cond, &park_mutex);
+
+  for (ParkedSession **p = &parked_sessions; *p; p = &(*p)->next) {
+    if (*p == &self) {
+      *p = self.next;
+      break;
+    }
+  }
+  parked_count--;
+  pthread_mutex_unlock(&park_mutex);
+}
+
+static void end_session(void)
+{
+  pthread_mutex_lock(&park_mutex);
+  live_sessions--;
+  pthread_cond_broadcast(&park_cond);
+  pthread_mutex_unlock(&park_mutex);
+}
+
+bool freeze_sessions(int timeout_ms)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&park_mutex);
+  atomic_store(&freeze_requested, true);
+  while (parked_count < live_sessions &&
+         pthread_cond_timedwait(&park_cond, &park_mutex, &deadline) == 0)
+    ;
+  bool frozen = parked_count == live_sessions;
+  pthread_mutex_unlock(&park_mutex);
+
+  if (!frozen)
+    LOG_WARN("Only %d of %d sessions parked for handoff", parked_count,
+             live_sessions);
+  return frozen;
+}
+
+void thaw_sessions(void)
+{
+  pthread_mutex_lock(&park_mutex);
+  atomic_store(&freeze_requested, false);
+  pthread_cond_broadcast(&park_cond);
+  pthread_mutex_unlock(&park_mutex);
+}
+
+bool for_each_parked_session(ParkedVisitor visit, void *arg)
+{
+  pthread_mutex_lock(&park_mutex);
+  bool completed = true;
+  for (ParkedSession *p = parked_sessions; p && completed; p = p->next)
+    completed = visit(p->sockfd, p->in->data, p->in->len, arg);
+  pthread_mutex_unlock(&park_mutex);
+  return completed;
 }
 
 /**
  * @brief Loop da thread do cliente no servidor.
- * Recebe mensagens continuamente, trata comandos e limpa recursos na
- * desconexão do cliente.
+ * Recebe mensagens continuamente, trata comandos, esvazia a fila de saída da
+ * conexão e limpa recursos na desconexão do cliente.
  *
  * @param arg Um ponteiro para a estrutura ClientArgs contendo o socket do
  * cliente.
  * @return NULL ao finalizar.
  */
-void *client_handler(void *arg)
+static void *client_handler(void *arg)
 {
   ClientArgs *client_args = (ClientArgs *)arg;
   int sockfd = client_args->sockfd;
-  free(client_args);
+  InboundBuffer in = {.len = 0};
 
   set_nonblocking(sockfd);
+  bool opened = client_args->outbound_open || outbound_open(sockfd);
+  if (client_args->inbound_len <= sizeof(in.data)) {
+    memcpy(in.data, client_args->inbound, client_args->inbound_len);
+    in.len = client_args->inbound_len;
+  }
+  free(client_args->inbound);
+  free(client_args);
+
+  if (!opened) {
+    LOG_WARN("No outbound queue for fd %d, closing", sockfd);
+    outbound_close(sockfd);
+    close(sockfd);
+    end_session();
+    return NULL;
+  }
+
+  /* Uma sessão recebida numa troca de processo já chega autenticada. */
+  ring_user = find_client_by_sockfd(&client_manager, sockfd);
+
+  uint32_t capture_conn = capture_open_connection();
+  char peer[INET6_ADDRSTRLEN] = "unknown";
+  struct sockaddr_storage peer_addr;
+  socklen_t peer_len = sizeof(peer_addr);
+  if (getpeername(sockfd, (struct sockaddr *)&peer_addr, &peer_len) == 0) {
+    if (peer_addr.ss_family == AF_INET6)
+      inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&peer_addr)->sin6_addr,
+                peer, sizeof(peer));
+    else if (peer_addr.ss_family == AF_INET)
+      inet_ntop(AF_INET, &((struct sockaddr_in *)&peer_addr)->sin_addr, peer,
+                sizeof(peer));
+  }
 
   while (1) {
-    Message msg;
-    int received = receive_message(sockfd, &msg);
+    if (atomic_load(&freeze_requested)) park_session(sockfd, &in);
+
+    if (outbound_flush(sockfd) < 0) break;
+    drain_subscriptions();
+
+    ssize_t received = read_inbound(sockfd, &in);
 
     if (received < 0) {
       break;
     } else if (received == 0) {
-      usleep(10000);
+      wait_for_socket(sockfd);
       continue;
     }
 
-    handle_client_message(sockfd, &msg);
+    /* Um recv() pode trazer vários comandos em pipeline ou parte de um. */
+    size_t offset = 0;
+    while (in.len - offset >= sizeof(Message)) {
+      Message msg;
+      memcpy(&msg, in.data + offset, sizeof(Message));
+      offset += sizeof(Message);
+
+      capture_frame(capture_conn, &msg);
+      handle_client_message(sockfd, &msg, peer);
+    }
+
+    memmove(in.data, in.data + offset, in.len - offset);
+    in.len -= offset;
   }
 
+  capture_close_connection(capture_conn);
+
   User *user = find_client_by_sockfd(&client_manager, sockfd);
   if (user) {
-    if (user->current_group[0] != '\0') {
-      Group *group = find_group(&group_manager, user->current_group);
-      if (group) {
-        Message notification;
-        memset(&notification, 0, sizeof(Message));
-        notification.type = CMD_NOTIFICATION;
-        snprintf(notification.message, MAX_BUFFER, "%s has disconnected",
-                 user->username);
-        broadcast_to_group(group, &notification, sockfd);
-        leave_group(&group_manager, group, user);
-      }
-    }
+    LOG_INFO("User %s disconnected (fd %d)", user->username, sockfd);
+    flight_record(FLIGHT_DISCONNECT, sockfd, -1, -1, user->username,
+                  user->current_group, flight_now_ns());
+    leave_all_groups(user, true);
+    relay_user(user->username, false);
     remove_client(&client_manager, sockfd);
   } else {
-    printf("Client with socket %d disconnected.\n", sockfd);
+    LOG_INFO("Client with socket %d disconnected", sockfd);
+    flight_record(FLIGHT_DISCONNECT, sockfd, -1, -1, NULL, NULL,
+                  flight_now_ns());
   }
 
+  outbound_close(sockfd);
   close(sockfd);
+  end_session();
 
   return NULL;
 }
+
+bool spawn_session(ClientArgs *args)
+{
+  pthread_mutex_lock(&park_mutex);
+  live_sessions++;
+  pthread_mutex_unlock(&park_mutex);
+
+  pthread_t thread_id;
+  if (pthread_create(&thread_id, NULL, client_handler, args) != 0) {
+    end_session();
+    return false;
+  }
+
+  pthread_detach(thread_id);
+  return true;
+}
@@ -0,0 +1,398 @@
+#include "../../include/shard.h"
+#include "../../include/chat.h"
+#include "../../include/log.h"
+#include "../../include/outbound.h"
+#include "../../include/relay.h"
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+extern GroupManager group_manager;
+
+typedef enum {
+  SHARD_PUBLISH,
+  SHARD_ACK,
+  SHARD_JOIN,
+  SHARD_LEAVE,
+  SHARD_DELETE,
+  SHARD_WAKE
+} ShardTaskType;
+
+/* Nó intrusivo da fila MPSC (Vyukov): produtores só fazem um exchange na
+ * cabeça; o consumidor, único, anda pela cauda. */
+typedef struct ShardNode {
+  _Atomic(struct ShardNode *) next;
+} ShardNode;
+
+typedef struct {
+  ShardNode node; /* primeiro campo: ShardNode* <-> ShardTask* */
+  ShardTaskType type;
+  Group *group; /* fixado enquanto a tarefa existe; o dono o solta */
+  Message msg;  /* SHARD_ACK usa username e seq; SHARD_DELETE, o aviso */
+
+  /* SHARD_WAKE: uma partição do fanout, alocada logo depois da tarefa. */
+  int *fds;
+  int fd_count;
+
+  /* SHARD_JOIN, SHARD_LEAVE e SHARD_DELETE: quem enviou espera o
+   * resultado; a tarefa fica na pilha dele e o dono não a libera. */
+  User *user;
+  const char *creator; /* SHARD_DELETE */
+  bool keep_cursor;
+  bool result;
+  bool finished;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} ShardTask;
+
+typedef struct {
+  _Atomic(ShardNode *) head; /* último nó inserido */
+  ShardNode *tail;           /* próximo a sair; só o dono mexe */
+  ShardNode stub;
+
+  pthread_t thread;
+  int wake_fd;              /* eventfd */
+  _Atomic bool sleeping;    /* o dono vai dormir ou está dormindo */
+  _Atomic uint64_t pushed;
+  _Atomic uint64_t done;
+} Shard;
+
+static Shard shards[SHARD_MAX];
+static int shard_count = 0;
+static _Atomic bool shards_running = false;
+static _Atomic int fanout_threshold = FANOUT_DEFAULT_THRESHOLD;
+static _Thread_local int current_shard = -1;
+
+static void queue_init(Shard *shard)
+{
+  atomic_store(&shard->stub.next, NULL);
+  atomic_store(&shard->head, &shard->stub);
+  shard->tail = &shard->stub;
+}
+
+static void queue_push(Shard *shard, ShardNode *node)
+{
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  ShardNode *prev =
+      atomic_exchange_explicit(&shard->head, node, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/**
+ * @brief Retira o nó mais antigo. Pode retornar NULL com a fila não vazia
+ * quando um produtor está no meio do push; o dono tenta de novo depois.
+ */
+static ShardNode *queue_pop(Shard *shard)
+{
+  ShardNode *tail = shard->tail;
+  ShardNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (tail == &shard->stub) {
+    if (!next) return NULL;
+    shard->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&next->next, memory_order_acquire);
+  }
+
+  if (next) {
+    shard->tail = next;
+    return tail;
+  }
+
+  if (tail != atomic_load_explicit(&shard->head, memory_order_acquire))
+    return NULL;
+
+  queue_push(shard, &shard->stub);
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  if (next) {
+    shard->tail = next;
+    return tail;
+  }
+  return NULL;
+}
+
+/* FNV-1a, o mesmo grupo sempre no mesmo dono. */
+static Shard *shard_for(const char *groupname)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *p = groupname; *p; p++) {
+    hash ^= (unsigned char)*p;
+    hash *= 16777619u;
+  }
+  return &shards[hash % (uint32_t)shard_count];
+}
+
+/**
+ * @brief Aplica a tarefa no grupo que ela traz, sem buscá-lo pelo nome. Um
+ * grupo apagado depois do envio continua fixado: publish_to_group() e as
+ * outras o reconhecem e não fazem nada.
+ */
+static void run_task(ShardTask *task)
+{
+  Group *group = task->group;
+
+  switch (task->type) {
+  case SHARD_PUBLISH:
+    /* O dono leva o chat, já numerado, aos outros nós (relay.h). */
+    if (publish_to_group(group, &task->msg)) relay_chat(group, &task->msg);
+    break;
+  case SHARD_ACK:
+    ack_group(group, task->msg.username, task->msg.seq);
+    break;
+  case SHARD_JOIN:
+    task->result = join_group(&group_manager, group, task->user);
+    break;
+  case SHARD_LEAVE:
+    task->result = task->keep_cursor
+                       ? disconnect_from_group(&group_manager, group, task->user)
+                       : leave_group(&group_manager, group, task->user);
+    break;
+  case SHARD_DELETE:
+    broadcast_to_group(group, &task->msg, -1);
+    task->result = delete_group(&group_manager, group->name, task->creator);
+    break;
+  case SHARD_WAKE:
+    for (int i = 0; i < task->fd_count; i++) outbound_wake(task->fds[i]);
+    return;
+  }
+  unpin_group(group);
+}
+
+/**
+ * @brief Libera a tarefa ou, se alguém espera por ela, entrega o resultado.
+ */
+static void finish_task(ShardTask *task)
+{
+  if (task->type == SHARD_PUBLISH || task->type == SHARD_ACK ||
+      task->type == SHARD_WAKE) {
+    free(task);
+    return;
+  }
+
+  pthread_mutex_lock(&task->lock);
+  task->finished = true;
+  pthread_cond_signal(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+static void *shard_loop(void *arg)
+{
+  Shard *shard = arg;
+  current_shard = (int)(shard - shards);
+
+  while (1) {
+    ShardNode *node = queue_pop(shard);
+    if (!node) {
+      /* Anuncia o sono antes de olhar a fila de novo: um push depois disso
+       * vê 'sleeping' e acorda o dono. */
+      atomic_store(&shard->sleeping, true);
+      node = queue_pop(shard);
+      if (!node) {
+        if (!atomic_load(&shards_running) &&
+            atomic_load(&shard->done) == atomic_load(&shard->pushed))
+          break;
+
+        struct pollfd pfd = {.fd = shard->wake_fd, .events = POLLIN};
+        poll(&pfd, 1, SHARD_IDLE_WAIT_MS);
+        uint64_t wakeups;
+        ssize_t n = read(shard->wake_fd, &wakeups, sizeof(wakeups));
+        (void)n;
+        atomic_store(&shard->sleeping, false);
+        continue;
+      }
+      atomic_store(&shard->sleeping, false);
+    }
+
+    run_task((ShardTask *)node);
+    atomic_fetch_add(&shard->done, 1);
+    finish_task((ShardTask *)node);
+  }
+
+  return NULL;
+}
+
+bool shard_start(int count)
+{
+  if (count > SHARD_MAX) count = SHARD_MAX;
+  if (count <= 0) return true;
+
+  atomic_store(&shards_running, true);
+  for (int i = 0; i < count; i++) {
+    Shard *shard = &shards[i];
+    queue_init(shard);
+    atomic_init(&shard->sleeping, false);
+    atomic_init(&shard->pushed, 0);
+    atomic_init(&shard->done, 0);
+    shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->wake_fd < 0 ||
+        pthread_create(&shard->thread, NULL, shard_loop, shard) != 0) {
+      LOG_WARN("Started only %d of %d group shards", i, count);
+      if (shard->wake_fd >= 0) close(shard->wake_fd);
+      break;
+    }
+    shard_count++;
+  }
+
+  if (shard_count == 0) atomic_store(&shards_running, false);
+  return shard_count > 0;
+}
+
+static void wake(Shard *shard)
+{
+  if (atomic_exchange(&shard->sleeping, false)) {
+    uint64_t one = 1;
+    ssize_t n = write(shard->wake_fd, &one, sizeof(one));
+    (void)n;
+  }
+}
+
+void shard_stop(void)
+{
+  if (shard_count == 0) return;
+
+  atomic_store(&shards_running, false);
+  for (int i = 0; i < shard_count; i++) {
+    atomic_store(&shards[i].sleeping, true);
+    wake(&shards[i]);
+  }
+  for (int i = 0; i < shard_count; i++) {
+    pthread_join(shards[i].thread, NULL);
+    close(shards[i].wake_fd);
+  }
+  shard_count = 0;
+}
+
+void shard_drain(void)
+{
+  for (int i = 0; i < shard_count; i++) {
+    Shard *shard = &shards[i];
+    while (atomic_load(&shard->done) != atomic_load(&shard->pushed)) {
+      struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000L};
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+static void enqueue(Shard *shard, ShardTask *task)
+{
+  atomic_fetch_add(&shard->pushed, 1);
+  queue_push(shard, &task->node);
+  wake(shard);
+}
+
+static bool submit(ShardTaskType type, Group *group, const Message *msg)
+{
+  if (shard_count == 0 || !atomic_load(&shards_running)) return false;
+
+  ShardTask *task = malloc(sizeof(ShardTask));
+  if (!task) return false;
+  atomic_fetch_add(&group->pins, 1);
+  task->type = type;
+  task->group = group;
+  task->msg = *msg;
+
+  enqueue(shard_for(group->name), task);
+  return true;
+}
+
+bool shard_publish(Group *group, const Message *msg)
+{
+  return submit(SHARD_PUBLISH, group, msg);
+}
+
+bool shard_ack(Group *group, const char *username, uint64_t seq)
+{
+  Message msg;
+  memset(&msg, 0, sizeof(msg));
+  strncpy(msg.username, username, MAX_USERNAME - 1);
+  msg.seq = seq;
+  return submit(SHARD_ACK, group, &msg);
+}
+
+/**
+ * @brief Manda a entrada, a saída ou a remoção ao dono e espera que ele a
+ * aplique.
+ */
+static bool submit_and_wait(ShardTask *task, Group *group, bool *result)
+{
+  if (shard_count == 0 || !atomic_load(&shards_running)) return false;
+
+  atomic_fetch_add(&group->pins, 1);
+  task->group = group;
+  task->finished = false;
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->cond, NULL);
+
+  enqueue(shard_for(group->name), task);
+
+  pthread_mutex_lock(&task->lock);
+  while (!task->finished) pthread_cond_wait(&task->cond, &task->lock);
+  pthread_mutex_unlock(&task->lock);
+
+  pthread_cond_destroy(&task->cond);
+  pthread_mutex_destroy(&task->lock);
+  *result = task->result;
+  return true;
+}
+
+bool shard_join(Group *group, User *user, bool *joined)
+{
+  ShardTask task = {.type = SHARD_JOIN, .user = user};
+  return submit_and_wait(&task, group, joined);
+}
+
+bool shard_leave(Group *group, User *user, bool keep_cursor, bool *left)
+{
+  ShardTask task = {.type = SHARD_LEAVE, .user = user,
+                    .keep_cursor = keep_cursor};
+  return submit_and_wait(&task, group, left);
+}
+
+bool shard_delete(Group *group, const char *creator,
+                  const Message *notification, bool *deleted)
+{
+  ShardTask task = {.type = SHARD_DELETE, .creator = creator,
+                    .msg = *notification};
+  return submit_and_wait(&task, group, deleted);
+}
+
+void set_fanout_threshold(int subscribers)
+{
+  atomic_store(&fanout_threshold, subscribers);
+}
+
+bool shard_wake(const int *fds, int count)
+{
+  int threshold = atomic_load(&fanout_threshold);
+  if (shard_count < 2 || threshold <= 0 || count < threshold ||
+      !atomic_load(&shards_running))
+    return false;
+
+  /* Partições contíguas, uma por shard; a do shard que publica (ou a
+   * primeira, fora de um shard) é acordada aqui mesmo. */
+  int size = (count + shard_count - 1) / shard_count;
+  int own = current_shard >= 0 ? current_shard : 0;
+  ShardTask *tasks[SHARD_MAX] = {NULL};
+  for (int i = 0; i < shard_count; i++) {
+    int first = i * size;
+    if (i == own || first >= count) continue;
+
+    int part = count - first < size ? count - first : size;
+    tasks[i] = malloc(sizeof(ShardTask) + sizeof(int) * (size_t)part);
+    if (!tasks[i]) {
+      for (int j = 0; j < i; j++) free(tasks[j]);
+      return false;
+    }
+    tasks[i]->type = SHARD_WAKE;
+    tasks[i]->fds = (int *)(tasks[i] + 1);
+    tasks[i]->fd_count = part;
+    memcpy(tasks[i]->fds, fds + first, sizeof(int) * (size_t)part);
+  }
+
+  for (int i = 0; i < shard_count; i++) {
+    if (tasks[i]) enqueue(&shards[i], tasks[i]);
+  }
+  for (int i = own * size; i < count && i < (own + 1) * size; i++)
+    outbound_wake(fds[i]);
+  return true;
+}
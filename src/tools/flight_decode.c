@@ -0,0 +1,161 @@
+#include "../../include/common.h"
+#include "../../include/flight.h"
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Compara dois eventos pela sequência, para ordenação com qsort.
+ */
+static int compare_events(const void *a, const void *b)
+{
+  uint64_t sa = atomic_load(&(*(const FlightEvent *const *)a)->seq);
+  uint64_t sb = atomic_load(&(*(const FlightEvent *const *)b)->seq);
+  return (sa > sb) - (sa < sb);
+}
+
+static const char *kind_name(uint8_t kind)
+{
+  switch (kind) {
+  case FLIGHT_CONNECT:
+    return "CONNECT";
+  case FLIGHT_COMMAND:
+    return "COMMAND";
+  case FLIGHT_DISCONNECT:
+    return "DISCONNECT";
+  default:
+    return "?";
+  }
+}
+
+/**
+ * @brief Imprime um evento em uma linha.
+ *
+ * @param event O evento a ser impresso.
+ */
+static void print_event(const FlightEvent *event)
+{
+  time_t sec = (time_t)(event->wall_ns / 1000000000ull);
+  struct tm tm_info;
+  char time_str[32];
+  localtime_r(&sec, &tm_info);
+  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+  printf("%10llu %s.%06u %10.1f %5d %-10s %-14s %-12s %-16s %s\n",
+         (unsigned long long)atomic_load(&event->seq), time_str,
+         (unsigned)(event->wall_ns / 1000 % 1000000),
+         event->duration_ns / 1000.0, event->conn, kind_name(event->kind),
+         event->kind == FLIGHT_COMMAND ? command_name(event->command) : "-",
+         event->kind == FLIGHT_COMMAND && event->result != 0xff
+             ? command_name(event->result)
+             : "-",
+         event->username[0] ? event->username : "-",
+         event->groupname[0] ? event->groupname : "-");
+}
+
+/**
+ * @brief Decodifica o arquivo do flight recorder do servidor e imprime os
+ * eventos em ordem, opcionalmente filtrando por latência, usuário ou grupo.
+ *
+ * @param argc Número de argumentos da linha de comando.
+ * @param argv Array de strings dos argumentos da linha de comando.
+ * @return 0 em caso de sucesso, 1 em caso de erro.
+ */
+int main(int argc, char *argv[])
+{
+  long last = 0;
+  double slow_us = 0;
+  const char *user_filter = NULL;
+  const char *group_filter = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:u:g:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      last = atol(optarg);
+      break;
+    case 's':
+      slow_us = atof(optarg);
+      break;
+    case 'u':
+      user_filter = optarg;
+      break;
+    case 'g':
+      group_filter = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-n last] [-s min_us] [-u user] [-g group] [file]\n"
+              "  -n <n>      Show only the last n matching events\n"
+              "  -s <us>     Show only events slower than <us> microseconds\n"
+              "  -u <user>   Show only events for this user\n"
+              "  -g <group>  Show only events for this group\n",
+              argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  const char *path = optind < argc ? argv[optind] : FLIGHT_DEFAULT_PATH;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) error_exit("open");
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) error_exit("fstat");
+  if ((size_t)st.st_size < sizeof(FlightHeader)) {
+    fprintf(stderr, "%s: file too small\n", path);
+    return 1;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) error_exit("mmap");
+
+  const FlightHeader *header = map;
+  if (header->magic != FLIGHT_MAGIC || header->version != FLIGHT_VERSION ||
+      header->event_size != sizeof(FlightEvent) ||
+      sizeof(FlightHeader) + (size_t)header->capacity * sizeof(FlightEvent) >
+          (size_t)st.st_size) {
+    fprintf(stderr, "%s: not a compatible whisp flight recorder file\n", path);
+    return 1;
+  }
+
+  const FlightEvent *events = (const FlightEvent *)(header + 1);
+  const FlightEvent **sorted = malloc(header->capacity * sizeof(*sorted));
+  if (!sorted) error_exit("malloc");
+
+  size_t count = 0;
+  size_t torn = 0;
+  for (uint32_t i = 0; i < header->capacity; i++) {
+    uint64_t seq = atomic_load(&events[i].seq);
+    if (seq == 0) continue;
+    if ((seq - 1) % header->capacity != i) {
+      torn++;
+      continue;
+    }
+
+    const FlightEvent *event = &events[i];
+    if (event->duration_ns / 1000.0 < slow_us) continue;
+    if (user_filter && strcmp(event->username, user_filter) != 0) continue;
+    if (group_filter && strcmp(event->groupname, group_filter) != 0) continue;
+    sorted[count++] = event;
+  }
+
+  qsort(sorted, count, sizeof(*sorted), compare_events);
+
+  printf("# %s: %llu events recorded, capacity %u, %zu shown", path,
+         (unsigned long long)atomic_load(&header->head), header->capacity,
+         last > 0 && (size_t)last < count ? (size_t)last : count);
+  if (torn > 0) printf(", %zu incomplete", torn);
+  printf("\n%10s %-26s %10s %5s %-10s %-14s %-12s %-16s %s\n", "seq", "time",
+         "dur_us", "conn", "event", "command", "result", "user", "group");
+
+  size_t start = (last > 0 && (size_t)last < count) ? count - last : 0;
+  for (size_t i = start; i < count; i++) {
+    print_event(sorted[i]);
+  }
+
+  free(sorted);
+  munmap(map, st.st_size);
+  return 0;
+}
@@ -0,0 +1,370 @@
+#include "../../include/capture.h"
+#include "../../include/common.h"
+#include <getopt.h>
+#include <poll.h>
+#include <sys/resource.h>
+
+#define REPLAY_DRAIN_EVERY 64
+
+typedef struct {
+  int *fds;           /* indexado pelo id da conexão na captura */
+  size_t fd_capacity; /* tamanho de 'fds' */
+  struct pollfd *pollfds;
+  size_t poll_count;
+  size_t open_count;
+  bool dirty; /* 'pollfds' precisa ser reconstruído */
+
+  uint64_t frames_sent;
+  uint64_t connections;
+  uint64_t connect_errors;
+  uint64_t send_errors;
+  uint64_t bytes_received;
+  uint64_t lateness_total_us;
+  uint64_t lateness_max_us;
+} Replay;
+
+static volatile sig_atomic_t replay_running = 1;
+
+static void handle_signal(int sig)
+{
+  (void)sig;
+  replay_running = 0;
+}
+
+/**
+ * @brief Retorna o tempo monotônico atual em microssegundos.
+ */
+static uint64_t now_us(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000ull + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Retorna o descritor associado a um id de conexão da captura,
+ * aumentando a tabela se necessário.
+ */
+static int *conn_slot(Replay *replay, uint32_t conn)
+{
+  if (conn >= replay->fd_capacity) {
+    size_t capacity = replay->fd_capacity ? replay->fd_capacity : 256;
+    while (capacity <= conn) capacity *= 2;
+
+    int *fds = realloc(replay->fds, capacity * sizeof(int));
+    if (!fds) error_exit("realloc");
+    for (size_t i = replay->fd_capacity; i < capacity; i++) fds[i] = -1;
+
+    replay->fds = fds;
+    replay->fd_capacity = capacity;
+  }
+  return &replay->fds[conn];
+}
+
+/**
+ * @brief Reconstrói o array do poll com as conexões abertas.
+ */
+static void rebuild_pollfds(Replay *replay)
+{
+  size_t size = (replay->open_count + 1) * sizeof(struct pollfd);
+  replay->pollfds = realloc(replay->pollfds, size);
+  if (!replay->pollfds) error_exit("realloc");
+
+  replay->poll_count = 0;
+  for (size_t i = 0; i < replay->fd_capacity; i++) {
+    if (replay->fds[i] < 0) continue;
+    replay->pollfds[replay->poll_count].fd = replay->fds[i];
+    replay->pollfds[replay->poll_count].events = POLLIN;
+    replay->poll_count++;
+  }
+  replay->dirty = false;
+}
+
+/**
+ * @brief Fecha uma conexão da reprodução e a tira do poll.
+ */
+static void close_conn(Replay *replay, int *fd)
+{
+  close(*fd);
+  *fd = -1;
+  replay->open_count--;
+  replay->dirty = true;
+}
+
+/**
+ * @brief Espera até 'timeout_ms' por respostas do servidor e as descarta,
+ * contando os bytes. Manter os sockets drenados evita que o servidor bloqueie
+ * ao enviar para os clientes da reprodução.
+ *
+ * @param replay O estado da reprodução.
+ * @param timeout_ms Tempo máximo de espera (0 para não esperar).
+ */
+static void drain_replies(Replay *replay, int timeout_ms)
+{
+  static char scratch[1 << 16];
+
+  if (replay->dirty) rebuild_pollfds(replay);
+  if (replay->poll_count == 0) {
+    if (timeout_ms > 0) usleep(timeout_ms * 1000);
+    return;
+  }
+
+  int ready = poll(replay->pollfds, replay->poll_count, timeout_ms);
+  if (ready <= 0) return;
+
+  for (size_t i = 0; i < replay->poll_count && ready > 0; i++) {
+    if (!replay->pollfds[i].revents) continue;
+    ready--;
+
+    int fd = replay->pollfds[i].fd;
+    ssize_t n;
+    while ((n = recv(fd, scratch, sizeof(scratch), 0)) > 0)
+      replay->bytes_received += n;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      continue;
+
+    /* O servidor fechou a conexão: sem isso o poll a devolveria sempre. */
+    for (size_t c = 0; c < replay->fd_capacity; c++) {
+      if (replay->fds[c] == fd) {
+        close_conn(replay, &replay->fds[c]);
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Envia um frame completo em um socket não-bloqueante, drenando as
+ * respostas enquanto o buffer de envio estiver cheio.
+ *
+ * @return true em caso de sucesso, false se a conexão falhou.
+ */
+static bool send_frame(Replay *replay, int fd, const Message *msg)
+{
+  const char *data = (const char *)msg;
+  size_t left = sizeof(Message);
+
+  while (left > 0) {
+    ssize_t n = send(fd, data, left, 0);
+    if (n > 0) {
+      data += n;
+      left -= n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+      drain_replies(replay, 0);
+      poll(&pfd, 1, 10);
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Abre uma conexão com o servidor e a configura como não-bloqueante.
+ *
+ * @return O descritor conectado, ou -1 em caso de falha.
+ */
+static int open_connection(const struct sockaddr_in *server_addr)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+
+  if (connect(fd, (const struct sockaddr *)server_addr,
+              sizeof(*server_addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  set_nonblocking(fd);
+  return fd;
+}
+
+/**
+ * @brief Aplica um registro da captura: abre, envia ou fecha a conexão
+ * correspondente.
+ */
+static void apply_record(Replay *replay, const CaptureRecord *record,
+                         const struct sockaddr_in *server_addr)
+{
+  int *fd = conn_slot(replay, record->conn);
+
+  switch (record->kind) {
+  case CAPTURE_OPEN:
+    if (*fd >= 0) break;
+    *fd = open_connection(server_addr);
+    if (*fd < 0) {
+      replay->connect_errors++;
+      break;
+    }
+    replay->connections++;
+    replay->open_count++;
+    replay->dirty = true;
+    break;
+  case CAPTURE_FRAME:
+    if (*fd < 0) break;
+    if (send_frame(replay, *fd, &record->msg)) {
+      replay->frames_sent++;
+    } else {
+      replay->send_errors++;
+      if (*fd >= 0) close_conn(replay, fd);
+    }
+    break;
+  case CAPTURE_CLOSE:
+    if (*fd >= 0) close_conn(replay, fd);
+    break;
+  }
+}
+
+/**
+ * @brief Eleva o limite de descritores abertos ao máximo permitido, já que
+ * cada conexão da captura vira um socket.
+ */
+static void raise_fd_limit(void)
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+
+static void print_usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <capture> <server_ip> [port]\n"
+          "  -s <speed>  Playback speed: 1 = real time, 4 = 4x faster, "
+          "0 = as fast as possible (default: 1)\n"
+          "  -w <ms>     Time to keep draining replies after the last record "
+          "(default: 1000)\n",
+          prog);
+}
+
+/**
+ * @brief Reproduz uma captura gravada com --capture contra um servidor,
+ * abrindo uma conexão por conexão capturada e respeitando os intervalos
+ * originais escalados pela velocidade escolhida.
+ *
+ * @param argc Número de argumentos da linha de comando.
+ * @param argv Array de strings dos argumentos da linha de comando.
+ * @return 0 em caso de sucesso, 1 em caso de erro.
+ */
+int main(int argc, char *argv[])
+{
+  double speed = 1.0;
+  int linger_ms = 1000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:h")) != -1) {
+    switch (opt) {
+    case 's':
+      speed = atof(optarg);
+      break;
+    case 'w':
+      linger_ms = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (argc - optind < 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  const char *path = argv[optind];
+  const char *server_ip = argv[optind + 1];
+  int port = argc - optind > 2 ? atoi(argv[optind + 2]) : DEFAULT_PORT;
+
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
+    fprintf(stderr, "Invalid address: %s\n", server_ip);
+    return 1;
+  }
+
+  CaptureReader reader;
+  if (!capture_reader_open(&reader, path)) {
+    perror(path);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, handle_signal);
+  raise_fd_limit();
+
+  Replay replay;
+  memset(&replay, 0, sizeof(Replay));
+
+  CaptureRecord record;
+  record.time_us = 0;
+  uint64_t start = now_us();
+  uint64_t records = 0;
+  int status = 0;
+
+  while (replay_running && (status = capture_read(&reader, &record)) == 1) {
+    if (speed > 0) {
+      uint64_t target = start + (uint64_t)(record.time_us / speed);
+      uint64_t now;
+      while (replay_running && (now = now_us()) < target) {
+        uint64_t wait_ms = (target - now) / 1000;
+        drain_replies(&replay, wait_ms > 100 ? 100 : (int)wait_ms);
+        if (wait_ms == 0) break;
+      }
+
+      now = now_us();
+      uint64_t late = now > target ? now - target : 0;
+      replay.lateness_total_us += late;
+      if (late > replay.lateness_max_us) replay.lateness_max_us = late;
+    } else if (records % REPLAY_DRAIN_EVERY == 0) {
+      drain_replies(&replay, 0);
+    }
+
+    apply_record(&replay, &record, &server_addr);
+    records++;
+  }
+
+  if (status < 0) fprintf(stderr, "%s: truncated or corrupt record\n", path);
+
+  uint64_t elapsed = now_us() - start;
+
+  uint64_t linger_end = now_us() + (uint64_t)linger_ms * 1000;
+  while (replay_running && now_us() < linger_end) drain_replies(&replay, 50);
+
+  for (size_t i = 0; i < replay.fd_capacity; i++) {
+    if (replay.fds[i] >= 0) close(replay.fds[i]);
+  }
+  capture_reader_close(&reader);
+
+  double seconds = elapsed / 1e6;
+  printf("Replayed %llu records in %.3f s (capture span %.3f s, ",
+         (unsigned long long)records, seconds, record.time_us / 1e6);
+  if (speed > 0)
+    printf("speed %gx)\n", speed);
+  else
+    printf("max speed)\n");
+  printf("  connections: %llu opened, %llu failed\n",
+         (unsigned long long)replay.connections,
+         (unsigned long long)replay.connect_errors);
+  printf("  frames:      %llu sent (%.0f/s), %llu send errors\n",
+         (unsigned long long)replay.frames_sent,
+         seconds > 0 ? replay.frames_sent / seconds : 0.0,
+         (unsigned long long)replay.send_errors);
+  printf("  replies:     %llu frames received\n",
+         (unsigned long long)(replay.bytes_received / sizeof(Message)));
+  if (speed > 0 && records > 0)
+    printf("  lateness:    avg %.1f us, max %.1f us\n",
+           (double)replay.lateness_total_us / records,
+           (double)replay.lateness_max_us);
+
+  free(replay.fds);
+  free(replay.pollfds);
+  return status < 0 ? 1 : 0;
+}